@@ -23,12 +23,38 @@
 
 #include "cpp_guard.h"
 #include "CAN.h"
+#include "stdbool.h"
 #include "stddef.h"
 
 CPP_GUARD_BEGIN
 
 #define OBD2_PID_DEFAULT_TIMEOUT_MS 500
 #define OBD2_PID_REQUEST_TIMEOUT_MS 10
+#define OBD2_11BIT_PID_RESPONSE     0x7E8
+#define OBD2_29BIT_PID_RESPONSE     0x18DAF110
+#define OBD2_PID_RATE_PERIOD_MS     1000
+
+/* The number of PID requests that may wait for a response at once */
+#define OBD2_MAX_IN_FLIGHT          4
+#define OBD2_DEFAULT_IN_FLIGHT      1
+
+/* The number of mode 01 PIDs a single request may ask for */
+#define OBD2_MAX_BATCH_PIDS         6
+
+struct obd2_stats {
+        /* true once an ECU has answered */
+        bool active;
+        /* PID responses per second */
+        uint16_t pid_rate;
+        /* PID requests waiting for a response */
+        uint8_t in_flight;
+        /* PID requests allowed to wait for a response at once */
+        uint8_t max_in_flight;
+        /* true if mode 01 PIDs are batched and the ECU hasn't rejected it */
+        bool batching;
+        /* OBDII channels being queried */
+        uint16_t channels;
+};
 
 /**
  * Call to flag that the OBD2 state is stale
@@ -91,6 +117,39 @@ bool OBD2_get_value_for_pid(uint16_t pid, float *value);
  */
 void OBD2_set_pid_delay(uint32_t delay);
 
+/**
+ * Set the number of PID requests that may wait for a response at once.
+ * Responses are matched to their request by mode and PID, so more than
+ * one request in flight hides the ECU round trip.  Not every ECU copes,
+ * so only one is allowed by default.
+ * @param count the number of requests, from 1 to OBD2_MAX_IN_FLIGHT
+ */
+void OBD2_set_max_in_flight(uint8_t count);
+
+/**
+ * Enable asking for several mode 01 PIDs in a single request.  PIDs that
+ * are due together are batched, up to OBD2_MAX_BATCH_PIDS at a time.  If
+ * the ECU rejects or ignores a batch, we go back to single PID requests
+ * until the OBDII configuration is reloaded.
+ * @param enabled true to batch PIDs
+ */
+void OBD2_set_batching(bool enabled);
+
+/**
+ * Get the statistics of the OBDII querying
+ * @param stats filled in with the statistics
+ */
+void OBD2_get_stats(struct obd2_stats *stats);
+
+/**
+ * Get the latency of the last response for an OBDII channel
+ * @param index the channel index
+ * @param pid set to the PID of the channel
+ * @param latency set to the latency in ms, or 0 if there was no response
+ * @return true if the channel exists
+ */
+bool OBD2_get_pid_latency(size_t index, uint16_t *pid, uint16_t *latency);
+
 CPP_GUARD_END
 
 #endif /* OBD2_H_ */
@@ -59,6 +59,17 @@ float CAN_get_current_channel_value(int index);
  */
 void CAN_set_current_channel_value(int index, float value);
 
+/**
+ * Index the enabled CAN mappings by bus, CAN ID and sub ID, so
+ * update_can_channels only visits the mappings a message can match, and
+ * compile each mapping into an extractor.  Call whenever the CAN channel configuration changes.
+ * @param cfg the CAN channel configuration, containing the mappings
+ * @param count the number of channel mappings
+ * @return true if the index was built; if not, update_can_channels falls
+ * back to checking every mapping
+ */
+bool CAN_init_mapping_index(const CANChannelConfig *cfg, uint16_t count);
+
 /**
  * Apply the CAN message to the current list of of CAN channel mappings.
  * @param msg the CAN message containing the raw data
@@ -0,0 +1,106 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CAN_FILTERS_H_
+#define CAN_FILTERS_H_
+
+#include "capabilities.h"
+#include "cpp_guard.h"
+#include "loggerConfig.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+CPP_GUARD_BEGIN
+
+#define CAN_STD_ID_MASK 0x7FF
+#define CAN_EXT_ID_MASK 0x1FFFFFFF
+
+/*
+ * A hardware acceptance filter.  A frame of the same type passes if
+ * (frame ID ^ id) & mask == 0.
+ */
+struct can_filter {
+        uint32_t id;
+        uint32_t mask;
+        bool extended;
+};
+
+/**
+ * Reduce a set of filters to at most max_filters filters that still
+ * accept every frame the original set accepts.  Filters already covered
+ * by another are dropped, then the pair of filters of the same frame type
+ * whose merged filter lets through the fewest extra IDs is merged until
+ * the set fits.
+ * @param filters the filters, reduced in place
+ * @param count the number of filters
+ * @param max_filters the number of filters the hardware has
+ * @return the number of filters left, or -1 if max_filters is too small
+ * to hold even one filter per frame type
+ */
+int can_filters_cover(struct can_filter *filters, size_t count,
+                      size_t max_filters);
+
+/**
+ * Plan the acceptance filters of a CAN bus from the CAN mappings, OBD2
+ * PIDs and ShiftX on that bus.
+ * @param bus the CAN bus
+ * @param ccc the CAN channel configuration, containing the mappings
+ * @param mapping_count the number of channel mappings
+ * @param oc the OBD2 configuration
+ * @param filters where to put the filters; must hold
+ * 2 * mapping_count + 4 filters
+ * @param max_filters the number of filters the hardware has
+ * @return the number of filters, or -1 if the bus has to accept all
+ * frames
+ */
+int CAN_plan_filters(uint8_t bus, const CANChannelConfig *ccc,
+                     uint16_t mapping_count, const OBD2Config *oc,
+                     struct can_filter *filters, size_t max_filters);
+
+/**
+ * Plan and set the acceptance filters of every CAN bus, so frames nothing
+ * uses are dropped by the CAN controller.  Buses fall back to accepting
+ * all frames if the filters can't be planned.  While the script receives
+ * CAN messages the filters are its own: those set with
+ * CAN_set_script_filter are left alone, and planned ones are replaced by
+ * accepting all frames.
+ * @param ccc the CAN channel configuration, containing the mappings
+ * @param mapping_count the number of channel mappings
+ * @param oc the OBD2 configuration
+ */
+void CAN_update_filters(const CANChannelConfig *ccc, uint16_t mapping_count,
+                        const OBD2Config *oc);
+
+#if LUA_SUPPORT
+/**
+ * Set a hardware filter for the script, like CAN_set_filter does.  The
+ * filters of the bus are the script's from then on.
+ */
+int CAN_set_script_filter(const uint8_t bus, const uint8_t id,
+                          const uint8_t extended, const uint32_t filter,
+                          const uint32_t mask, const bool enabled);
+#endif
+
+CPP_GUARD_END
+
+#endif /* CAN_FILTERS_H_ */
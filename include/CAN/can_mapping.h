@@ -27,6 +27,28 @@
 
 CPP_GUARD_BEGIN
 
+/**
+ * A CAN mapping compiled down to what extracting its value needs, so the
+ * offsets, bit masks, byte swapping and type handling are worked out once
+ * when the configuration changes instead of for every message.  The
+ * formula and units conversion are folded into a single scale and offset.
+ */
+struct canmapping_extractor {
+        /* mask of the value, after shifting it down */
+        uint32_t mask;
+        /* value = raw * scale + offset */
+        float scale;
+        float offset;
+        /* right shift of the big endian payload bringing the value down */
+        uint8_t shift;
+        /* width of the value to byte swap, or 0 for none */
+        uint8_t swap_bits;
+        /* enum CANMappingType */
+        uint8_t type;
+        /* sign shift for signed values, or sign bit for sign-magnitude */
+        uint8_t sign;
+};
+
 /**
  * match the can message based on the specified CAN mapping ID and ID mask
  * @param can_msg the CAN message to test
@@ -60,5 +82,22 @@ float canmapping_apply_formula(float value, const CANMapping *mapping);
  */
 float canmapping_extract_value(uint64_t raw_data, const CANMapping *mapping);
 
+/**
+ * compile the CAN mapping into an extractor
+ * @param extractor the extractor to fill in
+ * @param mapping the mapping to compile
+ */
+void canmapping_compile(struct canmapping_extractor *extractor, const CANMapping *mapping);
+
+/**
+ * extract the value using a compiled mapping.  Equivalent to
+ * canmapping_extract_value, canmapping_apply_formula and convert_units
+ * applied in turn, apart from float rounding.
+ * @param extractor the compiled mapping
+ * @param raw_data the raw data of the CAN message
+ * @return the extracted, transformed and converted value
+ */
+float canmapping_extract(const struct canmapping_extractor *extractor, uint64_t raw_data);
+
 CPP_GUARD_END
 #endif /* CAN_MAPPING_H_ */
@@ -25,6 +25,9 @@
 #include "cpp_guard.h"
 #include "jsmn.h"
 #include "serial.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 CPP_GUARD_BEGIN
 
@@ -47,12 +50,25 @@ typedef struct _api_context {
 typedef struct _api_t {
         const char *cmd;
         int (*func)(struct Serial *serial, const jsmntok_t *json);
+        /*
+         * Optional.  Takes the elements of an array in the payload that is
+         * too big to parse all at once as they arrive, before func gets
+         * the rest of the payload.  The payload only holds what came ahead
+         * of the array.  index counts the elements handed over so far.
+         */
+        int (*element)(struct Serial *serial, const jsmntok_t *json,
+                       const jsmntok_t *elem, size_t index);
 } api_t;
 
-#define NULL_API {NULL, NULL}
+#define NULL_API {NULL, NULL, NULL}
 
 void initApi();
 
+/**
+ * @return The API handling the named command, or NULL if there is none.
+ */
+const api_t* find_api(const char *name);
+
 void json_valueStart(struct Serial *serial, const char *name);
 void json_null(struct Serial *serial, const char *name, int more);
 void json_int(struct Serial *serial, const char *name, int value, int more);
@@ -73,8 +89,85 @@ void json_arrayElementFloat(struct Serial *serial, float value, int precision, i
 void json_arrayEnd(struct Serial *serial, int more);
 void json_sendResult(struct Serial *serial, const char *messageName, int resultCode);
 
+#define JSON_WRITER_BUFFER_LEN	64
+
+/*
+ * Buffered JSON writer.  Output collects in a small scratch buffer that
+ * goes out to the Serial device in bulk instead of a character at a time,
+ * and the writer tracks nesting so the commas between values are put in
+ * for us.  Values in arrays have a NULL name.
+ *
+ * The writer starts out inside whatever the caller already has open, so it
+ * can also render just a fragment of a response.  Call json_writer_flush
+ * before writing to the Serial device directly again.  Commas are only
+ * tracked for the first 32 levels of nesting.
+ */
+typedef void json_writer_func(const void *data, const size_t len, void *arg);
+
+struct json_writer {
+        json_writer_func *write;
+        void *arg;
+        /* Bit n is set once the container at depth n has a value */
+        uint32_t has_value;
+        size_t depth;
+        size_t len;
+        char buf[JSON_WRITER_BUFFER_LEN];
+};
+
+void json_writer_init(struct json_writer *jw, struct Serial *serial);
+/**
+ * Sets up a writer that hands its output to a function instead of a
+ * Serial device.
+ */
+void json_writer_init_func(struct json_writer *jw, json_writer_func *write,
+                           void *arg);
+void json_writer_flush(struct json_writer *jw);
+void json_writer_null(struct json_writer *jw, const char *name);
+void json_writer_int(struct json_writer *jw, const char *name, int value);
+void json_writer_uint(struct json_writer *jw, const char *name,
+                      unsigned int value);
+void json_writer_ll(struct json_writer *jw, const char *name,
+                    long long value);
+void json_writer_float(struct json_writer *jw, const char *name,
+                       float value, int precision);
+void json_writer_double(struct json_writer *jw, const char *name,
+                        double value, int precision);
+void json_writer_bool(struct json_writer *jw, const char *name,
+                      bool value);
+/* Writes a NULL value as null */
+void json_writer_string(struct json_writer *jw, const char *name,
+                        const char *value);
+/* Writes an already rendered JSON value as is */
+void json_writer_raw(struct json_writer *jw, const char *name,
+                     const char *json, size_t len);
+void json_writer_obj_start(struct json_writer *jw, const char *name);
+void json_writer_obj_end(struct json_writer *jw);
+void json_writer_array_start(struct json_writer *jw, const char *name);
+void json_writer_array_end(struct json_writer *jw);
+
 int process_api(struct Serial *serial, char * buffer, size_t bufferSize);
 
+/**
+ * Parses what has arrived of a message too big for the buffer holding it,
+ * handing the payload array elements parsed so far to the element handler
+ * of the command to make room for the rest.  Call again once the buffer
+ * fills up again, and process_api once the message is complete.  Only one
+ * message can be in progress at a time.  Processing a message from
+ * another Serial device in between abandons it, and the next call for
+ * the rest of it fails with API_ERROR_MALFORMED.
+ * @param buffer The message so far, NUL terminated.
+ * @param count The length of the message so far.  Updated to the length
+ * left in the buffer, after which the rest of the message goes.
+ * @return API_SUCCESS if room was made, otherwise the error.
+ */
+int process_api_partial(struct Serial *serial, char *buffer, size_t *count);
+
+/**
+ * @return The number of payload array elements of the message being
+ * processed that went to the element handler of its command.
+ */
+size_t api_streamed_elements();
+
 const char* unknown_api_key();
 
 CPP_GUARD_END
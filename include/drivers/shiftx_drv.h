@@ -59,6 +59,15 @@ typedef enum {
  */
 void shiftx_handle_can_rx_msg(const CAN_msg *msg);
 
+#define SHIFTX_RX_CAN_IDS 2
+
+/**
+ * Get the IDs of the CAN messages ShiftX sends to us, based on the
+ * current runtime configuration
+ * @param ids filled in with the CAN IDs
+ */
+void shiftx_get_rx_can_ids(uint32_t ids[SHIFTX_RX_CAN_IDS]);
+
 /**
  * Retreive a pointer to the current runtime configuration
  * @return pointer to struct of the shiftx_configuration
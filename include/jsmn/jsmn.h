@@ -26,6 +26,7 @@
 #include "serial.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 CPP_GUARD_BEGIN
 
@@ -79,6 +80,7 @@ typedef struct {
         unsigned int pos; /* offset in the JSON string */
         unsigned int toknext; /* next token to allocate */
         int toksuper; /* superior token node, e.g parent object or array */
+        bool partial; /* more of the string is still to come */
 } jsmn_parser;
 
 /**
@@ -93,6 +95,102 @@ void jsmn_init(jsmn_parser *parser);
 jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js,
                      jsmntok_t *tokens, unsigned int num_tokens);
 
+/**
+ * Receives an element of the array being streamed.
+ * @param tok The element, followed by the tokens nested in it.  Lookups
+ * from it stop at its end.  Only valid for the duration of the call.
+ * @param arg The user argument given to jsmn_stream_init.
+ * @return true to carry on, false to stop parsing.
+ */
+typedef bool jsmn_stream_func(const jsmntok_t *tok, void *arg);
+
+/**
+ * Parses a JSON string that may not fit in the tokens or in memory all at
+ * once, as long as the bulk of it is a single array.
+ */
+struct jsmn_stream {
+        jsmn_parser parser;
+        jsmntok_t *tokens;
+        unsigned int num_tokens;
+        /* Nesting depth of the array to stream.  The root value is 0 */
+        unsigned int depth;
+        jsmn_stream_func *func;
+        void *arg;
+        /* Token index of the array being streamed, or -1 */
+        int array;
+        /* Length of the text cut out so far */
+        size_t dropped;
+};
+
+/**
+ * Sets up a stream parse.  The tokens must be zeroed beforehand.  The last
+ * one always stays that way, so lookups never run off the end.
+ */
+void jsmn_stream_init(struct jsmn_stream *s, jsmntok_t *tokens,
+                      const unsigned int num_tokens, const unsigned int depth,
+                      jsmn_stream_func *func, void *arg);
+
+/**
+ * Parses as much of the string as has arrived, picking up where the last
+ * call left off.  Whenever the tokens run out, or the string does while
+ * more is to come, the complete elements of the first array at the stream
+ * depth go to the stream function and are dropped, both their tokens and
+ * their text.  Elements that fit are left in the array.
+ * @param js The string so far, NUL terminated.  The same buffer every
+ * call.  Dropped text is cut out of it, so the rest goes on at its old
+ * length less what dropped grew by.  Lookups from the stream function may
+ * leave NULs behind in the text ahead of the array.
+ * @param more true if more of the string is still to come.
+ * @return JSMN_SUCCESS once the whole string is parsed, JSMN_ERROR_PART if
+ * more is expected, JSMN_ERROR_NOMEM if the tokens ran out with nothing
+ * to drop, or JSMN_ERROR_INVAL if the string is invalid or the stream
+ * function stopped the parse.
+ */
+jsmnerr_t jsmn_stream_parse(struct jsmn_stream *s, char *js, const bool more);
+
+/**
+ * A key of an object in the index.  Both are token indexes + 1, so a free
+ * slot is all 0.
+ */
+struct jsmn_index_slot {
+        uint16_t obj;
+        uint16_t key;
+};
+
+/**
+ * Hashes the keys of every object in a parsed token array by object and
+ * name, so finding a key doesn't mean a strcmp against every token that
+ * follows the object.
+ */
+struct jsmn_index {
+        const jsmntok_t *tokens;
+        size_t count;
+        struct jsmn_index_slot *slots;
+        size_t slot_count;
+};
+
+/**
+ * Builds the key index of the tokens from jsmn_parse and has the jsmn_find
+ * functions use it from here on.  Lookups in an object it covers only
+ * match the keys of that object, not those of objects nested in it or
+ * following it.  Lookups in anything else scan the tokens as before.
+ * @param idx The index to build.
+ * @param tokens The parsed tokens.
+ * @param count The number of tokens parsed.
+ * @param slots Space for the index.
+ * @param slot_count The number of slots.  One per token always suffices.
+ * @return true if built, false if it didn't fit in the slots, in which
+ * case nothing is indexed.
+ */
+bool jsmn_index_build(struct jsmn_index *idx, const jsmntok_t *tokens,
+                      const size_t count, struct jsmn_index_slot *slots,
+                      const size_t slot_count);
+
+/**
+ * @return The token after the given one and everything nested in it.
+ */
+const jsmntok_t * jsmn_next(const jsmntok_t *tok);
+
 /**
  * null terminate the string at the current token for convenience
  */
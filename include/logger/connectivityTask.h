@@ -30,6 +30,9 @@
 #include "sampleRecord.h"
 #include "serial.h"
 #include "task.h"
+#include "telemetry_backlog.h"
+#include "telemetry_batch.h"
+#include "telemetry_frame.h"
 #include "dateTime.h"
 #include <stdint.h>
 #include <stdbool.h>
@@ -43,19 +46,6 @@ CPP_GUARD_BEGIN
 /* 5 second disconnect timeout */
 #define TELEMETRY_DISCONNECT_TIMEOUT 10
 
-/* Disconnect timeout + extra seconds at 10Hz for tracking samples
- * This is used to calculate the size of the circular buffer
- * for tracking sample byte offsets within buffer file.
- * We add 1 second to the timeout to allow some overhead.
- */
-#define SAMPLE_TRACKING_WINDOW 10 * (TELEMETRY_DISCONNECT_TIMEOUT + 4)
-
-/* maps a tick against a byte offset in a file */
-typedef struct _SampleOffsetMap {
-        uint32_t tick;
-        uint32_t buffer_file_index;
-} SampleOffsetMap;
-
 typedef struct _ConnParams {
         bool always_streaming;
         char * connectionName;
@@ -66,8 +56,10 @@ typedef struct _ConnParams {
         size_t periodicMeta;
         uint32_t connection_timeout;
         xQueueHandle sampleQueue;
+        enum sample_consumer consumer;
         int max_sample_rate;
         enum led activity_led;
+        struct telemetry_batch_cfg batch;
 } ConnParams;
 
 typedef struct _TelemetryConnParams {
@@ -81,6 +73,7 @@ typedef struct _TelemetryConnParams {
         xQueueHandle sampleQueue;
         int max_sample_rate;
         enum led activity_led;
+        struct telemetry_batch_cfg batch;
 } TelemetryConnParams;
 
 typedef struct _BufferingTaskParams {
@@ -88,6 +81,7 @@ typedef struct _BufferingTaskParams {
         char * connectionName;
         size_t periodicMeta;
         xQueueHandle sampleQueue;
+        enum sample_consumer consumer;
         int max_sample_rate;
 } BufferingTaskParams;
 
@@ -102,14 +96,14 @@ typedef struct _CellularState {
         FIL *buffer_file;
         char buffer_buffer[BUFFER_BUFFER_SIZE + 1];
         char cell_buffer[BUFFER_SIZE];
-        int32_t read_index;
+        struct telemetry_backlog backlog;
+        struct telemetry_delta delta;
+        struct telemetry_batch batch;
         bool buffer_file_open;
         bool should_stream;
         bool should_reconnect;
         uint32_t server_tick_echo;
         size_t server_tick_echo_changed_at;
-        SampleOffsetMap sample_offset_map[SAMPLE_TRACKING_WINDOW];
-        size_t sample_offset_map_index;
 } CellularState;
 
 void queueTelemetryRecord(const LoggerMessage *msg);
@@ -25,13 +25,23 @@
 #include "FreeRTOS.h"
 #include "cpp_guard.h"
 #include "ff.h"
+#include "jsmn.h"
+#include "log_journal.h"
 #include "loggerConfig.h"
 #include "sampleRecord.h"
+#include "serial.h"
+#include <stdbool.h>
 
 CPP_GUARD_BEGIN
 
 #define FILENAME_LEN 13
 #define FLUSH_INTERVAL_MS 1000
+/*
+ * Journaled logs that are pre-allocated don't rely on the sync to keep
+ * the file size current, so they can afford to sync far less often.
+ */
+#define JOURNAL_FLUSH_INTERVAL_MS 10000
+#define SD_SECTOR_SIZE	512
 
 enum writing_status {
         WRITING_INACTIVE = 0,
@@ -45,13 +55,47 @@ struct logging_status {
         enum writing_status writing_status;
         portTickType flush_tick;
         portTickType last_sample_tick;
+        /* Tick at which the oldest unwritten row was buffered */
+        portTickType buffer_tick;
+        struct logfile_config cfg;
+        /* Bytes to grow the log file by at a time.  0 if not used */
+        DWORD prealloc_size;
+        /* Checkpoint state.  Only used if cfg.journal is set */
+        struct log_journal journal;
         char name[FILENAME_LEN];
 };
 
+/*
+ * Counters for sizing the file writer queue and buffers.  Formatting and
+ * card writes overlap, so stalls only happen when the card takes longer
+ * to write a buffer than it takes to fill the other one.
+ */
+struct file_writer_stats {
+        /* Messages dropped because the file writer queue was full */
+        uint32_t queue_overflows;
+        /* Most messages ever waiting in the file writer queue */
+        uint32_t queue_high_water;
+        /* Times formatting had to wait for a buffer to be written */
+        uint32_t buffer_stalls;
+        /* Longest time formatting has waited for a buffer */
+        uint32_t stall_ms_high_water;
+        /* Buffers that failed to write and the bytes lost with them */
+        uint32_t write_errors;
+        uint32_t dropped_bytes;
+};
 
 void startFileWriterTask( int priority );
 portBASE_TYPE queue_logfile_record(const LoggerMessage *msg);
 
+void file_writer_get_stats(struct file_writer_stats *stats);
+
+void logfile_sanitize_config(struct logfile_config *cfg);
+
+void logfile_get_config(const struct logfile_config *cfg,
+                        struct Serial *serial, const bool more);
+
+bool logfile_set_config(struct logfile_config *cfg, const jsmntok_t *json);
+
 CPP_GUARD_END
 
 #endif /* FILEWRITER_H_ */
@@ -0,0 +1,90 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOG_COMPRESS_H_
+#define _LOG_COMPRESS_H_
+
+#include "cpp_guard.h"
+#include "log_format.h"
+#include <stddef.h>
+#include <stdint.h>
+
+CPP_GUARD_BEGIN
+
+/*
+ * Compressed logs are a series of blocks that each decode on their own,
+ * so everything up to a block cut short by a power loss can be recovered.
+ * All multi-byte fields are little endian.
+ *
+ * Block:
+ *   "RZ"
+ *   u16 raw length
+ *   u16 payload length.  Equal to the raw length if the data is stored
+ *       as is because it didn't compress.
+ *   payload
+ *
+ * The payload uses LZ4 style sequences: a token byte holding the literal
+ * count in its high nibble and the match length - 4 in its low nibble
+ * (15 means more length bytes follow, each added until one is < 255),
+ * the literals, then a u16 match offset.  The last sequence of a block
+ * has literals only.  Matches never reach outside their block.
+ */
+#define LOG_COMPRESS_MAGIC		"RZ"
+#define LOG_COMPRESS_MAGIC_LEN		2
+#define LOG_COMPRESS_HEADER_LEN		6
+#define LOG_COMPRESS_MAX_BLOCK		UINT16_MAX
+#define LOG_COMPRESS_HASH_BITS		10
+
+/* Space needed to compress a block of len bytes */
+#define LOG_COMPRESS_BLOCK_BOUND(len)	(LOG_COMPRESS_HEADER_LEN + (len))
+
+struct log_compress {
+        /* Last position + 1 seen for each hash of 4 input bytes */
+        uint16_t table[1 << LOG_COMPRESS_HASH_BITS];
+};
+
+/**
+ * Compresses data into a single self contained block.
+ * @param lc Scratch state.  Does not need to be initialized.
+ * @param src The data to compress.
+ * @param len The length of the data.  At most LOG_COMPRESS_MAX_BLOCK.
+ * @param dst Where to put the block.  Must be able to hold
+ * LOG_COMPRESS_BLOCK_BOUND(len) bytes.
+ * @return The length of the block.
+ */
+size_t log_compress_block(struct log_compress *lc, const void *src,
+                          const size_t len, void *dst);
+
+/**
+ * Decompresses a series of blocks.  A truncated or corrupt block ends the
+ * stream, and everything before it is still written out.
+ * @param data The compressed blocks.
+ * @param len The length of the data.
+ * @param w Where to write the decompressed data.
+ * @return The number of blocks decompressed, or -1 if the data doesn't
+ * start with a block.
+ */
+int log_decompress(const void *data, const size_t len,
+                   const struct log_format_writer *w);
+
+CPP_GUARD_END
+
+#endif /* _LOG_COMPRESS_H_ */
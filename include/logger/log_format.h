@@ -0,0 +1,160 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOG_FORMAT_H_
+#define _LOG_FORMAT_H_
+
+#include "cpp_guard.h"
+#include "sampleRecord.h"
+#include <stddef.h>
+#include <stdint.h>
+
+CPP_GUARD_BEGIN
+
+/*
+ * RCB (RaceCapture Binary) log layout.  All multi-byte fields are little
+ * endian.
+ *
+ * Header:
+ *   "RCB" + version byte
+ *   u16 channel count
+ *   per channel:
+ *     u8 value type (enum rcb_value_type)
+ *     u8 precision
+ *     u16 sample rate (encoded, as stored in ChannelConfig)
+ *     f32 min, f32 max
+ *     u8 label length, label bytes
+ *     u8 units length, units bytes
+ *
+ * Record:
+ *   u8 RCB_RECORD_MARKER
+ *   u32 tick
+ *   populated channel bitmap, (channel count + 7) / 8 bytes, LSB first
+ *   raw value of every populated channel, sized by its value type
+ */
+#define RCB_MAGIC		"RCB"
+#define RCB_MAGIC_LEN		3
+#define RCB_VERSION		1
+#define RCB_RECORD_MARKER	0xA5
+#define RCB_TYPE_INVALID	0xFF
+
+enum rcb_value_type {
+        RCB_TYPE_INT32 = 0,
+        RCB_TYPE_INT64,
+        RCB_TYPE_FLOAT,
+        RCB_TYPE_DOUBLE,
+};
+
+/**
+ * Receives formatted log data.
+ * @param data The bytes to write.
+ * @param len The number of bytes to write.
+ * @param arg The user argument given in struct log_format_writer.
+ */
+typedef void log_format_write_func(const void *data, const size_t len,
+                                   void *arg);
+
+struct log_format_writer {
+        log_format_write_func *write;
+        void *arg;
+};
+
+/**
+ * Writes the CSV header row describing every channel in the sample.
+ */
+void log_format_csv_header(const struct log_format_writer *w,
+                           const struct sample *s);
+
+/**
+ * Writes a CSV row with the values of all populated channels.
+ * @return 0 on success, -1 if the sample has no channel data.
+ */
+int log_format_csv_row(const struct log_format_writer *w,
+                       const struct sample *s);
+
+/**
+ * Writes a sparse CSV row holding only the populated channels, so the row
+ * size follows the data actually sampled at this tick rather than the
+ * channel count.  Each run of populated channels starts with the index of
+ * its first channel.  For example:
+ *
+ *   0=1234,1500000000000,7=0.12,0.34
+ *
+ * holds channels 0, 1, 7 and 8.  The header is the same as for regular
+ * CSV logs.
+ * @return 0 on success, -1 if the sample has no channel data.
+ */
+int log_format_csv_sparse_row(const struct log_format_writer *w,
+                              const struct sample *s);
+
+/**
+ * Writes the RCB header block describing every channel in the sample.
+ */
+void log_format_rcb_header(const struct log_format_writer *w,
+                           const struct sample *s);
+
+/**
+ * Writes an RCB record with the raw values of all populated channels.
+ * @return 0 on success, -1 if the sample has no channel data.
+ */
+int log_format_rcb_record(const struct log_format_writer *w,
+                          const struct sample *s, const uint32_t tick);
+
+/**
+ * @return The number of bytes log_format_rcb_header writes for the sample.
+ */
+size_t log_format_rcb_header_len(const struct sample *s);
+
+/**
+ * @return The number of bytes log_format_rcb_record writes for the sample.
+ */
+size_t log_format_rcb_record_len(const struct sample *s);
+
+/**
+ * Reads the value type of every channel out of an RCB header.
+ * @param data The start of the header.
+ * @param len The length of the data.
+ * @param types Where to put the enum rcb_value_type of each channel.
+ * Channels with a type RCB doesn't know get RCB_TYPE_INVALID.
+ * @param max_channels The number of entries types has room for.
+ * @return The channel count, or -1 if the header is invalid or has more
+ * than max_channels channels.
+ */
+int log_format_rcb_header_types(const void *data, const size_t len,
+                                uint8_t *types, const size_t max_channels);
+
+/**
+ * Converts an RCB log back into the CSV produced by log_format_csv_header
+ * and log_format_csv_row.  A truncated trailing record, such as one left
+ * behind by a power loss, is silently dropped.  Journal checkpoints (see
+ * log_journal.h) between records are skipped.
+ * @param data The RCB log contents.
+ * @param len The length of the RCB log.
+ * @param w Where to write the CSV output.
+ * @return The number of records converted, or -1 if the data is not a
+ * valid RCB log.
+ */
+int log_format_rcb_to_csv(const void *data, const size_t len,
+                          const struct log_format_writer *w);
+
+CPP_GUARD_END
+
+#endif /* _LOG_FORMAT_H_ */
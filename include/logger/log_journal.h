@@ -0,0 +1,125 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOG_JOURNAL_H_
+#define _LOG_JOURNAL_H_
+
+#include "cpp_guard.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+CPP_GUARD_BEGIN
+
+/*
+ * Journaled logs carry checkpoint lines in between rows so that a log cut
+ * short by a power loss can be trimmed back to data that is known to be
+ * good.  A checkpoint is a fixed length line of lower case hex fields:
+ *
+ *   #CK,<id>,<tick>,<rows>,<len>,<crc>\r\n
+ *
+ *   id    Identifies the log file.  Tells our checkpoints apart from stale
+ *         ones left on the card by files that were deleted.
+ *   tick  Tick count when the checkpoint was written.
+ *   rows  Rows written to the file so far.
+ *   len   Bytes of log data between the previous checkpoint and this one.
+ *   crc   CRC-32 of those len bytes followed by this line up to and
+ *         including the comma before the crc field.
+ *
+ * The leading '#' lets most CSV tools skip checkpoints as comments.
+ */
+#define LOG_JOURNAL_MAGIC		"#CK,"
+#define LOG_JOURNAL_MAGIC_LEN		4
+#define LOG_JOURNAL_CHECKPOINT_LEN	50
+
+struct log_journal {
+        uint32_t id;
+        /* Running CRC and length of the data since the last checkpoint */
+        uint32_t crc;
+        uint32_t len;
+};
+
+struct log_journal_checkpoint {
+        uint32_t id;
+        uint32_t tick;
+        uint32_t rows;
+        uint32_t len;
+        uint32_t crc;
+};
+
+/**
+ * Starts a journal with nothing written since the last checkpoint.
+ * @param id The id to stamp every checkpoint with.
+ */
+void log_journal_init(struct log_journal *j, const uint32_t id);
+
+/**
+ * Accounts for log data that will be covered by the next checkpoint.
+ */
+void log_journal_update(struct log_journal *j, const void *data,
+                        const size_t len);
+
+/**
+ * Formats a checkpoint covering the data since the previous one and starts
+ * a new block.
+ * @param buf Where to put the checkpoint.  Must hold
+ * LOG_JOURNAL_CHECKPOINT_LEN bytes.  It is not NUL terminated.
+ * @return LOG_JOURNAL_CHECKPOINT_LEN.
+ */
+size_t log_journal_checkpoint(struct log_journal *j, char *buf,
+                              const uint32_t tick, const uint32_t rows);
+
+/**
+ * Parses a checkpoint at the start of data.  The crc is not verified.
+ * @return true if data starts with a well formed checkpoint.
+ */
+bool log_journal_parse(const void *data, const size_t len,
+                       struct log_journal_checkpoint *cp);
+
+/**
+ * Finds the first well formed checkpoint in data.
+ * @return true if found, false otherwise.
+ */
+bool log_journal_find_first(const void *data, const size_t len,
+                            struct log_journal_checkpoint *cp);
+
+/**
+ * Checks a checkpoint against the data before it, which the caller has
+ * accounted for with log_journal_update on a journal started with
+ * log_journal_init.  Lets blocks too big to hold in memory be verified.
+ * @param checkpoint Must hold LOG_JOURNAL_CHECKPOINT_LEN bytes.
+ * @return true if the checkpoint carries the journal's id and its length
+ * and crc match the data.
+ */
+bool log_journal_verify(const struct log_journal *j, const void *checkpoint);
+
+/**
+ * Finds the last checkpoint in data that carries the given id and whose
+ * crc matches the data before it.  Checkpoints whose data starts before
+ * the start of the buffer can't be verified and are skipped.
+ * @return The offset just past the checkpoint, or -1 if there is none.
+ */
+long log_journal_find_last(const void *data, const size_t len,
+                           const uint32_t id);
+
+CPP_GUARD_END
+
+#endif /* _LOG_JOURNAL_H_ */
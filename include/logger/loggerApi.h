@@ -29,9 +29,12 @@
 #include "jsmn.h"
 #include "sampleRecord.h"
 #include "serial.h"
+#include "telemetry_batch.h"
+#include "telemetry_frame.h"
 CPP_GUARD_BEGIN
 
-#define API_METHOD(_NAME, _FUNC) {(_NAME), (_FUNC)},
+#define API_METHOD(_NAME, _FUNC) {(_NAME), (_FUNC), NULL},
+#define API_STREAM_METHOD(_NAME, _FUNC, _ELEMENT) {(_NAME), (_FUNC), (_ELEMENT)},
 
 #define BASE_API_METHODS						\
 	API_METHOD("addTrackDb", api_addTrackDb)			\
@@ -39,7 +42,8 @@ CPP_GUARD_BEGIN
 	API_METHOD("flashCfg", api_flashConfig)				\
 	API_METHOD("getCanCfg", api_getCanConfig)			\
 	API_METHOD("getCanChanCfg", api_get_can_channel_config) \
-	API_METHOD("setCanChanCfg", api_set_can_channel_config) \
+	API_STREAM_METHOD("setCanChanCfg", api_set_can_channel_config, \
+			  api_set_can_channel_element)			\
 	API_METHOD("getCapabilities", api_getCapabilities)		\
 	API_METHOD("getConnCfg", api_getConnectivityConfig)		\
 	API_METHOD("getLapCfg", api_getLapConfig)			\
@@ -80,7 +84,9 @@ CPP_GUARD_BEGIN
 #if SDCARD_SUPPORT
 #define AUTOLOGGING_METHODS                                     \
     API_METHOD("getSdLogCtrlCfg", api_get_auto_logger_cfg)     \
-    API_METHOD("setSdLogCtrlCfg", api_set_auto_logger_cfg)
+    API_METHOD("setSdLogCtrlCfg", api_set_auto_logger_cfg)     \
+    API_METHOD("getLogFileCfg", api_get_logfile_cfg)           \
+    API_METHOD("setLogFileCfg", api_set_logfile_cfg)
 #else
 #define AUTOLOGGING_METHODS
 #endif
@@ -202,6 +208,8 @@ int api_getCanConfig(struct Serial *serial, const jsmntok_t *json);
 int api_setCanConfig(struct Serial *serial, const jsmntok_t *json);
 int api_get_can_channel_config(struct Serial *serial, const jsmntok_t *json);
 int api_set_can_channel_config(struct Serial *serial, const jsmntok_t *json);
+int api_set_can_channel_element(struct Serial *serial, const jsmntok_t *json,
+                                const jsmntok_t *chan, size_t index);
 int api_reset_lap_stats(struct Serial *serial, const jsmntok_t *json);
 
 /* Sensor channels */
@@ -227,6 +235,25 @@ void api_sendLogEnd(struct Serial *serial);
 void api_send_sample_record(struct Serial *serial,
                             const struct sample *sample,
                             const unsigned int tick, const int sendMeta);
+/**
+ * Streams a sample in the telemetry format negotiated on the Serial
+ * device, either a JSON line or a binary frame.
+ * @param delta The delta state of the connection, or NULL if it can't
+ * keep one.  Delta encoding falls back to plain binary frames without it.
+ * Sending meta makes the sample a keyframe.
+ */
+void api_send_telemetry_sample(struct Serial *serial,
+                               struct telemetry_delta *delta,
+                               const struct sample *sample,
+                               const unsigned int tick, const int sendMeta);
+/**
+ * Like api_send_telemetry_sample, but the sample joins a batch that goes
+ * out to the batch's Serial device in a single write.
+ */
+void api_batch_telemetry_sample(struct telemetry_batch *batch,
+                                struct telemetry_delta *delta,
+                                const struct sample *sample,
+                                const unsigned int tick, const int sendMeta);
 
 /* Wifi methods */
 int api_get_wifi_cfg(struct Serial *s, const jsmntok_t *json);
@@ -241,6 +268,8 @@ int api_set_active_track(struct Serial *serial, const jsmntok_t *json);
 #if SDCARD_SUPPORT
 int api_get_auto_logger_cfg(struct Serial *serial, const jsmntok_t *json);
 int api_set_auto_logger_cfg(struct Serial *serial, const jsmntok_t *json);
+int api_get_logfile_cfg(struct Serial *serial, const jsmntok_t *json);
+int api_set_logfile_cfg(struct Serial *serial, const jsmntok_t *json);
 #endif
 
 #if CAMERA_CONTROL
@@ -519,11 +519,51 @@ typedef struct _ConnectivityConfig {
         struct wifi_cfg wifi;
 } ConnectivityConfig;
 
+#define DEFAULT_LOGFILE_WRITE_THRESHOLD		512
+#define DEFAULT_LOGFILE_WRITE_LATENCY_MS	500
+#define DEFAULT_LOGFILE_PREALLOC_MINUTES	0
+
+enum logfile_format {
+        LOGFILE_FORMAT_CSV = 0,
+        /* Compact binary records.  See log_format.h */
+        LOGFILE_FORMAT_RCB,
+        /*
+         * CSV header with rows that only hold populated channels.  See
+         * log_format_csv_sparse_row.  Written to .rcs files so it isn't
+         * mistaken for regular CSV.
+         */
+        LOGFILE_FORMAT_CSV_SPARSE,
+        __LOGFILE_FORMAT_COUNT, /* ALWAYS AT THE END */
+};
+
+/**
+ * Controls how the fileWriter formats rows and batches them before handing
+ * them to FatFs.  Rows accumulate until write_threshold bytes (rounded down
+ * to a multiple of the SD sector size) are buffered or the oldest buffered
+ * row is older than write_latency_ms.  A write_threshold of 0 writes every
+ * row out as soon as it is formatted.  A non-zero prealloc_minutes grows
+ * journaled log files ahead of time by the amount of data we expect to log
+ * over that many minutes, and truncates the excess when the file is closed.
+ * With compress set, every buffer is compressed into a self contained
+ * block before it is written.  See log_compress.h.  With journal set,
+ * uncompressed logs carry checkpoints that let a log cut short by a power
+ * loss be trimmed back to good data.  See log_journal.h.
+ */
+struct logfile_config {
+        uint16_t write_threshold;
+        uint16_t write_latency_ms;
+        uint8_t format;
+        uint8_t prealloc_minutes;
+        bool compress;
+        bool journal;
+};
+
 /**
  * Configurations specific to our logging infrastructure.
  */
 struct logging_config {
         enum serial_log_type serial[__SERIAL_COUNT];
+        struct logfile_config logfile;
 };
 
 typedef struct _LoggerConfig {
@@ -40,6 +40,13 @@ int populate_sample_buffer(struct sample *s, size_t logTick);
 void init_channel_sample_buffer(LoggerConfig *loggerConfig,
                                 struct sample *s);
 
+/**
+ * Works out the sampling schedule of a sample from the channels in it.
+ * init_channel_sample_buffer does this already.  Only needed if the
+ * channels are set up some other way.
+ */
+void sample_schedule_init(struct sample *s);
+
 float get_mapped_value(float value, ScalingMap *scalingMap);
 
 typedef void logger_sample_cb_t(const struct sample* sample,
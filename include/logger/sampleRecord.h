@@ -32,6 +32,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 CPP_GUARD_BEGIN
 
@@ -81,10 +82,84 @@ typedef struct _ChannelSample {
         enum SampleData sampleData;
 }  __attribute__((__packed__,aligned(4))) ChannelSample;
 
+/* Enough for every sample rate encodeSampleRate can produce */
+#define SAMPLE_SCHEDULE_MAX_RATES	10
+
+struct sample_schedule_bucket {
+        unsigned short rate;
+        uint16_t start;
+        uint16_t count;
+};
+
+/*
+ * Which channels to populate on which ticks, worked out once when the
+ * channel configuration is applied so that a tick only touches the
+ * channels that are due.  order holds channel indexes: the always sampled
+ * channels first, then the channels of each bucket, with every group
+ * sorted by getter type.
+ */
+struct sample_schedule {
+        /* False if the config didn't fit.  Channels get scanned instead */
+        bool valid;
+        uint8_t bucket_count;
+        uint16_t always_count;
+        /* Buckets populated last time, always sampled ones as the top bit */
+        uint16_t populated;
+        struct sample_schedule_bucket buckets[SAMPLE_SCHEDULE_MAX_RATES];
+        uint16_t *order;
+};
+
 struct sample {
         size_t ticks;
         size_t channel_count;
         ChannelSample *channel_samples;
+        struct sample_schedule schedule;
+        /* References held on this sample.  Free for reuse when 0 */
+        volatile uint8_t refs;
+        /* How many of those the telemetry consumers hold */
+        volatile uint8_t telemetry_refs;
+        /*
+         * The pool layout the channel samples were built for, or 0 if
+         * the sample isn't from a pool.
+         */
+        uint32_t layout;
+};
+
+/*
+ * Samples are shared with their consumers by reference rather than
+ * copied.  The logger task takes a free sample from its pool and every
+ * LoggerMessage queued with that sample holds a reference to it.  The
+ * sample only goes back to the pool once every consumer has released it,
+ * so a consumer that falls behind never sees its sample overwritten.
+ * Instead the pool runs dry, and the per consumer counters below show who
+ * was holding on to the samples when it did.
+ */
+enum sample_consumer {
+        SAMPLE_CONSUMER_FILE = 0,
+        SAMPLE_CONSUMER_BLUETOOTH,
+        SAMPLE_CONSUMER_CELLULAR,
+        __SAMPLE_CONSUMER_COUNT, /* ALWAYS AT THE END */
+};
+
+/*
+ * Links stall far more often than the card does, so the file writer has
+ * part of the pool to itself.  The telemetry consumers share what is left
+ * after that and the sample the logger is filling.  They may hold at most
+ * SAMPLE_TELEMETRY_MAX_HELD different samples between them, and samples
+ * over the limit are dropped like those that don't fit in the queue.
+ */
+#define SAMPLE_FILE_RESERVED		(LOGGER_MESSAGE_BUFFER_SIZE / 2)
+#define SAMPLE_TELEMETRY_MAX_HELD	(LOGGER_MESSAGE_BUFFER_SIZE - 1 - \
+                                         SAMPLE_FILE_RESERVED)
+
+struct sample_consumer_stats {
+        /* Samples not sent because the consumer's queue was full */
+        uint32_t dropped;
+        /* Samples the consumer holds now, and the most it ever held */
+        uint32_t held;
+        uint32_t held_high_water;
+        /* Samples lost to an empty pool while this consumer held the most */
+        uint32_t starved;
 };
 
 typedef struct _LoggerMessage {
@@ -134,8 +209,8 @@ LoggerMessage create_logger_message(const enum LoggerMessageType t,
                                     const bool needs_meta);
 
 /**
- * Receives and validates a LoggerMessage from the provided queue.  If the
- * LoggerMessage is invalid, then it is ignored.
+ * Receives a LoggerMessage from the provided queue.  The consumer must
+ * hand it to release_logger_message once done with it.
  * @param queue The Queue containing the message
  * @param lm The LoggerMessage structure to populate.
  * @param timeout The amount of time to wait before timing out.
@@ -145,7 +220,86 @@ LoggerMessage create_logger_message(const enum LoggerMessageType t,
 char receive_logger_message(xQueueHandle queue, LoggerMessage *lm,
                             portTickType timeout);
 
-bool is_sample_data_valid(const LoggerMessage *lm);
+/**
+ * Releases the reference a received LoggerMessage holds on its sample, if
+ * any.  The sample must not be used afterwards.
+ * @param c The consumer that received the message.
+ * @param lm The message.
+ */
+void release_logger_message(const enum sample_consumer c,
+                            const LoggerMessage *lm);
+
+/**
+ * Gives back a sample a consumer was holding.
+ * @param c The consumer that received the sample.
+ * @param s The sample.  Does nothing if NULL.
+ */
+void sample_consumer_release(const enum sample_consumer c, struct sample *s);
+
+/**
+ * Takes a reference on a sample.
+ */
+void sample_hold(struct sample *s);
+
+/**
+ * Drops a reference on a sample.  Does nothing if s is NULL.
+ */
+void sample_release(struct sample *s);
+
+/**
+ * (Re)builds the samples of a pool for a new channel layout.  Samples a
+ * consumer still holds keep their old buffer until they are released, and
+ * sample_pool_acquire rebuilds them then.
+ * @param pool The samples of the pool.
+ * @param count The number of samples in the pool.
+ * @param channel_count The number of channels that we are logging.
+ * @return The number of samples in the pool that can be used, or 0 if
+ * none could be allocated.
+ */
+size_t sample_pool_init(struct sample *pool, const size_t count,
+                        const size_t channel_count);
+
+/**
+ * @return The layout that samples built by the last sample_pool_init have.
+ */
+uint32_t sample_pool_layout(void);
+
+/**
+ * Finds a sample that nobody holds and takes a reference on it for the
+ * caller.  A sample left with an old layout is rebuilt first.
+ * @param pool The samples to choose from.
+ * @param count The number of samples in the pool.
+ * @return The sample, or NULL if every sample is in use.
+ */
+struct sample* sample_pool_acquire(struct sample *pool, const size_t count);
+
+/**
+ * Charges a sample lost to an empty pool to the consumer holding the most
+ * samples.
+ */
+void sample_pool_starved(void);
+
+/**
+ * Starts sending samples to a consumer.  Consumers only get samples while
+ * they are subscribed so that one that isn't reading its queue doesn't tie
+ * up the pool.  Messages without a sample are always sent.
+ */
+void sample_consumer_subscribe(const enum sample_consumer c);
+
+/**
+ * Stops sending samples to a consumer and releases the ones still waiting
+ * in its queue.  Messages without a sample stay queued, in order.
+ * @param c The consumer.
+ * @param queue The consumer's queue.
+ */
+void sample_consumer_unsubscribe(const enum sample_consumer c,
+                                 xQueueHandle queue);
+
+/**
+ * Copies out the sample counters of a consumer.
+ */
+void sample_consumer_get_stats(const enum sample_consumer c,
+                               struct sample_consumer_stats *stats);
 
 /**
  * Creates a brand new LoggerMessage queue.  This is useful for sending
@@ -158,12 +312,15 @@ bool is_sample_data_valid(const LoggerMessage *lm);
 xQueueHandle create_logger_message_queue();
 
 /**
- * Enqueues a LoggerMessage onto a provided queue.
+ * Enqueues a LoggerMessage onto a provided queue.  A queued message holds
+ * a reference on its sample until the consumer releases it.
+ * @param c The consumer the queue belongs to.
  * @param queue The queue to append the message to.
  * @param msg The message to put into the queue.
  * @return pdTRUE if successful, or an error code otherwise.
  */
-portBASE_TYPE send_logger_message(const xQueueHandle queue,
+portBASE_TYPE send_logger_message(const enum sample_consumer c,
+                                  const xQueueHandle queue,
                                   const LoggerMessage * const msg);
 
 CPP_GUARD_END
@@ -0,0 +1,120 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _TELEMETRY_BACKLOG_H_
+#define _TELEMETRY_BACKLOG_H_
+
+#include "cpp_guard.h"
+#include "ff.h"
+#include "sampleRecord.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+CPP_GUARD_BEGIN
+
+/*
+ * Telemetry backlog kept on the SD card while the link to the server is
+ * down.  The file is append only and holds the JSON sample lines exactly
+ * as the server takes them, so catching up is a straight copy of the file
+ * in large chunks.
+ *
+ * A sparse index maps ticks to the offsets of their records so a
+ * reconnect can resume right after the last tick the server has.  Every
+ * record whose tick is a multiple of the interval gets an entry, as does
+ * the first record of every run of ticks (ticks start over with each
+ * log).  When the index fills up the interval doubles and every other
+ * entry goes, so the index always covers the whole file.  The records
+ * between two entries have consecutive ticks.
+ *
+ * The file is recreated on every boot, so the index lives in RAM only.
+ */
+#define TELEMETRY_BACKLOG_INDEX_LEN		128
+#define TELEMETRY_BACKLOG_INDEX_INTERVAL	8
+
+struct telemetry_backlog_entry {
+        uint32_t tick;
+        uint32_t offset;
+};
+
+struct telemetry_backlog {
+        FIL *file;
+        char *buf;
+        size_t buf_len;
+        struct telemetry_backlog_entry index[TELEMETRY_BACKLOG_INDEX_LEN];
+        size_t count;
+        /* First entry of the latest run of ticks */
+        size_t run_start;
+        uint32_t interval;
+        uint32_t last_tick;
+        /* Where the next read starts */
+        uint32_t read_offset;
+};
+
+/**
+ * Starts a new, empty backlog.  None of these functions lock the file
+ * system, callers hold fs_lock around them.
+ * @param file The backlog file, open for reading and writing and empty.
+ * @param buf Where reads land.
+ * @param buf_len The size of buf, which is the most one read returns.
+ */
+void telemetry_backlog_init(struct telemetry_backlog *tb, FIL *file,
+                            char *buf, const size_t buf_len);
+
+/**
+ * Appends a sample record to the end of the file and indexes it.
+ */
+FRESULT telemetry_backlog_append(struct telemetry_backlog *tb,
+                                 const struct sample *sample,
+                                 const uint32_t tick, const bool meta);
+
+/**
+ * Notes that the record for a tick starts at an offset.  Records have to
+ * be noted in the order they are appended.
+ */
+void telemetry_backlog_index(struct telemetry_backlog *tb,
+                             const uint32_t tick, const uint32_t offset);
+
+/**
+ * Moves the read position to just after the record of a tick, like the
+ * last one the server got.  Only ticks in the latest run can be found.
+ * @return true if the tick is in the backlog.  The read position stays
+ * put if not.
+ */
+bool telemetry_backlog_resume(struct telemetry_backlog *tb,
+                              const uint32_t tick);
+
+/**
+ * Reads the next chunk of the backlog.
+ * @param len Where to put the number of bytes read.  0 once caught up.
+ * @return The data read, or NULL on a read error.
+ */
+const char* telemetry_backlog_read(struct telemetry_backlog *tb, size_t *len);
+
+/**
+ * @return The number of bytes left to read.
+ */
+uint32_t telemetry_backlog_pending(const struct telemetry_backlog *tb);
+
+CPP_GUARD_END
+
+#endif /* _TELEMETRY_BACKLOG_H_ */
@@ -0,0 +1,111 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _TELEMETRY_BATCH_H_
+#define _TELEMETRY_BATCH_H_
+
+#include "cpp_guard.h"
+#include "serial.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+CPP_GUARD_BEGIN
+
+/*
+ * Collects consecutive telemetry samples so they go out to the Serial
+ * device in a single write.  Links that pay a fixed cost for every burst
+ * of data, like a cellular modem sending each in its own packet, then pay
+ * it once per batch instead of once per sample.  What goes over the wire is
+ * unchanged, the samples just arrive together.
+ *
+ * A batch goes out once it holds the configured number of samples, once
+ * the next write would take it past its byte budget, or once its oldest
+ * sample has waited the configured latency.  Samples are never split
+ * across batches, and one bigger than the whole budget goes out on its own
+ * as it is written.  Held samples are always complete, so other output may
+ * be written to the Serial device between samples without a flush.
+ */
+struct telemetry_batch_cfg {
+        /* Samples per batch.  0 or 1 sends every sample on its own */
+        uint16_t samples;
+        /* Bytes a batch may hold */
+        uint16_t bytes;
+        /* How long a sample may be held back, in ms */
+        uint16_t latency_ms;
+};
+
+struct telemetry_batch {
+        struct Serial *serial;
+        struct telemetry_batch_cfg cfg;
+        char *buf;
+        size_t len;
+        size_t samples;
+        /* Where the sample being written starts in buf */
+        size_t sample_start;
+        /* The sample being written bypasses buf */
+        bool oversized;
+        /* Tick the oldest held sample was written at */
+        size_t started_at;
+};
+
+/**
+ * The buffer is only allocated once the first batch starts.
+ */
+void telemetry_batch_init(struct telemetry_batch *tb, struct Serial *serial,
+                          const struct telemetry_batch_cfg *cfg);
+
+void telemetry_batch_free(struct telemetry_batch *tb);
+
+/**
+ * Adds sample data to the batch.  A log_format_write_func, so the
+ * telemetry formatters can write straight into a batch.
+ * @param arg The struct telemetry_batch.
+ */
+void telemetry_batch_write(const void *data, const size_t len, void *arg);
+
+/**
+ * Marks the end of a sample written with telemetry_batch_write, sending
+ * the batch if it is full.
+ */
+void telemetry_batch_end_sample(struct telemetry_batch *tb);
+
+/**
+ * Sends the batch if its oldest sample has waited long enough.  Call this
+ * regularly, as nothing else will while no samples come in.
+ * @return true if the batch was sent.
+ */
+bool telemetry_batch_poll(struct telemetry_batch *tb);
+
+/**
+ * Sends whatever the batch holds right away.
+ */
+void telemetry_batch_flush(struct telemetry_batch *tb);
+
+/**
+ * Drops whatever the batch holds, like when the other end has gone away.
+ */
+void telemetry_batch_discard(struct telemetry_batch *tb);
+
+CPP_GUARD_END
+
+#endif /* _TELEMETRY_BATCH_H_ */
@@ -0,0 +1,150 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TELEMETRY_FRAME_H_
+#define _TELEMETRY_FRAME_H_
+
+#include "cpp_guard.h"
+#include "log_format.h"
+#include "sampleRecord.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+CPP_GUARD_BEGIN
+
+/*
+ * Binary telemetry framing, an alternative to the JSON sample stream for
+ * hosts that ask for it.  All multi-byte fields are little endian.
+ *
+ * Frame:
+ *   u8 TELEMETRY_FRAME_START
+ *   u16 payload length
+ *   payload
+ *   u32 CRC-32 of the payload
+ *
+ * The payload is either the RCB header (see log_format.h), which carries
+ * the channel meta and is only sent when the meta changes, an RCB record
+ * holding the tick, populated channel bitmap and raw values of a sample,
+ * or a delta record.  They are told apart by their first byte.
+ *
+ * Delta record:
+ *   u8 TELEMETRY_FRAME_DELTA_MARKER
+ *   u8 sequence, the number of records since the last RCB record
+ *   bit stream, most significant bit first, padded with 0 bits to a byte:
+ *     tick, as the change in the tick delta of the previous record:
+ *       '0' unchanged
+ *       '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits, '1111' + 32 bits
+ *     populated channel bitmap:
+ *       '0' same as the previous record
+ *       '1' + one bit per channel
+ *     per populated channel, the value XORed with the last value sent for
+ *     that channel.  32 bit values are zero extended to 64 bits.
+ *       '0' unchanged
+ *       '10' + the meaningful bits, if they fit the channel's last window
+ *       '11' + 6 bit leading zero count + 6 bit meaningful bit count - 1
+ *            + the meaningful bits, which become the channel's window
+ *
+ * Delta records only make sense following the RCB record that starts
+ * their sequence, the keyframe.  Readers that miss a record have to wait
+ * for the next keyframe.
+ *
+ * JSON never contains the start byte, so API replies may sit between
+ * frames.  Readers skip anything that isn't a frame with a good CRC.
+ */
+#define TELEMETRY_FRAME_START		0x00
+#define TELEMETRY_FRAME_HEADER_LEN	3
+#define TELEMETRY_FRAME_CRC_LEN		4
+#define TELEMETRY_FRAME_OVERHEAD	(TELEMETRY_FRAME_HEADER_LEN + \
+                                         TELEMETRY_FRAME_CRC_LEN)
+#define TELEMETRY_FRAME_MAX_PAYLOAD	UINT16_MAX
+#define TELEMETRY_FRAME_DELTA_MARKER	0xA6
+
+struct telemetry_delta_channel {
+        uint64_t bits;
+        uint8_t leading;
+        uint8_t meaningful;
+        bool populated;
+};
+
+/**
+ * What both ends of a delta encoded stream know about the records sent so
+ * far.  Each connection needs its own.
+ */
+struct telemetry_delta {
+        struct telemetry_delta_channel *channels;
+        size_t channel_count;
+        uint32_t tick;
+        int32_t tick_delta;
+        uint8_t sequence;
+        bool synced;
+};
+
+void telemetry_delta_init(struct telemetry_delta *td);
+
+/**
+ * Makes the next record a keyframe.  Call this whenever the other end may
+ * have lost track, like after a reconnect.
+ */
+void telemetry_delta_reset(struct telemetry_delta *td);
+
+void telemetry_delta_free(struct telemetry_delta *td);
+
+/**
+ * Writes a frame holding the channel meta of the sample.
+ * @return 0 on success, -1 if the meta doesn't fit in a frame.
+ */
+int telemetry_frame_meta(const struct log_format_writer *w,
+                         const struct sample *s);
+
+/**
+ * Writes a frame holding the values of all populated channels.
+ * @return 0 on success, -1 if the sample has no channel data.
+ */
+int telemetry_frame_sample(const struct log_format_writer *w,
+                           const struct sample *s, const uint32_t tick);
+
+/**
+ * Writes a delta record of the sample, or an RCB record when a keyframe
+ * is due.  Keyframes are sent after telemetry_delta_reset, when the
+ * channel count changes, and when the delta state can't be allocated.
+ * @return 0 on success, -1 if the sample has no channel data.
+ */
+int telemetry_frame_delta(const struct log_format_writer *w,
+                          struct telemetry_delta *td,
+                          const struct sample *s, const uint32_t tick);
+
+/**
+ * Extracts the payloads of all intact frames in a telemetry stream.
+ * Delta records are expanded back into RCB records, and those that can't
+ * be, having lost their keyframe, are dropped.  The concatenation of the
+ * payloads is an RCB log that log_format_rcb_to_csv can read.
+ * @param data The received stream.
+ * @param len The length of the stream.
+ * @param w Where to write the payloads.
+ * @return The number of frames found.
+ */
+int telemetry_frame_decode(const void *data, const size_t len,
+                           const struct log_format_writer *w);
+
+CPP_GUARD_END
+
+#endif /* _TELEMETRY_FRAME_H_ */
@@ -26,6 +26,7 @@
 #include "capabilities.h"
 #include "memory.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 CPP_GUARD_BEGIN
@@ -57,6 +58,12 @@ int flash_default_script();
 
 const char * getScript();
 
+/**
+ * @return true if the script reads CAN messages or sets the CAN filters
+ * itself, in which case the CAN filters are left to the script
+ */
+bool script_uses_can_rx(void);
+
 enum script_add_result flashScriptPage(unsigned int page, const char *data,
                                        enum script_add_mode mode);
 
@@ -36,6 +36,11 @@ int InitFS();
 int UnmountFS();
 bool sdcard_present();
 bool sdcard_fs_mounted(void);
+/**
+ * @return The number of times the file system has been mounted.  Lets
+ * callers know when anything they cached about the card is stale.
+ */
+unsigned int sdcard_mount_count(void);
 int OpenNextLogFile(FIL *f);
 void fs_lock(void);
 void fs_unlock(void);
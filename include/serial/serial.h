@@ -67,6 +67,14 @@ enum serial_log_type {
         SERIAL_LOG_TYPE_BINARY = 2,
 };
 
+/* How samples are streamed out when telemetry runs over a Serial device */
+enum serial_telemetry_format {
+        SERIAL_TELEMETRY_FORMAT_JSON   = 0,
+        SERIAL_TELEMETRY_FORMAT_BINARY = 1,
+        /* Binary, with samples delta encoded against the previous one */
+        SERIAL_TELEMETRY_FORMAT_DELTA  = 2,
+};
+
 struct Serial;
 
 void serial_destroy(struct Serial *s);
@@ -93,6 +101,17 @@ void serial_flush(struct Serial *s);
 enum serial_log_type serial_logging(struct Serial *s,
                                     const enum serial_log_type type);
 
+void serial_set_telemetry_format(struct Serial *s,
+                                 const enum serial_telemetry_format fmt);
+
+enum serial_telemetry_format serial_get_telemetry_format(const struct Serial *s);
+
+/**
+ * @return true if the telemetry format was set since the last call.  The
+ * other end starts over when it picks a format, even the one it had.
+ */
+bool serial_telemetry_restarted(struct Serial *s);
+
 void serial_set_name(struct Serial *s, const char *name);
 
 const char* serial_get_name(struct Serial *s);
@@ -110,6 +129,9 @@ int serial_read_c(struct Serial *s, char* c);
 
 int serial_read_byte(struct Serial *serial, uint8_t *b, const size_t delay);
 
+int serial_read_buff_wait(struct Serial *s, char *buf, const size_t len,
+                          const size_t delay);
+
 int serial_read_line(struct Serial *s, char *l, const size_t len);
 
 int serial_read_line_wait(struct Serial *s, char *l, const size_t len,
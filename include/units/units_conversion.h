@@ -22,6 +22,10 @@
 #ifndef UNITS_CONVERSION_H_
 #define UNITS_CONVERSION_H_
 
+#include "cpp_guard.h"
+
+CPP_GUARD_BEGIN
+
 #define UNITS_CONVERSION_COUNT 19
 
 enum unit_conversions {
@@ -70,4 +74,17 @@ enum unit_conversions {
  **/
 float convert_units(enum unit_conversions id, const float value);
 
+/**
+ * Get the units conversion for the specified units conversion id as the
+ * linear function value * scale + offset, so it can be folded into other
+ * linear transforms
+ * @param id the units conversion id
+ * @param scale set to the conversion's scale; 1 if the id is not a valid conversion id
+ * @param offset set to the conversion's offset; 0 if the id is not a valid conversion id
+ **/
+void units_conversion_linear(enum unit_conversions id, float *scale,
+                             float *offset);
+
+CPP_GUARD_END
+
 #endif /* UNITS_CONVERSION_H_ */
@@ -0,0 +1,54 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+#include "cpp_guard.h"
+#include <stddef.h>
+#include <stdint.h>
+
+CPP_GUARD_BEGIN
+
+#define CRC32_INIT	0xFFFFFFFFU
+
+/**
+ * Updates a running CRC-32 (IEEE 802.3) with more data.  Start with
+ * CRC32_INIT and pass the result through crc32_final when done.
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+static inline uint32_t crc32_final(const uint32_t crc)
+{
+        return ~crc;
+}
+
+/**
+ * @return The CRC-32 of a single block of data.
+ */
+static inline uint32_t crc32(const void *data, const size_t len)
+{
+        return crc32_final(crc32_update(CRC32_INIT, data, len));
+}
+
+CPP_GUARD_END
+
+#endif /* _CRC32_H_ */
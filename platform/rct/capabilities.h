@@ -44,6 +44,7 @@
 #define CAN_CHANNELS	            1
 #define CAN_SW_TERMINATION          false
 #define CAN_MAPPINGS                10
+#define CAN_FILTERS                 14
 #define OBD2_CHANNELS               10
 
 //Wireless connections
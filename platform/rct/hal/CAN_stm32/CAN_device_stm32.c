@@ -213,11 +213,18 @@ int CAN_device_set_filter(const uint8_t channel, const uint8_t id, const uint8_t
 	CAN_FilterInitStructure.CAN_FilterActivation =
 		enabled ? ENABLE : DISABLE;
 
+	/*
+	 * The low half holds the rest of an extended ID and the IDE bit.
+	 * Only match on the frame type when matching on the ID at all.
+	 */
 	const size_t shift = extended ? 3 : 21;
-	CAN_FilterInitStructure.CAN_FilterIdHigh = (filter << shift) >> 16;
-	CAN_FilterInitStructure.CAN_FilterMaskIdHigh = (mask << shift) >> 16;
-	CAN_FilterInitStructure.CAN_FilterIdLow = (uint16_t) filter;
-	CAN_FilterInitStructure.CAN_FilterMaskIdLow = (uint16_t) mask;
+	const uint32_t filter_reg = filter << shift |
+		(extended ? CAN_ID_EXT : CAN_ID_STD);
+	const uint32_t mask_reg = mask << shift | (mask ? CAN_ID_EXT : 0);
+	CAN_FilterInitStructure.CAN_FilterIdHigh = filter_reg >> 16;
+	CAN_FilterInitStructure.CAN_FilterMaskIdHigh = mask_reg >> 16;
+	CAN_FilterInitStructure.CAN_FilterIdLow = (uint16_t) filter_reg;
+	CAN_FilterInitStructure.CAN_FilterMaskIdLow = (uint16_t) mask_reg;
 
 	CAN_FilterInit(&CAN_FilterInitStructure);
 
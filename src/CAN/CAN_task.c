@@ -35,6 +35,7 @@
 #include "capabilities.h"
 #include "can_mapping.h"
 #include "can_channels.h"
+#include "can_filters.h"
 #include "CAN_aux_queue.h"
 #include "CAN_dispatcher.h"
 
@@ -63,6 +64,8 @@ static void CAN_task(void *parameters)
                 enabled_mapping_count = success ? new_enabled_mapping_count : 0;
                 if (!success)
                         pr_error_int_msg("Failed to create buffer for CAN channels; size ", new_enabled_mapping_count);
+                else if (!CAN_init_mapping_index(ccc, enabled_mapping_count))
+                        pr_warning("Failed to index CAN channels\r\n");
 
                 uint16_t new_enabled_obd2_pids_count = oc->enabledPids;
                 success = OBD2_init_current_values(oc);
@@ -70,6 +73,8 @@ static void CAN_task(void *parameters)
                 if (!success)
                         pr_error_int_msg("Failed to create buffer for OBD2 channels; size ", new_enabled_obd2_pids_count);
 
+                CAN_update_filters(ccc, enabled_mapping_count, oc);
+
                 while(! (CAN_is_state_stale() || OBD2_is_state_stale())) {
                         CAN_msg msg;
                         int result = CAN_rx_msg(&msg, CAN_RX_DELAY );
@@ -26,12 +26,43 @@
 #include "printk.h"
 #include <string.h>
 
+#define INDEX_NONE      UINT16_MAX
+
+/*
+ * Index of the CAN mappings by (bus, CAN ID, sub ID), so a frame only
+ * visits the mappings that can match it instead of every mapping, along
+ * with the mappings compiled into extractors.
+ * Mappings sharing a key are chained through next[].  Masked and
+ * wildcard mappings can't be keyed by the frame ID, so they are chained
+ * from fallback and checked against every frame.
+ */
+struct CANMappingIndex {
+        /* the configuration and mapping count the index was built for */
+        const CANChannelConfig *cfg;
+        uint16_t count;
+
+        /* open addressing table holding the first mapping of each key */
+        uint16_t *slots;
+        size_t slot_mask;
+
+        /* the next mapping with the same key, per mapping */
+        uint16_t *next;
+
+        /* the compiled form of each mapping */
+        struct canmapping_extractor *extractors;
+
+        /* the first masked or wildcard mapping */
+        uint16_t fallback;
+};
 
 /* manages the running state of the CAN channels*/
 struct CANState {
         /* CAN bus channels current channel values */
         float * CAN_current_values;
 
+        /* index of the enabled mappings */
+        struct CANMappingIndex index;
+
         /* flag to indicate if state is stale */
         bool stale;
 };
@@ -78,8 +109,140 @@ void CAN_set_current_channel_value(int index, float value)
         can_state.CAN_current_values[index] = value;
 }
 
+static bool is_exact_mapping(const CANMapping *mapping)
+{
+        return mapping->can_id != 0 &&
+                (mapping->can_mask == 0 || mapping->can_mask == UINT32_MAX);
+}
+
+/* canmapping_match_id takes any negative sub ID as none */
+static int8_t index_sub_id(const int8_t sub_id)
+{
+        return sub_id < 0 ? -1 : sub_id;
+}
+
+static size_t index_hash(const uint8_t bus, const uint32_t can_id,
+                         const int8_t sub_id)
+{
+        const uint32_t key = can_id ^ (uint32_t) bus << 29 ^
+                (uint32_t) (uint8_t) sub_id << 21;
+        return key * 2654435761U >> 16;
+}
+
+/**
+ * Finds the slot for a key, which is either the slot already holding
+ * the key or the empty slot it would go in.
+ */
+static uint16_t* index_find(const struct CANMappingIndex *index,
+                            const uint8_t bus, const uint32_t can_id,
+                            const int8_t sub_id)
+{
+        size_t i = index_hash(bus, can_id, sub_id);
+
+        for (;; ++i) {
+                uint16_t *slot = &index->slots[i & index->slot_mask];
+                if (*slot == INDEX_NONE)
+                        return slot;
+
+                const CANMapping *mapping =
+                        &index->cfg->can_channels[*slot].mapping;
+                if (mapping->can_channel == bus &&
+                    mapping->can_id == can_id &&
+                    index_sub_id(mapping->sub_id) == sub_id)
+                        return slot;
+        }
+}
+
+bool CAN_init_mapping_index(const CANChannelConfig *cfg, uint16_t count)
+{
+        struct CANMappingIndex *index = &can_state.index;
+
+        if (index->extractors != NULL)
+                portFree(index->extractors);
+        memset(index, 0, sizeof(*index));
+
+        /* Keep the table at most half full so probes stay short */
+        size_t slot_count = 4;
+        while (slot_count < 2 * count)
+                slot_count <<= 1;
+
+        const size_t count_alloc = MAX(1, count);
+        struct canmapping_extractor *extractors =
+                portMalloc(sizeof(struct canmapping_extractor[count_alloc]) +
+                           sizeof(uint16_t[slot_count + count_alloc]));
+        if (!extractors)
+                return false;
+
+        uint16_t *slots = (uint16_t *) (extractors + count_alloc);
+        memset(slots, 0xff, sizeof(uint16_t[slot_count]));
+        index->cfg = cfg;
+        index->extractors = extractors;
+        index->slots = slots;
+        index->slot_mask = slot_count - 1;
+        index->next = slots + slot_count;
+        index->fallback = INDEX_NONE;
+
+        /* Go backwards so every chain ends up in mapping order */
+        for (size_t i = count; i-- > 0;) {
+                const CANMapping *mapping = &cfg->can_channels[i].mapping;
+                uint16_t *head = &index->fallback;
+
+                if (is_exact_mapping(mapping))
+                        head = index_find(index, mapping->can_channel,
+                                          mapping->can_id,
+                                          index_sub_id(mapping->sub_id));
+
+                index->next[i] = *head;
+                *head = i;
+                canmapping_compile(&extractors[i], mapping);
+        }
+
+        index->count = count;
+        return true;
+}
+
+static void update_can_chain(const CAN_msg *msg, const CANChannelConfig *cfg,
+                             uint16_t i)
+{
+        const struct CANMappingIndex *index = &can_state.index;
+
+        for (; i != INDEX_NONE; i = index->next[i]) {
+                const CANMapping *mapping = &cfg->can_channels[i].mapping;
+
+                if (msg->can_bus != mapping->can_channel ||
+                    !canmapping_match_id(msg, mapping))
+                        continue;
+
+                const float value = canmapping_extract(&index->extractors[i],
+                                                       msg->data64);
+                CAN_set_current_channel_value(i, value);
+        }
+}
+
 void update_can_channels(CAN_msg *msg, CANChannelConfig *cfg, uint16_t enabled_mapping_count)
 {
+        const struct CANMappingIndex *index = &can_state.index;
+
+        /*
+         * The index is rebuilt once the CAN task picks up the new config,
+         * so until then scan the mappings as given.
+         */
+        if (index->slots && index->cfg == cfg &&
+            index->count == enabled_mapping_count && !can_state.stale) {
+                const uint8_t bus = msg->can_bus;
+                const uint32_t can_id = msg->addressValue;
+
+                /* A sub ID only ever matches a first data byte <= 127 */
+                if (msg->data[0] <= INT8_MAX)
+                        update_can_chain(msg, cfg,
+                                         *index_find(index, bus, can_id,
+                                                     msg->data[0]));
+
+                update_can_chain(msg, cfg, *index_find(index, bus, can_id, -1));
+                update_can_chain(msg, cfg, index->fallback);
+                return;
+        }
+
         for (size_t i = 0; i < enabled_mapping_count; i++) {
                 CANMapping *mapping = &cfg->can_channels[i].mapping;
 
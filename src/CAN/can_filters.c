@@ -0,0 +1,300 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "CAN.h"
+#include "OBD2.h"
+#include "can_filters.h"
+#include "capabilities.h"
+#include "luaScript.h"
+#include "mem_mang.h"
+#include "printk.h"
+#include "shiftx_drv.h"
+
+#define _LOG_PFX "[CAN_filters] "
+
+static uint32_t id_mask(const bool extended)
+{
+        return extended ? CAN_EXT_ID_MASK : CAN_STD_ID_MASK;
+}
+
+/**
+ * @return the number of IDs the filter accepts
+ */
+static uint64_t accepted_ids(const struct can_filter *f)
+{
+        const uint32_t all = id_mask(f->extended);
+        return 1ULL << (__builtin_popcount(all) -
+                        __builtin_popcount(f->mask & all));
+}
+
+/**
+ * @return true if every frame b accepts is accepted by a
+ */
+static bool covers(const struct can_filter *a, const struct can_filter *b)
+{
+        return a->extended == b->extended &&
+                !(a->mask & ~b->mask) &&
+                !((a->id ^ b->id) & a->mask);
+}
+
+/**
+ * @return the narrowest filter accepting every frame a or b accepts
+ */
+static struct can_filter merge(const struct can_filter *a,
+                               const struct can_filter *b)
+{
+        const uint32_t mask = a->mask & b->mask & ~(a->id ^ b->id);
+        const struct can_filter f = {
+                .id = a->id & mask,
+                .mask = mask,
+                .extended = a->extended,
+        };
+        return f;
+}
+
+/**
+ * Drops the filters covered by filters[keep].
+ * @return the number of filters left
+ */
+static size_t drop_covered(struct can_filter *filters, size_t count,
+                           size_t *keep)
+{
+        for (size_t i = 0; i < count;) {
+                if (i == *keep || !covers(&filters[*keep], &filters[i])) {
+                        ++i;
+                        continue;
+                }
+
+                filters[i] = filters[--count];
+                if (count == *keep)
+                        *keep = i;
+        }
+
+        return count;
+}
+
+int can_filters_cover(struct can_filter *filters, size_t count,
+                      size_t max_filters)
+{
+        for (size_t i = 0; i < count; ++i) {
+                /* Keep hold of i; drop_covered may move it */
+                size_t keep = i;
+                count = drop_covered(filters, count, &keep);
+        }
+
+        while (count > max_filters) {
+                size_t best_i = 0;
+                size_t best_j = 0;
+                int64_t best_cost = INT64_MAX;
+
+                for (size_t i = 0; i < count; ++i) {
+                        for (size_t j = i + 1; j < count; ++j) {
+                                if (filters[i].extended != filters[j].extended)
+                                        continue;
+
+                                const struct can_filter m =
+                                        merge(&filters[i], &filters[j]);
+                                const int64_t cost = accepted_ids(&m) -
+                                        accepted_ids(&filters[i]) -
+                                        accepted_ids(&filters[j]);
+                                if (cost < best_cost) {
+                                        best_cost = cost;
+                                        best_i = i;
+                                        best_j = j;
+                                }
+                        }
+                }
+
+                /* One filter per frame type and still too many */
+                if (best_cost == INT64_MAX)
+                        return -1;
+
+                filters[best_i] = merge(&filters[best_i], &filters[best_j]);
+                filters[best_j] = filters[--count];
+                if (count == best_i)
+                        best_i = best_j;
+
+                count = drop_covered(filters, count, &best_i);
+        }
+
+        return count;
+}
+
+static size_t add_filter(struct can_filter *filters, size_t count,
+                         const uint32_t id, const uint32_t mask,
+                         const bool extended)
+{
+        const struct can_filter f = {
+                .id = id,
+                .mask = mask & id_mask(extended),
+                .extended = extended,
+        };
+        filters[count] = f;
+        return count + 1;
+}
+
+/*
+ * Messages are matched on ID alone, whatever their frame type.  An
+ * unmasked ID that fits in 11 bits is taken to be a standard frame.
+ * Otherwise a filter is added for each frame type the ID could match.
+ */
+static size_t add_id(struct can_filter *filters, size_t count,
+                     const uint32_t id, uint32_t mask)
+{
+        const bool exact = mask == 0 || mask == UINT32_MAX;
+        if (exact)
+                mask = UINT32_MAX;
+
+        /* Can never match */
+        if (id & ~mask)
+                return count;
+
+        if (!(id & ~CAN_STD_ID_MASK))
+                count = add_filter(filters, count, id, mask, false);
+
+        if (!(id & ~CAN_EXT_ID_MASK) && (!exact || id > CAN_STD_ID_MASK))
+                count = add_filter(filters, count, id, mask, true);
+
+        return count;
+}
+
+static bool obd2_uses_bus(const uint8_t bus, const OBD2Config *oc)
+{
+        if (!oc->enabled)
+                return false;
+
+        for (size_t i = 0; i < oc->enabledPids; ++i) {
+                if (oc->pids[i].mapping.can_channel == bus)
+                        return true;
+        }
+
+        return false;
+}
+
+int CAN_plan_filters(uint8_t bus, const CANChannelConfig *ccc,
+                     uint16_t mapping_count, const OBD2Config *oc,
+                     struct can_filter *filters, size_t max_filters)
+{
+        size_t count = 0;
+
+        if (ccc->enabled) {
+                for (size_t i = 0; i < mapping_count; ++i) {
+                        const CANMapping *mapping = &ccc->can_channels[i].mapping;
+                        if (mapping->can_channel != bus)
+                                continue;
+
+                        /* Wildcard */
+                        if (mapping->can_id == 0)
+                                return -1;
+
+                        count = add_id(filters, count, mapping->can_id,
+                                       mapping->can_mask);
+                }
+        }
+
+        if (obd2_uses_bus(bus, oc)) {
+                count = add_id(filters, count, OBD2_11BIT_PID_RESPONSE, 0);
+                count = add_id(filters, count, OBD2_29BIT_PID_RESPONSE, 0);
+        }
+
+        if (shiftx_get_config()->can_bus == bus) {
+                uint32_t ids[SHIFTX_RX_CAN_IDS];
+                shiftx_get_rx_can_ids(ids);
+                for (size_t i = 0; i < SHIFTX_RX_CAN_IDS; ++i)
+                        count = add_id(filters, count, ids[i], 0);
+        }
+
+        return can_filters_cover(filters, count, max_filters);
+}
+
+/* Buses whose filters are the ones we planned, rather than accept all */
+static bool g_planned[CAN_CHANNELS];
+
+static void accept_all(const uint8_t bus)
+{
+        /* Filter 0 accepts all */
+        CAN_set_filter(bus, 0, 1, 0, 0, true);
+        for (size_t i = 1; i < CAN_FILTERS; ++i)
+                CAN_set_filter(bus, i, 0, 0, 0, false);
+
+        g_planned[bus] = false;
+}
+
+#if LUA_SUPPORT
+int CAN_set_script_filter(const uint8_t bus, const uint8_t id,
+                          const uint8_t extended, const uint32_t filter,
+                          const uint32_t mask, const bool enabled)
+{
+        if (bus < CAN_CHANNELS)
+                g_planned[bus] = false;
+
+        return CAN_set_filter(bus, id, extended, filter, mask, enabled);
+}
+#endif
+
+void CAN_update_filters(const CANChannelConfig *ccc, uint16_t mapping_count,
+                        const OBD2Config *oc)
+{
+#if LUA_SUPPORT
+        /*
+         * The script wants to see the raw bus, or filter it itself, so its
+         * filters are left alone.  Filters we planned before it came along
+         * would hide frames from it though.
+         */
+        if (script_uses_can_rx()) {
+                for (uint8_t bus = 0; bus < CAN_CHANNELS; ++bus) {
+                        if (g_planned[bus])
+                                accept_all(bus);
+                }
+                return;
+        }
+#endif
+        struct can_filter *filters =
+                portMalloc(sizeof(struct can_filter[2 * mapping_count + 4]));
+        if (!filters)
+                pr_warning(_LOG_PFX "Failed to plan CAN filters\r\n");
+
+        for (uint8_t bus = 0; bus < CAN_CHANNELS; ++bus) {
+                const int count = filters == NULL ? -1 :
+                        CAN_plan_filters(bus, ccc, mapping_count, oc,
+                                         filters, CAN_FILTERS);
+
+                if (count < 0) {
+                        accept_all(bus);
+                        continue;
+                }
+
+                pr_info_int_msg(_LOG_PFX "Hardware filters: ", count);
+                for (size_t i = 0; i < CAN_FILTERS; ++i) {
+                        if (i < (size_t) count)
+                                CAN_set_filter(bus, i, filters[i].extended,
+                                               filters[i].id,
+                                               filters[i].mask, true);
+                        else
+                                CAN_set_filter(bus, i, 0, 0, 0, false);
+                }
+                g_planned[bus] = true;
+        }
+
+        if (filters)
+                portFree(filters);
+}
@@ -22,6 +22,7 @@
 #include "byteswap.h"
 #include "units_conversion.h"
 #include "panic.h"
+#include <string.h>
 
 float canmapping_extract_value(uint64_t raw_data, const CANMapping *mapping)
 {
@@ -114,3 +115,84 @@ bool canmapping_map_value(float *value, const CAN_msg *can_msg, const CANMapping
         *value = convert_units(mapping->conversion_filter_id, *value);
         return true;
 }
+
+void canmapping_compile(struct canmapping_extractor *extractor, const CANMapping *mapping)
+{
+        uint8_t offset = mapping->offset;
+        uint8_t length = mapping->length;
+        if (! mapping->bit_mode) {
+                length *= 8;
+                offset *= 8;
+        }
+
+        memset(extractor, 0, sizeof(*extractor));
+        extractor->type = mapping->type;
+
+        /* Values are at most 32 bits and have to fit in the message */
+        if (length == 0 || offset + length > 64)
+                length = 0;
+        else if (length > 32)
+                length = 32;
+
+        if (length) {
+                extractor->shift = 64 - offset - length;
+                extractor->mask = UINT32_MAX >> (32 - length);
+        }
+
+        /* the same widths swap_uint_length swaps */
+        if (!mapping->big_endian && length > 8)
+                extractor->swap_bits = length <= 16 ? 16 : length <= 24 ? 24 : 32;
+
+        switch (mapping->type) {
+        case CANMappingType_signed:
+                extractor->sign = length <= 8 ? 24 : length <= 16 ? 16 : 0;
+                break;
+        case CANMappingType_sign_magnitude:
+                extractor->sign = length ? length - 1 : 0;
+                break;
+        default:
+                break;
+        }
+
+        float scale = mapping->multiplier;
+        if (mapping->divider)
+                scale /= mapping->divider;
+
+        float units_scale, units_offset;
+        units_conversion_linear(mapping->conversion_filter_id, &units_scale,
+                                &units_offset);
+        extractor->scale = scale * units_scale;
+        extractor->offset = mapping->adder * units_scale + units_offset;
+}
+
+float canmapping_extract(const struct canmapping_extractor *extractor, uint64_t raw_data)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        raw_data = __builtin_bswap64(raw_data);
+#endif
+        uint32_t raw_value = (raw_data >> extractor->shift) & extractor->mask;
+
+        if (extractor->swap_bits)
+                raw_value = __builtin_bswap32(raw_value) >> (32 - extractor->swap_bits);
+
+        float value;
+        switch (extractor->type) {
+        case CANMappingType_signed:
+                value = (float)((int32_t)(raw_value << extractor->sign) >> extractor->sign);
+                break;
+        case CANMappingType_IEEE754:
+                memcpy(&value, &raw_value, sizeof(value));
+                break;
+        case CANMappingType_sign_magnitude:
+        {
+                const uint32_t sign = 1UL << extractor->sign;
+                value = raw_value < sign ? (float)raw_value : -(float)(raw_value & (sign - 1));
+                break;
+        }
+        default:
+                value = (float)raw_value;
+                break;
+        }
+
+        return value * extractor->scale + extractor->offset;
+}
@@ -32,9 +32,6 @@
 #include "can_mapping.h"
 
 #define _LOG_PFX                        "[OBD2] "
-#define OBD2_11BIT_PID_RESPONSE         0x7E8
-#define OBD2_29BIT_PID_RESPONSE         0x18DAF110
-
 #define OBD2_11BIT_PID_REQUEST          0x7DF
 #define OBD2_29BIT_PID_REQUEST          0x18DB33F1
 
@@ -45,8 +42,19 @@
 #define OBD2_MODE_O2_SENSOR_MONITOR   0x05
 #define OBD2_MODE_BODY_INFO             0x09
 #define OBD2_MODE_ENHANCED_DATA         0x22
+#define OBD2_NEGATIVE_RESPONSE          0x7F
 #define OBD2_TIMEOUT_DISABLE_THRESHOLD  10
 
+/* ISO 15765-2 (ISO-TP) framing of the responses to batched requests */
+#define OBD2_11BIT_FLOW_CONTROL         0x7E0
+#define OBD2_29BIT_FLOW_CONTROL         0x18DA10F1
+#define ISOTP_FRAME_TYPE_MASK           0xF0
+#define ISOTP_SINGLE_FRAME              0x00
+#define ISOTP_FIRST_FRAME               0x10
+#define ISOTP_CONSECUTIVE_FRAME         0x20
+#define ISOTP_FLOW_CONTROL_CTS          0x30
+#define ISOTP_MAX_LEN                   64
+
 enum obd2_channel_status {
         OBD2_CHANNEL_STATUS_NO_DATA = 0,
         OBD2_CHANNEL_STATUS_DATA_RECEIVED,
@@ -66,26 +74,72 @@ struct OBD2ChannelState {
         /* PID associated with OBD2 channel */
         uint16_t pid;
 
+        /* latency in ms of the last response for this channel */
+        uint16_t latency;
+
         /* number of timeouts seen on this channel */
         uint8_t timeout_count;
 
+        /* left out of a batched response, so only ever requested singly */
+        bool unbatched;
+
         /* indicates status of channel */
         enum obd2_channel_status channel_status;
 };
 
+/* a PID request waiting for its response */
+struct OBD2Request {
+        /* the indexes of the PIDs requested; more than one for a batch */
+        uint16_t pid_indexes[OBD2_MAX_BATCH_PIDS];
+        uint8_t pid_count;
+
+        /* when the request was sent, for determining OBD2 query timeouts */
+        size_t timestamp;
+};
+
+/* reassembles a multi-frame response to a batched request */
+struct OBD2Transfer {
+        uint8_t data[ISOTP_MAX_LEN];
+        uint8_t len;
+        uint8_t received;
+
+        /* the sequence number of the next consecutive frame */
+        uint8_t sequence;
+        bool active;
+};
+
 /* manages the running state of OBD2 queries */
 struct OBD2State {
         /* points to a dynamically created array of OBD2ChannelState structs */
         struct OBD2ChannelState * current_channel_states;
 
-        /* holds the last query timestamp, for determining OBD2 query timeouts */
+        /* the requests waiting for a response, oldest first */
+        struct OBD2Request in_flight[OBD2_MAX_IN_FLIGHT];
+        uint8_t in_flight_count;
+
+        /* the number of requests allowed to wait for a response at once */
+        uint8_t max_in_flight;
+
+        /* mode 01 PIDs that are due together are sent in a single request */
+        bool batching;
+
+        /* set once the ECU fails a batched request; we fall back to single PIDs */
+        bool batching_rejected;
+
+        struct OBD2Transfer transfer;
+
+        /* holds the timestamp of the last OBDII request */
         size_t last_obd2_query_timestamp;
 
         /* holds the timestamp of the last OBDII response */
         size_t last_obd2_response_timestamp;
 
-        /* the index of the current OBD2 PID we're querying */
-        uint16_t current_obd2_pid_index;
+        /* responses counted towards pid_rate since pid_rate_timestamp */
+        uint16_t response_count;
+        size_t pid_rate_timestamp;
+
+        /* responses per second, over the last second */
+        uint16_t pid_rate;
 
         /**
          * the max sample rate across all of the channels;
@@ -130,7 +184,9 @@ struct OBD2State {
 
 };
 
-static struct OBD2State obd2_state = {0};
+static struct OBD2State obd2_state = {
+        .max_in_flight = OBD2_DEFAULT_IN_FLIGHT,
+};
 
 
 void OBD2_state_stale(void)
@@ -186,6 +242,80 @@ static int OBD2_request_PID(uint8_t bus, uint32_t pid, uint8_t mode, bool is_29_
         return CAN_tx_msg(bus, &msg, timeout);
 }
 
+/**
+ * Sends a mode 01 request for several PIDs in one frame.
+ * @param the CAN bus to use
+ * @param pids the OBD2 PIDs to request
+ * @param count the number of PIDs, up to OBD2_MAX_BATCH_PIDS
+ * @param timeout the timeout in ms for sending the OBD2 request
+ */
+static int OBD2_request_PIDs(uint8_t bus, const uint8_t *pids, uint8_t count, bool is_29_bit, size_t timeout)
+{
+        CAN_msg msg;
+        msg.addressValue = is_29_bit ? OBD2_29BIT_PID_REQUEST : OBD2_11BIT_PID_REQUEST;
+        memset(msg.data, 0x55, sizeof(msg.data));
+        msg.data[0] = count + 1;
+        msg.data[1] = OBD2_MODE_SHOW_CURRENT_DATA;
+        memcpy(msg.data + 2, pids, count);
+        msg.dataLength = 8;
+        msg.isExtendedAddress = is_29_bit;
+        return CAN_tx_msg(bus, &msg, timeout);
+}
+
+/**
+ * Tells the ECU to send the rest of a multi-frame response without waiting.
+ */
+static void OBD2_send_flow_control(const CAN_msg *response)
+{
+        CAN_msg msg;
+        msg.addressValue = response->isExtendedAddress ? OBD2_29BIT_FLOW_CONTROL : OBD2_11BIT_FLOW_CONTROL;
+        memset(msg.data, 0x55, sizeof(msg.data));
+        /* no block size limit, no separation time */
+        msg.data[0] = ISOTP_FLOW_CONTROL_CTS;
+        msg.data[1] = 0;
+        msg.data[2] = 0;
+        msg.dataLength = 8;
+        msg.isExtendedAddress = response->isExtendedAddress;
+        CAN_tx_msg(response->can_bus, &msg, OBD2_PID_REQUEST_TIMEOUT_MS);
+}
+
+/* Data bytes in the response to each standard mode 01 PID, 0 if unknown */
+static const uint8_t mode1_pid_lengths[] = {
+        4, 4, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, /* 0x00 */
+        2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, /* 0x10 */
+        4, 2, 2, 2, 4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1, 1, /* 0x20 */
+        1, 2, 2, 1, 4, 4, 4, 4, 4, 4, 4, 4, 2, 2, 2, 2, /* 0x30 */
+        4, 4, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 4, /* 0x40 */
+        4, 1, 1, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 1, /* 0x50 */
+        4, 1, 1, 2, 5,                                  /* 0x60 */
+};
+
+static uint8_t mode1_pid_length(uint32_t pid)
+{
+        return pid < sizeof(mode1_pid_lengths) ? mode1_pid_lengths[pid] : 0;
+}
+
+/**
+ * @return true if the PID can share a request with other PIDs.  We must
+ * know the length of its data to split up the response.
+ */
+static bool is_batchable(const OBD2Config *obd2_config, size_t pid_index)
+{
+        const PidConfig *pid_cfg = &obd2_config->pids[pid_index];
+        return pid_cfg->mode == OBD2_MODE_SHOW_CURRENT_DATA &&
+                !pid_cfg->passive && mode1_pid_length(pid_cfg->pid) &&
+                !obd2_state.current_channel_states[pid_index].unbatched;
+}
+
+/**
+ * Only batch once the ECU has answered, so a batch that goes unanswered
+ * can be blamed on the batching.
+ */
+static bool is_batching(void)
+{
+        return obd2_state.batching && !obd2_state.batching_rejected && obd2_state.is_active;
+}
+
 bool OBD2_init_current_values(OBD2Config *obd2_config)
 {
         pr_info(_LOG_PFX "Init current values\r\n");
@@ -196,8 +326,14 @@ bool OBD2_init_current_values(OBD2Config *obd2_config)
                 portFree(obd2_state.current_channel_states);
 
         /* start the querying from the first PID */
-        obd2_state.current_obd2_pid_index = 0;
+        obd2_state.in_flight_count = 0;
+        obd2_state.batching_rejected = false;
+        obd2_state.transfer.active = false;
         obd2_state.last_obd2_query_timestamp = 0;
+        obd2_state.last_obd2_response_timestamp = 0;
+        obd2_state.response_count = 0;
+        obd2_state.pid_rate_timestamp = getCurrentTicks();
+        obd2_state.pid_rate = 0;
         obd2_state.squelched_count = 0;
         obd2_state.query_latency = 0;
         obd2_state.is_active = false;
@@ -236,6 +372,9 @@ bool OBD2_init_current_values(OBD2Config *obd2_config)
                 state->pid = obd2_config->pids[i].pid;
                 state->channel_status = OBD2_CHANNEL_STATUS_NO_DATA;
                 state->timeout_count = 0;
+                state->sequencer_count = 0;
+                state->unbatched = false;
+                state->latency = 0;
                 state->current_value = 0.0;
         }
 
@@ -258,54 +397,107 @@ void OBD2_set_current_channel_value(int index, float value)
         obd2_state.current_channel_states[index].current_value = value;
 }
 
-void sequence_next_obd2_query(OBD2Config * obd2_config, uint16_t enabled_obd2_pids_count)
+/**
+ * Handles a PID request that timed out.
+ * @return true if nothing has answered yet and the other OBDII bit mode
+ * should be tried
+ */
+static bool handle_obd2_timeout(struct OBD2ChannelState *state)
 {
-        /* no PIDs, no query... */
-        if (enabled_obd2_pids_count == 0)
-                return;
+        pr_debug_int_msg(_LOG_PFX "Timeout requesting PID ", state->pid);
 
-        bool is_obd2_timeout = obd2_state.last_obd2_query_timestamp > 0 &&
-                               isTimeoutMs(obd2_state.last_obd2_query_timestamp, OBD2_PID_DEFAULT_TIMEOUT_MS);
-
-        size_t current_pid_index = obd2_state.current_obd2_pid_index;
-
-        if (is_obd2_timeout) {
-                /* check for timeout and squelch current PID if needed */
-                struct OBD2ChannelState *state = &obd2_state.current_channel_states[current_pid_index];
-                pr_debug_int_msg(_LOG_PFX "Timeout requesting PID ", state->pid);
-
-                /* only start counting timeouts if we've ever received data */
-                if (obd2_state.is_active) {
-                        state->timeout_count++;
-                        if (state->timeout_count >= OBD2_TIMEOUT_DISABLE_THRESHOLD) {
-                                state->channel_status = OBD2_CHANNEL_STATUS_SQUELCHED;
-                                pr_info_int_msg(_LOG_PFX "Excessive timeouts, squelching PID ", state->pid);
-                                obd2_state.squelched_count++;
-                                /**
-                                 * if all channels end up being squelched, then we should just reset OBD2 config
-                                 * This accounts for cases where there's a complete disconnect and a reset is needed
-                                 */
-                                if (obd2_state.squelched_count == obd2_state.channel_count) {
-                                        pr_info(_LOG_PFX "all channels timed out, resetting OBD2 state\r\n");
-                                        obd2_state.is_stale = true;
-                                }
-                        }
-                }
-                /*if we have timed out and we're not active, then we should try auto-detecting 29 or 11 bit OBDII */
-                else {
-                        obd2_state.is_29bit_obd2 = !obd2_state.is_29bit_obd2;
-                        pr_info_int_msg(_LOG_PFX "Trying OBDII bit mode ", obd2_state.is_29bit_obd2 ? 29 : 11);
+        /* only start counting timeouts if we've ever received data */
+        if (!obd2_state.is_active)
+                return true;
+
+        state->timeout_count++;
+        if (state->timeout_count >= OBD2_TIMEOUT_DISABLE_THRESHOLD &&
+            state->channel_status != OBD2_CHANNEL_STATUS_SQUELCHED) {
+                state->channel_status = OBD2_CHANNEL_STATUS_SQUELCHED;
+                pr_info_int_msg(_LOG_PFX "Excessive timeouts, squelching PID ", state->pid);
+                obd2_state.squelched_count++;
+                /**
+                 * if all channels end up being squelched, then we should just reset OBD2 config
+                 * This accounts for cases where there's a complete disconnect and a reset is needed
+                 */
+                if (obd2_state.squelched_count == obd2_state.channel_count) {
+                        pr_info(_LOG_PFX "all channels timed out, resetting OBD2 state\r\n");
+                        obd2_state.is_stale = true;
                 }
         }
+        return false;
+}
 
-        /* if a query is active and not timed out, exit now */
-        if (obd2_state.last_obd2_query_timestamp != 0 && !is_obd2_timeout)
-                return;
+static void remove_in_flight(size_t i)
+{
+        obd2_state.in_flight_count--;
+        memmove(&obd2_state.in_flight[i], &obd2_state.in_flight[i + 1],
+                sizeof(struct OBD2Request[obd2_state.in_flight_count - i]));
+}
 
-        /* Check for a configured delay */
-        if (obd2_state.last_obd2_response_timestamp && !isTimeoutMs(obd2_state.last_obd2_response_timestamp, obd2_state.pid_query_delay)) {
-                return;
+static int find_in_request(const struct OBD2Request *req, size_t pid_index)
+{
+        for (size_t i = 0; i < req->pid_count; i++) {
+                if (req->pid_indexes[i] == pid_index)
+                        return i;
         }
+        return -1;
+}
+
+static bool is_in_flight(size_t pid_index)
+{
+        for (size_t i = 0; i < obd2_state.in_flight_count; i++) {
+                if (find_in_request(&obd2_state.in_flight[i], pid_index) >= 0)
+                        return true;
+        }
+        return false;
+}
+
+static void reject_batching(void)
+{
+        pr_info(_LOG_PFX "ECU rejected batched PIDs, requesting PIDs singly\r\n");
+        obd2_state.batching_rejected = true;
+        obd2_state.transfer.active = false;
+}
+
+/**
+ * Drops the requests that timed out waiting for a response.
+ */
+static void expire_obd2_requests(void)
+{
+        bool toggle_bit_mode = false;
+
+        for (size_t i = 0; i < obd2_state.in_flight_count;) {
+                const struct OBD2Request *req = &obd2_state.in_flight[i];
+                if (!isTimeoutMs(req->timestamp, OBD2_PID_DEFAULT_TIMEOUT_MS)) {
+                        i++;
+                        continue;
+                }
+
+                if (req->pid_count > 1) {
+                        /* don't hold it against the PIDs, they get asked for singly from now on */
+                        reject_batching();
+                } else {
+                        struct OBD2ChannelState *state = &obd2_state.current_channel_states[req->pid_indexes[0]];
+                        toggle_bit_mode |= handle_obd2_timeout(state);
+                }
+                remove_in_flight(i);
+        }
+
+        /*if we have timed out and we're not active, then we should try auto-detecting 29 or 11 bit OBDII */
+        if (toggle_bit_mode) {
+                obd2_state.is_29bit_obd2 = !obd2_state.is_29bit_obd2;
+                pr_info_int_msg(_LOG_PFX "Trying OBDII bit mode ", obd2_state.is_29bit_obd2 ? 29 : 11);
+        }
+}
+
+/**
+ * Picks the PID to query next.  The sequencers only move on once a request
+ * actually goes out, see advance_obd2_sequencers.
+ * @return the PID index, or -1 if no PID is due
+ */
+static int select_next_obd2_pid(OBD2Config *obd2_config, uint16_t enabled_obd2_pids_count)
+{
         /**
          * Scheduler algorithm.  This updates a sequencer counter
          * based on the channel's sample rate.
@@ -327,9 +519,14 @@ void sequence_next_obd2_query(OBD2Config * obd2_config, uint16_t enabled_obd2_pi
          * Channel 1 is selected for PID querying approx. 1/50 the rate of channel 3
          * Channel 2 is selected for PID querying approx. 1/2 the rate of channel 3
          * Channel 3 is selected for PID querying approx. every time
+         *
+         * Counters advance once per request sent, not per pass, so
+         * passes that find every due PID in flight don't skew them.
+         * PIDs still waiting for a response keep counting, but can't be
+         * selected until the response arrives or times out.
          */
 
-        uint16_t highest_timeout_factor = 0;
+        uint32_t highest_timeout_factor = 0;
 
         /* tracks which PID should be scheduled next */
         int most_due_pid_index = -1;
@@ -340,87 +537,396 @@ void sequence_next_obd2_query(OBD2Config * obd2_config, uint16_t enabled_obd2_pi
                         /* if channel is squelched then skip */
                         continue;
 
-                uint16_t timeout = state->sequencer_count;
                 uint16_t sample_rate = decodeSampleRate(obd2_config->pids[i].mapping.channel_cfg.sampleRate);
-                timeout += sample_rate;
+                uint32_t timeout = state->sequencer_count + sample_rate;
 
                 /**
                  * select the channel if:
                  * 1. the timeout has reached the trigger point
                  * 2. the timeout has taken the longest amount of time to reach the trigger point */
-                uint16_t timeout_factor = timeout / sample_rate;
+                uint32_t timeout_factor = timeout / sample_rate;
+                if (timeout >= obd2_state.max_sample_rate && timeout_factor > highest_timeout_factor &&
+                    !is_in_flight(i)) {
+                        highest_timeout_factor = timeout_factor;
+                        most_due_pid_index = i;
+                }
+        }
+
+        return most_due_pid_index;
+}
+
+/**
+ * Moves the sequencers on for a request that went out.  The PIDs it asked
+ * for start over and every other PID gets closer to being due.
+ */
+static void advance_obd2_sequencers(OBD2Config *obd2_config, uint16_t enabled_obd2_pids_count,
+                                    const struct OBD2Request *req)
+{
+        for (size_t i = 0; i < enabled_obd2_pids_count; i++) {
+                struct OBD2ChannelState *state = &obd2_state.current_channel_states[i];
+                if (state->channel_status == OBD2_CHANNEL_STATUS_SQUELCHED)
+                        continue;
+
+                if (find_in_request(req, i) >= 0) {
+                        state->sequencer_count = 0;
+                        continue;
+                }
+
+                uint16_t sample_rate = decodeSampleRate(obd2_config->pids[i].mapping.channel_cfg.sampleRate);
+                state->sequencer_count = MIN((uint32_t) state->sequencer_count + sample_rate, UINT16_MAX);
+        }
+}
+
+/**
+ * Picks the most due PID that can join a batched request.  Only PIDs
+ * select_next_obd2_pid would also take on this pass are packed in.
+ * @return the PID index, or -1 if no PID is due
+ */
+static int select_batch_pid(OBD2Config *obd2_config, uint16_t enabled_obd2_pids_count,
+                            const struct OBD2Request *req)
+{
+        const uint8_t bus = obd2_config->pids[req->pid_indexes[0]].mapping.can_channel;
+        uint32_t highest_timeout_factor = 0;
+        int most_due_pid_index = -1;
+
+        for (size_t i = 0; i < enabled_obd2_pids_count; i++) {
+                struct OBD2ChannelState *state = &obd2_state.current_channel_states[i];
+                PidConfig *pid_cfg = &obd2_config->pids[i];
+
+                if (state->channel_status == OBD2_CHANNEL_STATUS_SQUELCHED ||
+                    !is_batchable(obd2_config, i) || pid_cfg->mapping.can_channel != bus ||
+                    find_in_request(req, i) >= 0 || is_in_flight(i))
+                        continue;
+
+                uint16_t sample_rate = decodeSampleRate(pid_cfg->mapping.channel_cfg.sampleRate);
+                uint32_t timeout = state->sequencer_count + sample_rate;
+                uint32_t timeout_factor = timeout / sample_rate;
                 if (timeout >= obd2_state.max_sample_rate && timeout_factor > highest_timeout_factor) {
                         highest_timeout_factor = timeout_factor;
                         most_due_pid_index = i;
                 }
-                state->sequencer_count = timeout;
         }
 
-        if (most_due_pid_index < 0)
-                /* no PID was selected, give up */
+        return most_due_pid_index;
+}
+
+static int send_obd2_request(OBD2Config *obd2_config, const struct OBD2Request *req)
+{
+        PidConfig *pid_cfg = &obd2_config->pids[req->pid_indexes[0]];
+        if (req->pid_count == 1)
+                return pid_cfg->passive || OBD2_request_PID(pid_cfg->mapping.can_channel, pid_cfg->pid, pid_cfg->mode, obd2_state.is_29bit_obd2, OBD2_PID_REQUEST_TIMEOUT_MS);
+
+        uint8_t pids[OBD2_MAX_BATCH_PIDS];
+        for (size_t i = 0; i < req->pid_count; i++)
+                pids[i] = obd2_config->pids[req->pid_indexes[i]].pid;
+
+        return OBD2_request_PIDs(pid_cfg->mapping.can_channel, pids, req->pid_count, obd2_state.is_29bit_obd2, OBD2_PID_REQUEST_TIMEOUT_MS);
+}
+
+static void update_pid_rate(void)
+{
+        const size_t elapsed = ticksToMs(getCurrentTicks() - obd2_state.pid_rate_timestamp);
+        if (elapsed < OBD2_PID_RATE_PERIOD_MS)
                 return;
 
-        current_pid_index = most_due_pid_index;
-        obd2_state.current_channel_states[current_pid_index].sequencer_count = 0;
+        obd2_state.pid_rate = obd2_state.response_count * 1000 / elapsed;
+        obd2_state.response_count = 0;
+        obd2_state.pid_rate_timestamp = getCurrentTicks();
+}
 
-        PidConfig * pid_cfg = &obd2_config->pids[current_pid_index];
-        int pid_request_result = pid_cfg->passive || OBD2_request_PID(pid_cfg->mapping.can_channel, pid_cfg->pid, pid_cfg->mode, obd2_state.is_29bit_obd2, OBD2_PID_REQUEST_TIMEOUT_MS);
-        if (pid_request_result) {
-                obd2_state.last_obd2_query_timestamp = getCurrentTicks();
-        } else {
-                pr_debug_int_msg("Timeout sending PID request ", pid_cfg->pid);
-        }
-        obd2_state.current_obd2_pid_index = current_pid_index;
+/*
+ * The configured delay counts from the last response.  Only with more than
+ * one request in flight, where responses no longer pace the queries, does
+ * it count from the last query as well.
+ */
+static bool is_query_delayed(void)
+{
+        const uint32_t delay = obd2_state.pid_query_delay;
+        if (!delay)
+                return false;
+
+        if (obd2_state.last_obd2_response_timestamp &&
+            !isTimeoutMs(obd2_state.last_obd2_response_timestamp, delay))
+                return true;
+
+        return obd2_state.max_in_flight > 1 &&
+                obd2_state.last_obd2_query_timestamp &&
+                !isTimeoutMs(obd2_state.last_obd2_query_timestamp, delay);
 }
 
-void update_obd2_channels(CAN_msg *msg, OBD2Config *cfg)
+void sequence_next_obd2_query(OBD2Config * obd2_config, uint16_t enabled_obd2_pids_count)
 {
-        uint16_t current_pid_index = obd2_state.current_obd2_pid_index;
-        PidConfig *pid_config = &cfg->pids[current_pid_index];
-        struct OBD2ChannelState *channel_state = &obd2_state.current_channel_states[current_pid_index];
+        /* no PIDs, no query... */
+        if (enabled_obd2_pids_count == 0)
+                return;
+
+        update_pid_rate();
+        expire_obd2_requests();
+
+        /* Keep the window of requests waiting for a response full */
+        while (obd2_state.in_flight_count < obd2_state.max_in_flight) {
+                if (is_query_delayed())
+                        return;
+
+                const int pid_index = select_next_obd2_pid(obd2_config, enabled_obd2_pids_count);
+                if (pid_index < 0)
+                        /* no PID was selected, give up */
+                        return;
+
+                struct OBD2Request *req = &obd2_state.in_flight[obd2_state.in_flight_count];
+                req->pid_indexes[0] = pid_index;
+                req->pid_count = 1;
+
+                /* Pack in the other PIDs that are due */
+                if (is_batching() && is_batchable(obd2_config, pid_index)) {
+                        while (req->pid_count < OBD2_MAX_BATCH_PIDS) {
+                                const int batch_index = select_batch_pid(obd2_config, enabled_obd2_pids_count, req);
+                                if (batch_index < 0)
+                                        break;
+                                req->pid_indexes[req->pid_count++] = batch_index;
+                        }
+                }
 
-        /* Did we get an OBDII PID we were waiting for? */
+                if (!send_obd2_request(obd2_config, req)) {
+                        pr_debug_int_msg("Timeout sending PID request ", obd2_config->pids[pid_index].pid);
+                        return;
+                }
+
+                advance_obd2_sequencers(obd2_config, enabled_obd2_pids_count, req);
+
+                const size_t now = getCurrentTicks();
+                req->timestamp = now;
+                obd2_state.in_flight_count++;
+                obd2_state.last_obd2_query_timestamp = now;
+        }
+}
 
+/**
+ * @return true if the CAN message is the response to a request for the PID
+ */
+static bool is_obd2_response(const CAN_msg *msg, const PidConfig *pid_config)
+{
         uint8_t mode = pid_config->mode;
 
-        /* valid OBD2 request timestamp? */
-        if (obd2_state.last_obd2_query_timestamp &&
+        /* does the returned mode + response offeset match the one expected in the query? */
+        if (msg->data[1] != mode + OBD2_MODE_RESPONSE_OFFSET)
+                return false;
+
+        return
+
+                /* does the 1 byte or 2 byte response match the query? enhanced mode = 2 byte PID*/
+                (msg->data[2] == pid_config->pid && msg->data[1] == OBD2_MODE_SHOW_CURRENT_DATA + OBD2_MODE_RESPONSE_OFFSET) ||
+
+                /* or does it match match on miscellaneous modes */
+                (mode == OBD2_MODE_REQUEST_TROUBLE_CODES) ||
+                (mode == OBD2_MODE_CLEAR_TROUBLE_CODES) ||
+                (mode == OBD2_MODE_O2_SENSOR_MONITOR) ||
+                (mode == OBD2_MODE_BODY_INFO) ||
+
+                /* otherwise account for special mode with multi-byte PIDs (e.g. 0x22) */
+                ((msg->data[2] * 256 + msg->data[3]) == pid_config->pid && msg->data[1] == mode + OBD2_MODE_RESPONSE_OFFSET);
+}
+
+/**
+ * Updates a channel from the response to its request.
+ */
+static void update_obd2_channel(size_t pid_index, const CAN_msg *msg, OBD2Config *cfg,
+                                const struct OBD2Request *req)
+{
+        PidConfig *pid_config = &cfg->pids[pid_index];
+        struct OBD2ChannelState *channel_state = &obd2_state.current_channel_states[pid_index];
+
+        float value;
+        bool result = canmapping_map_value(&value, msg, &pid_config->mapping);
+        if (result) {
+                OBD2_set_current_channel_value(pid_index, value);
+                channel_state->channel_status = OBD2_CHANNEL_STATUS_DATA_RECEIVED;
+                channel_state->timeout_count = 0;
+        }
+        /* Save our latency */
+        const size_t now = getCurrentTicks();
+        obd2_state.query_latency = ticksToMs(now - req->timestamp);
+        channel_state->latency = MIN(obd2_state.query_latency, UINT16_MAX);
+        obd2_state.is_active = true;
+        obd2_state.last_obd2_response_timestamp = now;
+        obd2_state.response_count++;
+}
+
+static bool has_batch_in_flight(void)
+{
+        for (size_t i = 0; i < obd2_state.in_flight_count; i++) {
+                if (obd2_state.in_flight[i].pid_count > 1)
+                        return true;
+        }
+        return false;
+}
+
+/**
+ * @return the index of the batched request asking for the PID, or -1
+ */
+static int find_batch(OBD2Config *cfg, uint8_t pid)
+{
+        for (size_t i = 0; i < obd2_state.in_flight_count; i++) {
+                const struct OBD2Request *req = &obd2_state.in_flight[i];
+                if (req->pid_count < 2)
+                        continue;
+
+                for (size_t p = 0; p < req->pid_count; p++) {
+                        if (cfg->pids[req->pid_indexes[p]].pid == pid)
+                                return i;
+                }
+        }
+        return -1;
+}
 
-            /* is this CAN message an OBD2 PID response */
-            (msg->addressValue == OBD2_11BIT_PID_RESPONSE || msg->addressValue == OBD2_29BIT_PID_RESPONSE) &&
+/**
+ * Splits up a complete response to a batched request.  Each PID is handed
+ * to its mapping as if it came back in a single PID response.
+ * @param payload the response, starting with the mode
+ * @return true if the response was to a batched request
+ */
+static bool complete_obd2_batch(const uint8_t *payload, size_t len, const CAN_msg *msg,
+                                OBD2Config *cfg)
+{
+        if (len < 3 || payload[0] != OBD2_MODE_SHOW_CURRENT_DATA + OBD2_MODE_RESPONSE_OFFSET)
+                return false;
 
-            /* does the returned mode + response offeset match the one expected in the current query? ? */
-            msg->data[1] == mode + OBD2_MODE_RESPONSE_OFFSET &&
+        const int req_i = find_batch(cfg, payload[1]);
+        if (req_i < 0)
+                return false;
 
-            (
+        const struct OBD2Request *req = &obd2_state.in_flight[req_i];
+        bool answered[OBD2_MAX_BATCH_PIDS] = {false};
+
+        for (size_t i = 1; i < len;) {
+                const uint8_t pid = payload[i];
+                const uint8_t pid_len = mode1_pid_length(pid);
+                if (!pid_len || i + 1 + pid_len > len)
+                        break;
+
+                for (size_t p = 0; p < req->pid_count; p++) {
+                        const size_t pid_index = req->pid_indexes[p];
+                        if (answered[p] || cfg->pids[pid_index].pid != pid)
+                                continue;
+
+                        CAN_msg single = *msg;
+                        memset(single.data, 0x55, sizeof(single.data));
+                        single.data[0] = pid_len + 2;
+                        single.data[1] = payload[0];
+                        single.data[2] = pid;
+                        memcpy(single.data + 3, payload + i + 1, pid_len);
+                        update_obd2_channel(pid_index, &single, cfg, req);
+                        answered[p] = true;
+                        break;
+                }
+                i += 1 + pid_len;
+        }
 
-                    /* does the 1 byte or 2 byte response match the current query? enhanced mode = 2 byte PID*/
-                    (msg->data[2] == pid_config->pid && msg->data[1] == OBD2_MODE_SHOW_CURRENT_DATA + OBD2_MODE_RESPONSE_OFFSET) ||
+        /*
+         * The ECU leaves out PIDs it doesn't support, and some only answer
+         * the first PID of a batch.  Either way the PIDs left out get asked
+         * for singly, and only count a timeout if that goes unanswered too.
+         */
+        for (size_t p = 0; p < req->pid_count; p++) {
+                if (!answered[p])
+                        obd2_state.current_channel_states[req->pid_indexes[p]].unbatched = true;
+        }
 
-                    /* or does it match match on miscellaneous modes */
-                    (mode == OBD2_MODE_REQUEST_TROUBLE_CODES) ||
-                    (mode == OBD2_MODE_CLEAR_TROUBLE_CODES) ||
-                    (mode == OBD2_MODE_O2_SENSOR_MONITOR) ||
-                    (mode == OBD2_MODE_BODY_INFO) ||
+        remove_in_flight(req_i);
+        return true;
+}
 
-                    /* otherwise account for special mode with multi-byte PIDs (e.g. 0x22) */
-                    ((msg->data[2] * 256 + msg->data[3]) == pid_config->pid && msg->data[1] == mode + OBD2_MODE_RESPONSE_OFFSET)
+/**
+ * Handles a frame that may be part of the response to a batched request.
+ * Responses too long for one frame are reassembled from ISO-TP frames.
+ * @return true if the frame was used up
+ */
+static bool update_obd2_batch(const CAN_msg *msg, OBD2Config *cfg)
+{
+        struct OBD2Transfer *transfer = &obd2_state.transfer;
+
+        switch (msg->data[0] & ISOTP_FRAME_TYPE_MASK) {
+        case ISOTP_SINGLE_FRAME: {
+                if (msg->data[1] == OBD2_NEGATIVE_RESPONSE &&
+                    msg->data[2] == OBD2_MODE_SHOW_CURRENT_DATA) {
+                        /* drop the batches, their PIDs get asked for singly */
+                        reject_batching();
+                        for (size_t i = obd2_state.in_flight_count; i-- > 0;) {
+                                if (obd2_state.in_flight[i].pid_count > 1)
+                                        remove_in_flight(i);
+                        }
+                        return true;
+                }
 
-            )
-           ) {
-                float value;
-                bool result = canmapping_map_value(&value, msg, &pid_config->mapping);
-                if (result) {
-                        OBD2_set_current_channel_value(current_pid_index, value);
-                        channel_state->channel_status = OBD2_CHANNEL_STATUS_DATA_RECEIVED;
-                        channel_state->timeout_count = 0;
+                const size_t len = msg->data[0];
+                return len < CAN_MSG_SIZE &&
+                        complete_obd2_batch(msg->data + 1, len, msg, cfg);
+        }
+        case ISOTP_FIRST_FRAME: {
+                const size_t len = (msg->data[0] & ~ISOTP_FRAME_TYPE_MASK) << 8 | msg->data[1];
+                /* shorter ones fit in a single frame, and would overrun us */
+                if (len < CAN_MSG_SIZE || len > sizeof(transfer->data) ||
+                    msg->data[2] != OBD2_MODE_SHOW_CURRENT_DATA + OBD2_MODE_RESPONSE_OFFSET)
+                        return false;
+
+                memcpy(transfer->data, msg->data + 2, CAN_MSG_SIZE - 2);
+                transfer->len = len;
+                transfer->received = CAN_MSG_SIZE - 2;
+                transfer->sequence = 1;
+                transfer->active = true;
+                OBD2_send_flow_control(msg);
+                return true;
+        }
+        case ISOTP_CONSECUTIVE_FRAME: {
+                if (!transfer->active)
+                        return false;
+
+                if ((msg->data[0] & ~ISOTP_FRAME_TYPE_MASK) != transfer->sequence) {
+                        /* lost a frame; the batch will time out */
+                        transfer->active = false;
+                        return true;
                 }
-                /* Save our latency */
-                obd2_state.query_latency = ticksToMs(getCurrentTicks() - obd2_state.last_obd2_query_timestamp);
-                obd2_state.is_active = true;
+
+                const size_t count = MIN(CAN_MSG_SIZE - 1, transfer->len - transfer->received);
+                memcpy(transfer->data + transfer->received, msg->data + 1, count);
+                transfer->received += count;
+                transfer->sequence = (transfer->sequence + 1) & ~ISOTP_FRAME_TYPE_MASK;
+                if (transfer->received < transfer->len)
+                        return true;
+
+                transfer->active = false;
+                complete_obd2_batch(transfer->data, transfer->len, msg, cfg);
+                return true;
+        }
+        default:
+                return false;
+        }
+}
+
+void update_obd2_channels(CAN_msg *msg, OBD2Config *cfg)
+{
+        /* is this CAN message an OBD2 PID response */
+        if (msg->addressValue != OBD2_11BIT_PID_RESPONSE && msg->addressValue != OBD2_29BIT_PID_RESPONSE)
+                return;
+
+        if (has_batch_in_flight() && update_obd2_batch(msg, cfg))
+                return;
+
+        /* Did we get an OBDII PID we were waiting for?  Match the oldest request first */
+        for (size_t i = 0; i < obd2_state.in_flight_count; i++) {
+                const struct OBD2Request *req = &obd2_state.in_flight[i];
+                if (req->pid_count > 1)
+                        continue;
+
+                const uint16_t pid_index = req->pid_indexes[0];
+                if (!is_obd2_response(msg, &cfg->pids[pid_index]))
+                        continue;
+
+                update_obd2_channel(pid_index, msg, cfg, req);
+
                 /* PID request is complete */
-                obd2_state.last_obd2_query_timestamp = 0;
-                obd2_state.last_obd2_response_timestamp = getCurrentTicks();
+                remove_in_flight(i);
+                return;
         }
 }
 
@@ -443,3 +949,35 @@ bool OBD2_get_value_for_pid(uint16_t pid, float *value)
 void OBD2_set_pid_delay(uint32_t delay){
         obd2_state.pid_query_delay = delay;
 }
+
+void OBD2_set_max_in_flight(uint8_t count)
+{
+        obd2_state.max_in_flight = MAX(1, MIN(count, OBD2_MAX_IN_FLIGHT));
+}
+
+void OBD2_set_batching(bool enabled)
+{
+        obd2_state.batching = enabled;
+}
+
+void OBD2_get_stats(struct obd2_stats *stats)
+{
+        stats->active = obd2_state.is_active;
+        stats->pid_rate = obd2_state.pid_rate;
+        stats->in_flight = obd2_state.in_flight_count;
+        stats->max_in_flight = obd2_state.max_in_flight;
+        stats->batching = obd2_state.batching && !obd2_state.batching_rejected;
+        stats->channels = obd2_state.current_channel_states ?
+                obd2_state.channel_count : 0;
+}
+
+bool OBD2_get_pid_latency(size_t index, uint16_t *pid, uint16_t *latency)
+{
+        if (obd2_state.current_channel_states == NULL || index >= obd2_state.channel_count)
+                return false;
+
+        const struct OBD2ChannelState *state = &obd2_state.current_channel_states[index];
+        *pid = state->pid;
+        *latency = state->latency;
+        return true;
+}
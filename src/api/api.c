@@ -23,26 +23,105 @@
 #include "api.h"
 #include "constants.h"
 #include "loggerApi.h"
+#include "macros.h"
+#include "modp_numtoa.h"
 #include "panic.h"
 #include "printk.h"
+#include "serial_device.h"
 #include <stdlib.h>
 #include <string.h>
 
 #define JSON_TOKENS 200
 
-static jsmn_parser g_jsonParser;
+static struct jsmn_stream g_json_stream;
 static jsmntok_t* g_json_tok;
+static struct jsmn_index g_json_index;
+static struct jsmn_index_slot *g_json_index_slots;
 static const api_t apis[] = {API_METHODS NULL_API};
 
+/*
+ * Progress through a message whose payload array goes to the element
+ * handler of its command as it is parsed.
+ */
+static struct {
+        /* The device whose message is partly parsed, or NULL */
+        struct Serial *serial;
+        const api_t *api;
+        size_t elements;
+        int result;
+} g_stream;
+
+/*
+ * Devices whose partly parsed message was cut off by a message from some
+ * other device, and the command it was for.  The parse can't be picked
+ * up where it left off, so whatever they send of it next fails.
+ */
+static struct {
+        struct Serial *serial;
+        const char *cmd;
+} g_interrupted[__SERIAL_COUNT];
+
+/*
+ * Open addressed hash of the command names so dispatch costs a hash and
+ * usually a single strcmp, however many commands there are.  Slots hold
+ * the index into apis + 1, or 0 if empty.  Twice the size of apis keeps
+ * the probe sequences short.
+ */
+static uint8_t g_api_index[2 * ARRAY_LEN(apis)];
+
+static size_t api_hash(const char *name)
+{
+        /* FNV-1a */
+        uint32_t h = 2166136261u;
+        for (; *name; ++name)
+                h = (h ^ (uint8_t) *name) * 16777619u;
+
+        return h % ARRAY_LEN(g_api_index);
+}
+
+static size_t next_api_slot(const size_t slot)
+{
+        return (slot + 1) % ARRAY_LEN(g_api_index);
+}
+
+static void build_api_index()
+{
+        memset(g_api_index, 0, sizeof(g_api_index));
+
+        for (size_t i = 0; NULL != apis[i].cmd; ++i) {
+                size_t slot = api_hash(apis[i].cmd);
+                while (g_api_index[slot])
+                        slot = next_api_slot(slot);
+
+                g_api_index[slot] = i + 1;
+        }
+}
+
 void initApi()
 {
         if (NULL == g_json_tok)
                 g_json_tok = calloc(sizeof(jsmntok_t), JSON_TOKENS);
 
-        if (NULL == g_json_tok)
+        if (NULL == g_json_index_slots)
+                g_json_index_slots = calloc(sizeof(struct jsmn_index_slot),
+                                            JSON_TOKENS);
+
+        if (NULL == g_json_tok || NULL == g_json_index_slots)
                 panic(PANIC_CAUSE_MALLOC);
 
-        jsmn_init(&g_jsonParser);
+        build_api_index();
+}
+
+const api_t* find_api(const char *name)
+{
+        for (size_t slot = api_hash(name); g_api_index[slot];
+             slot = next_api_slot(slot)) {
+                const api_t *api = apis + g_api_index[slot] - 1;
+                if (0 == strcmp(api->cmd, name))
+                        return api;
+        }
+
+        return NULL;
 }
 
 static void putQuotedStr(struct Serial *serial, const char *str)
@@ -198,21 +277,254 @@ void json_sendResult(struct Serial *serial, const char *messageName, int resultC
         json_objEnd(serial, 0);
 }
 
-static int dispatch_api(struct Serial *serial, const char * apiMsgName, const jsmntok_t *apiPayload)
+/* Room needed to format any number in place */
+#define JSON_NUMBER_LEN	32
+
+static void jw_write_serial(const void *data, const size_t len, void *arg)
 {
+        serial_write_buff(arg, data, len);
+}
 
-        const api_t * api = apis;
-        int res = API_ERROR_UNSPECIFIED;
-        while (api->cmd != NULL) {
-                if (strcmp(api->cmd, apiMsgName) == 0) {
-                        res = api->func(serial, apiPayload);
-                        if (res != API_SUCCESS_NO_RETURN)
-                                json_sendResult(serial, apiMsgName, res);
-                        break;
-                }
-                api++;
+void json_writer_init(struct json_writer *jw, struct Serial *serial)
+{
+        json_writer_init_func(jw, jw_write_serial, serial);
+}
+
+void json_writer_init_func(struct json_writer *jw, json_writer_func *write,
+                           void *arg)
+{
+        jw->write = write;
+        jw->arg = arg;
+        jw->has_value = 0;
+        jw->depth = 0;
+        jw->len = 0;
+}
+
+void json_writer_flush(struct json_writer *jw)
+{
+        if (jw->len)
+                jw->write(jw->buf, jw->len, jw->arg);
+
+        jw->len = 0;
+}
+
+static void jw_put(struct json_writer *jw, const char *data, const size_t len)
+{
+        if (len <= sizeof(jw->buf) - jw->len) {
+                memcpy(jw->buf + jw->len, data, len);
+                jw->len += len;
+                return;
+        }
+
+        json_writer_flush(jw);
+        if (len > sizeof(jw->buf)) {
+                /* Nothing to gain from copying it through the buffer */
+                jw->write(data, len, jw->arg);
+        } else {
+                memcpy(jw->buf, data, len);
+                jw->len = len;
+        }
+}
+
+static void jw_put_c(struct json_writer *jw, const char c)
+{
+        if (jw->len == sizeof(jw->buf))
+                json_writer_flush(jw);
+
+        jw->buf[jw->len++] = c;
+}
+
+static void jw_put_s(struct json_writer *jw, const char *str)
+{
+        jw_put(jw, str, strlen(str));
+}
+
+static const char* json_escape(const char c)
+{
+        switch(c) {
+        case '\b':
+                return "\\b";
+        case '\f':
+                return "\\f";
+        case '\n':
+                return "\\n";
+        case '\r':
+                return "\\r";
+        case '\t':
+                return "\\t";
+        case '"':
+                return "\\\"";
+        case '\\':
+                return "\\\\";
+        default:
+                return NULL;
+        }
+}
+
+static void jw_put_quoted(struct json_writer *jw, const char *str)
+{
+        jw_put_c(jw, '"');
+        for (; *str; ++str) {
+                const char *esc = json_escape(*str);
+                if (esc)
+                        jw_put_s(jw, esc);
+                else
+                        jw_put_c(jw, *str);
+        }
+        jw_put_c(jw, '"');
+}
+
+/**
+ * @return Where to format a number of up to JSON_NUMBER_LEN - 1 chars.
+ * Follow with jw_commit_number.
+ */
+static char* jw_number_buf(struct json_writer *jw)
+{
+        if (sizeof(jw->buf) - jw->len < JSON_NUMBER_LEN)
+                json_writer_flush(jw);
+
+        return jw->buf + jw->len;
+}
+
+static void jw_commit_number(struct json_writer *jw)
+{
+        jw->len += strlen(jw->buf + jw->len);
+}
+
+static uint32_t depth_bit(const size_t depth)
+{
+        return depth < 32 ? 1u << depth : 0;
+}
+
+static void jw_value_start(struct json_writer *jw, const char *name)
+{
+        const uint32_t bit = depth_bit(jw->depth);
+        if (jw->has_value & bit)
+                jw_put_c(jw, ',');
+
+        jw->has_value |= bit;
+
+        if (name) {
+                jw_put_quoted(jw, name);
+                jw_put_c(jw, ':');
         }
-        if (NULL == api->cmd) {
+}
+
+void json_writer_null(struct json_writer *jw, const char *name)
+{
+        jw_value_start(jw, name);
+        jw_put(jw, "null", 4);
+}
+
+void json_writer_int(struct json_writer *jw, const char *name, int value)
+{
+        jw_value_start(jw, name);
+        modp_itoa10(value, jw_number_buf(jw));
+        jw_commit_number(jw);
+}
+
+void json_writer_uint(struct json_writer *jw, const char *name,
+                      unsigned int value)
+{
+        jw_value_start(jw, name);
+        modp_uitoa10(value, jw_number_buf(jw));
+        jw_commit_number(jw);
+}
+
+void json_writer_ll(struct json_writer *jw, const char *name,
+                    long long value)
+{
+        jw_value_start(jw, name);
+        modp_ltoa10(value, jw_number_buf(jw));
+        jw_commit_number(jw);
+}
+
+void json_writer_float(struct json_writer *jw, const char *name,
+                       float value, int precision)
+{
+        jw_value_start(jw, name);
+        modp_ftoa(value, jw_number_buf(jw), precision);
+        jw_commit_number(jw);
+}
+
+void json_writer_double(struct json_writer *jw, const char *name,
+                        double value, int precision)
+{
+        jw_value_start(jw, name);
+        modp_dtoa(value, jw_number_buf(jw), precision);
+        jw_commit_number(jw);
+}
+
+void json_writer_bool(struct json_writer *jw, const char *name,
+                      bool value)
+{
+        jw_value_start(jw, name);
+        jw_put_s(jw, value ? "true" : "false");
+}
+
+void json_writer_string(struct json_writer *jw, const char *name,
+                        const char *value)
+{
+        jw_value_start(jw, name);
+
+        if (value)
+                jw_put_quoted(jw, value);
+        else
+                jw_put(jw, "null", 4);
+}
+
+void json_writer_raw(struct json_writer *jw, const char *name,
+                     const char *json, size_t len)
+{
+        jw_value_start(jw, name);
+        jw_put(jw, json, len);
+}
+
+static void jw_open(struct json_writer *jw, const char *name, const char c)
+{
+        jw_value_start(jw, name);
+        jw_put_c(jw, c);
+        ++jw->depth;
+        jw->has_value &= ~depth_bit(jw->depth);
+}
+
+static void jw_close(struct json_writer *jw, const char c)
+{
+        jw_put_c(jw, c);
+        if (jw->depth)
+                --jw->depth;
+}
+
+void json_writer_obj_start(struct json_writer *jw, const char *name)
+{
+        jw_open(jw, name, '{');
+}
+
+void json_writer_obj_end(struct json_writer *jw)
+{
+        jw_close(jw, '}');
+}
+
+void json_writer_array_start(struct json_writer *jw, const char *name)
+{
+        jw_open(jw, name, '[');
+}
+
+void json_writer_array_end(struct json_writer *jw)
+{
+        jw_close(jw, ']');
+}
+
+static int dispatch_api(struct Serial *serial, const char * apiMsgName, const jsmntok_t *apiPayload)
+{
+        const api_t *api = find_api(apiMsgName);
+        int res;
+
+        if (api) {
+                res = api->func(serial, apiPayload);
+                if (res != API_SUCCESS_NO_RETURN)
+                        json_sendResult(serial, apiMsgName, res);
+        } else {
                 res = API_ERROR_UNKNOWN_MSG;
                 json_sendResult(serial, apiMsgName, res);
         }
@@ -237,14 +549,122 @@ static int execute_api(struct Serial * serial, const jsmntok_t *json)
         }
 }
 
-int process_api(struct Serial *serial, char *buffer, size_t bufferSize)
+static bool stream_element(const jsmntok_t *elem, void *arg)
 {
-        jsmn_init(&g_jsonParser);
+        struct Serial *serial = arg;
+        const jsmntok_t *name = g_json_tok + 1;
+        const jsmntok_t *payload = g_json_tok + 2;
+
+        /* The array has to be in the payload of {"cmd":{...}} */
+        if (!g_stream.api && JSMN_STRING == name->type &&
+            JSMN_OBJECT == payload->type)
+                g_stream.api = find_api(jsmn_trimData(name)->data);
+
+        if (!g_stream.api || !g_stream.api->element)
+                return false;
+
+        g_stream.result = g_stream.api->element(serial, payload, elem,
+                                                g_stream.elements++);
+        return API_SUCCESS == g_stream.result;
+}
+
+/**
+ * Remembers that the message the stream was part way through is cut off.
+ */
+static void interrupt_message(void)
+{
+        size_t i;
+        for (i = 0; i < ARRAY_LEN(g_interrupted) - 1; ++i)
+                if (!g_interrupted[i].serial ||
+                    g_stream.serial == g_interrupted[i].serial)
+                        break;
+
+        g_interrupted[i].serial = g_stream.serial;
+        g_interrupted[i].cmd = g_stream.api ? g_stream.api->cmd :
+                unknown_api_key();
+}
+
+/**
+ * @return The command of the message from serial that was cut off, or
+ * NULL if it wasn't.  Only reported once.
+ */
+static const char* take_interrupted(struct Serial *serial)
+{
+        for (size_t i = 0; i < ARRAY_LEN(g_interrupted); ++i) {
+                if (serial != g_interrupted[i].serial)
+                        continue;
+
+                g_interrupted[i].serial = NULL;
+                return g_interrupted[i].cmd;
+        }
+
+        return NULL;
+}
+
+static void start_message(struct Serial *serial)
+{
+        /* Some other device is part way through a message */
+        if (g_stream.serial)
+                interrupt_message();
+
         memset(g_json_tok, 0, sizeof(jsmntok_t) * JSON_TOKENS);
+        /* Keep lookups from using the index of the last message */
+        g_json_index.count = 0;
+
+        /* Root object, payload object, then the array */
+        jsmn_stream_init(&g_json_stream, g_json_tok, JSON_TOKENS, 2,
+                         stream_element, serial);
+
+        g_stream.serial = serial;
+        g_stream.api = NULL;
+        g_stream.elements = 0;
+        g_stream.result = API_SUCCESS;
+}
+
+/**
+ * Responds to a message the element handler of its command rejected.
+ */
+static int stream_failed(struct Serial *serial)
+{
+        json_sendResult(serial, g_stream.api->cmd, g_stream.result);
+        put_crlf(serial);
+        return g_stream.result;
+}
 
-        const int r = jsmn_parse(&g_jsonParser, buffer, g_json_tok, JSON_TOKENS);
-        if (JSMN_SUCCESS == r)
+/**
+ * Responds to the rest of a message that was cut off by another one.
+ */
+static int message_interrupted(struct Serial *serial, const char *cmd)
+{
+        pr_warning_str_msg("API message interrupted: ", cmd);
+        json_sendResult(serial, cmd, API_ERROR_MALFORMED);
+        put_crlf(serial);
+        return API_ERROR_MALFORMED;
+}
+
+int process_api(struct Serial *serial, char *buffer, size_t bufferSize)
+{
+        const char *cmd = take_interrupted(serial);
+        if (cmd)
+                return message_interrupted(serial, cmd);
+
+        if (g_stream.serial != serial)
+                start_message(serial);
+
+        /* Whatever happens, this message is done with after this */
+        g_stream.serial = NULL;
+
+        const int r = jsmn_stream_parse(&g_json_stream, buffer, false);
+        if (JSMN_SUCCESS == r) {
+                /* Handlers look up lots of keys, so index them up front */
+                jsmn_index_build(&g_json_index, g_json_tok,
+                                 g_json_stream.parser.toknext,
+                                 g_json_index_slots, JSON_TOKENS);
                 return execute_api(serial, g_json_tok);
+        }
+
+        if (API_SUCCESS != g_stream.result)
+                return stream_failed(serial);
 
         pr_warning("API Parsing Error: \"");
         pr_warning(buffer);
@@ -252,6 +672,36 @@ int process_api(struct Serial *serial, char *buffer, size_t bufferSize)
         return API_ERROR_MALFORMED;
 }
 
+int process_api_partial(struct Serial *serial, char *buffer, size_t *count)
+{
+        const char *cmd = take_interrupted(serial);
+        if (cmd)
+                return message_interrupted(serial, cmd);
+
+        if (g_stream.serial != serial)
+                start_message(serial);
+
+        const size_t dropped = g_json_stream.dropped;
+        const int r = jsmn_stream_parse(&g_json_stream, buffer, true);
+
+        /* Lookups leave NULs in the text, so go by what was cut out */
+        *count -= g_json_stream.dropped - dropped;
+        if (JSMN_ERROR_PART == r && g_json_stream.dropped > dropped)
+                return API_SUCCESS;
+
+        g_stream.serial = NULL;
+        if (API_SUCCESS != g_stream.result)
+                return stream_failed(serial);
+
+        pr_warning_int_msg("API message too big, failed with code ", r);
+        return API_ERROR_MALFORMED;
+}
+
+size_t api_streamed_elements()
+{
+        return g_stream.elements;
+}
+
 const char* unknown_api_key()
 {
         return "unknown";
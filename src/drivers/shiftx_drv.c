@@ -58,6 +58,12 @@ struct shiftx_configuration * shiftx_get_config(void)
         return &shiftx_config;
 }
 
+void shiftx_get_rx_can_ids(uint32_t ids[SHIFTX_RX_CAN_IDS])
+{
+        ids[0] = shiftx_config.base_address + ANNOUNCEMENT_OFFSET;
+        ids[1] = shiftx_config.base_address + NOTIFICATION_BUTTON_STATE_OFFSET;
+}
+
 void shiftx_handle_can_rx_msg(const CAN_msg *msg)
 {
         if (msg == NULL) return;
@@ -98,6 +98,11 @@ static jsmnerr_t jsmn_parse_primitive(jsmn_parser *parser, const char *js,
         parser->pos = start;
         return JSMN_ERROR_PART;
 #endif
+        /* The primitive may carry on in the text still to come */
+        if (parser->partial) {
+                parser->pos = start;
+                return JSMN_ERROR_PART;
+        }
 
 found:
         token = jsmn_alloc_token(parser, tokens, num_tokens);
@@ -146,6 +151,10 @@ static jsmnerr_t jsmn_parse_string(jsmn_parser *parser, const char *js,
                 /* Backslash: Quoted symbol expected */
                 if (c == '\\') {
                         parser->pos++;
+                        /* The escaped symbol is still to come */
+                        if (js[parser->pos] == '\0')
+                                break;
+
                         switch (js[parser->pos]) {
                         /* Allowed escaped symbols */
                         case '\"':
@@ -316,10 +325,195 @@ void jsmn_init(jsmn_parser *parser)
         parser->pos = 0;
         parser->toknext = 0;
         parser->toksuper = -1;
+        parser->partial = false;
+}
+
+void jsmn_stream_init(struct jsmn_stream *s, jsmntok_t *tokens,
+                      const unsigned int num_tokens, const unsigned int depth,
+                      jsmn_stream_func *func, void *arg)
+{
+        jsmn_init(&s->parser);
+        s->tokens = tokens;
+        s->num_tokens = num_tokens;
+        s->depth = depth;
+        s->func = func;
+        s->arg = arg;
+        s->array = -1;
+        s->dropped = 0;
+}
+
+static bool is_open(const jsmntok_t *tok)
+{
+        return tok->start != -1 && tok->end == -1;
+}
+
+static bool contains(const jsmntok_t *outer, const jsmntok_t *tok)
+{
+        return (JSMN_OBJECT == outer->type || JSMN_ARRAY == outer->type) &&
+                (is_open(outer) || tok->start < outer->end);
+}
+
+/**
+ * @return The index of the first array at the stream depth, or -1 if
+ * there is none yet.
+ */
+static int stream_array(struct jsmn_stream *s)
+{
+        const jsmntok_t *tokens = s->tokens;
+
+        /* Nothing before it ever moves, so it stays put once found */
+        for (unsigned int i = 0; s->array < 0 && i < s->parser.toknext; ++i) {
+                if (JSMN_ARRAY != tokens[i].type)
+                        continue;
+
+                unsigned int depth = 0;
+                for (unsigned int j = 0; j < i; ++j)
+                        depth += contains(tokens + j, tokens + i);
+
+                if (depth == s->depth)
+                        s->array = i;
+        }
+
+        return s->array;
+}
+
+/**
+ * @return The index of the token after complete token i and everything
+ * nested in it.
+ */
+static unsigned int stream_skip(const struct jsmn_stream *s,
+                                const unsigned int i)
+{
+        unsigned int next = i + 1;
+        while (next < s->parser.toknext &&
+               s->tokens[next].start < s->tokens[i].end)
+                ++next;
+
+        return next;
+}
+
+static bool stream_element(struct jsmn_stream *s, char *js,
+                           const unsigned int i, const unsigned int next)
+{
+        jsmntok_t *tokens = s->tokens;
+        jsmntok_t after;
+
+        /*
+         * End the tokens after the element so lookups from it stop there,
+         * and keep the text after it safe from jsmn_trimData.  There is
+         * always room, as the parse keeps the last token back.
+         */
+        after = tokens[next];
+        memset(tokens + next, 0, sizeof(*tokens));
+        const char c = js[tokens[i].end];
+
+        const bool res = s->func(tokens + i, s->arg);
+
+        js[tokens[i].end] = c;
+        tokens[next] = after;
+
+        return res;
+}
+
+/**
+ * Hands the complete elements of the streamed array to the stream function
+ * and cuts them out of the tokens and the text.
+ * @return The number of elements dropped, or -1 if the stream function
+ * stopped the parse.
+ */
+static int stream_drop(struct jsmn_stream *s, char *js)
+{
+        jsmn_parser *parser = &s->parser;
+        jsmntok_t *tokens = s->tokens;
+
+        const int array = stream_array(s);
+        if (array < 0)
+                return 0;
+
+        const unsigned int first = array + 1;
+        const size_t start = tokens[array].start + 1;
+        unsigned int next = first;
+        size_t cut = start;
+        int count = 0;
+
+        while (next < parser->toknext &&
+               contains(tokens + array, tokens + next) &&
+               !is_open(tokens + next)) {
+                const unsigned int i = next;
+
+                next = stream_skip(s, i);
+                if (!stream_element(s, js, i, next))
+                        return -1;
+
+                /* Strings end before their closing quote */
+                cut = tokens[i].end + (JSMN_STRING == tokens[i].type);
+                ++count;
+        }
+
+        if (!count)
+                return 0;
+
+        const unsigned int dropped = next - first;
+        const size_t shift = cut - start;
+
+        memmove(js + start, js + cut, strlen(js + cut) + 1);
+        memmove(tokens + first, tokens + next,
+                (parser->toknext - next) * sizeof(*tokens));
+        parser->toknext -= dropped;
+        memset(tokens + parser->toknext, 0, dropped * sizeof(*tokens));
+
+        for (unsigned int i = first; i < parser->toknext; ++i) {
+                jsmntok_t *tok = tokens + i;
+
+                tok->data -= shift;
+                tok->start -= shift;
+                if (tok->end != -1)
+                        tok->end -= shift;
+#ifdef JSMN_PARENT_LINKS
+                if (tok->parent >= (int) next)
+                        tok->parent -= dropped;
+#endif
+        }
+
+        if (parser->toksuper >= (int) next)
+                parser->toksuper -= dropped;
+
+        parser->pos -= shift;
+        s->dropped += shift;
+        tokens[array].size -= count;
+        if (tokens[array].end != -1)
+                tokens[array].end -= shift;
+        return count;
+}
+
+jsmnerr_t jsmn_stream_parse(struct jsmn_stream *s, char *js, const bool more)
+{
+        s->parser.partial = more;
+
+        for (;;) {
+                /* Leave a zeroed token at the end to stop lookups */
+                const jsmnerr_t r = jsmn_parse(&s->parser, js, s->tokens,
+                                               s->num_tokens - 1);
+                if (JSMN_ERROR_NOMEM != r &&
+                    !(more && JSMN_ERROR_PART == r))
+                        return r;
+
+                const int dropped = stream_drop(s, js);
+                if (dropped < 0)
+                        return JSMN_ERROR_INVAL;
+
+                /* Out of text, or out of tokens with no way to free any */
+                if (JSMN_ERROR_PART == r || !dropped)
+                        return r;
+        }
 }
 
 const jsmntok_t * jsmn_trimData(const jsmntok_t *tok)
 {
+        /* An object or array still being parsed has no end yet */
+        if (tok->end < tok->start)
+                return tok;
+
         tok->data[tok->end - tok->start] = '\0';
         return tok;
 }
@@ -341,11 +535,140 @@ const jsmntok_t * jsmn_find_node_type(const jsmntok_t *node, const jsmntype_t no
         return NULL;
 }
 
+/* The index the jsmn_find functions use, if any */
+static const struct jsmn_index *g_index;
+
+static size_t index_hash(const struct jsmn_index *idx, const size_t obj,
+                         const char *name)
+{
+        /* FNV-1a over the object index then the name */
+        uint32_t h = (2166136261u ^ obj) * 16777619u;
+        for (; *name; ++name)
+                h = (h ^ (uint8_t) *name) * 16777619u;
+
+        return h % idx->slot_count;
+}
+
+static size_t next_index_slot(const struct jsmn_index *idx, const size_t slot)
+{
+        return (slot + 1) % idx->slot_count;
+}
+
+static bool index_add(struct jsmn_index *idx, const size_t obj,
+                      const size_t key)
+{
+        const char *name = jsmn_trimData(idx->tokens + key)->data;
+        size_t slot = index_hash(idx, obj, name);
+
+        for (size_t probes = 0; idx->slots[slot].key; ++probes) {
+                if (probes == idx->slot_count)
+                        return false;
+
+                slot = next_index_slot(idx, slot);
+        }
+
+        idx->slots[slot].obj = obj + 1;
+        idx->slots[slot].key = key + 1;
+        return true;
+}
+
+/**
+ * @return The index of the token after token i and everything nested in it.
+ */
+static size_t skip_token(const struct jsmn_index *idx, const size_t i)
+{
+        const jsmntok_t *tokens = idx->tokens;
+        size_t next = i + 1;
+        while (next < idx->count && tokens[next].start < tokens[i].end)
+                ++next;
+
+        return next;
+}
+
+static bool index_objects(struct jsmn_index *idx)
+{
+        const jsmntok_t *tokens = idx->tokens;
+
+        for (size_t obj = 0; obj < idx->count; ++obj) {
+                if (JSMN_OBJECT != tokens[obj].type)
+                        continue;
+
+                /* Object size counts both the keys and the values */
+                size_t key = obj + 1;
+                for (int i = 0; i < tokens[obj].size / 2; ++i) {
+                        if (key + 1 >= idx->count ||
+                            !index_add(idx, obj, key))
+                                return false;
+
+                        key = skip_token(idx, key + 1);
+                }
+        }
+
+        return true;
+}
+
+bool jsmn_index_build(struct jsmn_index *idx, const jsmntok_t *tokens,
+                      const size_t count, struct jsmn_index_slot *slots,
+                      const size_t slot_count)
+{
+        idx->tokens = tokens;
+        idx->count = count;
+        idx->slots = slots;
+        idx->slot_count = slot_count;
+        memset(slots, 0, slot_count * sizeof(*slots));
+
+        /* Slot indexes need to fit */
+        const bool built = slot_count && count < UINT16_MAX &&
+                index_objects(idx);
+        if (!built)
+                idx->count = 0;
+
+        g_index = idx;
+        return built;
+}
+
+const jsmntok_t * jsmn_next(const jsmntok_t *tok)
+{
+        const jsmntok_t *next = tok + 1;
+        while ((next->start || next->end) && next->start < tok->end)
+                ++next;
+
+        return next;
+}
+
+static bool is_indexed(const struct jsmn_index *idx, const jsmntok_t *node)
+{
+        return idx && JSMN_OBJECT == node->type && node >= idx->tokens &&
+                node < idx->tokens + idx->count;
+}
+
+static const jsmntok_t * index_find(const struct jsmn_index *idx,
+                                    const jsmntok_t *node, const char *name)
+{
+        const size_t obj = node - idx->tokens;
+        size_t slot = index_hash(idx, obj, name);
+
+        for (size_t probes = 0;
+             probes < idx->slot_count && idx->slots[slot].key;
+             ++probes, slot = next_index_slot(idx, slot)) {
+                const struct jsmn_index_slot *s = idx->slots + slot;
+                const jsmntok_t *key = idx->tokens + s->key - 1;
+
+                if (s->obj == obj + 1 && 0 == strcmp(name, key->data))
+                        return key;
+        }
+
+        return NULL;
+}
+
 const jsmntok_t * jsmn_find_node(const jsmntok_t *node, const char * name)
 {
         if (NULL == node)
                 return NULL;
 
+        if (is_indexed(g_index, node))
+                return index_find(g_index, node, name);
+
         for (; node->start || node->end; ++node)
                 if (0 == strcmp(name, jsmn_trimData(node)->data))
                         return node;
@@ -42,14 +42,20 @@
 #include "stdint.h"
 #include "task.h"
 #include "taskUtil.h"
+#include "telemetry_backlog.h"
+#include "telemetry_batch.h"
+#include "telemetry_frame.h"
 #include "usart.h"
 #include "gps_device.h"
 #include "api_event.h"
 
 #if (CONNECTIVITY_CHANNELS == 1)
 #define CONNECTIVITY_TASK_INIT {NULL}
+#define CONNECTIVITY_CONSUMER_INIT {SAMPLE_CONSUMER_BLUETOOTH}
 #elif (CONNECTIVITY_CHANNELS == 2)
 #define CONNECTIVITY_TASK_INIT {NULL, NULL}
+#define CONNECTIVITY_CONSUMER_INIT {SAMPLE_CONSUMER_BLUETOOTH, \
+                                    SAMPLE_CONSUMER_CELLULAR}
 #else
 #error "invalid connectivity task count"
 #endif
@@ -63,25 +69,36 @@
 #define INIT_DELAY         600
 
 #define TELEMETRY_BUFFER_FILE_SYNC_INTERVAL 100
-#define TELEMETRY_STACK_SIZE 300
-#define CELLULAR_TELEMETRY_STACK_SIZE 330
+/* Room for a sample going out through a JSON writer or two */
+#define TELEMETRY_STACK_SIZE 360
+#define CELLULAR_TELEMETRY_STACK_SIZE 390
 #define BAD_MESSAGE_THRESHOLD     10
 #define API_EVENT_QUEUE_DEPTH 2
 #define CELLULAR_TELEMETRY_BUFFER_QUEUE_DEPTH 1
 #define METADATA_SAMPLE_INTERVAL    100
 #define HARD_INIT_RETRY_THRESHOLD 5
 
+/*
+ * The modem sends each burst of data in its own packet, so let a few
+ * samples share one.  At 10Hz this holds back at most half a second.
+ */
+#define CELLULAR_BATCH_SAMPLES		5
+#define CELLULAR_BATCH_BYTES		1024
+#define CELLULAR_BATCH_LATENCY_MS	500
+
 #define TELEMETRY_BUFFER_FILENAME "tele.buf"
 #define TELEMETRY_BUFFER_FILE_RETRY_MS 1000
 
-#define BUFFERED_CHUNK_SIZE 7000
-#define BUFFERED_CHUNK_WAIT 1000
 #define BUFFERED_MAX_SIZE 1024 * 1000
 
 static xQueueHandle g_sampleQueue[CONNECTIVITY_CHANNELS] = CONNECTIVITY_TASK_INIT;
+static const enum sample_consumer g_sampleConsumer[CONNECTIVITY_CHANNELS] =
+        CONNECTIVITY_CONSUMER_INIT;
 
 #if BLUETOOTH_SUPPORT
 static char bluetooth_buffer[BUFFER_SIZE];
+static struct telemetry_delta bluetooth_delta;
+static struct telemetry_batch bluetooth_batch;
 #endif
 
 #if CELLULAR_SUPPORT
@@ -90,14 +107,11 @@ static CellularState cellular_state = {
                 .buffer_file = NULL,
                 .buffer_buffer = {},
                 .cell_buffer = {},
-                .read_index = 0,
                 .buffer_file_open = false,
                 .should_reconnect = false,
                 .should_stream = false,
                 .server_tick_echo = 0,
                 .server_tick_echo_changed_at = 0,
-                .sample_offset_map = {0},
-                .sample_offset_map_index = 0
 };
 
 bool cellular_telemetry_buffering_enabled(void)
@@ -117,45 +131,34 @@ void cellular_update_last_server_tick_echo(uint32_t server_tick_echo)
         cellular_state.server_tick_echo = server_tick_echo;
 }
 
-/* reset the sample offset map circular buffer */
-static void cellular_reset_buffer_offset_map(void){
-        memset(cellular_state.sample_offset_map, 0, SAMPLE_TRACKING_WINDOW * sizeof(SampleOffsetMap));
-}
-
-/* get an offset by the specified tick */
-static bool cellular_get_buffer_offset_by_tick(uint32_t tick, uint32_t *offset)
+/*
+ * Sends the next chunk of the telemetry backlog.
+ * @return true if there is more to send right away.
+ */
+static bool cellular_stream_backlog(struct Serial *serial)
 {
-        SampleOffsetMap *map = cellular_state.sample_offset_map;
-        for (size_t i = 0; i < SAMPLE_TRACKING_WINDOW; i++){
-                if (map->tick == tick){
-                        *offset = map->buffer_file_index;
-                        return true;
-                }
-                map++;
+        size_t len = 0;
+        fs_lock();
+        const char *data = telemetry_backlog_read(&cellular_state.backlog,
+                                                  &len);
+        fs_unlock();
+
+        if (!data) {
+                pr_error(_LOG_PFX "Error reading telemetry buffer\r\n");
+                return false;
         }
-        return false;
-}
 
-/* store an offset into the circular buffer using the tick as a 'key' */
-static void cellular_add_buffer_offset_tick(uint32_t tick, uint32_t offset)
-{
-        int32_t index = cellular_state.sample_offset_map_index;
-        index++;
-        index = index >= SAMPLE_TRACKING_WINDOW ? 0 : index;
-        cellular_state.sample_offset_map[index].buffer_file_index = offset;
-        cellular_state.sample_offset_map[index].tick = tick;
-        cellular_state.sample_offset_map_index = index;
-}
-
-/* A cheap way to extract a value from the json sample string */
-static bool get_tick_from_sample_string(char * sample_string, uint32_t *tick)
-{
-        char * tick_string = strstr(sample_string,"{\"s\":{\"t\":");
-        if (tick_string) {
-                *tick = atoi(tick_string + 10);
-                return true;
-        }
-        return false;
+        /* Blocks while the modem drains the queue, which paces us to it */
+        serial_write_buff(serial, data, len);
+        if (len < BUFFER_BUFFER_SIZE)
+                return false;
+
+        /* here we're catching up on a lot of buffered data,
+         * so reset the timestamp so we don't time out
+         * prematurely
+         */
+        cellular_state.server_tick_echo_changed_at = getCurrentTicks();
+        return true;
 }
 #endif
 
@@ -173,8 +176,9 @@ static size_t trimBuffer(char *buffer, size_t count)
 
 int process_rx_buffer(struct Serial *serial, char *buffer, size_t *rxCount)
 {
+        /* Leave room to terminate what is read */
         const int count = serial_read_line_wait(serial, buffer + *rxCount,
-                                                BUFFER_SIZE - *rxCount, 0);
+                                                BUFFER_SIZE - 1 - *rxCount, 0);
 
         if (count < 0) {
                 pr_error(_LOG_PFX "Serial device closed\r\n");
@@ -182,28 +186,36 @@ int process_rx_buffer(struct Serial *serial, char *buffer, size_t *rxCount)
         }
 
         *rxCount += count;
-        int processMsg = 0;
 
-        if (*rxCount >= BUFFER_SIZE - 1) {
-                buffer[BUFFER_SIZE - 1] = '\0';
-                *rxCount = BUFFER_SIZE - 1;
-                processMsg = 1;
-                pr_error_str_msg(_LOG_PFX "Rx Buffer overflow:", buffer);
-        }
         if (*rxCount > 0) {
                 char lastChar = buffer[*rxCount - 1];
                 if ('\r' == lastChar || '\n' == lastChar) {
                         *rxCount = trimBuffer(buffer, *rxCount);
-                        processMsg = 1;
+                        return 1;
                 }
         }
-        return processMsg;
+
+        if (*rxCount < BUFFER_SIZE - 1)
+                return 0;
+
+        buffer[*rxCount] = '\0';
+
+        /*
+         * Parse what we can of a message too big for the buffer to make
+         * room for the rest of it.
+         */
+        if (API_SUCCESS == process_api_partial(serial, buffer, rxCount))
+                return 0;
+
+        pr_error_str_msg(_LOG_PFX "Rx Buffer overflow:", buffer);
+        return 1;
 }
 
 void queueTelemetryRecord(const LoggerMessage *msg)
 {
         for (size_t i = 0; i < CONNECTIVITY_CHANNELS; i++)
-                send_logger_message(g_sampleQueue[i], msg);
+                send_logger_message(g_sampleConsumer[i], g_sampleQueue[i],
+                                    msg);
 }
 
 #if BLUETOOTH_SUPPORT
@@ -221,9 +233,12 @@ static void create_bluetooth_connection_task(int16_t priority,
         params->init_connection = &bt_init_connection;
         params->serial = SERIAL_BLUETOOTH;
         params->sampleQueue = sampleQueue;
+        params->consumer = SAMPLE_CONSUMER_BLUETOOTH;
         params->always_streaming = true;
         params->max_sample_rate = SAMPLE_50Hz;
         params->activity_led = activity_led;
+        /* The app draws samples as they come, so send them right away */
+        params->batch = (struct telemetry_batch_cfg) {0};
 
         /* Make all task names 16 chars including NULL char */
         static const signed portCHAR task_name[] = "Bluetooth Task ";
@@ -238,6 +253,10 @@ static void create_cellular_connection_tasks(int16_t priority,
                 enum led activity_led)
 {
         cellular_state.buffer_file = pvPortMalloc(sizeof(FIL));
+        telemetry_backlog_init(&cellular_state.backlog,
+                               cellular_state.buffer_file,
+                               cellular_state.buffer_buffer,
+                               BUFFER_BUFFER_SIZE);
         cellular_state.buffer_queue = xQueueCreate(CELLULAR_TELEMETRY_BUFFER_QUEUE_DEPTH, sizeof(BufferedLoggerMessage));
 
         {
@@ -245,6 +264,7 @@ static void create_cellular_connection_tasks(int16_t priority,
                 params->connectionName = "TelemBuffer";
                 params->periodicMeta = 0;
                 params->sampleQueue = sampleQueue;
+                params->consumer = SAMPLE_CONSUMER_CELLULAR;
                 params->always_streaming = false;
                 params->max_sample_rate = SAMPLE_10Hz;
 
@@ -267,6 +287,11 @@ static void create_cellular_connection_tasks(int16_t priority,
                 params->always_streaming = false;
                 params->max_sample_rate = SAMPLE_10Hz;
                 params->activity_led = activity_led;
+                params->batch = (struct telemetry_batch_cfg) {
+                        .samples = CELLULAR_BATCH_SAMPLES,
+                        .bytes = CELLULAR_BATCH_BYTES,
+                        .latency_ms = CELLULAR_BATCH_LATENCY_MS,
+                };
 
                 /* Make all task names 16 chars including NULL char */
                 static const signed portCHAR task_name[] = "Cell Telemetry";
@@ -361,6 +386,13 @@ void bluetooth_connectivity_task(void *params)
 
         bool logging_enabled = false;
 
+        /* Kept off the stack, the task is short on it */
+        struct telemetry_delta *delta = &bluetooth_delta;
+        telemetry_delta_init(delta);
+
+        struct telemetry_batch *batch = &bluetooth_batch;
+        telemetry_batch_init(batch, serial, &connParams->batch);
+
         xQueueHandle api_event_queue = xQueueCreate(API_EVENT_QUEUE_DEPTH, sizeof(struct api_event));
         api_event_create_callback(queue_bluetooth_api_event, api_event_queue);
 
@@ -387,12 +419,21 @@ void bluetooth_connectivity_task(void *params)
                         GPS_set_UTC_time(connected_at);
 
                 serial_flush(serial);
+                /* A new peer starts out with JSON until it asks otherwise */
+                serial_set_telemetry_format(serial,
+                                            SERIAL_TELEMETRY_FORMAT_JSON);
+                /* and knows nothing of what we sent before a reconnect */
+                telemetry_delta_reset(delta);
+                telemetry_batch_discard(batch);
                 rx_buffer_count = 0;
                 size_t bad_message_count = 0;
                 uint32_t tick = 0;
                 size_t last_message_time = getUptimeAsInt();
                 bool should_reconnect = false;
                 hard_init = false;
+
+                /* Only take samples while we can keep up with them */
+                sample_consumer_subscribe(connParams->consumer);
                 while (1) {
                         if ( should_reconnect )
                                 break; /*break out and trigger the re-connection if needed */
@@ -411,6 +452,7 @@ void bluetooth_connectivity_task(void *params)
                         if (pdFALSE != res) {
                                 switch(msg.type) {
                                 case LoggerMessageType_Start: {
+                                        telemetry_batch_flush(batch);
                                         api_sendLogStart(serial);
                                         put_crlf(serial);
                                         tick = 0;
@@ -421,6 +463,7 @@ void bluetooth_connectivity_task(void *params)
                                         break;
                                 }
                                 case LoggerMessageType_Stop: {
+                                        telemetry_batch_flush(batch);
                                         api_sendLogEnd(serial);
                                         put_crlf(serial);
                                         if (! (logger_config->ConnectivityConfigs.telemetryConfig.backgroundStreaming ||
@@ -439,9 +482,11 @@ void bluetooth_connectivity_task(void *params)
                                         const int send_meta = msg.needs_meta || tick == 0 ||
                                                               (connParams->periodicMeta &&
                                                                (tick % METADATA_SAMPLE_INTERVAL == 0));
-                                        api_send_sample_record(serial, msg.sample, tick, send_meta);
+                                        /* Keyframes let delta streams recover from lost data */
+                                        if (tick % METADATA_SAMPLE_INTERVAL == 0)
+                                                telemetry_delta_reset(delta);
 
-                                        put_crlf(serial);
+                                        api_batch_telemetry_sample(batch, delta, msg.sample, tick, send_meta);
                                         tick++;
                                         break;
                                 }
@@ -449,7 +494,12 @@ void bluetooth_connectivity_task(void *params)
                                         pr_info_int_msg(_LOG_PFX "Unknown logger message type ", msg.type);
                                         break;
                                 }
+                                release_logger_message(connParams->consumer,
+                                                       &msg);
                         }
+                        /* Samples may only be held back for so long */
+                        telemetry_batch_poll(batch);
+
                         /*//////////////////////////////////////////////////////////
                         // Process any pending API events
                         ////////////////////////////////////////////////////////////*/
@@ -499,6 +549,9 @@ void bluetooth_connectivity_task(void *params)
                         }
                 }
 
+                /* Don't hold samples the logger needs while we reconnect */
+                sample_consumer_unsubscribe(connParams->consumer, sampleQueue);
+
                 led_disable(connParams->activity_led);
                 connParams->disconnect(&deviceConfig);
         }
@@ -525,6 +578,7 @@ void cellular_buffering_task(void *params)
         uint32_t last_open_buffer_attempt = getCurrentTicks();
         uint32_t buffer_file_open_retries = 0;
 
+        sample_consumer_subscribe(connParams->consumer);
         while (1) {
                 cellular_state.should_stream = logging_enabled ||
                                      logger_config->ConnectivityConfigs.telemetryConfig.backgroundStreaming ||
@@ -533,9 +587,11 @@ void cellular_buffering_task(void *params)
                 while (1) {
                         if (!cellular_state.buffer_file_open && isTimeoutMs(last_open_buffer_attempt, re_open_buffer_file_timeout)) {
                                 last_open_buffer_attempt = getCurrentTicks();
-                                cellular_reset_buffer_offset_map();
-                                cellular_state.read_index = 0;
                                 fs_lock();
+                                telemetry_backlog_init(&cellular_state.backlog,
+                                                       cellular_state.buffer_file,
+                                                       cellular_state.buffer_buffer,
+                                                       BUFFER_BUFFER_SIZE);
                                 bool fs_good = sdcard_fs_mounted();
                                 if (!fs_good) {
                                         FRESULT initfs_rc = InitFS();
@@ -631,15 +687,14 @@ void cellular_buffering_task(void *params)
                                                 goto BUFFER_DONE;
                                         }
 
-                                        FRESULT fseek_res = f_lseek(cellular_state.buffer_file, file_size);
-                                        if (FR_OK != fseek_res) {
-                                                pr_error_int_msg(_LOG_PFX "Failed to seek to end of buffer: ", fseek_res);
+                                        FRESULT append_res = telemetry_backlog_append(&cellular_state.backlog,
+                                                                                      msg.sample, tick, send_meta);
+                                        if (FR_OK != append_res) {
+                                                pr_error_int_msg(_LOG_PFX "Failed to append to buffer: ", append_res);
                                                 fs_failed = true;
                                                 goto BUFFER_DONE;
                                         }
 
-                                        fs_write_sample_record(cellular_state.buffer_file, msg.sample, tick, send_meta);
-
                                         if (tick % TELEMETRY_BUFFER_FILE_SYNC_INTERVAL == 0) {
                                                 pr_debug_int_msg(_LOG_PFX "Flushing buffer file: ", tick);
                                                 FRESULT fsync_res = f_sync(cellular_state.buffer_file);
@@ -661,7 +716,11 @@ void cellular_buffering_task(void *params)
                                         buffer_msg.sample = msg.sample;
                                         buffer_msg.ticks = msg.ticks;
                                         buffer_msg.needs_meta = msg.needs_meta;
-                                        xQueueSend(cellular_state.buffer_queue, &buffer_msg, 0);
+
+                                        /* Our reference goes with it */
+                                        if (xQueueSend(cellular_state.buffer_queue,
+                                                       &buffer_msg, 0))
+                                                msg.sample = NULL;
 
                                         tick++;
                                         break;
@@ -670,6 +729,8 @@ void cellular_buffering_task(void *params)
                                         pr_info_int_msg(_LOG_PFX "Unknown logger message type ", msg.type);
                                         break;
                                 }
+                                release_logger_message(connParams->consumer,
+                                                       &msg);
                         }
                 }
         }
@@ -709,6 +770,13 @@ void cellular_connectivity_task(void *params)
         bool hard_init = true;
         bool buffering_enabled = false;
 
+        /* Kept off the stack, the task is short on it */
+        struct telemetry_delta *delta = &cellular_state.delta;
+        telemetry_delta_init(delta);
+
+        struct telemetry_batch *batch = &cellular_state.batch;
+        telemetry_batch_init(batch, serial, &connParams->batch);
+
         while (1) {
                 size_t connect_retries = 0;
                 millis_t connected_at = 0;
@@ -733,13 +801,21 @@ void cellular_connectivity_task(void *params)
                         GPS_set_UTC_time(connected_at);
 
                 serial_flush(serial);
+                /* A new peer starts out with JSON until it asks otherwise */
+                serial_set_telemetry_format(serial,
+                                            SERIAL_TELEMETRY_FORMAT_JSON);
+                /* and knows nothing of what we sent before a reconnect */
+                telemetry_delta_reset(delta);
+                telemetry_batch_discard(batch);
                 rx_buffer_count = 0;
                 size_t bad_api_msg_count = 0;
                 cellular_state.should_reconnect = false;
 
-                uint32_t file_offset = 0;
-                if(cellular_get_buffer_offset_by_tick(last_tick, &file_offset)) {
-                        cellular_state.read_index = file_offset;
+                fs_lock();
+                const bool resumed = telemetry_backlog_resume(&cellular_state.backlog,
+                                                              last_tick);
+                fs_unlock();
+                if (resumed) {
                         cellular_state.server_tick_echo = last_tick;
                 }
                 else {
@@ -752,7 +828,8 @@ void cellular_connectivity_task(void *params)
                 hard_init = false;
 
                 fs_lock();
-                int32_t backlog_size = f_size(cellular_state.buffer_file) - cellular_state.read_index;
+                int32_t backlog_size = cellular_state.buffer_file_open ?
+                        telemetry_backlog_pending(&cellular_state.backlog) : 0;
                 fs_unlock();
 
                 if ( backlog_size > 0) {
@@ -760,6 +837,8 @@ void cellular_connectivity_task(void *params)
                 }
 
                 bool needs_meta = true;
+                uint32_t samples_sent = 0;
+                bool catching_up = false;
                 while (cellular_state.should_stream) {
                         if ( cellular_state.should_reconnect )
                                 break; /*break out and trigger the re-connection if needed */
@@ -770,7 +849,9 @@ void cellular_connectivity_task(void *params)
                                 buffering_enabled = current_buffering_enabled;
                         }
 
-                        const char res = xQueueReceive(sampleQueue, &msg, IDLE_TIMEOUT);
+                        /* Don't wait around while there is backlog to send */
+                        const char res = xQueueReceive(sampleQueue, &msg,
+                                                       catching_up ? 0 : IDLE_TIMEOUT);
 
                         /*///////////////////////////////////////////////////////////
                         // Process a pending message from logger task, if exists
@@ -780,51 +861,29 @@ void cellular_connectivity_task(void *params)
 
                                         led_toggle(connParams->activity_led);
 
+                                        /* Buffered samples go out with the backlog */
                                         if (!current_buffering_enabled) {
                                                 /* Fall back to non-buffered sample streaming */
-                                                api_send_sample_record(serial, msg.sample, msg.ticks, needs_meta || msg.needs_meta);
-                                                needs_meta = false;
-                                                put_crlf(serial);
-                                        }
-                                        else {
-                                                /* Stream buffered samples, catching up with the tail of the file as needed */
-                                                int32_t start_index = cellular_state.read_index;
-                                                while (true) {
-                                                        char * read_string = NULL;
-                                                        fs_lock();
-                                                        FRESULT fseek_res = f_lseek(cellular_state.buffer_file, cellular_state.read_index);
-                                                        read_string = f_gets(cellular_state.buffer_buffer, BUFFER_BUFFER_SIZE, cellular_state.buffer_file);
-                                                        fs_unlock();
-
-                                                        if (FR_OK != fseek_res) {
-                                                                pr_error_int_msg("Error reading telemetry buffer, aborting ", fseek_res);
-                                                                break;
-                                                        }
-
-                                                        if (read_string == NULL || strlen(read_string) == 0)
-                                                                break;
-
-                                                        serial_write_s(serial, read_string);
-                                                        cellular_state.read_index += strlen(read_string);
-
-                                                        uint32_t tick = 0;
-                                                        if(get_tick_from_sample_string(read_string, &tick)){
-                                                                cellular_add_buffer_offset_tick(tick, cellular_state.read_index);
-                                                        }
+                                                /* Keyframes let delta streams recover from lost data */
+                                                if (samples_sent++ % METADATA_SAMPLE_INTERVAL == 0)
+                                                        telemetry_delta_reset(delta);
 
-                                                        if (cellular_state.read_index - start_index > BUFFERED_CHUNK_SIZE){
-                                                                delayMs(BUFFERED_CHUNK_WAIT);
-                                                                start_index = cellular_state.read_index;
-
-                                                                /* here we're catching up on a lot of buffered data,
-                                                                 * so reset the timestamp so we don't time out
-                                                                 * prematurely
-                                                                 */
-                                                                cellular_state.server_tick_echo_changed_at = getCurrentTicks();
-                                                        }
-                                                }
+                                                api_batch_telemetry_sample(batch, delta, msg.sample, msg.ticks, needs_meta || msg.needs_meta);
+                                                needs_meta = false;
                                         }
                                 }
+                                sample_consumer_release(SAMPLE_CONSUMER_CELLULAR,
+                                                        msg.sample);
+                        }
+                        /* Samples may only be held back for so long */
+                        telemetry_batch_poll(batch);
+
+                        /* Catch up with the backlog a chunk at a time */
+                        catching_up = false;
+                        if (current_buffering_enabled) {
+                                /* Whatever was held back comes before the file */
+                                telemetry_batch_flush(batch);
+                                catching_up = cellular_stream_backlog(serial);
                         }
 
                         /*//////////////////////////////////////////////////////////
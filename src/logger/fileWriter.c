@@ -20,13 +20,18 @@
  */
 
 
+#include "api.h"
+#include "crc32.h"
 #include "fileWriter.h"
 #include "led.h"
+#include "log_compress.h"
+#include "log_format.h"
 #include "loggerHardware.h"
 #include "macros.h"
 #include "mem_mang.h"
 #include "modp_numtoa.h"
 #include "printk.h"
+#include "queue.h"
 #include "ring_buffer.h"
 #include "sampleRecord.h"
 #include "sdcard.h"
@@ -36,41 +41,83 @@
 #include "logger.h"
 #include <stdbool.h>
 #include <string.h>
-#include <string.h>
+#include <strings.h>
 
 #define _LOG_PFX "[fileWriter] "
 #define ERROR_SLEEP_DELAY_MS	500
-#define FILE_BUFFER_SIZE	1024
+#define FILE_BUFFER_COUNT	2
+#define FILE_BUFFER_SIZE	2048
+#define FILE_IO_STACK_SIZE	512
 #define FILE_WRITER_STACK_SIZE	512
+/* Write a journal checkpoint once this much data has been logged */
+#define JOURNAL_INTERVAL_BYTES	1024
 #define LOG_PFX	"[fileWriter] "
 #define MAX_LOG_FILE_INDEX	99999
+/* Never grow the log file by more than this at a time */
+#define PREALLOC_MAX_BYTES	(64UL * 1024 * 1024)
+/* Most we grow the log file by while holding the card */
+#define PREALLOC_STEP_BYTES	(256UL * 1024)
+/* Generous estimates of the space one channel value takes in a row */
+#define PREALLOC_CSV_VALUE_BYTES	12
+#define PREALLOC_RCB_VALUE_BYTES	8
+/* Recovery reads the log file this much at a time */
+#define RECOVERY_WINDOW		4096
+/* How far into the file to look for the first checkpoint */
+#define RECOVERY_ID_SCAN_BYTES	(4 * RECOVERY_WINDOW)
 #define WRITE_FAIL	EOF
 
 static FIL *g_logfile;
 static xQueueHandle g_LoggerMessage_queue;
-static struct ring_buff *file_buff;
+/* The buffer that rows are currently being formatted into */
+static struct ring_buff *fill_buff;
+/* Filled buffers waiting for the I/O task to write them to the card */
+static xQueueHandle g_file_io_queue;
+/* Written buffers that are ready to be filled again */
+static xQueueHandle g_file_free_queue;
+/* True if a dedicated I/O task drains the buffers.  Otherwise inline */
+TESTABLE_STATIC bool file_io_async;
+/* First write error seen by the I/O side since the last time we checked */
+static volatile FRESULT g_file_io_res;
+static struct file_writer_stats g_stats;
+/* Compressor scratch space, allocated the first time it is needed */
+static struct log_compress *g_compress;
+static uint8_t *g_compress_buff;
+/* True if the current log file holds compressed blocks */
+static bool compress_active;
+/* Where to start looking for a free log file name on the current mount */
+static struct {
+        bool valid;
+        unsigned int mount;
+        int next;
+} g_log_index;
 
 static void error_led(const bool on)
 {
         led_set(LED_ERROR, on);
 }
 
-static FRESULT flush_file_buffer(void)
+/**
+ * Writes up to len bytes from the front of a file buffer to the log file.
+ * @param rb The buffer to write from.
+ * @param len The maximum number of bytes to write.
+ */
+static FRESULT write_file_buffer(struct ring_buff *rb, size_t len)
 {
-        while(true) {
+        while(len) {
                 size_t available = 0;
-                const void* buff =
-                        ring_buffer_dma_read_init(file_buff, &available);
+                const void* buff = ring_buffer_dma_read_init(rb, &available);
 
                 /* If nothing to write, we are done. */
                 if (!available)
                         return FR_OK;
 
+                available = MIN(available, len);
                 unsigned int written = 0;
                 fs_lock();
                 const FRESULT res = f_write(g_logfile, buff, available, &written);
                 fs_unlock();
-                ring_buffer_dma_read_fini(file_buff, written);
+                ring_buffer_dma_read_fini(rb, written);
+                len -= MIN(len, written);
                 if (FR_OK != res) {
                         pr_debug_int_msg("[FileWriter] f_write failed "
                                          "with status: ", (int) res);
@@ -78,144 +125,340 @@ static FRESULT flush_file_buffer(void)
                         return res;
                 }
         }
+
+        return FR_OK;
 }
 
-static FRESULT append_file_buffer(const char *str)
+/**
+ * Compresses the buffer one contiguous chunk at a time and writes every
+ * chunk out as its own block, so each write can be decoded by itself.
+ */
+static FRESULT write_compressed_buffer(struct ring_buff *rb)
 {
-        if (!str)
-                return FR_OK;
+        while(true) {
+                size_t available = 0;
+                const void* buff = ring_buffer_dma_read_init(rb, &available);
 
-        FRESULT res = FR_OK;
-        size_t len = strlen(str);
-        while(len) {
-                const size_t write_len =
-                        MIN(ring_buffer_bytes_free(file_buff), len);
-                ring_buffer_put(file_buff, str, write_len);
-                str += write_len;
-                len -= write_len;
+                /* If nothing to write, we are done. */
+                if (!available)
+                        return FR_OK;
+
+                const size_t len = log_compress_block(g_compress, buff,
+                                                      available,
+                                                      g_compress_buff);
+                unsigned int written = 0;
+                fs_lock();
+                FRESULT res = f_write(g_logfile, g_compress_buff, len,
+                                      &written);
+                fs_unlock();
 
-                /* If not at end of string, more to write.  Flush */
-                if (len > 0)
-                        res = flush_file_buffer();
+                /* A partial block is no good to anyone.  Card is full */
+                if (FR_OK == res && written < len)
+                        res = FR_DENIED;
+
+                if (FR_OK != res) {
+                        pr_debug_int_msg("[FileWriter] f_write failed "
+                                         "with status: ", (int) res);
+                        error_led(true);
+                        return res;
+                }
+
+                ring_buffer_dma_read_fini(rb, available);
         }
+}
 
-        return res;
+/**
+ * Writes a filled buffer out to the log file and hands it back to be
+ * filled again.  Data that fails to write is dropped since the file will
+ * be re-opened by the writer task once it sees the error.
+ */
+static void drain_file_buffer(struct ring_buff *rb)
+{
+        const FRESULT res = compress_active ?
+                write_compressed_buffer(rb) :
+                write_file_buffer(rb, ring_buffer_bytes_used(rb));
+        if (FR_OK != res) {
+                ++g_stats.write_errors;
+                g_stats.dropped_bytes += ring_buffer_bytes_used(rb);
+                if (FR_OK == g_file_io_res)
+                        g_file_io_res = res;
+        }
+
+        ring_buffer_clear(rb);
+        xQueueSend(g_file_free_queue, &rb, portMAX_DELAY);
 }
 
-portBASE_TYPE queue_logfile_record(const LoggerMessage * const msg)
+/**
+ * Writes out the next filled buffer handed to the I/O side.
+ * @param timeout How long to wait for a buffer to show up.
+ * @return true if a buffer was written, false otherwise.
+ */
+TESTABLE_STATIC bool drain_next_file_buffer(const portTickType timeout)
 {
-        return send_logger_message(g_LoggerMessage_queue, msg);
+        struct ring_buff *rb;
+
+        if (pdPASS != xQueueReceive(g_file_io_queue, &rb, timeout))
+                return false;
+
+        drain_file_buffer(rb);
+        return true;
 }
 
-static void appendQuotedString(const char *s)
+static void fileIoTask(void *params)
 {
-        append_file_buffer("\"");
-        append_file_buffer(s);
-        append_file_buffer("\"");
+        while(1)
+                drain_next_file_buffer(portMAX_DELAY);
 }
 
-static void appendInt(int num)
+/**
+ * @return The first write error seen since the last call, or FR_OK.
+ */
+static FRESULT take_file_io_status(void)
 {
-        char buf[12];
-        modp_itoa10(num, buf);
-        buf[11] = '\0';
-        append_file_buffer(buf);
+        const FRESULT res = g_file_io_res;
+        g_file_io_res = FR_OK;
+        return res;
 }
 
-static void appendLongLong(long long num)
+/**
+ * Hands the fill buffer over to be written and swaps in an empty one so
+ * that formatting can carry on while the card is busy.  If every buffer
+ * is still being written we have no choice but to wait for one.
+ */
+static void submit_file_buffer(void)
+{
+        if (!ring_buffer_bytes_used(fill_buff))
+                return;
+
+        if (file_io_async)
+                xQueueSend(g_file_io_queue, &fill_buff, portMAX_DELAY);
+        else
+                drain_file_buffer(fill_buff);
+
+        if (pdPASS == xQueueReceive(g_file_free_queue, &fill_buff, 0))
+                return;
+
+        ++g_stats.buffer_stalls;
+        const portTickType start = xTaskGetTickCount();
+        xQueueReceive(g_file_free_queue, &fill_buff, portMAX_DELAY);
+
+        const uint32_t stall_ms = ticksToMs(xTaskGetTickCount() - start);
+        g_stats.stall_ms_high_water = MAX(g_stats.stall_ms_high_water,
+                                          stall_ms);
+}
+
+/**
+ * Waits until every submitted buffer has been written to the log file.
+ * Must be done before the file is synced or closed.
+ * @return The first write error seen since the last check, or FR_OK.
+ */
+static FRESULT sync_file_buffers(void)
+{
+        struct ring_buff *spare[FILE_BUFFER_COUNT - 1];
+        size_t i;
+
+        for (i = 0; i < ARRAY_LEN(spare); ++i)
+                xQueueReceive(g_file_free_queue, spare + i, portMAX_DELAY);
+
+        for (i = 0; i < ARRAY_LEN(spare); ++i)
+                xQueueSend(g_file_free_queue, spare + i, portMAX_DELAY);
+
+        return take_file_io_status();
+}
+
+static FRESULT flush_file_buffer(void)
 {
-        char buf[24];
-        modp_ltoa10(num, buf);
-        buf[23] = '\0';
-        append_file_buffer(buf);
+        submit_file_buffer();
+        return sync_file_buffers();
 }
 
-static void appendDouble(double num, int precision)
+/**
+ * @return The number of bytes the fill buffer may hold before it is
+ * handed off.  With coalescing enabled this is the sector aligned write
+ * threshold, so every coalesced write covers whole sectors.
+ */
+static size_t get_fill_limit(const struct logging_status *ls)
 {
-        char buf[32];
-        modp_dtoa(num, buf, precision);
-        buf[31] = '\0';
-        append_file_buffer(buf);
+        return ls->cfg.write_threshold ? ls->cfg.write_threshold :
+                ring_buffer_capacity(fill_buff);
 }
 
-static void appendFloat(float num, int precision)
+/**
+ * Hands buffered rows off for writing if the write policy says it is
+ * time.  With coalescing disabled everything is written immediately.
+ * Otherwise full buffers are handed off as rows are appended and we only
+ * need to push out a partial buffer once the oldest buffered row has
+ * waited longer than the latency deadline.
+ * @return The first write error seen since the last check, or FR_OK.
+ */
+TESTABLE_STATIC FRESULT commit_file_buffer(struct logging_status *ls)
 {
-        char buf[16];
-        modp_ftoa(num, buf, precision);
-        buf[15] = '\0';
-        append_file_buffer(buf);
+        const struct logfile_config *cfg = &ls->cfg;
+
+        if (ring_buffer_bytes_used(fill_buff) &&
+            (0 == cfg->write_threshold ||
+             isTimeoutMs(ls->buffer_tick, cfg->write_latency_ms)))
+                submit_file_buffer();
+
+        return take_file_io_status();
 }
 
-static int write_samples_header(const LoggerMessage *msg)
+/**
+ * Puts data into the fill buffer, handing it off for writing whenever it
+ * reaches its limit.
+ */
+static void put_file_buffer(struct logging_status *ls, const void *data,
+                            const size_t size)
 {
-        int i;
-        const ChannelSample *sample = msg->sample->channel_samples;
-        size_t count = msg->sample->channel_count;
+        const size_t limit = get_fill_limit(ls);
+        const char *str = data;
+        size_t len = size;
 
-        for (i = 0; 0 < count; count--, sample++, i++) {
-                append_file_buffer(0 == i ? "" : ",");
+        while(len) {
+                const size_t used = ring_buffer_bytes_used(fill_buff);
+                const size_t write_len = MIN(limit - MIN(used, limit), len);
+                ring_buffer_put(fill_buff, str, write_len);
+                str += write_len;
+                len -= write_len;
+
+                if (ring_buffer_bytes_used(fill_buff) < limit)
+                        continue;
 
-                uint8_t precision = sample->cfg->precision;
-                appendQuotedString(sample->cfg->label);
-                append_file_buffer("|");
-                appendQuotedString(sample->cfg->units);
-                append_file_buffer("|");
-                appendFloat(sample->cfg->min, precision);
-                append_file_buffer("|");
-                appendFloat(sample->cfg->max, precision);
-                append_file_buffer("|");
-                appendInt(decodeSampleRate(sample->cfg->sampleRate));
+                submit_file_buffer();
+
+                /* Whatever comes next is now the oldest data buffered */
+                ls->buffer_tick = xTaskGetTickCount();
         }
+}
+
+/**
+ * log_format_writer callback for formatted log data.
+ */
+static void append_file_buffer(const void *data, const size_t size,
+                               void *arg)
+{
+        struct logging_status *ls = arg;
 
-        append_file_buffer("\n");
-        return flush_file_buffer();
+        if (ls->cfg.journal)
+                log_journal_update(&ls->journal, data, size);
+
+        put_file_buffer(ls, data, size);
 }
 
+/**
+ * Writes a journal checkpoint covering everything logged since the last
+ * one.  Only done in between rows so that CSV logs stay line oriented.
+ */
+static void write_checkpoint(struct logging_status *ls)
+{
+        char buf[LOG_JOURNAL_CHECKPOINT_LEN];
 
-static int write_samples_data(const LoggerMessage *msg)
+        const size_t len = log_journal_checkpoint(&ls->journal, buf,
+                                                  xTaskGetTickCount(),
+                                                  ls->rows_written);
+        put_file_buffer(ls, buf, len);
+}
+
+portBASE_TYPE queue_logfile_record(const LoggerMessage * const msg)
 {
-        const ChannelSample *sample = msg->sample->channel_samples;
-        size_t count = msg->sample->channel_count;
+        const portBASE_TYPE res =
+                send_logger_message(SAMPLE_CONSUMER_FILE,
+                                    g_LoggerMessage_queue, msg);
+        if (pdPASS != res)
+                ++g_stats.queue_overflows;
 
-        if (NULL == sample) {
-                pr_warning(_LOG_PFX "null sample record\r\n");
-                return WRITE_FAIL;
-        }
+        return res;
+}
 
-        int i;
-        for (i = 0; 0 < count; count--, sample++, i++) {
-                append_file_buffer(0 == i ? "" : ",");
+void file_writer_get_stats(struct file_writer_stats *stats)
+{
+        *stats = g_stats;
+}
 
-                if (!sample->populated)
-                        continue;
+static int write_samples_header(struct logging_status *ls,
+                                const LoggerMessage *msg)
+{
+        const struct log_format_writer w = {
+                .write = append_file_buffer,
+                .arg = ls,
+        };
+
+        switch (ls->cfg.format) {
+        case LOGFILE_FORMAT_RCB:
+                log_format_rcb_header(&w, msg->sample);
+                break;
+        default:
+                log_format_csv_header(&w, msg->sample);
+                break;
+        }
 
-                const int precision = sample->cfg->precision;
+        return FR_OK;
+}
 
-                switch(sample->sampleData) {
-                case SampleData_Float:
-                case SampleData_Float_Noarg:
-                        appendFloat(sample->valueFloat, precision);
-                        break;
-                case SampleData_Int:
-                case SampleData_Int_Noarg:
-                        appendInt(sample->valueInt);
-                        break;
-                case SampleData_LongLong:
-                case SampleData_LongLong_Noarg:
-                        appendLongLong(sample->valueLongLong);
-                        break;
-                case SampleData_Double:
-                case SampleData_Double_Noarg:
-                        appendDouble(sample->valueDouble, precision);
-                        break;
-                default:
-                        pr_warning(_LOG_PFX "Unknown channel "
-                                   "sample type\n");
-                }
+static int write_samples_data(struct logging_status *ls,
+                              const LoggerMessage *msg)
+{
+        const struct log_format_writer w = {
+                .write = append_file_buffer,
+                .arg = ls,
+        };
+        int rc;
+
+        switch (ls->cfg.format) {
+        case LOGFILE_FORMAT_RCB:
+                rc = log_format_rcb_record(&w, msg->sample, msg->ticks);
+                break;
+        case LOGFILE_FORMAT_CSV_SPARSE:
+                rc = log_format_csv_sparse_row(&w, msg->sample);
+                break;
+        default:
+                rc = log_format_csv_row(&w, msg->sample);
+                break;
         }
 
-        append_file_buffer("\n");
-        return flush_file_buffer();
+        return rc ? WRITE_FAIL : FR_OK;
+}
+
+void logfile_sanitize_config(struct logfile_config *cfg)
+{
+        cfg->write_threshold = MIN(cfg->write_threshold, FILE_BUFFER_SIZE);
+        cfg->write_threshold -= cfg->write_threshold % SD_SECTOR_SIZE;
+
+        if (cfg->format >= __LOGFILE_FORMAT_COUNT)
+                cfg->format = LOGFILE_FORMAT_CSV;
+}
+
+void logfile_get_config(const struct logfile_config *cfg,
+                        struct Serial *serial, const bool more)
+{
+        json_objStartString(serial, "logFileCfg");
+        json_int(serial, "wrThresh", cfg->write_threshold, true);
+        json_int(serial, "wrLatMs", cfg->write_latency_ms, true);
+        json_int(serial, "fmt", cfg->format, true);
+        json_int(serial, "preMin", cfg->prealloc_minutes, true);
+        json_bool(serial, "comp", cfg->compress, true);
+        json_bool(serial, "jrnl", cfg->journal, false);
+        json_objEnd(serial, more);
+}
+
+bool logfile_set_config(struct logfile_config *cfg, const jsmntok_t *json)
+{
+        int val;
+
+        if (jsmn_exists_set_val_int(json, "wrThresh", &val))
+                cfg->write_threshold = MIN(MAX(0, val), UINT16_MAX);
+
+        if (jsmn_exists_set_val_int(json, "wrLatMs", &val))
+                cfg->write_latency_ms = MIN(MAX(0, val), UINT16_MAX);
+
+        jsmn_exists_set_val_uint8(json, "fmt", &cfg->format, NULL);
+        jsmn_exists_set_val_uint8(json, "preMin", &cfg->prealloc_minutes,
+                                  NULL);
+        jsmn_exists_set_val_bool(json, "comp", &cfg->compress);
+        jsmn_exists_set_val_bool(json, "jrnl", &cfg->journal);
+
+        logfile_sanitize_config(cfg);
+        return true;
 }
 
 static enum writing_status open_existing_log_file(struct logging_status *ls)
@@ -237,26 +480,310 @@ static enum writing_status open_existing_log_file(struct logging_status *ls)
         return rc == FR_OK ? WRITING_ACTIVE : WRITING_INACTIVE;
 }
 
+/**
+ * @return The index of a log file name such as rc_12.log, or -1 if the
+ * name isn't one of our log files.
+ */
+TESTABLE_STATIC int get_log_file_index(const char *name)
+{
+        if (strncasecmp(name, "rc_", 3))
+                return -1;
+
+        const char *ext = name + 3;
+        int index = 0;
+        for (; *ext >= '0' && *ext <= '9'; ++ext)
+                index = index * 10 + *ext - '0';
+
+        if (ext == name + 3 ||
+            (strcasecmp(ext, ".log") && strcasecmp(ext, ".rcb") &&
+             strcasecmp(ext, ".rcs") && strcasecmp(ext, ".rcz")))
+                return -1;
+
+        return index;
+}
+
+/**
+ * Scans the root directory once for the highest numbered log file.  This
+ * replaces opening every name in turn, which gets slow on cards holding
+ * hundreds of sessions because each f_open searches the directory again.
+ * @param last_name Gets the name of the highest numbered log file, if any.
+ * Must hold FILENAME_LEN bytes.
+ * @return The index after the highest one in use.
+ */
+static int find_next_log_index(char *last_name)
+{
+        DIR dir;
+        FILINFO info;
+        int next = 0;
+
+        /* The short name is all we need */
+        info.lfname = NULL;
+        info.lfsize = 0;
+
+        fs_lock();
+        FRESULT res = f_opendir(&dir, "");
+        fs_unlock();
+
+        while (FR_OK == res) {
+                fs_lock();
+                res = f_readdir(&dir, &info);
+                fs_unlock();
+
+                if (FR_OK != res || '\0' == info.fname[0])
+                        break;
+
+                const int index = get_log_file_index(info.fname);
+                if (index >= next) {
+                        next = index + 1;
+                        strncpy(last_name, info.fname, FILENAME_LEN - 1);
+                        last_name[FILENAME_LEN - 1] = '\0';
+                }
+        }
+
+        fs_lock();
+        f_closedir(&dir);
+        fs_unlock();
+
+        return next;
+}
+
+static const char* get_log_file_ext(const struct logfile_config *cfg)
+{
+        if (cfg->compress)
+                return ".rcz";
+
+        switch (cfg->format) {
+        case LOGFILE_FORMAT_RCB:
+                return ".rcb";
+        case LOGFILE_FORMAT_CSV_SPARSE:
+                /* Looks like CSV, but tools must not read it as such */
+                return ".rcs";
+        default:
+                return ".log";
+        }
+}
+
+/**
+ * Reads part of the log file being recovered.
+ * @return The number of bytes read, or 0 on error.
+ */
+static size_t read_log_file(void *buf, const DWORD pos, const size_t len)
+{
+        UINT read = 0;
+
+        fs_lock();
+        FRESULT res = f_lseek(g_logfile, pos);
+        if (FR_OK == res)
+                res = f_read(g_logfile, buf, len, &read);
+        fs_unlock();
+
+        return FR_OK == res ? read : 0;
+}
+
+/**
+ * Gets the journal id of the open log file from its first checkpoint.
+ * @return true if found, false if the file isn't journaled.
+ */
+static bool find_journal_id(uint8_t *buf, uint32_t *id)
+{
+        const DWORD size = MIN(f_size(g_logfile), RECOVERY_ID_SCAN_BYTES);
+        const DWORD step = RECOVERY_WINDOW - LOG_JOURNAL_CHECKPOINT_LEN;
+        struct log_journal_checkpoint cp;
+
+        for (DWORD pos = 0; pos < size; pos += step) {
+                const size_t len = read_log_file(buf, pos,
+                                                 MIN(RECOVERY_WINDOW,
+                                                     size - pos));
+                if (!len)
+                        return false;
+
+                if (log_journal_find_first(buf, len, &cp)) {
+                        *id = cp.id;
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/**
+ * Checks the checkpoint at pos in the open log file against the data
+ * before it.  That data is read a window at a time, so a block of any
+ * length can be verified.  Clobbers buf.
+ * @return true if the checkpoint is good, false otherwise.
+ */
+static bool verify_checkpoint(uint8_t *buf, const uint32_t id,
+                              const DWORD pos)
+{
+        struct log_journal_checkpoint cp;
+        struct log_journal j;
+
+        if (LOG_JOURNAL_CHECKPOINT_LEN !=
+            read_log_file(buf, pos, LOG_JOURNAL_CHECKPOINT_LEN) ||
+            !log_journal_parse(buf, LOG_JOURNAL_CHECKPOINT_LEN, &cp) ||
+            cp.len > pos)
+                return false;
+
+        log_journal_init(&j, id);
+        for (DWORD start = pos - cp.len; start < pos;) {
+                const size_t len = read_log_file(buf, start,
+                                                 MIN(RECOVERY_WINDOW,
+                                                     pos - start));
+                if (!len)
+                        return false;
+
+                log_journal_update(&j, buf, len);
+                start += len;
+        }
+
+        return LOG_JOURNAL_CHECKPOINT_LEN ==
+                read_log_file(buf, pos, LOG_JOURNAL_CHECKPOINT_LEN) &&
+                log_journal_verify(&j, buf);
+}
+
+/**
+ * Looks back from the end of the open log file for its last good
+ * checkpoint.  Windows overlap so that every checkpoint lies entirely
+ * within one of them, newest first.
+ * @param max_scan How far back from the end to give up looking.
+ * @return The offset just past the checkpoint, or -1 if not found.
+ */
+static long find_recovery_point(uint8_t *buf, const uint32_t id,
+                                const DWORD max_scan)
+{
+        const DWORD size = f_size(g_logfile);
+        const DWORD step = RECOVERY_WINDOW - LOG_JOURNAL_CHECKPOINT_LEN + 1;
+        struct log_journal_checkpoint cp;
+        DWORD end = size;
+
+        while (end && size - end <= max_scan) {
+                const DWORD start = end > RECOVERY_WINDOW ?
+                        end - RECOVERY_WINDOW : 0;
+                const size_t len = end - start;
+                if (read_log_file(buf, start, len) != len)
+                        return -1;
+
+                for (size_t i = len; i-- > 0;) {
+                        if ('#' != buf[i] ||
+                            !log_journal_parse(buf + i, len - i, &cp) ||
+                            id != cp.id)
+                                continue;
+
+                        if (verify_checkpoint(buf, id, start + i))
+                                return (long) (start + i +
+                                               LOG_JOURNAL_CHECKPOINT_LEN);
+
+                        /* Verifying used the buffer, so get the window back */
+                        if (read_log_file(buf, start, len) != len)
+                                return -1;
+                }
+
+                if (!start)
+                        break;
+
+                end = end > step ? end - step : 0;
+        }
+
+        return -1;
+}
+
+/**
+ * Trims a journaled log file back to its last good checkpoint.  A power
+ * loss can leave a partial row, or with pre-allocation a whole lot of
+ * leftover junk, after the last data that made it to the card.  Files
+ * without checkpoints are left alone.
+ * @param name The log file to recover.  Must not be open.
+ * @param max_scan How far back from the end to look for a checkpoint.
+ */
+static void recover_log_file(const char *name, const DWORD max_scan)
+{
+        uint8_t *buf = portMalloc(RECOVERY_WINDOW);
+        if (!buf) {
+                pr_warning(_LOG_PFX "No memory for recovery\r\n");
+                return;
+        }
+
+        fs_lock();
+        FRESULT res = f_open(g_logfile, name, FA_READ | FA_WRITE);
+        fs_unlock();
+
+        if (FR_OK != res) {
+                portFree(buf);
+                return;
+        }
+
+        uint32_t id;
+        const long end = find_journal_id(buf, &id) ?
+                find_recovery_point(buf, id, max_scan) : -1;
+
+        if (end >= 0 && (DWORD) end < f_size(g_logfile)) {
+                pr_info_str_msg(_LOG_PFX "Recovering ", name);
+
+                fs_lock();
+                res = f_lseek(g_logfile, (DWORD) end);
+                if (FR_OK == res)
+                        res = f_truncate(g_logfile);
+                fs_unlock();
+
+                if (FR_OK != res)
+                        pr_warning_int_msg(_LOG_PFX "Recovery failed: ",
+                                           res);
+        }
+
+        fs_lock();
+        f_close(g_logfile);
+        fs_unlock();
+
+        portFree(buf);
+}
+
 static enum writing_status open_new_log_file(struct logging_status *ls)
 {
         pr_debug(_LOG_PFX "Opening new log file\r\n");
 
-        int i;
+        /* Anything we knew about the card is stale once it is remounted */
+        const unsigned int mount = sdcard_mount_count();
+        if (!g_log_index.valid || g_log_index.mount != mount) {
+                char last_name[FILENAME_LEN] = "";
+
+                g_log_index.next = find_next_log_index(last_name);
+                g_log_index.mount = mount;
+                g_log_index.valid = true;
+
+                /*
+                 * The last file on the card may have been cut short.  The
+                 * good data can't end further back than one pre-allocation
+                 * from the end.
+                 */
+                if (ls->cfg.journal && last_name[0])
+                        recover_log_file(last_name, ls->prealloc_size +
+                                         RECOVERY_WINDOW);
+        }
 
-        for (i = 0; i < MAX_LOG_FILE_INDEX; i++) {
+        /*
+         * Normally the first name is free.  We still probe in case files
+         * showed up behind our back.  Once we run out of names past the
+         * last file we go back and look for a free one from the start.
+         */
+        const int start = g_log_index.next < MAX_LOG_FILE_INDEX ?
+                g_log_index.next : 0;
+        for (int n = 0; n < MAX_LOG_FILE_INDEX; n++) {
+                const int i = (start + n) % MAX_LOG_FILE_INDEX;
                 char buf[12];
                 modp_itoa10(i, buf);
 
                 strcpy(ls->name, "rc_");
                 strcat(ls->name, buf);
-                strcat(ls->name, ".log");
+                strcat(ls->name, get_log_file_ext(&ls->cfg));
 
                 fs_lock();
                 const FRESULT res = f_open(g_logfile, ls->name, FA_WRITE | FA_CREATE_NEW);
                 fs_unlock();
 
-                if ( FR_OK == res )
+                if ( FR_OK == res ) {
+                        g_log_index.next = i + 1;
                         return WRITING_ACTIVE;
+                }
 
                 fs_lock();
                 f_close(g_logfile);
@@ -268,10 +795,98 @@ static enum writing_status open_new_log_file(struct logging_status *ls)
         return WRITING_INACTIVE;
 }
 
+/**
+ * Works out how much to grow the log file by at a time, based on how much
+ * data we expect to log over the configured number of minutes.
+ * @return The pre-allocation size in bytes, or 0 if disabled.
+ */
+TESTABLE_STATIC DWORD get_prealloc_size(const struct logfile_config *cfg,
+                                        LoggerConfig *lc)
+{
+        if (!cfg->prealloc_minutes)
+                return 0;
+
+        const unsigned int rate = getHighestSampleRate(lc);
+        if (SAMPLE_DISABLED == rate)
+                return 0;
+
+        const uint64_t value_bytes = LOGFILE_FORMAT_RCB == cfg->format ?
+                PREALLOC_RCB_VALUE_BYTES : PREALLOC_CSV_VALUE_BYTES;
+        const uint64_t row_bytes =
+                value_bytes * get_enabled_channel_count(lc);
+        uint64_t size = row_bytes * decodeSampleRate(rate) * 60 *
+                cfg->prealloc_minutes;
+
+        size = MIN(size, PREALLOC_MAX_BYTES);
+        return (DWORD) (size - size % SD_SECTOR_SIZE);
+}
+
+/**
+ * Grows the log file well ahead of the write pointer once the space left
+ * in the current pre-allocation runs low.  Doing it ahead of time lets
+ * FatFs allocate the clusters together instead of extending the cluster
+ * chain (and updating the FAT) in the middle of our writes.  It is done in
+ * steps of PREALLOC_STEP_BYTES so other users of the card aren't held up
+ * for the whole extent.  The file must not have writes in flight when this
+ * is called.
+ */
+static void extend_log_file(struct logging_status *ls)
+{
+        if (!ls->prealloc_size)
+                return;
+
+        const DWORD pos = f_tell(g_logfile);
+        if (f_size(g_logfile) - pos > ls->prealloc_size / 2)
+                return;
+
+        /* Seeking past the end of a file opened for writing grows it */
+        const DWORD end = pos + ls->prealloc_size;
+        FRESULT res = FR_OK;
+        bool full = false;
+        for (DWORD size = f_size(g_logfile); FR_OK == res && size < end;) {
+                fs_lock();
+                res = f_lseek(g_logfile, MIN(size + PREALLOC_STEP_BYTES, end));
+                fs_unlock();
+
+                /* FatFs clips the file instead of failing when the card fills */
+                const DWORD grown = f_size(g_logfile);
+                if (grown <= size) {
+                        full = true;
+                        break;
+                }
+                size = grown;
+        }
+
+        fs_lock();
+        FRESULT seek_res = f_lseek(g_logfile, pos);
+        /* Give the space back to the rows and stop growing this file */
+        if (full && FR_OK == seek_res)
+                seek_res = f_truncate(g_logfile);
+        fs_unlock();
+        if (FR_OK == res)
+                res = seek_res;
+
+        if (full) {
+                pr_warning(_LOG_PFX "Card full, prealloc disabled\r\n");
+                ls->prealloc_size = 0;
+        }
+
+        if (FR_OK != res)
+                pr_warning_int_msg(_LOG_PFX "Prealloc failed: ", res);
+}
+
 static void close_log_file(struct logging_status *ls)
 {
         ls->writing_status = WRITING_INACTIVE;
+
+        /* Don't pull the file out from under buffers still being written */
+        sync_file_buffers();
+
         fs_lock();
+        /* Give back whatever pre-allocated space we didn't use */
+        if (ls->prealloc_size)
+                f_truncate(g_logfile);
+
         f_close(g_logfile);
         fs_unlock();
 }
@@ -286,6 +901,24 @@ static void logging_led_off(void)
         led_disable(LED_LOGGER);
 }
 
+/**
+ * Starts a new block of journaled data.  Checkpoints in a new file get an
+ * id of their own.  A re-opened file keeps its id, and whatever reached
+ * the file since its last checkpoint is left for recovery to sort out.
+ */
+static void start_journal(struct logging_status *ls, const bool new_file)
+{
+        uint32_t id = ls->journal.id;
+
+        if (new_file) {
+                const portTickType tick = xTaskGetTickCount();
+                id = crc32_update(CRC32_INIT, ls->name, strlen(ls->name));
+                id = crc32_final(crc32_update(id, &tick, sizeof(tick)));
+        }
+
+        log_journal_init(&ls->journal, id);
+}
+
 static void open_log_file(struct logging_status *ls)
 {
         pr_info(_LOG_PFX "Opening log file\r\n");
@@ -314,8 +947,9 @@ static void open_log_file(struct logging_status *ls)
 
 
         // Open a file if one is set, else create a new one.
-        ls->writing_status = ls->name[0] ? open_existing_log_file(ls) :
-                             open_new_log_file(ls);
+        const bool new_file = !ls->name[0];
+        ls->writing_status = new_file ? open_new_log_file(ls) :
+                             open_existing_log_file(ls);
 
         if (WRITING_INACTIVE == ls->writing_status) {
                 pr_warning_str_msg(_LOG_PFX "Failed to open: ", ls->name);
@@ -325,6 +959,27 @@ static void open_log_file(struct logging_status *ls)
         pr_info_str_msg(_LOG_PFX "Opened " , ls->name);
         ls->flush_tick = xTaskGetTickCount();
         ls->last_sample_tick = 0;
+
+        if (ls->cfg.journal)
+                start_journal(ls, new_file);
+
+        extend_log_file(ls);
+}
+
+/**
+ * Allocates the compressor scratch space if not already done.
+ * @return true if the compressor is ready, false otherwise.
+ */
+static bool init_compressor(void)
+{
+        if (!g_compress)
+                g_compress = portMalloc(sizeof(struct log_compress));
+
+        if (!g_compress_buff)
+                g_compress_buff = portMalloc(
+                        LOG_COMPRESS_BLOCK_BOUND(FILE_BUFFER_SIZE));
+
+        return g_compress && g_compress_buff;
 }
 
 TESTABLE_STATIC int logging_start(struct logging_status *ls)
@@ -332,6 +987,31 @@ TESTABLE_STATIC int logging_start(struct logging_status *ls)
         pr_info(_LOG_PFX "Start\r\n");
         ls->logging = true;
 
+        LoggerConfig *lc = getWorkingLoggerConfig();
+        ls->cfg = lc->logging_cfg.logfile;
+        logfile_sanitize_config(&ls->cfg);
+
+        if (ls->cfg.compress && !init_compressor()) {
+                pr_warning(_LOG_PFX "Compression unavailable\r\n");
+                ls->cfg.compress = false;
+        }
+        compress_active = ls->cfg.compress;
+
+        /*
+         * Checkpoints would be buried inside compressed blocks, and those
+         * already end cleanly at the last complete block.
+         */
+        if (compress_active)
+                ls->cfg.journal = false;
+
+        /*
+         * Without checkpoints to mark where the good data ends, a power
+         * loss would leave whatever was on the card in the pre-allocated
+         * tail looking like part of the log.
+         */
+        ls->prealloc_size = ls->cfg.journal ?
+                get_prealloc_size(&ls->cfg, lc) : 0;
+
         /* Set this here because this is the start of the log stream */
         ls->rows_written = 0;
 
@@ -344,6 +1024,15 @@ TESTABLE_STATIC int logging_stop(struct logging_status *ls)
         pr_debug(_LOG_PFX "End\r\n");
         ls->logging = false;
 
+        /* Write out whatever rows are still waiting in the buffer */
+        if (WRITING_ACTIVE == ls->writing_status) {
+                if (ls->cfg.journal && ls->journal.len)
+                        write_checkpoint(ls);
+
+                flush_file_buffer();
+        }
+
+        ring_buffer_clear(fill_buff);
         close_log_file(ls);
 
         /* Prevent log file from being re-opened */
@@ -355,12 +1044,6 @@ TESTABLE_STATIC int logging_stop(struct logging_status *ls)
 
 static int write_samples(struct logging_status *ls, const LoggerMessage *msg)
 {
-        /* Ensure the LoggerMessage we are writing is valid */
-        if (!is_sample_data_valid(msg)) {
-                pr_warning(LOG_PFX "Sample invalid.  Skipping...\r\n");
-                return 0;
-        }
-
         /* Ensure that we don't write a sample that is older than previous */
         if (msg->ticks < ls->last_sample_tick) {
                 pr_debug(LOG_PFX "Sample is too old.  Skipping...\r\n");
@@ -370,23 +1053,37 @@ static int write_samples(struct logging_status *ls, const LoggerMessage *msg)
 
         int rc = 0;
 
+        /* Start the latency clock if these are the first buffered rows */
+        if (!ring_buffer_bytes_used(fill_buff))
+                ls->buffer_tick = xTaskGetTickCount();
+
         /* If we haven't written to this file yet, start with the headers */
         if (0 == ls->rows_written) {
-                rc = write_samples_header(msg);
+                rc = write_samples_header(ls, msg);
 
                 /* If headers written, then don't write them again */
                 if (0 == rc)
                         ls->rows_written++;
+
+                /* Gives recovery an early checkpoint to get the id from */
+                if (0 == rc && ls->cfg.journal)
+                        write_checkpoint(ls);
         }
 
         /* If the above write failed, then don't bother with the next */
         if (0 != rc)
                 return rc;
 
-        rc = write_samples_data(msg);
+        rc = write_samples_data(ls, msg);
 
-        if (0 == rc)
+        if (0 == rc) {
                 ls->rows_written++;
+                if (ls->cfg.journal &&
+                    ls->journal.len >= JOURNAL_INTERVAL_BYTES)
+                        write_checkpoint(ls);
+
+                rc = commit_file_buffer(ls);
+        }
 
         return rc;
 }
@@ -437,15 +1134,32 @@ TESTABLE_STATIC int logging_sample(struct logging_status *ls,
         return rc;
 }
 
+/**
+ * Syncing keeps the file size in the directory entry current.  A
+ * pre-allocated file is already big enough to cover what we write, and
+ * with checkpoints recovery can find where the good data ends, so we can
+ * sync far less often.
+ */
+static unsigned int get_flush_interval(const struct logging_status *ls)
+{
+        return ls->cfg.journal && ls->prealloc_size ?
+                JOURNAL_FLUSH_INTERVAL_MS : FLUSH_INTERVAL_MS;
+}
+
 TESTABLE_STATIC int flush_logfile(struct logging_status *ls)
 {
         if (ls->writing_status != WRITING_ACTIVE)
                 return -1;
 
-        if (!isTimeoutMs(ls->flush_tick, FLUSH_INTERVAL_MS))
+        if (!isTimeoutMs(ls->flush_tick, get_flush_interval(ls)))
                 return -2;
 
         pr_debug(_LOG_PFX "flush\r\n");
+
+        /* Make sure everything buffered reaches the file before we sync */
+        flush_file_buffer();
+        extend_log_file(ls);
+
         fs_lock();
         const int res = f_sync(g_logfile);
         fs_unlock();
@@ -473,6 +1187,19 @@ static void update_logger_status(struct logging_status *ls)
         }
 }
 
+/**
+ * @return How long we may block waiting for the next message without
+ * missing the latency deadline of rows waiting in the buffer.
+ */
+static portTickType get_receive_timeout(const struct logging_status *ls)
+{
+        if (WRITING_ACTIVE != ls->writing_status ||
+            !ring_buffer_bytes_used(fill_buff))
+                return portMAX_DELAY;
+
+        return msToTicks(ls->cfg.write_latency_ms);
+}
+
 static void fileWriterTask(void *params)
 {
         LoggerMessage msg;
@@ -484,11 +1211,23 @@ static void fileWriterTask(void *params)
 
                 /* Get a sample. */
                 const char status = receive_logger_message(g_LoggerMessage_queue,
-                                    &msg, portMAX_DELAY);
+                                    &msg, get_receive_timeout(&ls));
 
-                /* If we fail to receive for any reason, keep trying */
-                if (pdPASS != status)
+                /*
+                 * If we fail to receive for any reason, keep trying.  Give
+                 * any rows that are waiting on the buffer a chance to make
+                 * their deadline first.
+                 */
+                if (pdPASS != status) {
+                        if (WRITING_ACTIVE == ls.writing_status)
+                                commit_file_buffer(&ls);
                         continue;
+                }
+
+                const unsigned portBASE_TYPE waiting =
+                        1 + uxQueueMessagesWaiting(g_LoggerMessage_queue);
+                g_stats.queue_high_water = MAX(g_stats.queue_high_water,
+                                               waiting);
 
                 switch (msg.type) {
                 case LoggerMessageType_Sample:
@@ -513,11 +1252,57 @@ static void fileWriterTask(void *params)
                         pr_debug_int_msg(" failed with code ", rc);
                 }
 
+                /* Done with the sample.  Let the logger reuse it */
+                release_logger_message(SAMPLE_CONSUMER_FILE, &msg);
+
                 flush_logfile(&ls);
                 update_logger_status(&ls);
         }
 }
 
+/**
+ * Allocates the log file handle and the file buffers if not already done.
+ * @return true if all are available, false otherwise.
+ */
+TESTABLE_STATIC bool init_file_buffers(void)
+{
+        if (!g_logfile) {
+                g_logfile = (FIL *) portMalloc(sizeof(FIL));
+                if (NULL == g_logfile) {
+                        pr_error(_LOG_PFX "logfile sruct alloc err\r\n");
+                        return false;
+                }
+                memset(g_logfile, 0, sizeof(FIL));
+        }
+
+        if (!g_file_free_queue) {
+                g_file_io_queue = xQueueCreate(FILE_BUFFER_COUNT,
+                                               sizeof(struct ring_buff *));
+                g_file_free_queue = xQueueCreate(FILE_BUFFER_COUNT,
+                                                 sizeof(struct ring_buff *));
+                if (!g_file_io_queue || !g_file_free_queue) {
+                        pr_error(_LOG_PFX "Failed to alloc buffer queues\r\n");
+                        return false;
+                }
+
+                for (size_t i = 0; i < FILE_BUFFER_COUNT; ++i) {
+                        struct ring_buff *rb =
+                                ring_buffer_create(FILE_BUFFER_SIZE);
+                        if (!rb) {
+                                pr_error(_LOG_PFX "Failed to alloc ring "
+                                         "buffer.\r\n");
+                                return false;
+                        }
+                        xQueueSend(g_file_free_queue, &rb, 0);
+                }
+        }
+
+        if (!fill_buff)
+                xQueueReceive(g_file_free_queue, &fill_buff, 0);
+
+        return NULL != fill_buff;
+}
+
 void startFileWriterTask(int priority)
 {
         g_LoggerMessage_queue = create_logger_message_queue();
@@ -527,21 +1312,22 @@ void startFileWriterTask(int priority)
                 return;
         }
 
-        g_logfile = (FIL *) portMalloc(sizeof(FIL));
-        if (NULL == g_logfile) {
-                pr_error(_LOG_PFX "logfile sruct alloc err\r\n");
+        if (!init_file_buffers())
                 return;
-        }
-        memset(g_logfile, 0, sizeof(FIL));
 
-        file_buff = ring_buffer_create(FILE_BUFFER_SIZE);
-        if (!file_buff) {
-                pr_error(_LOG_PFX "Failed to alloc ring buffer.\r\n");
-                return;
-        }
+        sample_consumer_subscribe(SAMPLE_CONSUMER_FILE);
 
         /* Make all task names 16 chars including NULL char */
         static const signed portCHAR task_name[] = "File Task       ";
         xTaskCreate(fileWriterTask, task_name, FILE_WRITER_STACK_SIZE,
                     NULL, priority, NULL );
+
+        /*
+         * The I/O task runs at the same priority so that it can write out
+         * one buffer while the writer task formats rows into the other.
+         */
+        static const signed portCHAR io_task_name[] = "File IO Task    ";
+        file_io_async = pdPASS == xTaskCreate(fileIoTask, io_task_name,
+                                              FILE_IO_STACK_SIZE, NULL,
+                                              priority, NULL);
 }
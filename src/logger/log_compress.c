@@ -0,0 +1,294 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log_compress.h"
+#include "macros.h"
+#include "mem_mang.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define MIN_MATCH	4
+#define RUN_MASK	15
+#define MAX_OFFSET	UINT16_MAX
+
+static uint32_t read_u32(const uint8_t *p)
+{
+        uint32_t val;
+        memcpy(&val, p, sizeof(val));
+        return val;
+}
+
+static void put_u16(uint8_t *p, const uint16_t val)
+{
+        p[0] = val;
+        p[1] = val >> 8;
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+        return p[0] | p[1] << 8;
+}
+
+static size_t hash(const uint32_t val)
+{
+        return (val * 2654435761U) >> (32 - LOG_COMPRESS_HASH_BITS);
+}
+
+/**
+ * Appends a length that didn't fit in its token nibble.
+ * @return The new output position, or NULL if out of space.
+ */
+static uint8_t* put_length(uint8_t *op, const uint8_t *end, size_t len)
+{
+        for (; len >= 255; len -= 255) {
+                if (op >= end)
+                        return NULL;
+                *op++ = 255;
+        }
+
+        if (op >= end)
+                return NULL;
+
+        *op++ = len;
+        return op;
+}
+
+/**
+ * Appends a sequence of literals, optionally followed by a match.
+ * @return The new output position, or NULL if out of space.
+ */
+static uint8_t* put_sequence(uint8_t *op, const uint8_t *end,
+                             const uint8_t *literals, const size_t lit_len,
+                             const size_t offset, const size_t match_len)
+{
+        if (op >= end)
+                return NULL;
+
+        uint8_t *token = op++;
+        *token = MIN(lit_len, RUN_MASK) << 4;
+        if (lit_len >= RUN_MASK &&
+            !(op = put_length(op, end, lit_len - RUN_MASK)))
+                return NULL;
+
+        if ((size_t) (end - op) < lit_len)
+                return NULL;
+
+        memcpy(op, literals, lit_len);
+        op += lit_len;
+
+        /* The last sequence in a block has literals only */
+        if (!match_len)
+                return op;
+
+        if (end - op < 2)
+                return NULL;
+
+        put_u16(op, offset);
+        op += 2;
+
+        const size_t len = match_len - MIN_MATCH;
+        *token |= MIN(len, RUN_MASK);
+        if (len >= RUN_MASK)
+                op = put_length(op, end, len - RUN_MASK);
+
+        return op;
+}
+
+/**
+ * Compresses src into dst, giving up once the output would be no smaller
+ * than the input.
+ * @return The compressed length, or 0 if it didn't pay off.
+ */
+static size_t compress(struct log_compress *lc, const uint8_t *src,
+                       const size_t len, uint8_t *dst)
+{
+        const uint8_t *end = dst + len;
+        uint8_t *op = dst;
+        size_t anchor = 0;
+        size_t ip = 0;
+
+        memset(lc->table, 0, sizeof(lc->table));
+
+        while (op && ip + MIN_MATCH <= len) {
+                const uint32_t seq = read_u32(src + ip);
+                const size_t h = hash(seq);
+                const size_t ref = lc->table[h];
+                lc->table[h] = ip + 1;
+
+                if (!ref || ip - (ref - 1) > MAX_OFFSET ||
+                    read_u32(src + ref - 1) != seq) {
+                        ++ip;
+                        continue;
+                }
+
+                size_t match_len = MIN_MATCH;
+                while (ip + match_len < len &&
+                       src[ref - 1 + match_len] == src[ip + match_len])
+                        ++match_len;
+
+                op = put_sequence(op, end, src + anchor, ip - anchor,
+                                  ip - (ref - 1), match_len);
+
+                /*
+                 * Remember the positions we are skipping over too.  Log
+                 * rows repeat a lot, so this finds far more matches.
+                 */
+                const size_t match_end = ip + match_len;
+                for (++ip; ip < match_end && ip + MIN_MATCH <= len; ++ip)
+                        lc->table[hash(read_u32(src + ip))] = ip + 1;
+
+                ip = match_end;
+                anchor = ip;
+        }
+
+        if (op)
+                op = put_sequence(op, end, src + anchor, len - anchor, 0, 0);
+
+        return op && op < end ? (size_t) (op - dst) : 0;
+}
+
+size_t log_compress_block(struct log_compress *lc, const void *src,
+                          const size_t len, void *dst)
+{
+        uint8_t *block = dst;
+        uint8_t *payload = block + LOG_COMPRESS_HEADER_LEN;
+
+        size_t payload_len = compress(lc, src, len, payload);
+        if (!payload_len) {
+                /* Didn't compress.  Store it as is */
+                memcpy(payload, src, len);
+                payload_len = len;
+        }
+
+        memcpy(block, LOG_COMPRESS_MAGIC, LOG_COMPRESS_MAGIC_LEN);
+        put_u16(block + 2, len);
+        put_u16(block + 4, payload_len);
+
+        return LOG_COMPRESS_HEADER_LEN + payload_len;
+}
+
+/**
+ * Reads a length that didn't fit in its token nibble.
+ * @return false if the input ran out first.
+ */
+static bool get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+        uint8_t b;
+        do {
+                if (*ip >= end)
+                        return false;
+
+                b = *(*ip)++;
+                *len += b;
+        } while (255 == b);
+
+        return true;
+}
+
+/**
+ * Decompresses a single block payload.
+ * @return true if it decoded to exactly raw_len bytes.
+ */
+static bool decompress(const uint8_t *ip, const size_t len, uint8_t *dst,
+                       const size_t raw_len)
+{
+        const uint8_t *end = ip + len;
+        size_t op = 0;
+
+        while (ip < end) {
+                const uint8_t token = *ip++;
+
+                size_t lit_len = token >> 4;
+                if (RUN_MASK == lit_len && !get_length(&ip, end, &lit_len))
+                        return false;
+
+                if ((size_t) (end - ip) < lit_len || raw_len - op < lit_len)
+                        return false;
+
+                memcpy(dst + op, ip, lit_len);
+                ip += lit_len;
+                op += lit_len;
+
+                /* Literals only means this was the last sequence */
+                if (ip == end)
+                        break;
+
+                if (end - ip < 2)
+                        return false;
+
+                const size_t offset = get_u16(ip);
+                ip += 2;
+
+                size_t match_len = token & RUN_MASK;
+                if (RUN_MASK == match_len &&
+                    !get_length(&ip, end, &match_len))
+                        return false;
+                match_len += MIN_MATCH;
+
+                if (!offset || offset > op || raw_len - op < match_len)
+                        return false;
+
+                /* Byte by byte since matches may overlap themselves */
+                for (; match_len; --match_len, ++op)
+                        dst[op] = dst[op - offset];
+        }
+
+        return op == raw_len;
+}
+
+int log_decompress(const void *data, const size_t len,
+                   const struct log_format_writer *w)
+{
+        const uint8_t *ip = data;
+        const uint8_t *end = ip + len;
+        int blocks = 0;
+
+        if (len < LOG_COMPRESS_MAGIC_LEN ||
+            memcmp(ip, LOG_COMPRESS_MAGIC, LOG_COMPRESS_MAGIC_LEN))
+                return -1;
+
+        uint8_t *raw = portMalloc(LOG_COMPRESS_MAX_BLOCK);
+        if (!raw)
+                return -1;
+
+        while ((size_t) (end - ip) >= LOG_COMPRESS_HEADER_LEN &&
+               0 == memcmp(ip, LOG_COMPRESS_MAGIC, LOG_COMPRESS_MAGIC_LEN)) {
+                const size_t raw_len = get_u16(ip + 2);
+                const size_t payload_len = get_u16(ip + 4);
+                const uint8_t *payload = ip + LOG_COMPRESS_HEADER_LEN;
+
+                if ((size_t) (end - payload) < payload_len)
+                        break;
+
+                if (payload_len == raw_len) {
+                        memcpy(raw, payload, raw_len);
+                } else if (!decompress(payload, payload_len, raw, raw_len)) {
+                        break;
+                }
+
+                w->write(raw, raw_len, w->arg);
+                ip = payload + payload_len;
+                ++blocks;
+        }
+
+        portFree(raw);
+        return blocks;
+}
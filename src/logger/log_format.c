@@ -0,0 +1,650 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log_format.h"
+#include "log_journal.h"
+#include "loggerConfig.h"
+#include "macros.h"
+#include "mem_mang.h"
+#include "modp_numtoa.h"
+#include "printk.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define _LOG_PFX "[log_format] "
+
+static void write_bytes(const struct log_format_writer *w,
+                        const void *data, const size_t len)
+{
+        w->write(data, len, w->arg);
+}
+
+static void write_str(const struct log_format_writer *w, const char *str)
+{
+        write_bytes(w, str, strlen(str));
+}
+
+static void write_quoted_str(const struct log_format_writer *w,
+                             const char *s)
+{
+        write_str(w, "\"");
+        write_str(w, s);
+        write_str(w, "\"");
+}
+
+static void write_int(const struct log_format_writer *w, int num)
+{
+        char buf[12];
+        modp_itoa10(num, buf);
+        buf[11] = '\0';
+        write_str(w, buf);
+}
+
+static void write_long_long(const struct log_format_writer *w,
+                            long long num)
+{
+        char buf[24];
+        modp_ltoa10(num, buf);
+        buf[23] = '\0';
+        write_str(w, buf);
+}
+
+static void write_double(const struct log_format_writer *w, double num,
+                         int precision)
+{
+        char buf[32];
+        modp_dtoa(num, buf, precision);
+        buf[31] = '\0';
+        write_str(w, buf);
+}
+
+static void write_float(const struct log_format_writer *w, float num,
+                        int precision)
+{
+        char buf[16];
+        modp_ftoa(num, buf, precision);
+        buf[15] = '\0';
+        write_str(w, buf);
+}
+
+void log_format_csv_header(const struct log_format_writer *w,
+                           const struct sample *s)
+{
+        const ChannelSample *sample = s->channel_samples;
+        size_t count = s->channel_count;
+        int i;
+
+        for (i = 0; 0 < count; count--, sample++, i++) {
+                write_str(w, 0 == i ? "" : ",");
+
+                uint8_t precision = sample->cfg->precision;
+                write_quoted_str(w, sample->cfg->label);
+                write_str(w, "|");
+                write_quoted_str(w, sample->cfg->units);
+                write_str(w, "|");
+                write_float(w, sample->cfg->min, precision);
+                write_str(w, "|");
+                write_float(w, sample->cfg->max, precision);
+                write_str(w, "|");
+                write_int(w, decodeSampleRate(sample->cfg->sampleRate));
+        }
+
+        write_str(w, "\n");
+}
+
+static void write_csv_value(const struct log_format_writer *w,
+                            const ChannelSample *sample)
+{
+        const int precision = sample->cfg->precision;
+
+        switch(sample->sampleData) {
+        case SampleData_Float:
+        case SampleData_Float_Noarg:
+                write_float(w, sample->valueFloat, precision);
+                break;
+        case SampleData_Int:
+        case SampleData_Int_Noarg:
+                write_int(w, sample->valueInt);
+                break;
+        case SampleData_LongLong:
+        case SampleData_LongLong_Noarg:
+                write_long_long(w, sample->valueLongLong);
+                break;
+        case SampleData_Double:
+        case SampleData_Double_Noarg:
+                write_double(w, sample->valueDouble, precision);
+                break;
+        default:
+                pr_warning(_LOG_PFX "Unknown channel "
+                           "sample type\n");
+        }
+}
+
+int log_format_csv_row(const struct log_format_writer *w,
+                       const struct sample *s)
+{
+        const ChannelSample *sample = s->channel_samples;
+        size_t count = s->channel_count;
+
+        if (NULL == sample) {
+                pr_warning(_LOG_PFX "null sample record\r\n");
+                return -1;
+        }
+
+        int i;
+        for (i = 0; 0 < count; count--, sample++, i++) {
+                write_str(w, 0 == i ? "" : ",");
+
+                if (sample->populated)
+                        write_csv_value(w, sample);
+        }
+
+        write_str(w, "\n");
+        return 0;
+}
+
+int log_format_csv_sparse_row(const struct log_format_writer *w,
+                              const struct sample *s)
+{
+        const ChannelSample *sample = s->channel_samples;
+        const size_t count = s->channel_count;
+
+        if (NULL == sample) {
+                pr_warning(_LOG_PFX "null sample record\r\n");
+                return -1;
+        }
+
+        bool first = true;
+        bool in_run = false;
+        for (size_t i = 0; i < count; ++i, ++sample) {
+                if (!sample->populated) {
+                        in_run = false;
+                        continue;
+                }
+
+                write_str(w, first ? "" : ",");
+                first = false;
+
+                /* Tag the start of every run of populated channels */
+                if (!in_run) {
+                        write_int(w, i);
+                        write_str(w, "=");
+                        in_run = true;
+                }
+
+                write_csv_value(w, sample);
+        }
+
+        write_str(w, "\n");
+        return 0;
+}
+
+static void write_u8(const struct log_format_writer *w, const uint8_t val)
+{
+        write_bytes(w, &val, 1);
+}
+
+static void write_u16(const struct log_format_writer *w, const uint16_t val)
+{
+        const uint8_t buf[] = {val, val >> 8};
+        write_bytes(w, buf, sizeof(buf));
+}
+
+static void write_u32(const struct log_format_writer *w, const uint32_t val)
+{
+        const uint8_t buf[] = {val, val >> 8, val >> 16, val >> 24};
+        write_bytes(w, buf, sizeof(buf));
+}
+
+static void write_u64(const struct log_format_writer *w, const uint64_t val)
+{
+        write_u32(w, (uint32_t) val);
+        write_u32(w, (uint32_t) (val >> 32));
+}
+
+static void write_f32(const struct log_format_writer *w, const float val)
+{
+        uint32_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        write_u32(w, bits);
+}
+
+static void write_rcb_str(const struct log_format_writer *w,
+                          const char *str, const size_t max_len)
+{
+        const uint8_t len = strnlen(str, max_len);
+        write_u8(w, len);
+        write_bytes(w, str, len);
+}
+
+static uint8_t get_rcb_type(const enum SampleData sd)
+{
+        switch(sd) {
+        case SampleData_Int:
+        case SampleData_Int_Noarg:
+                return RCB_TYPE_INT32;
+        case SampleData_LongLong:
+        case SampleData_LongLong_Noarg:
+                return RCB_TYPE_INT64;
+        case SampleData_Float:
+        case SampleData_Float_Noarg:
+                return RCB_TYPE_FLOAT;
+        case SampleData_Double:
+        case SampleData_Double_Noarg:
+                return RCB_TYPE_DOUBLE;
+        default:
+                return RCB_TYPE_INVALID;
+        }
+}
+
+void log_format_rcb_header(const struct log_format_writer *w,
+                           const struct sample *s)
+{
+        write_bytes(w, RCB_MAGIC, RCB_MAGIC_LEN);
+        write_u8(w, RCB_VERSION);
+        write_u16(w, s->channel_count);
+
+        const ChannelSample *sample = s->channel_samples;
+        for (size_t i = 0; i < s->channel_count; ++i, ++sample) {
+                const ChannelConfig *cfg = sample->cfg;
+
+                write_u8(w, get_rcb_type(sample->sampleData));
+                write_u8(w, cfg->precision);
+                write_u16(w, cfg->sampleRate);
+                write_f32(w, cfg->min);
+                write_f32(w, cfg->max);
+                write_rcb_str(w, cfg->label, DEFAULT_LABEL_LENGTH);
+                write_rcb_str(w, cfg->units, DEFAULT_UNITS_LENGTH);
+        }
+}
+
+size_t log_format_rcb_header_len(const struct sample *s)
+{
+        size_t len = RCB_MAGIC_LEN + 1 + 2;
+
+        const ChannelSample *sample = s->channel_samples;
+        for (size_t i = 0; i < s->channel_count; ++i, ++sample) {
+                const ChannelConfig *cfg = sample->cfg;
+
+                len += 1 + 1 + 2 + 4 + 4 +
+                        1 + strnlen(cfg->label, DEFAULT_LABEL_LENGTH) +
+                        1 + strnlen(cfg->units, DEFAULT_UNITS_LENGTH);
+        }
+
+        return len;
+}
+
+/**
+ * @return true if the channel has a value that will go into the record.
+ */
+static bool rcb_has_value(const ChannelSample *sample)
+{
+        return sample->populated &&
+                RCB_TYPE_INVALID != get_rcb_type(sample->sampleData);
+}
+
+size_t log_format_rcb_record_len(const struct sample *s)
+{
+        const ChannelSample *sample = s->channel_samples;
+        size_t len = 1 + 4 + (s->channel_count + 7) / 8;
+
+        for (size_t i = 0; i < s->channel_count; ++i, ++sample) {
+                if (!rcb_has_value(sample))
+                        continue;
+
+                switch(get_rcb_type(sample->sampleData)) {
+                case RCB_TYPE_INT32:
+                case RCB_TYPE_FLOAT:
+                        len += 4;
+                        break;
+                case RCB_TYPE_INT64:
+                case RCB_TYPE_DOUBLE:
+                        len += 8;
+                        break;
+                }
+        }
+
+        return len;
+}
+
+int log_format_rcb_record(const struct log_format_writer *w,
+                          const struct sample *s, const uint32_t tick)
+{
+        const ChannelSample *sample = s->channel_samples;
+        const size_t count = s->channel_count;
+
+        if (NULL == sample) {
+                pr_warning(_LOG_PFX "null sample record\r\n");
+                return -1;
+        }
+
+        write_u8(w, RCB_RECORD_MARKER);
+        write_u32(w, tick);
+
+        for (size_t i = 0; i < count; i += 8) {
+                uint8_t bits = 0;
+                for (size_t j = 0; j < 8 && i + j < count; ++j)
+                        if (rcb_has_value(sample + i + j))
+                                bits |= 1 << j;
+
+                write_u8(w, bits);
+        }
+
+        for (size_t i = 0; i < count; ++i, ++sample) {
+                if (!rcb_has_value(sample))
+                        continue;
+
+                switch(get_rcb_type(sample->sampleData)) {
+                case RCB_TYPE_INT32:
+                        write_u32(w, (uint32_t) sample->valueInt);
+                        break;
+                case RCB_TYPE_INT64:
+                        write_u64(w, (uint64_t) sample->valueLongLong);
+                        break;
+                case RCB_TYPE_FLOAT:
+                        write_f32(w, sample->valueFloat);
+                        break;
+                case RCB_TYPE_DOUBLE: {
+                        uint64_t bits;
+                        memcpy(&bits, &sample->valueDouble, sizeof(bits));
+                        write_u64(w, bits);
+                        break;
+                }
+                }
+        }
+
+        return 0;
+}
+
+struct rcb_reader {
+        const uint8_t *data;
+        size_t len;
+        size_t pos;
+};
+
+static bool read_bytes(struct rcb_reader *r, void *dst, const size_t len)
+{
+        if (r->len - r->pos < len)
+                return false;
+
+        memcpy(dst, r->data + r->pos, len);
+        r->pos += len;
+        return true;
+}
+
+static bool read_u8(struct rcb_reader *r, uint8_t *val)
+{
+        return read_bytes(r, val, 1);
+}
+
+static bool read_u16(struct rcb_reader *r, uint16_t *val)
+{
+        uint8_t buf[2];
+        if (!read_bytes(r, buf, sizeof(buf)))
+                return false;
+
+        *val = buf[0] | buf[1] << 8;
+        return true;
+}
+
+static bool read_u32(struct rcb_reader *r, uint32_t *val)
+{
+        uint8_t buf[4];
+        if (!read_bytes(r, buf, sizeof(buf)))
+                return false;
+
+        *val = (uint32_t) buf[0] | (uint32_t) buf[1] << 8 |
+                (uint32_t) buf[2] << 16 | (uint32_t) buf[3] << 24;
+        return true;
+}
+
+static bool read_u64(struct rcb_reader *r, uint64_t *val)
+{
+        uint32_t lo, hi;
+        if (!read_u32(r, &lo) || !read_u32(r, &hi))
+                return false;
+
+        *val = (uint64_t) hi << 32 | lo;
+        return true;
+}
+
+static bool read_f32(struct rcb_reader *r, float *val)
+{
+        uint32_t bits;
+        if (!read_u32(r, &bits))
+                return false;
+
+        memcpy(val, &bits, sizeof(bits));
+        return true;
+}
+
+static bool read_rcb_str(struct rcb_reader *r, char *dst,
+                         const size_t max_len)
+{
+        uint8_t len;
+        if (!read_u8(r, &len) || len >= max_len)
+                return false;
+
+        if (!read_bytes(r, dst, len))
+                return false;
+
+        dst[len] = '\0';
+        return true;
+}
+
+static bool read_rcb_channel(struct rcb_reader *r, ChannelSample *sample)
+{
+        ChannelConfig *cfg = sample->cfg;
+        uint8_t type;
+
+        if (!read_u8(r, &type) ||
+            !read_u8(r, &cfg->precision) ||
+            !read_u16(r, &cfg->sampleRate) ||
+            !read_f32(r, &cfg->min) ||
+            !read_f32(r, &cfg->max) ||
+            !read_rcb_str(r, cfg->label, DEFAULT_LABEL_LENGTH) ||
+            !read_rcb_str(r, cfg->units, DEFAULT_UNITS_LENGTH))
+                return false;
+
+        switch(type) {
+        case RCB_TYPE_INT32:
+                sample->sampleData = SampleData_Int;
+                break;
+        case RCB_TYPE_INT64:
+                sample->sampleData = SampleData_LongLong;
+                break;
+        case RCB_TYPE_FLOAT:
+                sample->sampleData = SampleData_Float;
+                break;
+        case RCB_TYPE_DOUBLE:
+                sample->sampleData = SampleData_Double;
+                break;
+        default:
+                /* Keep going.  The CSV row just won't have a value */
+                sample->sampleData = (enum SampleData) type;
+                break;
+        }
+
+        return true;
+}
+
+/**
+ * Steps over journal checkpoints, which may sit between any two records.
+ */
+static void skip_checkpoints(struct rcb_reader *r)
+{
+        struct log_journal_checkpoint cp;
+
+        while (log_journal_parse(r->data + r->pos, r->len - r->pos, &cp))
+                r->pos += LOG_JOURNAL_CHECKPOINT_LEN;
+}
+
+/**
+ * Reads a single record into the sample.
+ * @return true if a complete record was read, false otherwise.
+ */
+static bool read_rcb_record(struct rcb_reader *r, struct sample *s)
+{
+        ChannelSample *samples = s->channel_samples;
+        uint8_t marker;
+        uint32_t tick;
+
+        skip_checkpoints(r);
+        if (!read_u8(r, &marker) || RCB_RECORD_MARKER != marker ||
+            !read_u32(r, &tick))
+                return false;
+
+        s->ticks = tick;
+        for (size_t i = 0; i < s->channel_count; i += 8) {
+                uint8_t bits;
+                if (!read_u8(r, &bits))
+                        return false;
+
+                for (size_t j = 0; j < 8 && i + j < s->channel_count; ++j)
+                        samples[i + j].populated = bits & (1 << j);
+        }
+
+        for (size_t i = 0; i < s->channel_count; ++i) {
+                ChannelSample *sample = samples + i;
+                if (!sample->populated)
+                        continue;
+
+                uint32_t val32;
+                uint64_t val64;
+                bool ok = true;
+
+                switch(sample->sampleData) {
+                case SampleData_Int:
+                        ok = read_u32(r, &val32);
+                        sample->valueInt = (int) val32;
+                        break;
+                case SampleData_LongLong:
+                        ok = read_u64(r, &val64);
+                        sample->valueLongLong = (long long) val64;
+                        break;
+                case SampleData_Float:
+                        ok = read_f32(r, &sample->valueFloat);
+                        break;
+                case SampleData_Double:
+                        ok = read_u64(r, &val64);
+                        memcpy(&sample->valueDouble, &val64,
+                               sizeof(val64));
+                        break;
+                default:
+                        /* Encoder never sets the bit for unknown types */
+                        ok = false;
+                        break;
+                }
+
+                if (!ok)
+                        return false;
+        }
+
+        return true;
+}
+
+/**
+ * Reads the magic, version and channel count of an RCB header.
+ */
+static bool read_rcb_start(struct rcb_reader *r, uint16_t *count)
+{
+        char magic[RCB_MAGIC_LEN];
+        uint8_t version;
+
+        return read_bytes(r, magic, RCB_MAGIC_LEN) &&
+                0 == memcmp(magic, RCB_MAGIC, RCB_MAGIC_LEN) &&
+                read_u8(r, &version) && RCB_VERSION == version &&
+                read_u16(r, count);
+}
+
+int log_format_rcb_header_types(const void *data, const size_t len,
+                                uint8_t *types, const size_t max_channels)
+{
+        struct rcb_reader r = {
+                .data = data,
+                .len = len,
+        };
+        uint16_t count;
+
+        if (!read_rcb_start(&r, &count) || count > max_channels)
+                return -1;
+
+        for (size_t i = 0; i < count; ++i) {
+                ChannelConfig cfg;
+                ChannelSample sample = {
+                        .cfg = &cfg,
+                };
+
+                if (!read_rcb_channel(&r, &sample))
+                        return -1;
+
+                types[i] = get_rcb_type(sample.sampleData);
+        }
+
+        return count;
+}
+
+int log_format_rcb_to_csv(const void *data, const size_t len,
+                          const struct log_format_writer *w)
+{
+        struct rcb_reader r = {
+                .data = data,
+                .len = len,
+        };
+        uint16_t count;
+
+        if (!read_rcb_start(&r, &count))
+                return -1;
+
+        ChannelConfig *cfgs = portMalloc(sizeof(ChannelConfig) * count);
+        ChannelSample *samples = portMalloc(sizeof(ChannelSample) * count);
+        int records = -1;
+
+        if (!cfgs || !samples)
+                goto done;
+
+        memset(cfgs, 0, sizeof(ChannelConfig) * count);
+        memset(samples, 0, sizeof(ChannelSample) * count);
+
+        struct sample s = {
+                .channel_count = count,
+                .channel_samples = samples,
+        };
+
+        for (size_t i = 0; i < count; ++i) {
+                samples[i].cfg = cfgs + i;
+                if (!read_rcb_channel(&r, samples + i))
+                        goto done;
+        }
+
+        log_format_csv_header(w, &s);
+
+        for (records = 0; read_rcb_record(&r, &s); ++records)
+                log_format_csv_row(w, &s);
+
+done:
+        if (cfgs)
+                portFree(cfgs);
+        if (samples)
+                portFree(samples);
+
+        return records;
+}
@@ -0,0 +1,165 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crc32.h"
+#include "log_journal.h"
+#include <string.h>
+
+#define FIELD_LEN	8
+#define FIELD_COUNT	5
+/* Everything before the crc field is covered by the crc */
+#define CRC_PREFIX_LEN	(LOG_JOURNAL_MAGIC_LEN + \
+                         (FIELD_COUNT - 1) * (FIELD_LEN + 1))
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static char* put_field(char *p, uint32_t val, const char sep)
+{
+        for (int i = FIELD_LEN - 1; i >= 0; --i, val >>= 4)
+                p[i] = hex_digits[val & 0xF];
+
+        p += FIELD_LEN;
+        if (sep)
+                *p++ = sep;
+
+        return p;
+}
+
+static bool get_field(const char *p, uint32_t *val)
+{
+        *val = 0;
+        for (int i = 0; i < FIELD_LEN; ++i) {
+                const char *digit = strchr(hex_digits, p[i]);
+                if (!p[i] || !digit)
+                        return false;
+
+                *val = *val << 4 | (uint32_t) (digit - hex_digits);
+        }
+
+        return true;
+}
+
+void log_journal_init(struct log_journal *j, const uint32_t id)
+{
+        j->id = id;
+        j->crc = CRC32_INIT;
+        j->len = 0;
+}
+
+void log_journal_update(struct log_journal *j, const void *data,
+                        const size_t len)
+{
+        j->crc = crc32_update(j->crc, data, len);
+        j->len += len;
+}
+
+size_t log_journal_checkpoint(struct log_journal *j, char *buf,
+                              const uint32_t tick, const uint32_t rows)
+{
+        char *p = buf;
+
+        memcpy(p, LOG_JOURNAL_MAGIC, LOG_JOURNAL_MAGIC_LEN);
+        p += LOG_JOURNAL_MAGIC_LEN;
+        p = put_field(p, j->id, ',');
+        p = put_field(p, tick, ',');
+        p = put_field(p, rows, ',');
+        p = put_field(p, j->len, ',');
+
+        const uint32_t crc = crc32_update(j->crc, buf, CRC_PREFIX_LEN);
+        p = put_field(p, crc32_final(crc), '\r');
+        *p = '\n';
+
+        log_journal_init(j, j->id);
+        return LOG_JOURNAL_CHECKPOINT_LEN;
+}
+
+bool log_journal_parse(const void *data, const size_t len,
+                       struct log_journal_checkpoint *cp)
+{
+        const char *p = data;
+        uint32_t *fields[FIELD_COUNT] = {
+                &cp->id, &cp->tick, &cp->rows, &cp->len, &cp->crc,
+        };
+
+        if (len < LOG_JOURNAL_CHECKPOINT_LEN ||
+            memcmp(p, LOG_JOURNAL_MAGIC, LOG_JOURNAL_MAGIC_LEN))
+                return false;
+
+        p += LOG_JOURNAL_MAGIC_LEN;
+        for (size_t i = 0; i < FIELD_COUNT; ++i) {
+                const char sep = i < FIELD_COUNT - 1 ? ',' : '\r';
+                if (!get_field(p, fields[i]) || sep != p[FIELD_LEN])
+                        return false;
+
+                p += FIELD_LEN + 1;
+        }
+
+        return '\n' == *p;
+}
+
+bool log_journal_find_first(const void *data, const size_t len,
+                            struct log_journal_checkpoint *cp)
+{
+        const char *p = data;
+
+        for (size_t i = 0; i + LOG_JOURNAL_CHECKPOINT_LEN <= len; ++i)
+                if ('#' == p[i] && log_journal_parse(p + i, len - i, cp))
+                        return true;
+
+        return false;
+}
+
+bool log_journal_verify(const struct log_journal *j, const void *checkpoint)
+{
+        struct log_journal_checkpoint cp;
+
+        if (!log_journal_parse(checkpoint, LOG_JOURNAL_CHECKPOINT_LEN, &cp) ||
+            j->id != cp.id || j->len != cp.len)
+                return false;
+
+        const uint32_t crc = crc32_update(j->crc, checkpoint, CRC_PREFIX_LEN);
+        return crc32_final(crc) == cp.crc;
+}
+
+long log_journal_find_last(const void *data, const size_t len,
+                           const uint32_t id)
+{
+        const char *p = data;
+        struct log_journal_checkpoint cp;
+
+        if (len < LOG_JOURNAL_CHECKPOINT_LEN)
+                return -1;
+
+        size_t i = len - LOG_JOURNAL_CHECKPOINT_LEN + 1;
+        while (i--) {
+                if ('#' != p[i] || !log_journal_parse(p + i, len - i, &cp) ||
+                    id != cp.id || cp.len > i)
+                        continue;
+
+                uint32_t crc = crc32_update(CRC32_INIT, p + i - cp.len,
+                                            cp.len);
+                crc = crc32_update(crc, p + i, CRC_PREFIX_LEN);
+                if (crc32_final(crc) == cp.crc)
+                        return (long) (i + LOG_JOURNAL_CHECKPOINT_LEN);
+        }
+
+        return -1;
+}
@@ -34,6 +34,7 @@
 #include "cpu.h"
 #include "dateTime.h"
 #include "esp8266_drv.h"
+#include "fileWriter.h"
 #include "flags.h"
 #include "geopoint.h"
 #include "gps.h"
@@ -60,6 +61,8 @@
 #include "str_util.h"
 #include "task.h"
 #include "taskUtil.h"
+#include "telemetry_batch.h"
+#include "telemetry_frame.h"
 #include "timer.h"
 #include "tracks.h"
 #include "units.h"
@@ -72,11 +75,8 @@
 /* Max number of channels that can be specified in the setOBD2Cfg message */
 #define MAX_OBD2_MESSAGE_PIDS 4
 
-/* Max number of channels that can be specified in the setCanChan message */
-#define MAX_CAN_MESSAGE_CHANNELS 4
-
 typedef void (*getConfigs_func)(size_t channeId, void ** baseCfg, ChannelConfig ** channelCfg);
-typedef const jsmntok_t * (*setExtField_func)(const jsmntok_t *json, const char *name, const char *value, void *cfg);
+typedef void (*setExtFields_func)(const jsmntok_t *json, void *cfg);
 typedef int (*reInitConfig_func)(LoggerConfig *config);
 
 int api_systemReset(struct Serial *serial, const jsmntok_t *json)
@@ -272,13 +272,78 @@ static void get_bt_status(struct Serial* serial, const bool more)
 static void get_logging_status(struct Serial* serial, const bool more)
 {
 #if SDCARD_SUPPORT
+        struct file_writer_stats stats;
+        file_writer_get_stats(&stats);
+
         json_objStartString(serial, "logging");
         json_int(serial, "status", (int)logging_get_status(), 1);
-        json_int(serial, "dur", logging_active_time(), 0);
+        json_int(serial, "dur", logging_active_time(), 1);
+
+        json_objStartString(serial, "writer");
+        json_uint(serial, "qOvf", stats.queue_overflows, 1);
+        json_uint(serial, "qHw", stats.queue_high_water, 1);
+        json_uint(serial, "stalls", stats.buffer_stalls, 1);
+        json_uint(serial, "stallHwMs", stats.stall_ms_high_water, 1);
+        json_uint(serial, "wrErr", stats.write_errors, 1);
+        json_uint(serial, "dropped", stats.dropped_bytes, 0);
+        json_objEnd(serial, 0);
+
         json_objEnd(serial, 1);
 #endif
 }
 
+static void get_sample_consumer_status(struct Serial* serial,
+                                       const char *name,
+                                       const enum sample_consumer c,
+                                       const bool more)
+{
+        struct sample_consumer_stats stats;
+        sample_consumer_get_stats(c, &stats);
+
+        json_objStartString(serial, name);
+        json_uint(serial, "drop", stats.dropped, 1);
+        json_uint(serial, "held", stats.held, 1);
+        json_uint(serial, "heldHw", stats.held_high_water, 1);
+        json_uint(serial, "starved", stats.starved, 0);
+        json_objEnd(serial, more);
+}
+
+static void get_sample_status(struct Serial* serial, const bool more)
+{
+        json_objStartString(serial, "samples");
+        get_sample_consumer_status(serial, "file", SAMPLE_CONSUMER_FILE, 1);
+        get_sample_consumer_status(serial, "bt", SAMPLE_CONSUMER_BLUETOOTH, 1);
+        get_sample_consumer_status(serial, "cell", SAMPLE_CONSUMER_CELLULAR, 0);
+        json_objEnd(serial, more);
+}
+
+static void get_obd2_status(struct Serial* serial, const bool more)
+{
+        struct obd2_stats stats;
+        OBD2_get_stats(&stats);
+
+        json_objStartString(serial, "OBD2");
+        json_bool(serial, "active", stats.active, 1);
+        json_uint(serial, "pidRate", stats.pid_rate, 1);
+        json_uint(serial, "inFlight", stats.in_flight, 1);
+        json_uint(serial, "maxInFlight", stats.max_in_flight, 1);
+        json_bool(serial, "batch", stats.batching, 1);
+
+        /* PIDs and the latency of their last response, in matching order */
+        uint16_t pid, latency;
+        json_arrayStart(serial, "pids");
+        for (size_t i = 0; OBD2_get_pid_latency(i, &pid, &latency); i++)
+                json_arrayElementInt(serial, pid, i + 1 < stats.channels);
+        json_arrayEnd(serial, 1);
+
+        json_arrayStart(serial, "latMs");
+        for (size_t i = 0; OBD2_get_pid_latency(i, &pid, &latency); i++)
+                json_arrayElementInt(serial, latency, i + 1 < stats.channels);
+        json_arrayEnd(serial, 0);
+
+        json_objEnd(serial, more);
+}
+
 int api_getStatus(struct Serial *serial, const jsmntok_t *json)
 {
         json_objStart(serial);
@@ -304,6 +369,8 @@ int api_getStatus(struct Serial *serial, const jsmntok_t *json)
         get_cellular_status(serial, true);
         get_bt_status(serial, true);
         get_logging_status(serial, true);
+        get_sample_status(serial, true);
+        get_obd2_status(serial, true);
 
         json_objStartString(serial, "track");
         json_int(serial, "status", lapstats_get_track_status(), 1);
@@ -509,38 +576,179 @@ int api_log(struct Serial *serial, const jsmntok_t *json)
         return API_SUCCESS;
 }
 
+static void write_channel_config(struct json_writer *jw,
+                                 const ChannelConfig *cfg)
+{
+        json_writer_string(jw, "nm", cfg->label);
+        json_writer_string(jw, "ut", cfg->units);
+        json_writer_float(jw, "min", cfg->min, cfg->precision);
+        json_writer_float(jw, "max", cfg->max, cfg->precision);
+        json_writer_int(jw, "prec", (int) cfg->precision);
+        json_writer_int(jw, "sr", decodeSampleRate(cfg->sampleRate));
+}
+
 static void json_channelConfig(struct Serial *serial, const ChannelConfig *cfg, int more)
 {
-        json_string(serial, "nm", cfg->label, 1);
-        json_string(serial, "ut", cfg->units, 1);
-        json_float(serial, "min", cfg->min, cfg->precision, 1);
-        json_float(serial, "max", cfg->max, cfg->precision, 1);
-        json_int(serial, "prec", (int) cfg->precision, 1);
-        json_int(serial, "sr", decodeSampleRate(cfg->sampleRate), more);
+        struct json_writer jw;
+
+        json_writer_init(&jw, serial);
+        write_channel_config(&jw, cfg);
+        json_writer_flush(&jw);
+
+        if (more)
+                serial_write_c(serial, ',');
 }
 
-static void write_sample_meta(struct Serial *serial, const struct sample *sample,
-                              int sampleRateLimit, int more)
+static void render_sample_meta(struct json_writer *jw, const char *name,
+                               const struct sample *sample)
 {
-        json_arrayStart(serial, "meta");
+        json_writer_array_start(jw, name);
         ChannelSample *channel_sample = sample->channel_samples;
 
         for (size_t i = 0; i < sample->channel_count; ++i, ++channel_sample) {
-                if (0 < i)
-                        serial_write_c(serial, ',');
-
-                serial_write_c(serial, '{');
-                json_channelConfig(serial, channel_sample->cfg, 0);
-                serial_write_c(serial, '}');
+                json_writer_obj_start(jw, NULL);
+                write_channel_config(jw, channel_sample->cfg);
+                json_writer_obj_end(jw);
         }
 
-        json_arrayEnd(serial, more);
+        json_writer_array_end(jw);
 }
 
-int api_getMeta(struct Serial *serial, const jsmntok_t *json)
+/*
+ * The meta block only changes with the config, yet every connection sends
+ * it on connect and then periodically.  So it is rendered once per layout
+ * of the sample pool and shared.  Connections hold a reference while they write
+ * it out, since a config change may replace it at any time.
+ */
+struct meta_cache {
+        size_t refs;
+        uint32_t generation;
+        size_t channel_count;
+        size_t len;
+        char json[];
+};
+
+static struct meta_cache *g_meta_cache;
+
+struct meta_render {
+        /* NULL just counts */
+        char *buf;
+        size_t len;
+};
+
+static void render_meta_write(const void *data, const size_t len, void *arg)
 {
-        json_objStart(serial);
+        struct meta_render *mr = arg;
+
+        if (mr->buf)
+                memcpy(mr->buf + mr->len, data, len);
+        mr->len += len;
+}
+
+static void render_meta(struct meta_render *mr, const struct sample *sample)
+{
+        struct json_writer jw;
+
+        json_writer_init_func(&jw, render_meta_write, mr);
+        render_sample_meta(&jw, NULL, sample);
+        json_writer_flush(&jw);
+}
+
+static struct meta_cache* render_meta_cache(const struct sample *sample,
+                                            const uint32_t generation)
+{
+        /* Size it up first so it takes exactly one allocation */
+        struct meta_render mr = {
+                .buf = NULL,
+        };
+        render_meta(&mr, sample);
+
+        struct meta_cache *mc = portMalloc(sizeof(*mc) + mr.len);
+        if (!mc)
+                return NULL;
+
+        mr.buf = mc->json;
+        mr.len = 0;
+        render_meta(&mr, sample);
+
+        mc->refs = 1;
+        mc->generation = generation;
+        mc->channel_count = sample->channel_count;
+        mc->len = mr.len;
+        return mc;
+}
+
+static void put_meta_cache(struct meta_cache *mc)
+{
+        if (!mc)
+                return;
 
+        taskENTER_CRITICAL();
+        const bool last = 0 == --mc->refs;
+        taskEXIT_CRITICAL();
+
+        if (last)
+                portFree(mc);
+}
+
+/**
+ * @return A reference to the meta for the sample, rendering it if the
+ * layout changed since it was last rendered, or NULL if out of memory or
+ * the sample isn't from the pool.
+ */
+static struct meta_cache* get_meta_cache(const struct sample *sample)
+{
+        /*
+         * Not the config generation.  The config changes before the pool
+         * is rebuilt, and the samples still in flight have the old layout.
+         */
+        const uint32_t generation = sample->layout;
+        if (!generation)
+                return NULL;
+
+        taskENTER_CRITICAL();
+        struct meta_cache *mc = g_meta_cache;
+        if (mc && generation == mc->generation &&
+            sample->channel_count == mc->channel_count)
+                ++mc->refs;
+        else
+                mc = NULL;
+        taskEXIT_CRITICAL();
+
+        if (mc)
+                return mc;
+
+        mc = render_meta_cache(sample, generation);
+        if (!mc)
+                return NULL;
+
+        /* One reference for the cache and one for our caller */
+        ++mc->refs;
+
+        taskENTER_CRITICAL();
+        struct meta_cache *old = g_meta_cache;
+        g_meta_cache = mc;
+        taskEXIT_CRITICAL();
+
+        put_meta_cache(old);
+        return mc;
+}
+
+static void write_sample_meta(struct json_writer *jw,
+                              const struct sample *sample)
+{
+        struct meta_cache *mc = get_meta_cache(sample);
+
+        if (mc) {
+                json_writer_raw(jw, "meta", mc->json, mc->len);
+                put_meta_cache(mc);
+        } else {
+                render_sample_meta(jw, "meta", sample);
+        }
+}
+
+int api_getMeta(struct Serial *serial, const jsmntok_t *json)
+{
         LoggerConfig * config = getWorkingLoggerConfig();
         const size_t channelCount = get_enabled_channel_count(config);
 
@@ -553,33 +761,36 @@ int api_getMeta(struct Serial *serial, const jsmntok_t *json)
         if (!size)
                 return API_ERROR_SEVERE;
 
-        write_sample_meta(serial, &s, getConnectivitySampleRateLimit(), 0);
+        struct json_writer jw;
+        json_writer_init(&jw, serial);
+        json_writer_obj_start(&jw, NULL);
+        write_sample_meta(&jw, &s);
+        json_writer_obj_end(&jw);
+        json_writer_flush(&jw);
 
         free_sample_buffer(&s);
-        json_objEnd(serial, 0);
         return API_SUCCESS_NO_RETURN;
 }
 
 
 #define MAX_BITMAPS 10
 
-void api_send_sample_record(struct Serial *serial,
-                            const struct sample *sample,
-                            const unsigned int tick, const int sendMeta)
+static void write_sample_record(struct json_writer *jw,
+                                const struct sample *sample,
+                                const unsigned int tick, const int sendMeta)
 {
-        json_objStart(serial);
-        json_objStartString(serial, "s");
-        json_uint(serial,"t", tick, 1);
+        json_writer_obj_start(jw, NULL);
+        json_writer_obj_start(jw, "s");
+        json_writer_uint(jw, "t", tick);
 
         if (sendMeta)
-                write_sample_meta(serial, sample,
-                                  getConnectivitySampleRateLimit(), 1);
+                write_sample_meta(jw, sample);
 
         size_t channelBitmaskIndex = 0;
         unsigned int channelBitmask[MAX_BITMAPS];
         memset(channelBitmask, 0, sizeof(channelBitmask));
 
-        json_arrayStart(serial, "d");
+        json_writer_array_start(jw, "d");
         ChannelSample *cs = sample->channel_samples;
 
         size_t channelBitPosition = 0;
@@ -601,19 +812,21 @@ void api_send_sample_record(struct Serial *serial,
                         switch(cs->sampleData) {
                         case SampleData_Float:
                         case SampleData_Float_Noarg:
-                                put_float(serial, cs->valueFloat, precision);
+                                json_writer_float(jw, NULL, cs->valueFloat,
+                                                  precision);
                                 break;
                         case SampleData_Int:
                         case SampleData_Int_Noarg:
-                                put_int(serial, cs->valueInt);
+                                json_writer_int(jw, NULL, cs->valueInt);
                                 break;
                         case SampleData_LongLong:
                         case SampleData_LongLong_Noarg:
-                                put_ll(serial, cs->valueLongLong);
+                                json_writer_ll(jw, NULL, cs->valueLongLong);
                                 break;
                         case SampleData_Double:
                         case SampleData_Double_Noarg:
-                                put_double(serial, cs->valueDouble, precision);
+                                json_writer_double(jw, NULL, cs->valueDouble,
+                                                   precision);
                                 break;
                         default:
                                 pr_warning_int_msg("[loggerApi] Unknown sample"
@@ -621,25 +834,118 @@ void api_send_sample_record(struct Serial *serial,
                                                    cs->sampleData);
                                 break;
                         }
-                        serial_write_c(serial, ',');
                 }
         }
 
         size_t channelBitmaskCount = channelBitmaskIndex + 1;
-        for (size_t i = 0; i < channelBitmaskCount; i++) {
-                put_uint(serial, channelBitmask[i]);
-                if (i < channelBitmaskCount - 1)
-                        serial_write_c(serial, ',');
+        for (size_t i = 0; i < channelBitmaskCount; i++)
+                json_writer_uint(jw, NULL, channelBitmask[i]);
+
+        json_writer_array_end(jw);
+        json_writer_obj_end(jw);
+        json_writer_obj_end(jw);
+}
+
+void api_send_sample_record(struct Serial *serial,
+                            const struct sample *sample,
+                            const unsigned int tick, const int sendMeta)
+{
+        struct json_writer jw;
+        json_writer_init(&jw, serial);
+        write_sample_record(&jw, sample, tick, sendMeta);
+        json_writer_flush(&jw);
+}
+
+static void write_serial(const void *data, const size_t len, void *arg)
+{
+        serial_write_buff(arg, data, len);
+}
+
+static void write_telemetry_sample(const struct log_format_writer *w,
+                                   struct Serial *serial,
+                                   struct telemetry_delta *delta,
+                                   const struct sample *sample,
+                                   const unsigned int tick,
+                                   const int sendMeta)
+{
+        const enum serial_telemetry_format fmt =
+                serial_get_telemetry_format(serial);
+
+        /*
+         * Anything but a delta record in between, or the host asking for a
+         * format again, and the next delta record has to be a keyframe.
+         */
+        if (delta && (serial_telemetry_restarted(serial) || sendMeta ||
+                      SERIAL_TELEMETRY_FORMAT_DELTA != fmt))
+                telemetry_delta_reset(delta);
+
+        if (SERIAL_TELEMETRY_FORMAT_JSON == fmt) {
+                struct json_writer jw;
+                json_writer_init_func(&jw, w->write, w->arg);
+                write_sample_record(&jw, sample, tick, sendMeta);
+                json_writer_flush(&jw);
+                w->write("\r\n", 2, w->arg);
+                return;
         }
 
-        json_arrayEnd(serial, 0);
-        json_objEnd(serial, 0);
-        json_objEnd(serial, 0);
+        if (sendMeta && telemetry_frame_meta(w, sample))
+                pr_warning("[loggerApi] Meta too big for a telemetry "
+                           "frame\r\n");
+
+        if (SERIAL_TELEMETRY_FORMAT_DELTA != fmt || !delta) {
+                telemetry_frame_sample(w, sample, tick);
+                return;
+        }
+
+        telemetry_frame_delta(w, delta, sample, tick);
+}
+
+void api_send_telemetry_sample(struct Serial *serial,
+                               struct telemetry_delta *delta,
+                               const struct sample *sample,
+                               const unsigned int tick, const int sendMeta)
+{
+        const struct log_format_writer w = {write_serial, serial};
+
+        write_telemetry_sample(&w, serial, delta, sample, tick, sendMeta);
+}
+
+void api_batch_telemetry_sample(struct telemetry_batch *batch,
+                                struct telemetry_delta *delta,
+                                const struct sample *sample,
+                                const unsigned int tick, const int sendMeta)
+{
+        const struct log_format_writer w = {telemetry_batch_write, batch};
+
+        write_telemetry_sample(&w, batch->serial, delta, sample, tick,
+                               sendMeta);
+        telemetry_batch_end_sample(batch);
+}
+
+/**
+ * @return The value of a field of a config object, or NULL if it is
+ * missing or not a string or primitive.
+ */
+static const char* get_field_value(const jsmntok_t *json, const char *name)
+{
+        const jsmntok_t *tok = jsmn_find_node(json, name);
+        if (!tok)
+                return NULL;
+
+        /* Move to the value node */
+        ++tok;
+        if (tok->type != JSMN_PRIMITIVE && tok->type != JSMN_STRING)
+                return NULL;
+
+        return jsmn_trimData(tok)->data;
 }
 
+/**
+ * @return The token following the channel config.
+ */
 static const jsmntok_t * setChannelConfig(struct Serial *serial, const jsmntok_t *cfg,
                 ChannelConfig *channelCfg,
-                setExtField_func setExtField,
+                setExtFields_func setExtFields,
                 void *extCfg)
 {
 
@@ -648,61 +954,46 @@ static const jsmntok_t * setChannelConfig(struct Serial *serial, const jsmntok_t
                 return cfg;
         }
 
-        int size = cfg->size;
-        cfg++;
-
-        for (int i = 0; i < size; i += 2 ) {
-                const jsmntok_t *nameTok = cfg;
-                jsmn_trimData(nameTok);
-                cfg++;
-
-                const jsmntok_t *valueTok = cfg;
-                cfg++;
-
-                if (valueTok->type == JSMN_PRIMITIVE || valueTok->type == JSMN_STRING)
-                        jsmn_trimData(valueTok);
-
-                char *name = nameTok->data;
-                char *value = valueTok->data;
-
-                if (STR_EQ("nm", name))
-                        jsmn_decode_string(channelCfg->label, value, DEFAULT_LABEL_LENGTH);
-                else if (STR_EQ("ut", name))
-                        jsmn_decode_string(channelCfg->units, value, DEFAULT_UNITS_LENGTH);
-                else if (STR_EQ("min", name))
-                        channelCfg->min = atof(value);
-                else if (STR_EQ("max", name))
-                        channelCfg->max = atof(value);
-                else if (STR_EQ("sr", name))
-                        channelCfg->sampleRate = encodeSampleRate(atoi(value));
-                else if (STR_EQ("prec", name))
-                        channelCfg->precision = (unsigned char) atoi(value);
-                else if (setExtField != NULL)
-                        cfg = setExtField(valueTok, name, value, extCfg);
-        }
+        const char *value;
+        if ((value = get_field_value(cfg, "nm")))
+                jsmn_decode_string(channelCfg->label, value, DEFAULT_LABEL_LENGTH);
+        if ((value = get_field_value(cfg, "ut")))
+                jsmn_decode_string(channelCfg->units, value, DEFAULT_UNITS_LENGTH);
+        if ((value = get_field_value(cfg, "min")))
+                channelCfg->min = atof(value);
+        if ((value = get_field_value(cfg, "max")))
+                channelCfg->max = atof(value);
+        if ((value = get_field_value(cfg, "sr")))
+                channelCfg->sampleRate = encodeSampleRate(atoi(value));
+        if ((value = get_field_value(cfg, "prec")))
+                channelCfg->precision = (unsigned char) atoi(value);
 
-        return cfg;
+        if (setExtFields != NULL)
+                setExtFields(cfg, extCfg);
+
+        return jsmn_next(cfg);
 }
 
 static int setMultiChannelConfigGeneric(struct Serial *serial, const jsmntok_t * json,
                                         getConfigs_func getConfigsFunc,
-                                        setExtField_func setExtFieldFunc,
+                                        setExtFields_func setExtFieldsFunc,
                                         reInitConfig_func reInitConfigFunc)
 {
         if (json->type == JSMN_OBJECT && json->size % 2 == 0) {
-                for (int i = 1; i <= json->size; i += 2) {
-                        const jsmntok_t *idTok = json + i;
-                        const jsmntok_t *cfgTok = json + i + 1;
+                const jsmntok_t *idTok = json + 1;
+                for (int i = 0; i < json->size; i += 2) {
+                        const jsmntok_t *cfgTok = idTok + 1;
                         jsmn_trimData(idTok);
                         size_t id = atoi(idTok->data);
                         void *baseCfg = NULL;
                         ChannelConfig *channelCfg = NULL;
                         getConfigsFunc(id, &baseCfg, &channelCfg);
                         if (channelCfg && baseCfg) {
-                                setChannelConfig(serial, cfgTok, channelCfg, setExtFieldFunc, baseCfg);
+                                setChannelConfig(serial, cfgTok, channelCfg, setExtFieldsFunc, baseCfg);
                         } else {
                                 return API_ERROR_PARAMETER;
                         }
+                        idTok = jsmn_next(cfgTok);
                 }
         }
         configChanged();
@@ -744,42 +1035,33 @@ static const jsmntok_t * setScalingMapValues(ADCConfig *adcCfg, const jsmntok_t
         return mapArrayTok + 1;
 }
 
-static const jsmntok_t * setScalingRow(ADCConfig *adcCfg, const jsmntok_t *mapRow)
-{
-        if (mapRow->type == JSMN_STRING) {
-                jsmn_trimData(mapRow);
-                if (STR_EQ(mapRow->data, "raw"))
-                        mapRow = setScalingMapRaw(adcCfg, mapRow + 1);
-                else if (STR_EQ("scal", mapRow->data))
-                        mapRow = setScalingMapValues(adcCfg, mapRow + 1);
-        } else {
-                mapRow++;
-        }
-        return mapRow;
-}
-
-static const jsmntok_t * setAnalogExtendedField(const jsmntok_t *valueTok, const char *name, const char *value, void *cfg)
+static void setAnalogExtendedFields(const jsmntok_t *json, void *cfg)
 {
         ADCConfig *adcCfg = (ADCConfig *)cfg;
-        if (STR_EQ("scalMod", name))
+        const char *value;
+
+        if ((value = get_field_value(json, "scalMod")))
                 adcCfg->scalingMode = filterAnalogScalingMode(atoi(value));
-        else if (STR_EQ("scaling", name))
+        if ((value = get_field_value(json, "scaling")))
                 adcCfg->linearScaling = atof(value);
-        else if (STR_EQ("offset", name))
+        if ((value = get_field_value(json, "offset")))
                 adcCfg->linearOffset = atof(value);
-        else if (STR_EQ("alpha", name))
+        if ((value = get_field_value(json, "alpha")))
                 adcCfg->filterAlpha = atof(value);
-        else if (STR_EQ("cal", name))
+        if ((value = get_field_value(json, "cal")))
                 adcCfg->calibration = atof(value);
-        else if (STR_EQ("map", name)) {
-                if (valueTok->type == JSMN_OBJECT) {
-                        valueTok++;
-                        valueTok = setScalingRow(adcCfg, valueTok);
-                        valueTok = setScalingRow(adcCfg, valueTok);
-                        valueTok--;
-                }
+
+        const jsmntok_t *map = jsmn_find_get_node_value(json, "map",
+                                                        JSMN_OBJECT);
+        if (map) {
+                const jsmntok_t *row = jsmn_find_node(map, "raw");
+                if (row)
+                        setScalingMapRaw(adcCfg, row + 1);
+
+                row = jsmn_find_node(map, "scal");
+                if (row)
+                        setScalingMapValues(adcCfg, row + 1);
         }
-        return valueTok + 1;
 }
 
 static void getAnalogConfigs(size_t channelId, void ** baseCfg, ChannelConfig ** channelCfg)
@@ -793,7 +1075,7 @@ static void getAnalogConfigs(size_t channelId, void ** baseCfg, ChannelConfig **
 
 int api_setAnalogConfig(struct Serial *serial, const jsmntok_t * json)
 {
-        int res = setMultiChannelConfigGeneric(serial, json, getAnalogConfigs, setAnalogExtendedField, ADC_init);
+        int res = setMultiChannelConfigGeneric(serial, json, getAnalogConfigs, setAnalogExtendedFields, ADC_init);
         return res;
 }
 
@@ -862,19 +1144,19 @@ int api_getAnalogConfig(struct Serial *serial, const jsmntok_t * json)
 
 #if IMU_CHANNELS > 0
 
-static const jsmntok_t * setImuExtendedField(const jsmntok_t *valueTok, const char *name, const char *value, void *cfg)
+static void setImuExtendedFields(const jsmntok_t *json, void *cfg)
 {
         ImuConfig *imuCfg = (ImuConfig *)cfg;
+        const char *value;
 
-        if (STR_EQ("mode",name))
+        if ((value = get_field_value(json, "mode")))
                 imuCfg->mode = filterImuMode(atoi(value));
-        else if (STR_EQ("chan",name))
+        if ((value = get_field_value(json, "chan")))
                 imuCfg->physicalChannel = filterImuChannel(atoi(value));
-        else if (STR_EQ("zeroVal",name))
+        if ((value = get_field_value(json, "zeroVal")))
                 imuCfg->zeroValue = atoi(value);
-        else if (STR_EQ("alpha", name))
+        if ((value = get_field_value(json, "alpha")))
                 imuCfg->filterAlpha = atof(value);
-        return valueTok + 1;
 }
 
 static void getImuConfigs(size_t channelId, void ** baseCfg, ChannelConfig ** channelCfg)
@@ -888,7 +1170,7 @@ static void getImuConfigs(size_t channelId, void ** baseCfg, ChannelConfig ** ch
 
 int api_setImuConfig(struct Serial *serial, const jsmntok_t *json)
 {
-        int res = setMultiChannelConfigGeneric(serial, json, getImuConfigs, setImuExtendedField, imu_soft_init);
+        int res = setMultiChannelConfigGeneric(serial, json, getImuConfigs, setImuExtendedFields, imu_soft_init);
 
         update_calculated_imu_channel_configs();
         return res;
@@ -1108,24 +1390,24 @@ static void getPwmConfigs(size_t channelId, void ** baseCfg, ChannelConfig ** ch
         }
 }
 
-static const jsmntok_t * setPwmExtendedField(const jsmntok_t *valueTok, const char *name, const char *value, void *cfg)
+static void setPwmExtendedFields(const jsmntok_t *json, void *cfg)
 {
         PWMConfig *pwmCfg = (PWMConfig *)cfg;
+        const char *value;
 
-        if (STR_EQ("outMode", name))
+        if ((value = get_field_value(json, "outMode")))
                 pwmCfg->outputMode = filterPwmOutputMode(atoi(value));
-        if (STR_EQ("logMode", name))
+        if ((value = get_field_value(json, "logMode")))
                 pwmCfg->loggingMode = filterPwmLoggingMode(atoi(value));
-        if (STR_EQ("stDutyCyc", name))
+        if ((value = get_field_value(json, "stDutyCyc")))
                 pwmCfg->startupDutyCycle = filterPwmDutyCycle(atoi(value));
-        if (STR_EQ("stPeriod", name))
+        if ((value = get_field_value(json, "stPeriod")))
                 pwmCfg->startupPeriod = filterPwmPeriod(atoi(value));
-        return valueTok + 1;
 }
 
 int api_setPwmConfig(struct Serial *serial, const jsmntok_t *json)
 {
-        int res = setMultiChannelConfigGeneric(serial, json, getPwmConfigs, setPwmExtendedField, PWM_update_config);
+        int res = setMultiChannelConfigGeneric(serial, json, getPwmConfigs, setPwmExtendedFields, PWM_update_config);
         return res;
 }
 #endif
@@ -1140,13 +1422,13 @@ static void getGpioConfigs(size_t channelId, void ** baseCfg, ChannelConfig ** c
         }
 }
 
-static const jsmntok_t * setGpioExtendedField(const jsmntok_t *valueTok, const char *name, const char *value, void *cfg)
+static void setGpioExtendedFields(const jsmntok_t *json, void *cfg)
 {
         GPIOConfig *gpioCfg = (GPIOConfig *)cfg;
+        const char *value;
 
-        if (STR_EQ("mode", name))
+        if ((value = get_field_value(json, "mode")))
                 gpioCfg->mode = filterGpioMode(atoi(value));
-        return valueTok + 1;
 }
 
 static void sendGpioConfig(struct Serial *serial, size_t startIndex, size_t endIndex)
@@ -1188,7 +1470,7 @@ int api_getGpioConfig(struct Serial *serial, const jsmntok_t *json)
 
 int api_setGpioConfig(struct Serial *serial, const jsmntok_t *json)
 {
-        int res = setMultiChannelConfigGeneric(serial, json, getGpioConfigs, setGpioExtendedField, GPIO_init);
+        int res = setMultiChannelConfigGeneric(serial, json, getGpioConfigs, setGpioExtendedFields, GPIO_init);
         return res;
 }
 #endif
@@ -1203,27 +1485,23 @@ static void getTimerConfigs(size_t channelId, void ** baseCfg, ChannelConfig **
         }
 }
 
-static const jsmntok_t * setTimerExtendedField(const jsmntok_t *valueTok,
-                const char *name,
-                const char *value,
-                void *cfg)
+static void setTimerExtendedFields(const jsmntok_t *json, void *cfg)
 {
         TimerConfig *timerCfg = (TimerConfig *)cfg;
+        const char *value;
 
-        if (STR_EQ("mode", name))
+        if ((value = get_field_value(json, "mode")))
                 timerCfg->mode = filterTimerMode(atoi(value));
-        if (STR_EQ("alpha", name))
+        if ((value = get_field_value(json, "alpha")))
                 timerCfg->filterAlpha = atof(value);
-        if (STR_EQ("ppr", name))
+        if ((value = get_field_value(json, "ppr")))
                 timerCfg->pulsePerRevolution = atof(value);
-        if (STR_EQ("speed", name))
+        if ((value = get_field_value(json, "speed")))
                 timerCfg->timerSpeed = filterTimerDivider(atoi(value));
-        if (STR_EQ("filter_period", name))
+        if ((value = get_field_value(json, "filter_period")))
                 timerCfg->filter_period_us = atoi(value);
-        if (STR_EQ("edge", name))
+        if ((value = get_field_value(json, "edge")))
                 timerCfg->edge = get_timer_edge_enum(value);
-
-        return valueTok + 1;
 }
 
 static void sendTimerConfig(struct Serial *serial, size_t startIndex, size_t endIndex)
@@ -1271,7 +1549,7 @@ int api_getTimerConfig(struct Serial *serial, const jsmntok_t *json)
 
 int api_setTimerConfig(struct Serial *serial, const jsmntok_t *json)
 {
-        int res = setMultiChannelConfigGeneric(serial, json, getTimerConfigs, setTimerExtendedField, timer_init);
+        int res = setMultiChannelConfigGeneric(serial, json, getTimerConfigs, setTimerExtendedFields, timer_init);
         return res;
 }
 #endif
@@ -1438,6 +1716,8 @@ int api_setCanConfig(struct Serial *serial, const jsmntok_t *json)
         }
 #endif
         CAN_init(lc);
+        /* Re-initializing the CAN ports reset the CAN filters */
+        CAN_state_stale();
         return API_SUCCESS;
 }
 
@@ -1509,6 +1789,84 @@ static void set_can_mapping(const jsmntok_t *json_mapping, CANMapping *mapping)
         }
 }
 
+#define CAN_STREAM_CHUNK	8
+
+/*
+ * The chans of a setCanChanCfg message too big to parse at once.  They are
+ * staged here as they arrive and only go into the config once the whole
+ * message made it, so one that fails or is abandoned changes nothing.
+ */
+static struct {
+        CANChannel *chans;
+        size_t count;
+        size_t capacity;
+        uint32_t index;
+} g_can_stream;
+
+static void can_stream_discard(void)
+{
+        if (g_can_stream.chans)
+                portFree(g_can_stream.chans);
+
+        g_can_stream.chans = NULL;
+        g_can_stream.count = 0;
+        g_can_stream.capacity = 0;
+}
+
+static int stage_can_channel(struct Serial *serial, const jsmntok_t *chan,
+                             const CANChannelConfig *can_channel_cfg)
+{
+        const size_t slot = g_can_stream.index + g_can_stream.count;
+        if (slot >= CONFIG_CAN_MAPPINGS)
+                return API_ERROR_PARAMETER;
+
+        if (g_can_stream.count == g_can_stream.capacity) {
+                const size_t capacity = g_can_stream.capacity +
+                        CAN_STREAM_CHUNK;
+                CANChannel *chans = portRealloc(g_can_stream.chans,
+                                                sizeof(CANChannel[capacity]));
+                if (!chans)
+                        return API_ERROR_SEVERE;
+
+                g_can_stream.chans = chans;
+                g_can_stream.capacity = capacity;
+        }
+
+        /* Whatever the element leaves out stays as it is in the config */
+        CANChannel *staged = g_can_stream.chans + g_can_stream.count;
+        *staged = can_channel_cfg->can_channels[slot];
+        set_can_mapping(chan, &staged->mapping);
+        setChannelConfig(serial, chan, &staged->mapping.channel_cfg, NULL,
+                         NULL);
+
+        ++g_can_stream.count;
+        return API_SUCCESS;
+}
+
+int api_set_can_channel_element(struct Serial *serial, const jsmntok_t *json,
+                                const jsmntok_t *chan, size_t index)
+{
+        const CANChannelConfig *can_channel_cfg =
+                &(getWorkingLoggerConfig()->can_channel_cfg);
+
+        if (0 == index) {
+                /* Anything left over is from a message that never ended */
+                can_stream_discard();
+                g_can_stream.index = 0;
+                jsmn_exists_set_val_int(json, "index", &g_can_stream.index);
+
+                /* we can only start updating up to the item right after the last */
+                if (g_can_stream.index > can_channel_cfg->enabled_mappings)
+                        return API_ERROR_PARAMETER;
+        }
+
+        const int rc = stage_can_channel(serial, chan, can_channel_cfg);
+        if (API_SUCCESS != rc)
+                can_stream_discard();
+
+        return rc;
+}
+
 int api_set_can_channel_config(struct Serial *serial, const jsmntok_t *json)
 {
         CANChannelConfig * can_channel_cfg = &(getWorkingLoggerConfig()->can_channel_cfg);
@@ -1521,23 +1879,41 @@ int api_set_can_channel_config(struct Serial *serial, const jsmntok_t *json)
         uint32_t index = 0;
         jsmn_exists_set_val_int(json, "index", &index);
 
-        /* we can only start updating up to the item right after the last */
-        if (index >= CONFIG_CAN_MAPPINGS || index > can_channel_cfg->enabled_mappings)
+        /* the channels api_set_can_channel_element took are staged */
+        const size_t streamed = api_streamed_elements();
+        if (!streamed) {
+                can_stream_discard();
+        } else if (index != g_can_stream.index ||
+                   streamed != g_can_stream.count) {
+                /* An index after the chans came too late to place them */
+                can_stream_discard();
                 return API_ERROR_PARAMETER;
+        }
+
+        if (index >= CONFIG_CAN_MAPPINGS ||
+            index > can_channel_cfg->enabled_mappings) {
+                /* we can only start updating up to the item right after the last */
+                return API_ERROR_PARAMETER;
+        }
 
         /* find the beginning of the channels json array */
         const jsmntok_t *chans_tok = jsmn_find_node(json, "chans");
         chans_tok = jsmn_find_node_type(chans_tok, JSMN_ARRAY);
 
         if (chans_tok) {
-                int channel_max = chans_tok->size;
-                if (channel_max > MAX_CAN_MESSAGE_CHANNELS) {
+                int channel_max = chans_tok->size + index + streamed;
+                if (channel_max > CONFIG_CAN_MAPPINGS) {
+                        can_stream_discard();
                         return API_ERROR_PARAMETER;
                 }
 
-                channel_max += index;
-                if (channel_max > CONFIG_CAN_MAPPINGS) {
-                        return API_ERROR_PARAMETER;
+                /* The whole message made it, so the staged ones go in */
+                if (streamed) {
+                        memcpy(can_channel_cfg->can_channels + index,
+                               g_can_stream.chans,
+                               sizeof(CANChannel[streamed]));
+                        index += streamed;
+                        can_stream_discard();
                 }
 
                 for (chans_tok++; index < channel_max; index++) {
@@ -1741,51 +2117,56 @@ int api_getLapConfig(struct Serial *serial, const jsmntok_t *json)
         return API_SUCCESS_NO_RETURN;
 }
 
-static void json_geoPointArray(struct Serial *serial, const char *name, const GeoPoint *point, int more)
+static void json_geoPointArray(struct json_writer *jw, const char *name,
+                               const GeoPoint *point)
 {
-        json_arrayStart(serial, name);
-        json_arrayElementFloat(serial, point->latitude, DEFAULT_GPS_POSITION_PRECISION, 1);
-        json_arrayElementFloat(serial, point->longitude, DEFAULT_GPS_POSITION_PRECISION, 0);
-        json_arrayEnd(serial, more);
+        json_writer_array_start(jw, name);
+        json_writer_float(jw, NULL, point->latitude,
+                          DEFAULT_GPS_POSITION_PRECISION);
+        json_writer_float(jw, NULL, point->longitude,
+                          DEFAULT_GPS_POSITION_PRECISION);
+        json_writer_array_end(jw);
 }
 
-static void json_track(struct Serial *serial, const Track *track)
+static void json_track(struct json_writer *jw, const Track *track)
 {
-        json_int(serial, "id", track->trackId, 1);
-        json_int(serial, "type", track->track_type, 1);
+        json_writer_int(jw, "id", track->trackId);
+        json_writer_int(jw, "type", track->track_type);
         if (track->track_type == TRACK_TYPE_CIRCUIT) {
-                json_geoPointArray(serial, "sf", &track->circuit.startFinish, 1);
-                json_arrayStart(serial, "sec");
-                for (size_t i = 0; i < CIRCUIT_SECTOR_COUNT; i++) {
-                        json_geoPointArray(serial, NULL, &track->circuit.sectors[i], i < CIRCUIT_SECTOR_COUNT - 1);
-                }
-                json_arrayEnd(serial, 0);
+                json_geoPointArray(jw, "sf", &track->circuit.startFinish);
+                json_writer_array_start(jw, "sec");
+                for (size_t i = 0; i < CIRCUIT_SECTOR_COUNT; i++)
+                        json_geoPointArray(jw, NULL, &track->circuit.sectors[i]);
+                json_writer_array_end(jw);
         } else {
                 GeoPoint start = getStartPoint(track);
                 GeoPoint finish = getFinishPoint(track);
-                json_geoPointArray(serial, "st", &start, 1);
-                json_geoPointArray(serial, "fin", &finish, 1);
-                json_arrayStart(serial, "sec");
-                for (size_t i = 0; i < STAGE_SECTOR_COUNT; i++) {
-                        json_geoPointArray(serial, NULL, &track->stage.sectors[i], i < STAGE_SECTOR_COUNT - 1);
-                }
-                json_arrayEnd(serial, 0);
+                json_geoPointArray(jw, "st", &start);
+                json_geoPointArray(jw, "fin", &finish);
+                json_writer_array_start(jw, "sec");
+                for (size_t i = 0; i < STAGE_SECTOR_COUNT; i++)
+                        json_geoPointArray(jw, NULL, &track->stage.sectors[i]);
+                json_writer_array_end(jw);
         }
 }
 
 int api_getTrackConfig(struct Serial *serial, const jsmntok_t *json)
 {
         TrackConfig *trackCfg = &(getWorkingLoggerConfig()->TrackConfigs);
-
-        json_objStart(serial);
-        json_objStartString(serial, "trackCfg");
-        json_float(serial, "rad", trackCfg->radius, DEFAULT_GPS_RADIUS_PRECISION, 1);
-        json_int(serial, "autoDetect", trackCfg->auto_detect, 1);
-        json_objStartString(serial, "track");
-        json_track(serial, &trackCfg->track);
-        json_objEnd(serial, 0);
-        json_objEnd(serial, 0);
-        json_objEnd(serial, 0);
+        struct json_writer jw;
+
+        json_writer_init(&jw, serial);
+        json_writer_obj_start(&jw, NULL);
+        json_writer_obj_start(&jw, "trackCfg");
+        json_writer_float(&jw, "rad", trackCfg->radius,
+                          DEFAULT_GPS_RADIUS_PRECISION);
+        json_writer_int(&jw, "autoDetect", trackCfg->auto_detect);
+        json_writer_obj_start(&jw, "track");
+        json_track(&jw, &trackCfg->track);
+        json_writer_obj_end(&jw);
+        json_writer_obj_end(&jw);
+        json_writer_obj_end(&jw);
+        json_writer_flush(&jw);
 
         return API_SUCCESS_NO_RETURN;
 }
@@ -1923,20 +2304,23 @@ int api_getTrackDb(struct Serial *serial, const jsmntok_t *json)
         const Tracks * tracks = get_tracks();
 
         size_t track_count = tracks->count;
-        json_objStart(serial);
-        json_objStartString(serial, "trackDb");
-        json_int(serial,"size", track_count, 1);
-        json_int(serial, "max", MAX_TRACK_COUNT, 1);
-        json_arrayStart(serial, "tracks");
+        struct json_writer jw;
+
+        json_writer_init(&jw, serial);
+        json_writer_obj_start(&jw, NULL);
+        json_writer_obj_start(&jw, "trackDb");
+        json_writer_int(&jw, "size", track_count);
+        json_writer_int(&jw, "max", MAX_TRACK_COUNT);
+        json_writer_array_start(&jw, "tracks");
         for (size_t track_index = 0; track_index < track_count; track_index++) {
-                const Track *track = tracks->tracks + track_index;
-                json_objStart(serial);
-                json_track(serial, track);
-                json_objEnd(serial, track_index < track_count - 1);
+                json_writer_obj_start(&jw, NULL);
+                json_track(&jw, tracks->tracks + track_index);
+                json_writer_obj_end(&jw);
         }
-        json_arrayEnd(serial, 0);
-        json_objEnd(serial, 0);
-        json_objEnd(serial, 0);
+        json_writer_array_end(&jw);
+        json_writer_obj_end(&jw);
+        json_writer_obj_end(&jw);
+        json_writer_flush(&jw);
 
         return API_SUCCESS_NO_RETURN;
 }
@@ -2115,8 +2499,36 @@ int api_get_wifi_cfg(struct Serial *serial, const jsmntok_t *json)
 
 int api_set_telemetry(struct Serial *serial, const jsmntok_t *json)
 {
+        /* Hosts that don't ask for a format get JSON, as they always have */
+        char fmt[8] = "json";
+        const bool fmt_set =
+                jsmn_exists_set_val_string(json, "fmt", fmt, sizeof(fmt),
+                                           false);
+
+        if (STR_EQ(fmt, "bin")) {
+                serial_set_telemetry_format(serial,
+                                            SERIAL_TELEMETRY_FORMAT_BINARY);
+        } else if (STR_EQ(fmt, "delta")) {
+                serial_set_telemetry_format(serial,
+                                            SERIAL_TELEMETRY_FORMAT_DELTA);
+        } else if (STR_EQ(fmt, "json")) {
+                serial_set_telemetry_format(serial,
+                                            SERIAL_TELEMETRY_FORMAT_JSON);
+        } else {
+                return API_ERROR_PARAMETER;
+        }
+
         int sample_rate = 0;
-        jsmn_exists_set_val_int(json, "rate", &sample_rate);
+        const bool rate_set =
+                jsmn_exists_set_val_int(json, "rate", &sample_rate);
+
+        /*
+         * Just switching the format.  This also works on connections that
+         * stream on their own, like Bluetooth and cellular.
+         */
+        if (fmt_set && !rate_set)
+                return API_SUCCESS;
+
         void* data = (void*) (long) sample_rate;
 
         const enum serial_ioctl_status status =
@@ -2186,6 +2598,27 @@ int api_set_auto_logger_cfg(struct Serial *serial, const jsmntok_t *json)
         return auto_logger_set_config(cfg, json) ?
                API_SUCCESS : API_ERROR_UNSPECIFIED;
 }
+
+int api_get_logfile_cfg(struct Serial *serial, const jsmntok_t *json)
+{
+        const struct logfile_config* cfg =
+                &getWorkingLoggerConfig()->logging_cfg.logfile;
+
+        json_objStart(serial);
+        logfile_get_config(cfg, serial, false);
+        json_objEnd(serial, false);
+
+        return API_SUCCESS_NO_RETURN;
+}
+
+int api_set_logfile_cfg(struct Serial *serial, const jsmntok_t *json)
+{
+        struct logfile_config* cfg =
+                &getWorkingLoggerConfig()->logging_cfg.logfile;
+
+        return logfile_set_config(cfg, json) ?
+               API_SUCCESS : API_ERROR_UNSPECIFIED;
+}
 #endif
 
 #if CAMERA_CONTROL
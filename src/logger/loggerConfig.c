@@ -313,6 +313,9 @@ static void resetConnectivityConfig(ConnectivityConfig *cfg)
 static void reset_logging_config(struct logging_config *lc)
 {
         memset(lc, 0, sizeof(struct logging_config));
+        lc->logfile.write_threshold = DEFAULT_LOGFILE_WRITE_THRESHOLD;
+        lc->logfile.write_latency_ms = DEFAULT_LOGFILE_WRITE_LATENCY_MS;
+        lc->logfile.prealloc_minutes = DEFAULT_LOGFILE_PREALLOC_MINUTES;
 }
 
 bool isHigherSampleRate(const int contender, const int champ)
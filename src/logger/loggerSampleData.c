@@ -49,6 +49,7 @@
 #include <stdbool.h>
 
 #define SAMPLE_CB_REGISTRY_SIZE	8
+#define SCHEDULE_ALWAYS_BIT	(1 << SAMPLE_SCHEDULE_MAX_RATES)
 
 struct sample_cb_registry {
         logger_sample_cb_t* cb;
@@ -386,6 +387,93 @@ void init_channel_sample_buffer(LoggerConfig *loggerConfig, struct sample *buff)
                         get_distance_getter(chanCfg));
         chanCfg = &(trackConfig->session_time_cfg);
         sample = processChannelSampleWithFloatGetterNoarg(sample, chanCfg, lapstats_session_time_minutes);
+
+        sample_schedule_init(buff);
+}
+
+/**
+ * @return The index of the bucket for the rate, adding one if needed, or
+ * -1 if we are out of buckets.
+ */
+static int get_schedule_bucket(struct sample_schedule *sched,
+                               const unsigned short rate)
+{
+        for (int i = 0; i < sched->bucket_count; ++i)
+                if (rate == sched->buckets[i].rate)
+                        return i;
+
+        if (sched->bucket_count >= SAMPLE_SCHEDULE_MAX_RATES)
+                return -1;
+
+        struct sample_schedule_bucket *b = sched->buckets + sched->bucket_count;
+        b->rate = rate;
+        b->start = 0;
+        b->count = 0;
+
+        return sched->bucket_count++;
+}
+
+/**
+ * Appends the indexes of the channels sampled at the given rate, or of the
+ * always sampled channels if the rate is SAMPLE_DISABLED, sorted by getter
+ * type.
+ * @return The new end of the order.
+ */
+static uint16_t* put_schedule_group(const struct sample *s, uint16_t *op,
+                                    const unsigned short rate)
+{
+        for (int type = SampleData_Int_Noarg; type <= SampleData_Double;
+             ++type) {
+                for (size_t i = 0; i < s->channel_count; ++i) {
+                        const ChannelSample *cs = s->channel_samples + i;
+                        if (type != (int) cs->sampleData)
+                                continue;
+
+                        const bool always = cs->cfg->flags & ALWAYS_SAMPLED;
+                        if (SAMPLE_DISABLED == rate ? !always :
+                            always || rate != cs->cfg->sampleRate)
+                                continue;
+
+                        *op++ = i;
+                }
+        }
+
+        return op;
+}
+
+void sample_schedule_init(struct sample *s)
+{
+        struct sample_schedule *sched = &s->schedule;
+        sched->valid = false;
+        sched->bucket_count = 0;
+        sched->populated = 0;
+
+        for (size_t i = 0; i < s->channel_count; ++i) {
+                ChannelSample *cs = s->channel_samples + i;
+                cs->populated = false;
+
+                /*
+                 * Always sampled channels still get a bucket for their own
+                 * rate so that their ticks produce a sample.
+                 */
+                if (get_schedule_bucket(sched, cs->cfg->sampleRate) < 0) {
+                        pr_warning("Too many sample rates.  Scanning all "
+                                   "channels instead\r\n");
+                        return;
+                }
+        }
+
+        uint16_t *op = put_schedule_group(s, sched->order, SAMPLE_DISABLED);
+        sched->always_count = op - sched->order;
+
+        for (int i = 0; i < sched->bucket_count; ++i) {
+                struct sample_schedule_bucket *b = sched->buckets + i;
+                b->start = op - sched->order;
+                op = put_schedule_group(s, op, b->rate);
+                b->count = op - sched->order - b->start;
+        }
+
+        sched->valid = true;
 }
 
 static void populate_channel_sample(ChannelSample *sample)
@@ -424,12 +512,15 @@ static void populate_channel_sample(ChannelSample *sample)
         }
 }
 
-int populate_sample_buffer(struct sample *s, size_t logTick)
+/**
+ * Populates every channel due at this tick by checking each one.  Only used
+ * when the config doesn't fit in a schedule.
+ */
+static int scan_sample_buffer(struct sample *s, size_t logTick)
 {
         unsigned short highestRate = SAMPLE_DISABLED;
         ChannelSample *samples = s->channel_samples;
         const size_t count = s->channel_count;
-        s->ticks = logTick;
 
         for (size_t i = 0; i < count; i++, samples++) {
                 const unsigned short sampleRate = samples->cfg->sampleRate;
@@ -462,6 +553,69 @@ int populate_sample_buffer(struct sample *s, size_t logTick)
         return highestRate;
 }
 
+static void populate_channel_group(ChannelSample *samples,
+                                   const uint16_t *idx, size_t count)
+{
+        for (; count; --count, ++idx) {
+                ChannelSample *cs = samples + *idx;
+                cs->populated = true;
+                populate_channel_sample(cs);
+        }
+}
+
+static void clear_channel_group(ChannelSample *samples, const uint16_t *idx,
+                                size_t count)
+{
+        for (; count; --count, ++idx)
+                samples[*idx].populated = false;
+}
+
+int populate_sample_buffer(struct sample *s, size_t logTick)
+{
+        struct sample_schedule *sched = &s->schedule;
+        ChannelSample *samples = s->channel_samples;
+        s->ticks = logTick;
+
+        if (!sched->valid)
+                return scan_sample_buffer(s, logTick);
+
+        /* Clear out whatever this buffer held the last time it was used */
+        for (int i = 0; sched->populated && i < sched->bucket_count; ++i) {
+                const struct sample_schedule_bucket *b = sched->buckets + i;
+                if (sched->populated & (1 << i))
+                        clear_channel_group(samples, sched->order + b->start,
+                                            b->count);
+        }
+
+        if (sched->populated & SCHEDULE_ALWAYS_BIT)
+                clear_channel_group(samples, sched->order,
+                                    sched->always_count);
+
+        unsigned short highestRate = SAMPLE_DISABLED;
+        uint16_t due = 0;
+        for (int i = 0; i < sched->bucket_count; ++i) {
+                const struct sample_schedule_bucket *b = sched->buckets + i;
+                if (logTick % b->rate != 0)
+                        continue;
+
+                due |= 1 << i;
+                highestRate = getHigherSampleRate(b->rate, highestRate);
+                populate_channel_group(samples, sched->order + b->start,
+                                       b->count);
+        }
+
+        // Check if we got a sample.  If not, then bypass the rest as we are done.
+        sched->populated = due;
+        if (!due)
+                return SAMPLE_DISABLED;
+
+        // If there was a sample taken, now we fill in the always sampled fields.
+        populate_channel_group(samples, sched->order, sched->always_count);
+        sched->populated |= SCHEDULE_ALWAYS_BIT;
+
+        return highestRate;
+}
+
 
 static bool is_valid_registry_index(const int idx)
 {
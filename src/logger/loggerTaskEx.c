@@ -127,18 +127,9 @@ void startLoggerTaskEx(int priority)
 static int init_sample_ring_buffer(LoggerConfig *loggerConfig)
 {
         const size_t channel_count = get_enabled_channel_count(loggerConfig);
-        struct sample *s = g_sample_buffer;
-        const struct sample * const end = s + LOGGER_MESSAGE_BUFFER_SIZE;
-        int i;
-
-        for (i = 0; s < end; ++s, ++i) {
-                const size_t bytes = init_sample_buffer(s, channel_count);
-                if (0 == bytes) {
-                        /* If here, then can't alloc memory for buffers */
-                        pr_error("Failed to allocate memory for sample buffers\r\n");
-                        break;
-                }
-        }
+        const int i = sample_pool_init(g_sample_buffer,
+                                       LOGGER_MESSAGE_BUFFER_SIZE,
+                                       channel_count);
 
         pr_debug_int_msg("Sample buffers allocated: ", i);
         return i;
@@ -170,7 +161,7 @@ void updateSampleRates(LoggerConfig *loggerConfig, int *loggingSampleRate,
 void loggerTaskEx(void *params)
 {
         LoggerConfig *loggerConfig = getWorkingLoggerConfig();
-        size_t bufferIndex = 0;
+        struct sample *sample = NULL;
         size_t currentTicks = 0;
         int buffer_size = 0;
         int loggingSampleRate = SAMPLE_DISABLED;
@@ -196,6 +187,11 @@ void loggerTaskEx(void *params)
                 ++currentTicks;
 
                 if (g_config_changed) {
+                        /* Drop our references before the buffers change */
+                        sample_release(sample);
+                        sample_release(current_sample);
+                        sample = current_sample = NULL;
+
                         buffer_size = init_sample_ring_buffer(loggerConfig);
                         if (!buffer_size) {
                                 pr_error("Failed to allocate any buffers!\r\n");
@@ -251,8 +247,21 @@ void loggerTaskEx(void *params)
                         logging_set_status(LOGGING_STATUS_IDLE);
                 }
 
-                /* Prepare a Sample */
-                struct sample *sample = g_sample_buffer + bufferIndex;
+                /*
+                 * Prepare a Sample.  We keep the one we got until it is
+                 * actually used so ticks with nothing to sample don't cycle
+                 * through the pool.
+                 */
+                if (!sample)
+                        sample = sample_pool_acquire(g_sample_buffer,
+                                                     buffer_size);
+
+                if (!sample) {
+                        /* Every sample is still held by a consumer */
+                        if (should_sample(currentTicks, loggingSampleRate))
+                                sample_pool_starved();
+                        continue;
+                }
 
                 /* Check if we need to actually populate the buffer. */
                 const int sampledRate = populate_sample_buffer(sample,
@@ -288,10 +297,10 @@ void loggerTaskEx(void *params)
                 /* Process callback handlers for the samples */
                 logger_sample_process_callbacks(currentTicks, sample);
 
-                ++bufferIndex;
-                bufferIndex %= buffer_size;
-
+                /* Our reference moves on to the new current sample */
+                sample_release(current_sample);
                 current_sample = sample;
+                sample = NULL;
                 g_config_changed = false;
         }
 
@@ -26,25 +26,46 @@
 #include "loggerSampleData.h"
 #include "mem_mang.h"
 #include "sampleRecord.h"
+#include "task.h"
 #include "taskUtil.h"
 #include "macros.h"
 #include <stdbool.h>
+#include <string.h>
 #include "printk.h"
 
 #define LOG_PFX "[sampleRecord] "
+
+static struct {
+        bool subscribed;
+        struct sample_consumer_stats stats;
+} g_consumers[__SAMPLE_CONSUMER_COUNT];
+
+/* The channel layout new samples are built with */
+static struct {
+        uint32_t generation;
+        size_t channel_count;
+} g_layout;
+
+/* Different samples the telemetry consumers hold between them */
+static volatile uint32_t g_telemetry_held;
+
 size_t init_sample_buffer(struct sample *s, const size_t count)
 {
         if (s->channel_samples)
                 free_sample_buffer(s);
 
-        const size_t size = sizeof(ChannelSample[count]);
+        /* The schedule order lives right after the channel samples */
+        const size_t size = sizeof(ChannelSample[count]) +
+                sizeof(uint16_t[count]);
         s->channel_samples = (ChannelSample *) portMalloc(size);
 
         if (NULL == s->channel_samples)
                 return 0;
 
+        s->schedule.order = (uint16_t *) (s->channel_samples + count);
         s->ticks = 0;
         s->channel_count = count;
+        s->layout = 0;
         init_channel_sample_buffer(getWorkingLoggerConfig(), s);
 
         return size;
@@ -54,6 +75,8 @@ void free_sample_buffer(struct sample *s)
 {
         portFree(s->channel_samples);
         s->channel_samples = NULL;
+        s->schedule.order = NULL;
+        s->schedule.valid = false;
 }
 
 bool get_sample_value_by_name(const struct sample *s, const char * name, double *value, char ** units)
@@ -94,39 +117,230 @@ bool get_sample_value_by_name(const struct sample *s, const char * name, double
         return false;
 }
 
+void sample_hold(struct sample *s)
+{
+        taskENTER_CRITICAL();
+        ++s->refs;
+        taskEXIT_CRITICAL();
+}
+
+void sample_release(struct sample *s)
+{
+        if (!s)
+                return;
+
+        taskENTER_CRITICAL();
+        if (s->refs)
+                --s->refs;
+        taskEXIT_CRITICAL();
+}
+
+static bool is_telemetry(const enum sample_consumer c)
+{
+        return SAMPLE_CONSUMER_FILE != c;
+}
+
+/**
+ * Accounts for a consumer taking a sample.  Telemetry consumers only get
+ * it if that leaves the file writer its share of the pool.
+ * @return true if the consumer may have the sample, false otherwise.
+ */
+static bool take_held(const enum sample_consumer c, struct sample *s)
+{
+        struct sample_consumer_stats *stats = &g_consumers[c].stats;
+        const bool telemetry = is_telemetry(c);
+
+        taskENTER_CRITICAL();
+        /* Sharing a sample the other link holds costs the pool nothing */
+        const bool taken = !telemetry || s->telemetry_refs ||
+                g_telemetry_held < SAMPLE_TELEMETRY_MAX_HELD;
+
+        if (taken) {
+                if (telemetry && !s->telemetry_refs++)
+                        ++g_telemetry_held;
+
+                ++stats->held;
+                stats->held_high_water = MAX(stats->held_high_water,
+                                             stats->held);
+        }
+        taskEXIT_CRITICAL();
+
+        return taken;
+}
+
 /**
- * Checks to ensure that the LoggerMessage object is pointing to a
- * usable data_sample structure.  This is needed because while the
- * LoggerMessages are deeply copied to their respective queues, the
- * data_sample structures are not (they are a part of a ring buffer).
- * So we must validate that the timestamp on the LoggerMessage matches
- * that of the data_sample object.
- * @param lm The LoggerMessage object.
- * @return True if the data_sample is usable, false otherwise.
+ * Accounts for a consumer giving back a sample.
  */
-bool is_sample_data_valid(const LoggerMessage *lm)
+static void give_held(const enum sample_consumer c, struct sample *s)
 {
-        /* Only validate messages with non-null samples */
-        return NULL == lm->sample ? true : lm->ticks == lm->sample->ticks;
+        struct sample_consumer_stats *stats = &g_consumers[c].stats;
+
+        taskENTER_CRITICAL();
+        if (is_telemetry(c) && s->telemetry_refs &&
+            !--s->telemetry_refs && g_telemetry_held)
+                --g_telemetry_held;
+
+        if (stats->held)
+                --stats->held;
+        taskEXIT_CRITICAL();
 }
 
-portBASE_TYPE send_logger_message(const xQueueHandle queue,
+static size_t init_pool_sample(struct sample *s)
+{
+        const size_t size = init_sample_buffer(s, g_layout.channel_count);
+        if (size)
+                s->layout = g_layout.generation;
+
+        return size;
+}
+
+size_t sample_pool_init(struct sample *pool, const size_t count,
+                        const size_t channel_count)
+{
+        ++g_layout.generation;
+        g_layout.channel_count = channel_count;
+
+        size_t i;
+        for (i = 0; i < count; ++i) {
+                struct sample *s = pool + i;
+
+                /*
+                 * Consumers may still be reading the ones they hold.  Only
+                 * the pool owner takes new references, so a free sample
+                 * stays free while we rebuild it.
+                 */
+                if (s->refs)
+                        continue;
+
+                if (!init_pool_sample(s)) {
+                        pr_error(LOG_PFX "Failed to allocate sample buffer\r\n");
+                        break;
+                }
+        }
+
+        return i;
+}
+
+uint32_t sample_pool_layout(void)
+{
+        return g_layout.generation;
+}
+
+struct sample* sample_pool_acquire(struct sample *pool, const size_t count)
+{
+        for (size_t i = 0; i < count; ++i) {
+                struct sample *s = pool + i;
+                if (s->refs)
+                        continue;
+
+                if (!s->channel_samples)
+                        continue;
+
+                /* Held when the layout changed.  Nobody uses it any more */
+                if (s->layout != g_layout.generation &&
+                    !init_pool_sample(s))
+                        continue;
+
+                /* Only the pool owner takes new references.  No race */
+                sample_hold(s);
+                return s;
+        }
+
+        return NULL;
+}
+
+void sample_pool_starved(void)
+{
+        struct sample_consumer_stats *top = NULL;
+        for (size_t i = 0; i < __SAMPLE_CONSUMER_COUNT; ++i) {
+                struct sample_consumer_stats *stats = &g_consumers[i].stats;
+                if (stats->held && (!top || stats->held > top->held))
+                        top = stats;
+        }
+
+        if (top)
+                ++top->starved;
+}
+
+void sample_consumer_subscribe(const enum sample_consumer c)
+{
+        g_consumers[c].subscribed = true;
+}
+
+void sample_consumer_unsubscribe(const enum sample_consumer c,
+                                 xQueueHandle queue)
+{
+        g_consumers[c].subscribed = false;
+
+        /* Rotate through the queue once, putting back what we keep */
+        unsigned portBASE_TYPE waiting = uxQueueMessagesWaiting(queue);
+        LoggerMessage lm;
+
+        while (waiting-- && pdTRUE == xQueueReceive(queue, &lm, 0)) {
+                if (lm.sample)
+                        release_logger_message(c, &lm);
+                else
+                        xQueueSend(queue, &lm, 0);
+        }
+}
+
+void sample_consumer_get_stats(const enum sample_consumer c,
+                               struct sample_consumer_stats *stats)
+{
+        *stats = g_consumers[c].stats;
+}
+
+portBASE_TYPE send_logger_message(const enum sample_consumer c,
+                                  const xQueueHandle queue,
                                   const LoggerMessage * const msg)
 {
-        return NULL == queue ? errQUEUE_EMPTY : xQueueSend(queue, msg, 0);
+        if (NULL == queue)
+                return errQUEUE_EMPTY;
+
+        struct sample *s = msg->sample;
+        if (!s)
+                return xQueueSend(queue, msg, 0);
+
+        if (!g_consumers[c].subscribed)
+                return errQUEUE_FULL;
+
+        if (!take_held(c, s)) {
+                ++g_consumers[c].stats.dropped;
+                return errQUEUE_FULL;
+        }
+
+        /* Hold it first.  The consumer may be done before we return */
+        sample_hold(s);
+
+        const portBASE_TYPE res = xQueueSend(queue, msg, 0);
+        if (pdTRUE != res) {
+                ++g_consumers[c].stats.dropped;
+                release_logger_message(c, msg);
+        }
+
+        return res;
 }
 
 
 char receive_logger_message(xQueueHandle queue, LoggerMessage *lm,
                             portTickType timeout)
 {
-        char res;
+        return xQueueReceive(queue, lm, timeout);
+}
+
+void sample_consumer_release(const enum sample_consumer c, struct sample *s)
+{
+        if (!s)
+                return;
 
-        do {
-                res = xQueueReceive(queue, lm, timeout);
-        } while (pdTRUE == res && !is_sample_data_valid(lm));
+        give_held(c, s);
+        sample_release(s);
+}
 
-        return res;
+void release_logger_message(const enum sample_consumer c,
+                            const LoggerMessage *lm)
+{
+        sample_consumer_release(c, lm->sample);
 }
 
 xQueueHandle create_logger_message_queue()
@@ -0,0 +1,208 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "sdcard.h"
+#include "telemetry_backlog.h"
+#include <string.h>
+
+void telemetry_backlog_init(struct telemetry_backlog *tb, FIL *file,
+                            char *buf, const size_t buf_len)
+{
+        tb->file = file;
+        tb->buf = buf;
+        tb->buf_len = buf_len;
+        tb->count = 0;
+        tb->run_start = 0;
+        tb->interval = TELEMETRY_BACKLOG_INDEX_INTERVAL;
+        tb->last_tick = 0;
+        tb->read_offset = 0;
+}
+
+FRESULT telemetry_backlog_append(struct telemetry_backlog *tb,
+                                 const struct sample *sample,
+                                 const uint32_t tick, const bool meta)
+{
+        const DWORD end = f_size(tb->file);
+        const FRESULT res = f_lseek(tb->file, end);
+        if (FR_OK != res)
+                return res;
+
+        telemetry_backlog_index(tb, tick, end);
+        fs_write_sample_record(tb->file, sample, tick, meta);
+        return FR_OK;
+}
+
+static bool starts_run(const struct telemetry_backlog_entry *entry,
+                       const uint32_t prev_tick)
+{
+        return entry->tick <= prev_tick;
+}
+
+static void find_run_start(struct telemetry_backlog *tb)
+{
+        tb->run_start = 0;
+        for (size_t i = 1; i < tb->count; ++i)
+                if (starts_run(tb->index + i, tb->index[i - 1].tick))
+                        tb->run_start = i;
+}
+
+/**
+ * Makes room in a full index by doubling the interval.  Entries that
+ * start a run stay, so if those fill the index the oldest has to go.
+ */
+static void thin_index(struct telemetry_backlog *tb)
+{
+        struct telemetry_backlog_entry *index = tb->index;
+        const uint32_t interval = tb->interval * 2;
+        size_t kept = 1;
+
+        for (size_t i = 1; i < tb->count; ++i) {
+                if (index[i].tick % interval &&
+                    !starts_run(index + i, index[i - 1].tick))
+                        continue;
+
+                index[kept++] = index[i];
+        }
+
+        if (kept == tb->count) {
+                --kept;
+                memmove(index, index + 1, kept * sizeof(*index));
+        }
+
+        tb->count = kept;
+        tb->interval = interval;
+        find_run_start(tb);
+}
+
+static bool wants_entry(const struct telemetry_backlog *tb,
+                        const uint32_t tick, const bool new_run)
+{
+        return !tb->count || new_run || 0 == tick % tb->interval;
+}
+
+void telemetry_backlog_index(struct telemetry_backlog *tb,
+                             const uint32_t tick, const uint32_t offset)
+{
+        const bool new_run = tb->count && tick <= tb->last_tick;
+
+        tb->last_tick = tick;
+        if (!wants_entry(tb, tick, new_run))
+                return;
+
+        if (TELEMETRY_BACKLOG_INDEX_LEN == tb->count) {
+                thin_index(tb);
+
+                /* The interval just doubled */
+                if (!wants_entry(tb, tick, new_run))
+                        return;
+        }
+
+        if (new_run || !tb->count)
+                tb->run_start = tb->count;
+
+        tb->index[tb->count].tick = tick;
+        tb->index[tb->count].offset = offset;
+        ++tb->count;
+}
+
+/**
+ * Moves an offset past the given number of records.
+ * @return false if the file ends first.
+ */
+static bool skip_records(struct telemetry_backlog *tb, uint32_t *offset,
+                         uint32_t records)
+{
+        while (records) {
+                UINT len;
+                if (FR_OK != f_lseek(tb->file, *offset) ||
+                    FR_OK != f_read(tb->file, tb->buf, tb->buf_len, &len) ||
+                    !len)
+                        return false;
+
+                const char *c = tb->buf;
+                const char *end = tb->buf + len;
+                while (records && (c = memchr(c, '\n', end - c))) {
+                        ++c;
+                        --records;
+                }
+
+                *offset += records ? len : (uint32_t) (c - tb->buf);
+        }
+
+        return true;
+}
+
+bool telemetry_backlog_resume(struct telemetry_backlog *tb,
+                              const uint32_t tick)
+{
+        const uint32_t next = tick + 1;
+        if (!tb->count || tick > tb->last_tick ||
+            next < tb->index[tb->run_start].tick)
+                return false;
+
+        if (tick == tb->last_tick) {
+                tb->read_offset = f_size(tb->file);
+                return true;
+        }
+
+        /* The last entry at or before the record we want */
+        size_t lo = tb->run_start;
+        size_t hi = tb->count;
+        while (hi - lo > 1) {
+                const size_t mid = lo + (hi - lo) / 2;
+                if (tb->index[mid].tick <= next)
+                        lo = mid;
+                else
+                        hi = mid;
+        }
+
+        const struct telemetry_backlog_entry *entry = tb->index + lo;
+        uint32_t offset = entry->offset;
+        if (!skip_records(tb, &offset, next - entry->tick))
+                return false;
+
+        tb->read_offset = offset;
+        return true;
+}
+
+const char* telemetry_backlog_read(struct telemetry_backlog *tb, size_t *len)
+{
+        /* Don't bother the card when there is nothing new */
+        *len = 0;
+        if (!telemetry_backlog_pending(tb))
+                return tb->buf;
+
+        UINT read;
+        if (FR_OK != f_lseek(tb->file, tb->read_offset) ||
+            FR_OK != f_read(tb->file, tb->buf, tb->buf_len, &read))
+                return NULL;
+
+        tb->read_offset += read;
+        *len = read;
+        return tb->buf;
+}
+
+uint32_t telemetry_backlog_pending(const struct telemetry_backlog *tb)
+{
+        const DWORD size = f_size(tb->file);
+        return size > tb->read_offset ? size - tb->read_offset : 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mem_mang.h"
+#include "taskUtil.h"
+#include "telemetry_batch.h"
+#include <string.h>
+
+void telemetry_batch_init(struct telemetry_batch *tb, struct Serial *serial,
+                          const struct telemetry_batch_cfg *cfg)
+{
+        tb->serial = serial;
+        tb->cfg = *cfg;
+        tb->buf = NULL;
+        tb->len = 0;
+        tb->samples = 0;
+        tb->sample_start = 0;
+        tb->oversized = false;
+        tb->started_at = 0;
+}
+
+void telemetry_batch_free(struct telemetry_batch *tb)
+{
+        if (tb->buf)
+                portFree(tb->buf);
+
+        tb->buf = NULL;
+        telemetry_batch_discard(tb);
+}
+
+static bool batching(struct telemetry_batch *tb)
+{
+        if (tb->cfg.samples <= 1 || !tb->cfg.bytes)
+                return false;
+
+        if (!tb->buf)
+                tb->buf = portMalloc(tb->cfg.bytes);
+
+        /* Without a buffer every sample goes out on its own */
+        return NULL != tb->buf;
+}
+
+/*
+ * Sends the samples held ahead of the one being written, keeping what
+ * there is of that one so it is never split.
+ */
+static void flush_complete(struct telemetry_batch *tb)
+{
+        if (!tb->sample_start)
+                return;
+
+        serial_write_buff(tb->serial, tb->buf, tb->sample_start);
+        tb->len -= tb->sample_start;
+        memmove(tb->buf, tb->buf + tb->sample_start, tb->len);
+        tb->sample_start = 0;
+        tb->samples = 0;
+        tb->started_at = getCurrentTicks();
+}
+
+void telemetry_batch_write(const void *data, const size_t len, void *arg)
+{
+        struct telemetry_batch *tb = arg;
+
+        if (!batching(tb) || tb->oversized) {
+                serial_write_buff(tb->serial, data, len);
+                return;
+        }
+
+        if (len > tb->cfg.bytes - tb->len)
+                flush_complete(tb);
+
+        if (len > tb->cfg.bytes - tb->len) {
+                /*
+                 * The sample alone is bigger than the budget.  It goes out
+                 * as it is written, in one piece since nothing else is
+                 * written to the Serial device in the middle of a sample.
+                 */
+                if (tb->len)
+                        serial_write_buff(tb->serial, tb->buf, tb->len);
+
+                serial_write_buff(tb->serial, data, len);
+                tb->len = 0;
+                tb->oversized = true;
+                return;
+        }
+
+        if (!tb->len)
+                tb->started_at = getCurrentTicks();
+
+        memcpy(tb->buf + tb->len, data, len);
+        tb->len += len;
+}
+
+void telemetry_batch_end_sample(struct telemetry_batch *tb)
+{
+        if (tb->oversized) {
+                /* Already sent, so there is nothing more to hold */
+                tb->oversized = false;
+                return;
+        }
+
+        tb->sample_start = tb->len;
+        if (++tb->samples >= tb->cfg.samples)
+                telemetry_batch_flush(tb);
+        else
+                telemetry_batch_poll(tb);
+}
+
+bool telemetry_batch_poll(struct telemetry_batch *tb)
+{
+        if (!tb->len || !isTimeoutMs(tb->started_at, tb->cfg.latency_ms))
+                return false;
+
+        telemetry_batch_flush(tb);
+        return true;
+}
+
+void telemetry_batch_flush(struct telemetry_batch *tb)
+{
+        if (tb->len)
+                serial_write_buff(tb->serial, tb->buf, tb->len);
+
+        telemetry_batch_discard(tb);
+}
+
+void telemetry_batch_discard(struct telemetry_batch *tb)
+{
+        tb->len = 0;
+        tb->samples = 0;
+        tb->sample_start = 0;
+        tb->oversized = false;
+}
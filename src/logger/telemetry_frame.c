@@ -0,0 +1,692 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crc32.h"
+#include "macros.h"
+#include "mem_mang.h"
+#include "telemetry_frame.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define VALUE_BITS		64
+#define LEADING_BITS		6
+#define MEANINGFUL_BITS		6
+
+/* Ranges for the change in tick delta.  See telemetry_frame.h */
+static const struct {
+        uint8_t prefix;
+        uint8_t prefix_bits;
+        uint8_t bits;
+} tick_buckets[] = {
+        {0x2, 2, 7},
+        {0x6, 3, 9},
+        {0xE, 4, 12},
+        {0xF, 4, 32},
+};
+
+struct frame_writer {
+        const struct log_format_writer *out;
+        uint32_t crc;
+};
+
+static void write_payload(const void *data, const size_t len, void *arg)
+{
+        struct frame_writer *fw = arg;
+
+        fw->crc = crc32_update(fw->crc, data, len);
+        fw->out->write(data, len, fw->out->arg);
+}
+
+static void begin_frame(struct frame_writer *fw,
+                        const struct log_format_writer *w, const size_t len)
+{
+        const uint8_t header[] = {TELEMETRY_FRAME_START, len, len >> 8};
+
+        w->write(header, sizeof(header), w->arg);
+        fw->out = w;
+        fw->crc = CRC32_INIT;
+}
+
+static void end_frame(struct frame_writer *fw)
+{
+        const uint32_t crc = crc32_final(fw->crc);
+        const uint8_t buf[] = {crc, crc >> 8, crc >> 16, crc >> 24};
+
+        fw->out->write(buf, sizeof(buf), fw->out->arg);
+}
+
+int telemetry_frame_meta(const struct log_format_writer *w,
+                         const struct sample *s)
+{
+        const size_t len = log_format_rcb_header_len(s);
+        if (len > TELEMETRY_FRAME_MAX_PAYLOAD)
+                return -1;
+
+        struct frame_writer fw;
+        const struct log_format_writer payload = {write_payload, &fw};
+
+        begin_frame(&fw, w, len);
+        log_format_rcb_header(&payload, s);
+        end_frame(&fw);
+
+        return 0;
+}
+
+int telemetry_frame_sample(const struct log_format_writer *w,
+                           const struct sample *s, const uint32_t tick)
+{
+        if (NULL == s->channel_samples)
+                return -1;
+
+        /* Always fits.  The meta describing the sample is bigger */
+        struct frame_writer fw;
+        const struct log_format_writer payload = {write_payload, &fw};
+
+        begin_frame(&fw, w, log_format_rcb_record_len(s));
+        log_format_rcb_record(&payload, s, tick);
+        end_frame(&fw);
+
+        return 0;
+}
+
+void telemetry_delta_init(struct telemetry_delta *td)
+{
+        memset(td, 0, sizeof(*td));
+}
+
+void telemetry_delta_reset(struct telemetry_delta *td)
+{
+        td->synced = false;
+}
+
+void telemetry_delta_free(struct telemetry_delta *td)
+{
+        if (td->channels)
+                portFree(td->channels);
+
+        telemetry_delta_init(td);
+}
+
+/**
+ * Makes room for the state of every channel.
+ * @return false if we are out of memory.
+ */
+static bool resize_delta(struct telemetry_delta *td, const size_t count)
+{
+        if (td->channels && count == td->channel_count)
+                return true;
+
+        telemetry_delta_free(td);
+        td->channels = portMalloc(sizeof(*td->channels) * count);
+        if (!td->channels)
+                return false;
+
+        td->channel_count = count;
+        return true;
+}
+
+static void start_keyframe(struct telemetry_delta *td, const uint32_t tick)
+{
+        memset(td->channels, 0, sizeof(*td->channels) * td->channel_count);
+        td->tick = tick;
+        td->tick_delta = 0;
+        td->sequence = 0;
+        td->synced = true;
+}
+
+/**
+ * Gets the raw value of a channel the way an RCB record holds it.
+ * @return true if the channel has a value that goes into records.
+ */
+static bool get_value_bits(const ChannelSample *cs, uint64_t *bits)
+{
+        if (!cs->populated)
+                return false;
+
+        switch(cs->sampleData) {
+        case SampleData_Int:
+        case SampleData_Int_Noarg:
+                *bits = (uint32_t) cs->valueInt;
+                return true;
+        case SampleData_LongLong:
+        case SampleData_LongLong_Noarg:
+                *bits = (uint64_t) cs->valueLongLong;
+                return true;
+        case SampleData_Float:
+        case SampleData_Float_Noarg: {
+                uint32_t f;
+                memcpy(&f, &cs->valueFloat, sizeof(f));
+                *bits = f;
+                return true;
+        }
+        case SampleData_Double:
+        case SampleData_Double_Noarg:
+                memcpy(bits, &cs->valueDouble, sizeof(*bits));
+                return true;
+        default:
+                return false;
+        }
+}
+
+struct bit_writer {
+        /* NULL just counts the bits */
+        const struct log_format_writer *w;
+        size_t bits;
+        uint8_t byte;
+};
+
+static void put_bits(struct bit_writer *bw, const uint64_t val, size_t n)
+{
+        while (n--) {
+                bw->byte = bw->byte << 1 | (val >> n & 1);
+                if (++bw->bits % 8)
+                        continue;
+
+                if (bw->w)
+                        bw->w->write(&bw->byte, 1, bw->w->arg);
+                bw->byte = 0;
+        }
+}
+
+static bool fits_bits(const int32_t val, const size_t bits)
+{
+        const int64_t limit = (int64_t) 1 << (bits - 1);
+        return -limit <= val && val < limit;
+}
+
+static void put_tick(struct bit_writer *bw, const int32_t dod)
+{
+        if (!dod) {
+                put_bits(bw, 0, 1);
+                return;
+        }
+
+        size_t i = 0;
+        while (i < ARRAY_LEN(tick_buckets) - 1 &&
+               !fits_bits(dod, tick_buckets[i].bits))
+                ++i;
+
+        put_bits(bw, tick_buckets[i].prefix, tick_buckets[i].prefix_bits);
+        put_bits(bw, (uint32_t) dod, tick_buckets[i].bits);
+}
+
+/**
+ * XOR encodes a value against the last one sent for the channel.  Only
+ * moves the channel's window when the bits are really being written.
+ */
+static void put_value(struct bit_writer *bw,
+                      struct telemetry_delta_channel *ch,
+                      const uint64_t bits)
+{
+        const uint64_t x = bits ^ ch->bits;
+        if (!x) {
+                put_bits(bw, 0, 1);
+                return;
+        }
+
+        const size_t leading = __builtin_clzll(x);
+        const size_t trailing = __builtin_ctzll(x);
+        const size_t window_trailing =
+                VALUE_BITS - ch->leading - ch->meaningful;
+
+        if (ch->meaningful && leading >= ch->leading &&
+            trailing >= window_trailing) {
+                put_bits(bw, 0x2, 2);
+                put_bits(bw, x >> window_trailing, ch->meaningful);
+                return;
+        }
+
+        const size_t meaningful = VALUE_BITS - leading - trailing;
+        put_bits(bw, 0x3, 2);
+        put_bits(bw, leading, LEADING_BITS);
+        put_bits(bw, meaningful - 1, MEANINGFUL_BITS);
+        put_bits(bw, x >> trailing, meaningful);
+
+        if (bw->w) {
+                ch->leading = leading;
+                ch->meaningful = meaningful;
+        }
+}
+
+/**
+ * Writes the bit stream of a delta record.  The delta state only moves on
+ * when the bits are really being written, so a counting pass can go
+ * first to get the length.
+ */
+static void put_delta(struct bit_writer *bw, struct telemetry_delta *td,
+                      const struct sample *s, const uint32_t tick)
+{
+        const ChannelSample *cs = s->channel_samples;
+        const size_t count = s->channel_count;
+        const int32_t tick_delta = (int32_t) (tick - td->tick);
+        uint64_t bits;
+
+        put_tick(bw, tick_delta - td->tick_delta);
+
+        bool same_bitmap = true;
+        for (size_t i = 0; i < count && same_bitmap; ++i)
+                same_bitmap = get_value_bits(cs + i, &bits) ==
+                        td->channels[i].populated;
+
+        put_bits(bw, !same_bitmap, 1);
+        for (size_t i = 0; i < count && !same_bitmap; ++i)
+                put_bits(bw, get_value_bits(cs + i, &bits), 1);
+
+        for (size_t i = 0; i < count; ++i) {
+                struct telemetry_delta_channel *ch = td->channels + i;
+                const bool populated = get_value_bits(cs + i, &bits);
+
+                if (populated)
+                        put_value(bw, ch, bits);
+
+                if (bw->w) {
+                        ch->populated = populated;
+                        if (populated)
+                                ch->bits = bits;
+                }
+        }
+
+        /* Pad out the last byte */
+        put_bits(bw, 0, (8 - bw->bits % 8) % 8);
+
+        if (bw->w) {
+                td->tick = tick;
+                td->tick_delta = tick_delta;
+        }
+}
+
+int telemetry_frame_delta(const struct log_format_writer *w,
+                          struct telemetry_delta *td,
+                          const struct sample *s, const uint32_t tick)
+{
+        if (NULL == s->channel_samples)
+                return -1;
+
+        /* The sequence can't wrap, or readers couldn't spot lost records */
+        if (!td->synced || s->channel_count != td->channel_count ||
+            UINT8_MAX == td->sequence) {
+                if (resize_delta(td, s->channel_count)) {
+                        start_keyframe(td, tick);
+                        for (size_t i = 0; i < s->channel_count; ++i) {
+                                struct telemetry_delta_channel *ch =
+                                        td->channels + i;
+                                ch->populated = get_value_bits(
+                                        s->channel_samples + i, &ch->bits);
+                        }
+                }
+
+                return telemetry_frame_sample(w, s, tick);
+        }
+
+        struct bit_writer counter = {0};
+        put_delta(&counter, td, s, tick);
+
+        struct frame_writer fw;
+        const struct log_format_writer payload = {write_payload, &fw};
+        const uint8_t start[] = {TELEMETRY_FRAME_DELTA_MARKER,
+                                 ++td->sequence};
+
+        begin_frame(&fw, w, sizeof(start) + counter.bits / 8);
+        write_payload(start, sizeof(start), &fw);
+
+        struct bit_writer bw = {
+                .w = &payload,
+        };
+        put_delta(&bw, td, s, tick);
+        end_frame(&fw);
+
+        return 0;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+        return (uint32_t) p[0] | (uint32_t) p[1] << 8 |
+                (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/**
+ * Checks for a complete, intact frame at the start of the data.
+ * @return The length of its payload, or -1 if there is no frame here.
+ */
+static int get_frame(const uint8_t *p, const size_t len)
+{
+        if (len < TELEMETRY_FRAME_OVERHEAD || TELEMETRY_FRAME_START != p[0])
+                return -1;
+
+        const size_t payload_len = p[1] | p[2] << 8;
+        if (!payload_len || len - TELEMETRY_FRAME_OVERHEAD < payload_len)
+                return -1;
+
+        /*
+         * A run of zeros would pass for an empty frame, since the CRC of
+         * nothing is 0.  Real payloads are never empty and always start
+         * with an RCB header or record.
+         */
+        const uint8_t *payload = p + TELEMETRY_FRAME_HEADER_LEN;
+        if (RCB_MAGIC[0] != payload[0] && RCB_RECORD_MARKER != payload[0] &&
+            TELEMETRY_FRAME_DELTA_MARKER != payload[0])
+                return -1;
+
+        if (crc32(payload, payload_len) != get_u32(payload + payload_len))
+                return -1;
+
+        return payload_len;
+}
+
+struct frame_decoder {
+        struct telemetry_delta td;
+        /* enum rcb_value_type of each channel, from the last meta */
+        uint8_t *types;
+        size_t type_count;
+};
+
+static size_t value_size(const uint8_t type)
+{
+        switch(type) {
+        case RCB_TYPE_INT32:
+        case RCB_TYPE_FLOAT:
+                return 4;
+        case RCB_TYPE_INT64:
+        case RCB_TYPE_DOUBLE:
+                return 8;
+        default:
+                return 0;
+        }
+}
+
+static void read_meta(struct frame_decoder *fd, const uint8_t *payload,
+                      const size_t len)
+{
+        if (fd->types)
+                portFree(fd->types);
+
+        fd->type_count = 0;
+        fd->types = NULL;
+        telemetry_delta_reset(&fd->td);
+
+        const size_t count_pos = RCB_MAGIC_LEN + 1;
+        if (len < count_pos + 2)
+                return;
+
+        const size_t count = payload[count_pos] | payload[count_pos + 1] << 8;
+        fd->types = portMalloc(count ? count : 1);
+        if (!fd->types)
+                return;
+
+        if (log_format_rcb_header_types(payload, len, fd->types, count) < 0)
+                return;
+
+        fd->type_count = count;
+}
+
+/**
+ * Takes an RCB record as the keyframe of the delta records that follow.
+ */
+static void read_keyframe(struct frame_decoder *fd, const uint8_t *payload,
+                          const size_t len)
+{
+        struct telemetry_delta *td = &fd->td;
+        const size_t count = fd->type_count;
+        const size_t bitmap_len = (count + 7) / 8;
+
+        telemetry_delta_reset(td);
+        if (!count || len < 1 + 4 + bitmap_len || !resize_delta(td, count))
+                return;
+
+        start_keyframe(td, get_u32(payload + 1));
+
+        const uint8_t *bitmap = payload + 1 + 4;
+        const uint8_t *p = bitmap + bitmap_len;
+        const uint8_t *end = payload + len;
+
+        for (size_t i = 0; i < count; ++i) {
+                struct telemetry_delta_channel *ch = td->channels + i;
+                const size_t size = value_size(fd->types[i]);
+
+                ch->populated = bitmap[i / 8] & 1 << i % 8;
+                if (!ch->populated)
+                        continue;
+
+                if (!size || (size_t) (end - p) < size) {
+                        td->synced = false;
+                        return;
+                }
+
+                ch->bits = get_u32(p);
+                if (8 == size)
+                        ch->bits |= (uint64_t) get_u32(p + 4) << 32;
+                p += size;
+        }
+}
+
+struct bit_reader {
+        const uint8_t *data;
+        size_t len;
+        /* In bits */
+        size_t pos;
+};
+
+static bool get_bits(struct bit_reader *br, size_t n, uint64_t *val)
+{
+        if (br->len * 8 - br->pos < n)
+                return false;
+
+        for (*val = 0; n; --n, ++br->pos)
+                *val = *val << 1 |
+                        (br->data[br->pos / 8] >> (7 - br->pos % 8) & 1);
+
+        return true;
+}
+
+static bool get_tick(struct bit_reader *br, int32_t *dod)
+{
+        uint64_t bit, val;
+
+        *dod = 0;
+        if (!get_bits(br, 1, &bit))
+                return false;
+
+        if (!bit)
+                return true;
+
+        size_t i = 0;
+        while (i < ARRAY_LEN(tick_buckets) - 1) {
+                if (!get_bits(br, 1, &bit))
+                        return false;
+                if (!bit)
+                        break;
+                ++i;
+        }
+
+        const size_t bits = tick_buckets[i].bits;
+        if (!get_bits(br, bits, &val))
+                return false;
+
+        /* Sign extend */
+        const uint64_t sign = (uint64_t) 1 << (bits - 1);
+        *dod = (int32_t) ((val ^ sign) - sign);
+        return true;
+}
+
+static bool get_value(struct bit_reader *br,
+                      struct telemetry_delta_channel *ch)
+{
+        uint64_t control, val;
+
+        if (!get_bits(br, 1, &control))
+                return false;
+
+        if (!control)
+                return true;
+
+        if (!get_bits(br, 1, &control))
+                return false;
+
+        if (control) {
+                uint64_t leading, meaningful;
+                if (!get_bits(br, LEADING_BITS, &leading) ||
+                    !get_bits(br, MEANINGFUL_BITS, &meaningful))
+                        return false;
+
+                ch->leading = leading;
+                ch->meaningful = meaningful + 1;
+                if (ch->leading + ch->meaningful > VALUE_BITS)
+                        return false;
+        } else if (!ch->meaningful) {
+                return false;
+        }
+
+        if (!get_bits(br, ch->meaningful, &val))
+                return false;
+
+        ch->bits ^= val << (VALUE_BITS - ch->leading - ch->meaningful);
+        return true;
+}
+
+static bool read_delta(struct frame_decoder *fd, const uint8_t *payload,
+                       const size_t len)
+{
+        struct telemetry_delta *td = &fd->td;
+        struct bit_reader br = {
+                .data = payload + 2,
+                .len = len - 2,
+        };
+        uint64_t bit;
+        int32_t dod;
+
+        if (len < 2 || !td->synced ||
+            payload[1] != (uint8_t) (td->sequence + 1))
+                return false;
+
+        /* Anything going wrong from here on needs a new keyframe */
+        td->synced = false;
+        if (!get_tick(&br, &dod) || !get_bits(&br, 1, &bit))
+                return false;
+
+        td->tick_delta += dod;
+        td->tick += td->tick_delta;
+
+        for (size_t i = 0; i < td->channel_count && bit; ++i) {
+                uint64_t populated;
+                if (!get_bits(&br, 1, &populated))
+                        return false;
+
+                td->channels[i].populated = populated;
+        }
+
+        for (size_t i = 0; i < td->channel_count; ++i) {
+                struct telemetry_delta_channel *ch = td->channels + i;
+                if (ch->populated && !get_value(&br, ch))
+                        return false;
+        }
+
+        ++td->sequence;
+        td->synced = true;
+        return true;
+}
+
+static void write_le(const struct log_format_writer *w, const uint64_t val,
+                     const size_t size)
+{
+        uint8_t buf[8];
+        for (size_t i = 0; i < size; ++i)
+                buf[i] = val >> (8 * i);
+
+        w->write(buf, size, w->arg);
+}
+
+/**
+ * Writes out the RCB record a delta record stands for.
+ */
+static void write_record(const struct frame_decoder *fd,
+                         const struct log_format_writer *w)
+{
+        const struct telemetry_delta *td = &fd->td;
+        const uint8_t marker = RCB_RECORD_MARKER;
+
+        w->write(&marker, 1, w->arg);
+        write_le(w, td->tick, 4);
+
+        for (size_t i = 0; i < td->channel_count; i += 8) {
+                uint8_t bits = 0;
+                for (size_t j = 0; j < 8 && i + j < td->channel_count; ++j)
+                        if (td->channels[i + j].populated)
+                                bits |= 1 << j;
+
+                w->write(&bits, 1, w->arg);
+        }
+
+        for (size_t i = 0; i < td->channel_count; ++i)
+                if (td->channels[i].populated)
+                        write_le(w, td->channels[i].bits,
+                                 value_size(fd->types[i]));
+}
+
+int telemetry_frame_decode(const void *data, const size_t len,
+                           const struct log_format_writer *w)
+{
+        const uint8_t *p = data;
+        const uint8_t *end = p + len;
+        struct frame_decoder fd = {
+                .types = NULL,
+        };
+        int frames = 0;
+
+        telemetry_delta_init(&fd.td);
+
+        while (p < end) {
+                const int payload_len = get_frame(p, end - p);
+                if (payload_len < 0) {
+                        /* Text or damage.  Look for the next frame */
+                        ++p;
+                        continue;
+                }
+
+                const uint8_t *payload = p + TELEMETRY_FRAME_HEADER_LEN;
+                p += TELEMETRY_FRAME_OVERHEAD + payload_len;
+
+                switch(payload[0]) {
+                case TELEMETRY_FRAME_DELTA_MARKER:
+                        /* Can't be rebuilt without its keyframe */
+                        if (!read_delta(&fd, payload, payload_len))
+                                continue;
+
+                        write_record(&fd, w);
+                        ++frames;
+                        continue;
+                case RCB_RECORD_MARKER:
+                        read_keyframe(&fd, payload, payload_len);
+                        break;
+                default:
+                        read_meta(&fd, payload, payload_len);
+                        break;
+                }
+
+                w->write(payload, payload_len, w->arg);
+                ++frames;
+        }
+
+        telemetry_delta_free(&fd.td);
+        if (fd.types)
+                portFree(fd.types);
+
+        return frames;
+}
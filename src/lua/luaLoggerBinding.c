@@ -26,6 +26,7 @@
 #include "GPIO.h"
 #include "OBD2.h"
 #include "PWM.h"
+#include "can_filters.h"
 #include "channel_config.h"
 #include "dateTime.h"
 #include "gps.h"
@@ -54,6 +55,7 @@
 #include "predictive_timer_2.h"
 #include "shiftx_drv.h"
 #include "api_event.h"
+#include "can_channels.h"
 #include "math.h"
 #include "taskUtil.h"
 #include "connectivityTask.h"
@@ -689,8 +691,8 @@ static int lua_set_can_filter(lua_State *L)
         const uint32_t filter = lua_tointeger(L, 4);
         const uint32_t mask = lua_tointeger(L, 5);
 
-        const int result = CAN_set_filter(channel, id, extended, filter,
-                                          mask, enable);
+        const int result = CAN_set_script_filter(channel, id, extended,
+                                                 filter, mask, enable);
         lua_pushinteger(L, result);
 
         return 1;
@@ -802,6 +804,22 @@ static int lua_obd2_set_delay(lua_State *L)
         return 0;
 }
 
+static int lua_obd2_set_in_flight(lua_State *L)
+{
+        lua_validate_args_count(L, 1, 1);
+        lua_validate_arg_number(L, 1);
+        OBD2_set_max_in_flight(lua_tointeger(L, 1));
+        return 0;
+}
+
+static int lua_obd2_set_batching(lua_State *L)
+{
+        lua_validate_args_count(L, 1, 1);
+        lua_validate_arg_boolean(L, 1);
+        OBD2_set_batching(lua_toboolean(L, 1));
+        return 0;
+}
+
 static int lua_logging_start(lua_State *L)
 {
         startLogging();
@@ -1292,6 +1310,8 @@ static int lua_sx_set_config(lua_State *L)
         lua_validate_args_count(L, 0, 6);
 
         struct shiftx_configuration * shiftx_config = shiftx_get_config();
+        const uint32_t can_bus = shiftx_config->can_bus;
+        const uint32_t base_address = shiftx_config->base_address;
 
         switch(lua_gettop(L)) {
         default:
@@ -1321,6 +1341,12 @@ static int lua_sx_set_config(lua_State *L)
                 lua_validate_arg_number(L, 1);
                 shiftx_config->orientation_inverted = lua_tointeger(L, 1);
         }
+
+        /* The CAN filters have to let the new ShiftX IDs through */
+        if (shiftx_config->can_bus != can_bus ||
+            shiftx_config->base_address != base_address)
+                CAN_state_stale();
+
         delayMs(500);
         lua_pushinteger(L, shiftx_update_config());
         return 1;
@@ -1421,6 +1447,8 @@ void registerLuaLoggerBindings(lua_State *L)
         lua_registerlight(L, "setCANfilter", lua_set_can_filter);
         lua_registerlight(L, "readOBD2", lua_obd2_read);
         lua_registerlight(L, "setOBD2Delay", lua_obd2_set_delay);
+        lua_registerlight(L, "setOBD2InFlight", lua_obd2_set_in_flight);
+        lua_registerlight(L, "setOBD2Batch", lua_obd2_set_batching);
 
         lua_registerlight(L, "startLogging", lua_logging_start);
         lua_registerlight(L, "stopLogging", lua_logging_stop);
@@ -19,6 +19,7 @@
  * this code. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "can_channels.h"
 #include "luaScript.h"
 #include "luaTask.h"
 #include "mem_mang.h"
@@ -64,6 +65,9 @@ int flash_default_script()
                                      sizeof (minimal_script_t));
 
         pr_info(result == 0 ? "win\r\n" : "fail\r\n");
+
+        /* The CAN filters depend on what the script does with CAN */
+        CAN_state_stale();
         return result;
 }
 
@@ -72,6 +76,12 @@ const char * getScript()
         return (const char *)g_scriptConfig.script;
 }
 
+bool script_uses_can_rx(void)
+{
+        const char *script = getScript();
+        return strstr(script, "rxCAN") || strstr(script, "setCANfilter");
+}
+
 //unescapes a string in place
 void unescapeScript(char *data)
 {
@@ -166,6 +176,7 @@ enum script_add_result flashScriptPage(const unsigned int page,
         }
 
         pr_info("win!\r\n");
+        CAN_state_stale();
         lua_task_start();
         return SCRIPT_ADD_RESULT_OK;
 }
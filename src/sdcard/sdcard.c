@@ -36,6 +36,8 @@
 
 static FATFS *fat_fs = NULL;
 static xSemaphoreHandle fs_mutex = NULL;
+/* Bumped on every successful mount so callers can tell the card changed */
+static unsigned int mount_count;
 
 #define SD_TEST_PATTERN "0123456789"
 
@@ -89,7 +91,16 @@ int InitFS()
                 return -1;
         }
 
-        return f_mount(fat_fs, "0", 1);
+        const int res = f_mount(fat_fs, "0", 1);
+        if (FR_OK == res)
+                ++mount_count;
+
+        return res;
+}
+
+unsigned int sdcard_mount_count(void)
+{
+        return mount_count;
 }
 
 int UnmountFS()
@@ -60,6 +60,9 @@ struct Serial {
         size_t log_rx_cntr;
         size_t log_tx_cntr;
 
+        enum serial_telemetry_format telemetry_format;
+        bool telemetry_restart;
+
         struct serial_cfg cfg;
 };
 
@@ -114,6 +117,9 @@ void serial_reopen(struct Serial* s)
 {
         serial_clear(s);
         s->closed = false;
+
+        /* Whoever is on the other end now has to negotiate again */
+        s->telemetry_format = SERIAL_TELEMETRY_FORMAT_JSON;
 }
 
 
@@ -269,6 +275,25 @@ static void log_tx(struct Serial *s, const char data)
         _log(s, DATA_DIR_TX, data);
 }
 
+static void log_buff(struct Serial *s, const enum data_dir dir,
+                     const char *buf, const size_t len)
+{
+        if (SERIAL_LOG_TYPE_NONE == s->log_type)
+                return;
+
+        for (size_t i = 0; i < len; ++i)
+                _log(s, dir, buf[i]);
+}
+
+/**
+ * Lets the driver know that there is data waiting to be sent.
+ */
+static void post_tx(struct Serial *s)
+{
+        if (s->post_tx_cb)
+                s->post_tx_cb(s->tx_queue, s->post_tx_cb_arg);
+}
+
 enum serial_log_type serial_logging(struct Serial *s,
                                     const enum serial_log_type type)
 {
@@ -277,6 +302,25 @@ enum serial_log_type serial_logging(struct Serial *s,
         return prev;
 }
 
+void serial_set_telemetry_format(struct Serial *s,
+                                 const enum serial_telemetry_format fmt)
+{
+        s->telemetry_format = fmt;
+        s->telemetry_restart = true;
+}
+
+bool serial_telemetry_restarted(struct Serial *s)
+{
+        const bool restart = s->telemetry_restart;
+        s->telemetry_restart = false;
+        return restart;
+}
+
+enum serial_telemetry_format serial_get_telemetry_format(const struct Serial *s)
+{
+        return s->telemetry_format;
+}
+
 bool serial_config(struct Serial *s, const size_t bits,
                    const size_t parity, const size_t stop_bits,
                    const size_t baud)
@@ -337,6 +381,41 @@ int serial_read_c(struct Serial *s, char* c)
         return serial_read_c_wait(s, c, portMAX_DELAY);
 }
 
+/**
+ * Reads whatever data is available from a serial device, waiting only for
+ * the first byte.
+ * @param s The Serial device to read from.
+ * @param buf The buffer to put the data into.
+ * @param len The length of the buffer.
+ * @param delay The number of ticks to wait for the first byte.
+ * @return Number of bytes read, or -1 if the device is closed.
+ */
+int serial_read_buff_wait(struct Serial *s, char *buf, const size_t len,
+                          const size_t delay)
+{
+        if (s->closed)
+                return -1;
+
+        size_t i = 0;
+        for (size_t wait = delay; i < len; ++i, wait = 0) {
+                if (pdFALSE == xQueueReceive(s->rx_queue, buf + i, wait))
+                        break;
+
+                /* Check & handle closure of serial device here */
+                if (buf[i] == invalid_char && s->closed) {
+                        /* Unblock the queue for other waiting tasks */
+                        unblock_rx_queue(s);
+                        if (!i)
+                                return -1;
+
+                        break;
+                }
+        }
+
+        log_buff(s, DATA_DIR_RX, buf, i);
+        return i;
+}
+
 /**
  * Reads in a line from a serial device delimeted by \n.  The data is
  * written to buff BUT MAY NOT BE NULL TERMINATED.  NULL termination is the
@@ -388,9 +467,7 @@ int serial_write_c_wait(struct Serial *s, const char c, const size_t delay)
                 return -1;
 
         log_tx(s, c);
-
-        if (s->post_tx_cb)
-                s->post_tx_cb(s->tx_queue, s->post_tx_cb_arg);
+        post_tx(s);
 
         return 1;
 }
@@ -403,23 +480,36 @@ int serial_write_c(struct Serial *s, const char c)
 int serial_write_buff_wait(struct Serial *s, const char *buf, const size_t len,
                            const size_t delay)
 {
-        int i = 0;
-        for (; i < len; ++i) {
-                switch(serial_write_c_wait(s, buf[i], delay)) {
-                default:
-                        panic(PANIC_CAUSE_UNREACHABLE);
+        size_t i = 0;
+        while (i < len && !s->closed) {
+                /*
+                 * Queue up as much as fits without blocking and kick the
+                 * driver once for the whole chunk.  We only block once the
+                 * driver is busy draining the queue.
+                 */
+                const size_t start = i;
+                while (i < len &&
+                       pdFALSE != xQueueSend(s->tx_queue, buf + i, 0))
+                        ++i;
+
+                log_buff(s, DATA_DIR_TX, buf + start, i - start);
+                post_tx(s);
+
+                /* Queue is full.  Wait for the driver to make room */
+                if (i == len ||
+                    pdFALSE == xQueueSend(s->tx_queue, buf + i, delay))
                         break;
-                case -1:
-                        /* If partially sent, then return what was sent. */
-                        return i == 0 ? -1 : i;
-                case 0:
-                        return i;
-                case 1:
+
+                /* Handle case where closing queue unblocks xQueueSend */
+                if (s->closed)
                         break;
-                }
+
+                log_tx(s, buf[i++]);
+                post_tx(s);
         }
 
-        return i;
+        /* If partially sent, then return what was sent. */
+        return s->closed && !i ? -1 : (int) i;
 }
 
 int serial_write_buff(struct Serial *s, const char *buf, const size_t len)
@@ -40,6 +40,8 @@
  * - imu Inertia Measurement Unit support
  * - lua Lua scripting support
  * - pwm Pulsw width modulation generation output support
+ * - telembin Supports binary telemetry frames (setTelemetry fmt "bin")
+ * - telemdelta Supports delta encoded telemetry frames (fmt "delta")
  * - telemstream Supports telemetry streaming API
  * - timer Timed pulse frequency measurement support
  * - tracks Track DB support
@@ -81,6 +83,8 @@ static const char* feature_flags[] = {
 #if PWM_CHANNELS > 0
         FEATURE_FLAG("pwm")
 #endif
+        FEATURE_FLAG("telembin")
+        FEATURE_FLAG("telemdelta")
         FEATURE_FLAG("telemstream")
 #if TIMER_CHANNELS > 0
         FEATURE_FLAG("timer")
@@ -681,8 +681,7 @@ static void process_sample(struct wifi_sample_data* data)
 
         /* Only try to send if our Serial device is connected */
         if (serial_is_connected(serial)) {
-                api_send_sample_record(serial, sample, ticks, meta);
-                put_crlf(serial);
+                api_send_telemetry_sample(serial, NULL, sample, ticks, meta);
         }
 }
 
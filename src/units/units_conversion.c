@@ -21,126 +21,67 @@
 
 #include "units_conversion.h"
 
-static float no_conversion(float value)
-{
-        return value;
-}
-static float c_to_f(float value)
-{
-        return  value * 1.8f + 32;
-}
-
-static float f_to_c(float value)
-{
-        return (value - 32) * 0.555555556f;
-}
-
-static float bar_to_psi(float value)
-{
-        return value * 14.5037738f;
-}
-
-static float psi_to_bar(float value)
-{
-        return value * 0.0689475729f;
-}
-
-static float kph_to_mph(float value)
-{
-        return value * 0.6213711922f;
-}
-
-static float mph_to_kph(float value)
-{
-        return value * 1.609344f;
-}
-
-static float km_to_mi(float value)
-{
-        return value * 0.6213711922f;
-}
-
-static float mi_to_km(float value)
-{
-        return value * 1.609344f;
-}
-
-static float mm_to_inch(float value)
-{
-        return value * 0.0393700787f;
-}
-
-static float inch_to_mm(float value)
-{
-        return value * 25.4f;
-}
-
-static float l_to_gal(float value)
-{
-        return value * 0.2641720524f;
-}
-
-static float gal_to_l(float value)
-{
-        return value * 3.785411784f;
-}
-
-static float kg_to_lb(float value)
-{
-        return value * 2.2046226218f;
-}
-
-static float lb_to_kg(float value)
-{
-        return value * 0.45359237f;
-}
-
-static float nm_to_lbft(float value)
-{
-        return value * 0.7375621493f;
-}
+/* Every conversion is linear: value * scale + offset */
+struct units_linear {
+        float scale;
+        float offset;
+};
 
-static float lbft_to_nm(float value)
-{
-        return value * 1.3558179483f;
-}
+static const struct units_linear units_converter[UNITS_CONVERSION_COUNT] = {
+        /* no conversion */
+        {1.0f, 0.0f},
+        /* C to F */
+        {1.8f, 32.0f},
+        /* F to C */
+        {0.555555556f, -32.0f * 0.555555556f},
+        /* bar to psi */
+        {14.5037738f, 0.0f},
+        /* psi to bar */
+        {0.0689475729f, 0.0f},
+        /* kph to mph */
+        {0.6213711922f, 0.0f},
+        /* mph to kph */
+        {1.609344f, 0.0f},
+        /* km to mi */
+        {0.6213711922f, 0.0f},
+        /* mi to km */
+        {1.609344f, 0.0f},
+        /* mm to inch */
+        {0.0393700787f, 0.0f},
+        /* inch to mm */
+        {25.4f, 0.0f},
+        /* l to gal */
+        {0.2641720524f, 0.0f},
+        /* gal to l */
+        {3.785411784f, 0.0f},
+        /* kg to lb */
+        {2.2046226218f, 0.0f},
+        /* lb to kg */
+        {0.45359237f, 0.0f},
+        /* Nm to lb-ft */
+        {0.7375621493f, 0.0f},
+        /* lb-ft to Nm */
+        {1.3558179483f, 0.0f},
+        /* W to hp */
+        {0.0013410221f, 0.0f},
+        /* hp to W */
+        {745.69987158f, 0.0f},
+};
 
-static float w_to_hp(float value)
+void units_conversion_linear(enum unit_conversions id, float *scale,
+                             float *offset)
 {
-        return value * 0.0013410221f;
-}
+        if (id >= UNITS_CONVERSION_COUNT)
+                id = UNIT_CONVERSION_NONE;
 
-static float hp_to_w(float value)
-{
-        return value * 745.69987158f;
+        *scale = units_converter[id].scale;
+        *offset = units_converter[id].offset;
 }
 
-static float(*units_converter[UNITS_CONVERSION_COUNT]) (float value) = {
-        no_conversion,
-        c_to_f,
-        f_to_c,
-        bar_to_psi,
-        psi_to_bar,
-        kph_to_mph,
-        mph_to_kph,
-        km_to_mi,
-        mi_to_km,
-        mm_to_inch,
-        inch_to_mm,
-        l_to_gal,
-        gal_to_l,
-        kg_to_lb,
-        lb_to_kg,
-        nm_to_lbft,
-        lbft_to_nm,
-        w_to_hp,
-        hp_to_w
-};
-
 float convert_units(enum unit_conversions id, const float value)
 {
         if (id >= UNITS_CONVERSION_COUNT )
                 return value;
 
-        return (*units_converter[id]) (value);
+        return value * units_converter[id].scale + units_converter[id].offset;
 }
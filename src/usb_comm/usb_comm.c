@@ -222,8 +222,7 @@ static void process_sample(struct usb_sample_data* data)
                 return;
         }
 
-        api_send_sample_record(serial, sample, ticks, meta);
-        put_crlf(serial);
+        api_send_telemetry_sample(serial, NULL, sample, ticks, meta);
 }
 
 static void process_usb_api_event(const struct api_event *event)
@@ -0,0 +1,62 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FF_TESTING_H_
+#define _FF_TESTING_H_
+
+#include "cpp_guard.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+CPP_GUARD_BEGIN
+
+void ff_testing_reset(void);
+
+unsigned int ff_testing_write_calls(void);
+
+size_t ff_testing_bytes_written(void);
+
+/* Everything handed to f_write since the last reset, in order */
+const char* ff_testing_written_data(void);
+
+/* Size of the most recently opened file */
+size_t ff_testing_file_size(void);
+
+unsigned int ff_testing_open_calls(void);
+
+/* Clips files that are grown by seeking to this size.  0 is unlimited */
+void ff_testing_set_disk_size(size_t size);
+
+/* The mock root directory.  Files are created by f_open or added here */
+bool ff_testing_add_file(const char *name);
+size_t ff_testing_file_count(void);
+
+/*
+ * Gives a file contents that f_read can return.  Only one file has
+ * contents at a time.  Opening it without creating it keeps its size.
+ */
+bool ff_testing_set_file_data(const char *name, const void *data,
+                              size_t len);
+size_t ff_testing_file_data_len(void);
+
+CPP_GUARD_END
+
+#endif /* _FF_TESTING_H_ */
@@ -21,7 +21,113 @@
 
 
 #include "ff.h"
+#include "ff_testing.h"
 
+#include "macros.h"
+
+#include <string.h>
+
+#define FF_TESTING_CAPTURE_SIZE	65536
+#define FF_TESTING_MAX_FILES	8192
+#define FF_TESTING_NAME_LEN	13
+
+static struct {
+        unsigned int write_calls;
+        size_t bytes_written;
+        unsigned int open_calls;
+        FIL *last_file;
+        char capture[FF_TESTING_CAPTURE_SIZE];
+        /* A flat root directory holding just the names of the files */
+        size_t file_count;
+        char files[FF_TESTING_MAX_FILES][FF_TESTING_NAME_LEN];
+        /* The one file that has contents, and the handle it is open on */
+        char data_name[FF_TESTING_NAME_LEN];
+        char data[FF_TESTING_CAPTURE_SIZE];
+        size_t data_len;
+        FIL *data_file;
+        /* Largest a file can grow to by seeking.  0 if unlimited */
+        size_t disk_size;
+} ff_testing;
+
+static bool file_exists(const char *name)
+{
+        for (size_t i = 0; i < ff_testing.file_count; ++i)
+                if (0 == strcmp(ff_testing.files[i], name))
+                        return true;
+
+        return false;
+}
+
+bool ff_testing_add_file(const char *name)
+{
+        if (ff_testing.file_count >= FF_TESTING_MAX_FILES ||
+            strlen(name) >= FF_TESTING_NAME_LEN)
+                return false;
+
+        strcpy(ff_testing.files[ff_testing.file_count++], name);
+        return true;
+}
+
+size_t ff_testing_file_count(void)
+{
+        return ff_testing.file_count;
+}
+
+bool ff_testing_set_file_data(const char *name, const void *data,
+                              size_t len)
+{
+        if (len > FF_TESTING_CAPTURE_SIZE ||
+            strlen(name) >= FF_TESTING_NAME_LEN)
+                return false;
+
+        if (!file_exists(name) && !ff_testing_add_file(name))
+                return false;
+
+        strcpy(ff_testing.data_name, name);
+        memcpy(ff_testing.data, data, len);
+        ff_testing.data_len = len;
+        return true;
+}
+
+size_t ff_testing_file_data_len(void)
+{
+        return ff_testing.data_len;
+}
+
+void ff_testing_set_disk_size(size_t size)
+{
+        ff_testing.disk_size = size;
+}
+
+unsigned int ff_testing_open_calls(void)
+{
+        return ff_testing.open_calls;
+}
+
+void ff_testing_reset(void)
+{
+        memset(&ff_testing, 0, sizeof(ff_testing));
+}
+
+unsigned int ff_testing_write_calls(void)
+{
+        return ff_testing.write_calls;
+}
+
+size_t ff_testing_bytes_written(void)
+{
+        return ff_testing.bytes_written;
+}
+
+const char* ff_testing_written_data(void)
+{
+        return ff_testing.capture;
+}
+
+size_t ff_testing_file_size(void)
+{
+        return ff_testing.last_file ? ff_testing.last_file->fsize : 0;
+}
 
 FRESULT f_sync (FIL* fp)
 {
@@ -37,6 +143,47 @@ FRESULT f_open(FIL* fp,
                const TCHAR* path,
                BYTE mode)
 {
+        ++ff_testing.open_calls;
+
+        const bool exists = file_exists(path);
+        if (exists && (mode & FA_CREATE_NEW))
+                return FR_EXIST;
+
+        if (!exists && (mode & (FA_CREATE_NEW | FA_CREATE_ALWAYS |
+                                FA_OPEN_ALWAYS)))
+                ff_testing_add_file(path);
+
+        fp->fptr = 0;
+        fp->fsize = 0;
+        ff_testing.last_file = fp;
+
+        ff_testing.data_file = NULL;
+        if (ff_testing.data_name[0] &&
+            0 == strcmp(ff_testing.data_name, path)) {
+                ff_testing.data_file = fp;
+                if (!(mode & (FA_CREATE_NEW | FA_CREATE_ALWAYS)))
+                        fp->fsize = ff_testing.data_len;
+        }
+
+        return FR_OK;
+}
+
+FRESULT f_read (
+        FIL* fp,		/* Pointer to the file object */
+        void* buff,		/* Pointer to data buffer */
+        UINT btr,		/* Number of bytes to read */
+        UINT* br		/* Pointer to number of bytes read */
+)
+{
+        *br = 0;
+        if (fp != ff_testing.data_file)
+                return FR_DENIED;
+
+        if (fp->fptr < ff_testing.data_len)
+                *br = MIN(btr, ff_testing.data_len - fp->fptr);
+
+        memcpy(buff, ff_testing.data + fp->fptr, *br);
+        fp->fptr += *br;
         return FR_OK;
 }
 
@@ -53,6 +200,17 @@ FRESULT f_write (
         UINT* bw			/* Pointer to number of bytes written */
 )
 {
+        const size_t pos = ff_testing.bytes_written;
+        if (pos + btw < FF_TESTING_CAPTURE_SIZE)
+                memcpy(ff_testing.capture + pos, buff, btw);
+
+        ff_testing.write_calls++;
+        ff_testing.bytes_written += btw;
+        fp->fptr += btw;
+        if (fp->fptr > fp->fsize)
+                fp->fsize = fp->fptr;
+
+        *bw = btw;
         return FR_OK;
 }
 
@@ -61,6 +219,18 @@ FRESULT f_lseek (
         DWORD ofs		/* File pointer from top of file */
 )
 {
+        /*
+         * Like FatFs in write mode, seeking past the end grows the file.
+         * When the disk is full the file is clipped, and that isn't an
+         * error.
+         */
+        if (ff_testing.disk_size && ofs > fp->fsize)
+                ofs = MAX(fp->fsize, MIN(ofs, ff_testing.disk_size));
+
+        fp->fptr = ofs;
+        if (fp->fptr > fp->fsize)
+                fp->fsize = fp->fptr;
+
         return FR_OK;
 }
 
@@ -75,6 +245,31 @@ TCHAR* f_gets (
 
 FRESULT f_truncate (FIL* fp )
 {
+        fp->fsize = fp->fptr;
+        if (fp == ff_testing.data_file)
+                ff_testing.data_len = MIN(ff_testing.data_len, fp->fptr);
+        return FR_OK;
+}
+
+
+FRESULT f_opendir (DIR* dp, const TCHAR* path)
+{
+        dp->index = 0;
         return FR_OK;
 }
 
+FRESULT f_readdir (DIR* dp, FILINFO* fno)
+{
+        if (dp->index >= ff_testing.file_count) {
+                fno->fname[0] = '\0';
+                return FR_OK;
+        }
+
+        strcpy(fno->fname, ff_testing.files[dp->index++]);
+        return FR_OK;
+}
+
+FRESULT f_closedir (DIR* dp)
+{
+        return FR_OK;
+}
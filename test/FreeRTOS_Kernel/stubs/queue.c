@@ -97,10 +97,13 @@ signed portBASE_TYPE xQueueGenericSendFromISR(xQueueHandle pxQueue,
 
 unsigned portBASE_TYPE uxQueueMessagesWaiting( const xQueueHandle xQueue )
 {
-        return 0;
+        const struct mock_queue *mc = xQueue;
+        return ring_buffer_bytes_used(mc->rb) / mc->item_size;
 }
 
 portBASE_TYPE xQueueGenericReset( xQueueHandle pxQueue, portBASE_TYPE xNewQueue )
 {
+        struct mock_queue *mc = pxQueue;
+        ring_buffer_clear(mc->rb);
         return pdTRUE;
 }
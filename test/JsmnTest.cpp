@@ -24,6 +24,7 @@
 #include "mock_serial.h"
 #include "serial.h"
 #include <cppunit/extensions/HelperMacros.h>
+#include <vector>
 
 extern "C" {
 #include "jsmn/jsmn.c"
@@ -32,6 +33,7 @@ extern "C" {
 CPPUNIT_TEST_SUITE_REGISTRATION( JsmnTest );
 
 using std::string;
+using std::vector;
 
 void JsmnTest::decodeStringTest()
 {
@@ -56,3 +58,184 @@ void JsmnTest::encodeWriteStringTest()
                              string(mock_getTxBuffer()));
 
 }
+
+#define INDEX_TEST_TOKENS 32
+
+static const char index_test_json[] =
+        "{\"a\":1,\"b\":{\"a\":2,\"c\":\"x\"},\"d\":[{\"c\":3}],\"c\":4}";
+
+static void parse(char *json, jsmntok_t *toks, jsmn_parser *parser)
+{
+        memset(toks, 0, INDEX_TEST_TOKENS * sizeof(*toks));
+        jsmn_init(parser);
+        CPPUNIT_ASSERT_EQUAL(JSMN_SUCCESS,
+                             jsmn_parse(parser, json, toks,
+                                        INDEX_TEST_TOKENS));
+}
+
+static string value_of(const jsmntok_t *obj, const char *name)
+{
+        const jsmntok_t *key = jsmn_find_node(obj, name);
+        return key ? string(jsmn_trimData(key + 1)->data) : string("-");
+}
+
+void JsmnTest::indexTest()
+{
+        char json[sizeof(index_test_json)];
+        strcpy(json, index_test_json);
+        jsmntok_t toks[INDEX_TEST_TOKENS];
+        jsmn_parser parser;
+        parse(json, toks, &parser);
+
+        struct jsmn_index idx;
+        struct jsmn_index_slot slots[INDEX_TEST_TOKENS];
+        CPPUNIT_ASSERT(jsmn_index_build(&idx, toks, parser.toknext, slots,
+                                        ARRAY_LEN(slots)));
+
+        const jsmntok_t *b = toks + 4;
+        const jsmntok_t *d_elem = toks + 11;
+        CPPUNIT_ASSERT_EQUAL(JSMN_OBJECT, b->type);
+        CPPUNIT_ASSERT_EQUAL(JSMN_OBJECT, d_elem->type);
+
+        /* Only the keys of the object itself match */
+        CPPUNIT_ASSERT_EQUAL(string("1"), value_of(toks, "a"));
+        CPPUNIT_ASSERT_EQUAL(string("4"), value_of(toks, "c"));
+        CPPUNIT_ASSERT_EQUAL(string("2"), value_of(b, "a"));
+        CPPUNIT_ASSERT_EQUAL(string("x"), value_of(b, "c"));
+        CPPUNIT_ASSERT_EQUAL(string("3"), value_of(d_elem, "c"));
+        CPPUNIT_ASSERT_EQUAL(string("-"), value_of(b, "d"));
+        CPPUNIT_ASSERT_EQUAL(string("-"), value_of(toks, "x"));
+
+        CPPUNIT_ASSERT(toks + 9 == jsmn_next(b));
+        CPPUNIT_ASSERT(toks + 13 == jsmn_next(toks + 12));
+        CPPUNIT_ASSERT(toks + parser.toknext == jsmn_next(toks));
+}
+
+void JsmnTest::indexTooSmallTest()
+{
+        char json[sizeof(index_test_json)];
+        strcpy(json, index_test_json);
+        jsmntok_t toks[INDEX_TEST_TOKENS];
+        jsmn_parser parser;
+        parse(json, toks, &parser);
+
+        struct jsmn_index idx;
+        struct jsmn_index_slot slots[3];
+        CPPUNIT_ASSERT(!jsmn_index_build(&idx, toks, parser.toknext, slots,
+                                         ARRAY_LEN(slots)));
+
+        /* Falls back to scanning every token that follows */
+        CPPUNIT_ASSERT_EQUAL(string("x"), value_of(toks, "c"));
+}
+
+#define STREAM_TEST_TOKENS 14
+
+static const char stream_test_json[] =
+        "{\"cmd\":{\"i\":1,\"a\":[{\"x\":1},{\"x\":2},\"s\",3,"
+        "{\"x\":[4,5]}],\"e\":2}}";
+
+static const char *stream_test_elements[] = {
+        "{\"x\":1}", "{\"x\":2}", "s", "3", "{\"x\":[4,5]}",
+};
+
+static string token_text(const jsmntok_t *tok)
+{
+        return string(tok->data, tok->end - tok->start);
+}
+
+static bool collect_element(const jsmntok_t *tok, void *arg)
+{
+        vector<string> *elements = (vector<string> *) arg;
+        elements->push_back(token_text(tok));
+
+        /* Lookups don't run on past the element */
+        if (JSMN_OBJECT == tok->type)
+                CPPUNIT_ASSERT_EQUAL(string("-"), value_of(tok, "e"));
+
+        return true;
+}
+
+/**
+ * Checks that the elements streamed plus the ones left in the array add up
+ * to the whole array, and the rest of the payload is intact.
+ */
+static void check_stream(const jsmntok_t *toks, vector<string> elements)
+{
+        const jsmntok_t *payload = toks + 2;
+        const jsmntok_t *arr = jsmn_find_node(payload, "a") + 1;
+        CPPUNIT_ASSERT_EQUAL(JSMN_ARRAY, arr->type);
+
+        const jsmntok_t *tok = arr + 1;
+        for (int i = 0; i < arr->size; ++i, tok = jsmn_next(tok))
+                elements.push_back(token_text(tok));
+
+        CPPUNIT_ASSERT_EQUAL(ARRAY_LEN(stream_test_elements), elements.size());
+        for (size_t i = 0; i < elements.size(); ++i)
+                CPPUNIT_ASSERT_EQUAL(string(stream_test_elements[i]),
+                                     elements[i]);
+
+        CPPUNIT_ASSERT_EQUAL(string("1"), value_of(payload, "i"));
+        CPPUNIT_ASSERT_EQUAL(string("2"), value_of(payload, "e"));
+}
+
+void JsmnTest::streamTokensTest()
+{
+        /* Keep the index of an earlier test off these tokens */
+        g_index = NULL;
+
+        char json[sizeof(stream_test_json)];
+        strcpy(json, stream_test_json);
+        jsmntok_t toks[STREAM_TEST_TOKENS] = {};
+        vector<string> elements;
+
+        struct jsmn_stream s;
+        jsmn_stream_init(&s, toks, ARRAY_LEN(toks), 2, collect_element,
+                         &elements);
+        CPPUNIT_ASSERT_EQUAL(JSMN_SUCCESS, jsmn_stream_parse(&s, json, false));
+
+        /* Too many tokens for all at once */
+        CPPUNIT_ASSERT(!elements.empty());
+        check_stream(toks, elements);
+}
+
+void JsmnTest::streamChunksTest()
+{
+        const size_t json_len = strlen(stream_test_json);
+        g_index = NULL;
+
+        /* Every chunk size, so each token gets split everywhere */
+        for (size_t chunk = 1; chunk < json_len; ++chunk) {
+                char json[sizeof(stream_test_json)] = {};
+                jsmntok_t toks[STREAM_TEST_TOKENS] = {};
+                vector<string> elements;
+
+                struct jsmn_stream s;
+                jsmn_stream_init(&s, toks, ARRAY_LEN(toks), 2,
+                                 collect_element, &elements);
+
+                size_t len = 0;
+                size_t max_len = 0;
+                jsmnerr_t r = JSMN_ERROR_PART;
+                for (size_t sent = 0; sent < json_len;) {
+                        const size_t n = MIN(chunk, json_len - sent);
+                        memcpy(json + len, stream_test_json + sent, n);
+                        sent += n;
+                        len += n;
+                        json[len] = '\0';
+                        max_len = MAX(max_len, len);
+
+                        const size_t dropped = s.dropped;
+                        r = jsmn_stream_parse(&s, json, sent < json_len);
+                        len -= s.dropped - dropped;
+                        if (sent < json_len)
+                                CPPUNIT_ASSERT_EQUAL(JSMN_ERROR_PART, r);
+                }
+
+                CPPUNIT_ASSERT_EQUAL(JSMN_SUCCESS, r);
+                check_stream(toks, elements);
+
+                /* Small chunks never need the whole message at once */
+                if (chunk < 8)
+                        CPPUNIT_ASSERT(max_len < json_len);
+        }
+}
@@ -29,11 +29,19 @@ class JsmnTest : public CppUnit::TestFixture
 	CPPUNIT_TEST_SUITE( JsmnTest );
 	CPPUNIT_TEST( decodeStringTest );
 	CPPUNIT_TEST( encodeWriteStringTest );
+	CPPUNIT_TEST( indexTest );
+	CPPUNIT_TEST( indexTooSmallTest );
+	CPPUNIT_TEST( streamTokensTest );
+	CPPUNIT_TEST( streamChunksTest );
 	CPPUNIT_TEST_SUITE_END();
 
 public:
 	void decodeStringTest();
 	void encodeWriteStringTest();
+	void indexTest();
+	void indexTooSmallTest();
+	void streamTokensTest();
+	void streamChunksTest();
 };
 
 #endif /* _JSMNTEST_H_ */
@@ -0,0 +1,216 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "can_channels.h"
+#include "can_channels_test.h"
+#include "can_mapping.h"
+#include "macros.h"
+#include <cppunit/extensions/HelperMacros.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( CANChannelsTest );
+
+#define TRACE_FRAMES    20000
+#define BENCH_FRAMES    500000
+
+static CANChannelConfig cfg;
+
+/* Deterministic, so a failing trace can be replayed */
+static uint32_t rand_state;
+
+static uint32_t next_rand(void)
+{
+        rand_state = rand_state * 1103515245 + 12345;
+        return rand_state >> 8;
+}
+
+static void set_mapping(const size_t i, const uint8_t bus,
+                        const uint32_t can_id, const uint32_t can_mask,
+                        const int8_t sub_id)
+{
+        CANMapping *mapping = &cfg.can_channels[i].mapping;
+
+        memset(mapping, 0, sizeof(*mapping));
+        mapping->can_channel = bus;
+        mapping->can_id = can_id;
+        mapping->can_mask = can_mask;
+        mapping->sub_id = sub_id;
+        mapping->offset = 1 + i % 7;
+        mapping->length = 1;
+        mapping->multiplier = 1;
+        mapping->adder = i;
+}
+
+static void random_frame(CAN_msg *msg, const uint32_t *ids,
+                         const size_t id_count)
+{
+        memset(msg, 0, sizeof(*msg));
+        msg->can_bus = next_rand() % 2;
+        msg->addressValue = ids[next_rand() % id_count];
+        msg->dataLength = CAN_MSG_SIZE;
+        for (size_t i = 0; i < CAN_MSG_SIZE; ++i)
+                msg->data[i] = next_rand();
+
+        /* Make sub ID matches likely */
+        if (next_rand() % 2)
+                msg->data[0] %= 4;
+}
+
+/* What update_can_channels did before mappings were indexed */
+static void scan_mappings(const CAN_msg *msg, float *values,
+                          const size_t count)
+{
+        for (size_t i = 0; i < count; ++i) {
+                const CANMapping *mapping = &cfg.can_channels[i].mapping;
+                if (msg->can_bus != mapping->can_channel)
+                        continue;
+
+                float value;
+                if (canmapping_map_value(&value, msg, mapping))
+                        values[i] = value;
+        }
+}
+
+void CANChannelsTest::setUp(void)
+{
+        memset(&cfg, 0, sizeof(cfg));
+        rand_state = 1;
+}
+
+void CANChannelsTest::index_test(void)
+{
+        const uint32_t ids[] = {
+                0x100, 0x101, 0x120, 0x1F0, 0x1F1, 0x7E8, 0x18FEF100,
+        };
+        size_t count = 0;
+
+        /*
+         * Plain IDs, including two mappings on the same key, and one with
+         * a negative sub ID other than -1, which means none all the same.
+         */
+        set_mapping(count++, 0, 0x100, 0, -1);
+        set_mapping(count++, 0, 0x100, 0, -1);
+        set_mapping(count++, 1, 0x100, 0, -128);
+        set_mapping(count++, 0, 0x101, UINT32_MAX, -1);
+
+        /* Sub IDs, alongside a mapping of the same ID without one */
+        set_mapping(count++, 0, 0x7E8, 0, 0);
+        set_mapping(count++, 0, 0x7E8, 0, 1);
+        set_mapping(count++, 0, 0x7E8, 0, -1);
+
+        /* Masked IDs, including one that can never match */
+        set_mapping(count++, 0, 0x120, 0xFF0, -1);
+        set_mapping(count++, 0, 0x1F1, 0xFF0, -1);
+
+        /* Wildcard */
+        set_mapping(count++, 1, 0, 0, 3);
+
+        CPPUNIT_ASSERT(CAN_init_current_values(count));
+        CPPUNIT_ASSERT(CAN_init_mapping_index(&cfg, count));
+
+        float expected[CONFIG_CAN_MAPPINGS] = {0};
+        for (size_t f = 0; f < TRACE_FRAMES; ++f) {
+                CAN_msg msg;
+                random_frame(&msg, ids, ARRAY_LEN(ids));
+
+                update_can_channels(&msg, &cfg, count);
+                scan_mappings(&msg, expected, count);
+
+                for (size_t i = 0; i < count; ++i)
+                        CPPUNIT_ASSERT_EQUAL(expected[i],
+                                             CAN_get_current_channel_value(i));
+        }
+}
+
+void CANChannelsTest::stale_test(void)
+{
+        set_mapping(0, 0, 0x100, 0, -1);
+        set_mapping(1, 0, 0x200, 0, -1);
+        CPPUNIT_ASSERT(CAN_init_current_values(2));
+        CPPUNIT_ASSERT(CAN_init_mapping_index(&cfg, 1));
+
+        CAN_msg msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.addressValue = 0x200;
+        msg.data[1] = 7;
+
+        /* The changed mapping applies before the index catches up */
+        cfg.can_channels[0].mapping.can_id = 0x200;
+        CAN_state_stale();
+        update_can_channels(&msg, &cfg, 1);
+        CPPUNIT_ASSERT_EQUAL(7.0f, CAN_get_current_channel_value(0));
+
+        CPPUNIT_ASSERT(CAN_init_current_values(2));
+        CPPUNIT_ASSERT(CAN_init_mapping_index(&cfg, 1));
+        msg.data[1] = 8;
+        update_can_channels(&msg, &cfg, 1);
+        CPPUNIT_ASSERT_EQUAL(8.0f, CAN_get_current_channel_value(0));
+
+        /* Mappings past the count given are left alone */
+        CPPUNIT_ASSERT_EQUAL(0.0f, CAN_get_current_channel_value(1));
+}
+
+static double frames_per_sec(const CAN_msg *trace, const bool indexed)
+{
+        static float values[CONFIG_CAN_MAPPINGS];
+        const clock_t start = clock();
+
+        for (size_t f = 0; f < BENCH_FRAMES; ++f) {
+                CAN_msg msg = trace[f % TRACE_FRAMES];
+                if (indexed)
+                        update_can_channels(&msg, &cfg, CONFIG_CAN_MAPPINGS);
+                else
+                        scan_mappings(&msg, values, CONFIG_CAN_MAPPINGS);
+        }
+
+        const double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+        return secs > 0 ? BENCH_FRAMES / secs : 0;
+}
+
+void CANChannelsTest::benchmark_test(void)
+{
+        /*
+         * A full set of mappings, a couple of signals per frame on both
+         * buses, amid frames nobody has mapped.
+         */
+        uint32_t ids[CONFIG_CAN_MAPPINGS];
+        for (size_t i = 0; i < ARRAY_LEN(ids); ++i)
+                ids[i] = 0x100 + i * 8;
+
+        for (size_t i = 0; i < CONFIG_CAN_MAPPINGS; ++i)
+                set_mapping(i, i % 2, ids[i / 2], 0, -1);
+
+        static CAN_msg trace[TRACE_FRAMES];
+        for (size_t f = 0; f < TRACE_FRAMES; ++f)
+                random_frame(&trace[f], ids, ARRAY_LEN(ids));
+
+        CPPUNIT_ASSERT(CAN_init_current_values(CONFIG_CAN_MAPPINGS));
+        CPPUNIT_ASSERT(CAN_init_mapping_index(&cfg, CONFIG_CAN_MAPPINGS));
+
+        const double scan = frames_per_sec(trace, false);
+        const double indexed = frames_per_sec(trace, true);
+        printf("\nCAN mappings: %d, scan %.0f frames/s, "
+               "indexed %.0f frames/s\n", CONFIG_CAN_MAPPINGS, scan,
+               indexed);
+}
@@ -0,0 +1,284 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "CAN_mock.h"
+#include "OBD2.h"
+#include "can_filters.h"
+#include "can_filters_test.h"
+#include "luaScript.h"
+#include "macros.h"
+#include "shiftx_drv.h"
+#include <cppunit/extensions/HelperMacros.h>
+#include <stdlib.h>
+#include <string.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( CANFiltersTest );
+
+#define MAX_FILTERS     64
+
+static struct can_filter std_filter(const uint32_t id, const uint32_t mask)
+{
+        const struct can_filter f = {id, mask, false};
+        return f;
+}
+
+static struct can_filter ext_filter(const uint32_t id, const uint32_t mask)
+{
+        const struct can_filter f = {id, mask, true};
+        return f;
+}
+
+/* Does one of the filters accept every frame the wanted filter does? */
+static bool is_covered(const struct can_filter *filters, const int count,
+                       const struct can_filter *wanted)
+{
+        for (int i = 0; i < count; ++i) {
+                const struct can_filter *f = &filters[i];
+                if (f->extended == wanted->extended &&
+                    !(f->mask & ~wanted->mask) &&
+                    !((f->id ^ wanted->id) & f->mask))
+                        return true;
+        }
+
+        return false;
+}
+
+static bool has_filter(const struct can_filter *filters, const int count,
+                       const struct can_filter *wanted)
+{
+        for (int i = 0; i < count; ++i) {
+                if (filters[i].id == wanted->id &&
+                    filters[i].mask == wanted->mask &&
+                    filters[i].extended == wanted->extended)
+                        return true;
+        }
+
+        return false;
+}
+
+void CANFiltersTest::cover_exact_test(void)
+{
+        struct can_filter filters[] = {
+                std_filter(0x100, CAN_STD_ID_MASK),
+                std_filter(0x200, CAN_STD_ID_MASK),
+                std_filter(0x100, CAN_STD_ID_MASK),
+                std_filter(0x201, CAN_STD_ID_MASK),
+                std_filter(0x200, 0x7F0),
+                ext_filter(0x100, CAN_EXT_ID_MASK),
+        };
+
+        /* The duplicate 0x100 and the 0x200 covered by 0x200/0x7F0 go */
+        const int count = can_filters_cover(filters, ARRAY_LEN(filters),
+                                            CAN_FILTERS);
+        CPPUNIT_ASSERT_EQUAL(3, count);
+
+        const struct can_filter expected[] = {
+                std_filter(0x100, CAN_STD_ID_MASK),
+                std_filter(0x200, 0x7F0),
+                ext_filter(0x100, CAN_EXT_ID_MASK),
+        };
+        for (size_t i = 0; i < ARRAY_LEN(expected); ++i)
+                CPPUNIT_ASSERT(has_filter(filters, count, &expected[i]));
+}
+
+void CANFiltersTest::cover_merge_test(void)
+{
+        struct can_filter filters[17];
+        for (size_t i = 0; i < 16; ++i)
+                filters[i] = std_filter(0x100 + i, CAN_STD_ID_MASK);
+        filters[16] = std_filter(0x200, CAN_STD_ID_MASK);
+
+        /* The run of IDs merges into one filter, leaving 0x200 alone */
+        const int count = can_filters_cover(filters, ARRAY_LEN(filters), 2);
+        CPPUNIT_ASSERT_EQUAL(2, count);
+
+        const struct can_filter run = std_filter(0x100, 0x7F0);
+        const struct can_filter single = std_filter(0x200, CAN_STD_ID_MASK);
+        CPPUNIT_ASSERT(has_filter(filters, count, &run));
+        CPPUNIT_ASSERT(has_filter(filters, count, &single));
+}
+
+void CANFiltersTest::cover_types_test(void)
+{
+        struct can_filter filters[] = {
+                std_filter(0x100, CAN_STD_ID_MASK),
+                std_filter(0x7E8, CAN_STD_ID_MASK),
+                ext_filter(0x18DAF110, CAN_EXT_ID_MASK),
+        };
+
+        /* Standard and extended frames can't share a filter */
+        CPPUNIT_ASSERT_EQUAL(-1, can_filters_cover(filters,
+                                                   ARRAY_LEN(filters), 1));
+
+        const int count = can_filters_cover(filters, ARRAY_LEN(filters), 2);
+        CPPUNIT_ASSERT_EQUAL(2, count);
+        const struct can_filter ext = ext_filter(0x18DAF110, CAN_EXT_ID_MASK);
+        CPPUNIT_ASSERT(has_filter(filters, count, &ext));
+}
+
+void CANFiltersTest::cover_random_test(void)
+{
+        srand(1);
+
+        for (size_t run = 0; run < 200; ++run) {
+                struct can_filter wanted[MAX_FILTERS];
+                const size_t n = 1 + rand() % MAX_FILTERS;
+
+                for (size_t i = 0; i < n; ++i) {
+                        const bool extended = rand() % 4 == 0;
+                        const uint32_t all = extended ?
+                                CAN_EXT_ID_MASK : CAN_STD_ID_MASK;
+                        uint32_t mask = all;
+                        if (rand() % 4 == 0)
+                                mask &= ~(uint32_t) (rand() % 64);
+
+                        /* Cluster IDs the way vehicle buses do */
+                        const uint32_t id = (0x100 * (rand() % 4) +
+                                             rand() % 256) & mask;
+                        wanted[i] = extended ?
+                                ext_filter(id | 0x18000000, mask) :
+                                std_filter(id, mask);
+                }
+
+                struct can_filter filters[MAX_FILTERS];
+                memcpy(filters, wanted, sizeof(wanted));
+                const int count = can_filters_cover(filters, n, CAN_FILTERS);
+
+                CPPUNIT_ASSERT(count > 0);
+                CPPUNIT_ASSERT(count <= CAN_FILTERS);
+                for (size_t i = 0; i < n; ++i)
+                        CPPUNIT_ASSERT(is_covered(filters, count, &wanted[i]));
+        }
+}
+
+void CANFiltersTest::plan_test(void)
+{
+        static CANChannelConfig ccc;
+        static OBD2Config oc;
+        memset(&ccc, 0, sizeof(ccc));
+        memset(&oc, 0, sizeof(oc));
+
+        ccc.enabled = true;
+        ccc.can_channels[0].mapping.can_id = 0x100;
+        ccc.can_channels[1].mapping.can_id = 0x100;
+        ccc.can_channels[1].mapping.sub_id = 2;
+        ccc.can_channels[2].mapping.can_id = 0x18FEF100;
+        ccc.can_channels[3].mapping.can_id = 0x120;
+        ccc.can_channels[3].mapping.can_mask = 0xFF0;
+        ccc.can_channels[4].mapping.can_id = 0x300;
+        ccc.can_channels[4].mapping.can_channel = 1;
+        /* Can never match */
+        ccc.can_channels[5].mapping.can_id = 0x301;
+        ccc.can_channels[5].mapping.can_mask = 0x300;
+        const uint16_t count = 6;
+
+        oc.enabled = true;
+        oc.enabledPids = 1;
+
+        struct shiftx_configuration *sx = shiftx_get_config();
+        sx->can_bus = 1;
+
+        struct can_filter filters[2 * CONFIG_CAN_MAPPINGS + 4];
+        int n = CAN_plan_filters(0, &ccc, count, &oc, filters, CAN_FILTERS);
+
+        /* Masked IDs could be on either frame type */
+        const struct can_filter bus0[] = {
+                std_filter(0x100, CAN_STD_ID_MASK),
+                ext_filter(0x18FEF100, CAN_EXT_ID_MASK),
+                std_filter(0x120, 0x7F0),
+                ext_filter(0x120, 0xFF0),
+                std_filter(OBD2_11BIT_PID_RESPONSE, CAN_STD_ID_MASK),
+                ext_filter(OBD2_29BIT_PID_RESPONSE, CAN_EXT_ID_MASK),
+        };
+        CPPUNIT_ASSERT_EQUAL((int) ARRAY_LEN(bus0), n);
+        for (size_t i = 0; i < ARRAY_LEN(bus0); ++i)
+                CPPUNIT_ASSERT(has_filter(filters, n, &bus0[i]));
+
+        n = CAN_plan_filters(1, &ccc, count, &oc, filters, CAN_FILTERS);
+        uint32_t sx_ids[SHIFTX_RX_CAN_IDS];
+        shiftx_get_rx_can_ids(sx_ids);
+        const struct can_filter bus1[] = {
+                std_filter(0x300, CAN_STD_ID_MASK),
+                ext_filter(sx_ids[0], CAN_EXT_ID_MASK),
+                ext_filter(sx_ids[1], CAN_EXT_ID_MASK),
+        };
+        CPPUNIT_ASSERT_EQUAL((int) ARRAY_LEN(bus1), n);
+        for (size_t i = 0; i < ARRAY_LEN(bus1); ++i)
+                CPPUNIT_ASSERT(has_filter(filters, n, &bus1[i]));
+
+        /* Disabled mappings and OBD2 need nothing */
+        ccc.enabled = false;
+        oc.enabled = false;
+        CPPUNIT_ASSERT_EQUAL(0, CAN_plan_filters(0, &ccc, count, &oc,
+                                                 filters, CAN_FILTERS));
+
+        /* A wildcard needs every frame */
+        ccc.enabled = true;
+        ccc.can_channels[0].mapping.can_id = 0;
+        CPPUNIT_ASSERT_EQUAL(-1, CAN_plan_filters(0, &ccc, count, &oc,
+                                                  filters, CAN_FILTERS));
+}
+
+static void set_script(const char *script)
+{
+        CPPUNIT_ASSERT_EQUAL(SCRIPT_ADD_RESULT_OK,
+                             flashScriptPage(0, script,
+                                             SCRIPT_ADD_MODE_COMPLETE));
+}
+
+void CANFiltersTest::script_filters_test(void)
+{
+        static CANChannelConfig ccc;
+        static OBD2Config oc;
+        memset(&ccc, 0, sizeof(ccc));
+        memset(&oc, 0, sizeof(oc));
+
+        ccc.enabled = true;
+        ccc.can_channels[0].mapping.can_id = 0x100;
+        ccc.can_channels[1].mapping.can_id = 0x200;
+        ccc.can_channels[1].mapping.can_channel = 1;
+
+        set_script(DEFAULT_SCRIPT);
+        CAN_update_filters(&ccc, 2, &oc);
+
+        /* The script sets its own filters on bus 0 only */
+        set_script("setCANfilter(0, 0, 0, 0x300, 0x7FF)");
+        CAN_set_script_filter(0, 0, 0, 0x300, 0x7FF, true);
+
+        /* Those stay, and bus 1 is opened up for it */
+        CAN_mock_reset();
+        CAN_update_filters(&ccc, 2, &oc);
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, CAN_mock_filter_sets(0));
+        CPPUNIT_ASSERT_EQUAL((size_t) CAN_FILTERS, CAN_mock_filter_sets(1));
+
+        /* and then left alone as well */
+        CAN_mock_reset();
+        CAN_update_filters(&ccc, 2, &oc);
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, CAN_mock_filter_sets(0));
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, CAN_mock_filter_sets(1));
+
+        /* Without the script using CAN they are planned again */
+        set_script(DEFAULT_SCRIPT);
+        CAN_update_filters(&ccc, 2, &oc);
+        CPPUNIT_ASSERT_EQUAL((size_t) CAN_FILTERS, CAN_mock_filter_sets(0));
+        CPPUNIT_ASSERT_EQUAL((size_t) CAN_FILTERS, CAN_mock_filter_sets(1));
+}
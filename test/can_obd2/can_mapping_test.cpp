@@ -24,7 +24,11 @@
 #include <string.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include "byteswap.h"
+#include "units_conversion.h"
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 /*
  * #define CAN_MAPPING_TEST_DEBUG
@@ -33,6 +37,20 @@
 
 CPPUNIT_TEST_SUITE_REGISTRATION( CANMappingTest );
 
+/* The compiled mapping's raw value, before any formula */
+static float extract_compiled(uint64_t raw_data, const CANMapping *mapping)
+{
+        CANMapping raw_mapping = *mapping;
+        raw_mapping.multiplier = 1.0f;
+        raw_mapping.divider = 0.0f;
+        raw_mapping.adder = 0.0f;
+        raw_mapping.conversion_filter_id = UNIT_CONVERSION_NONE;
+
+        struct canmapping_extractor extractor;
+        canmapping_compile(&extractor, &raw_mapping);
+        return canmapping_extract(&extractor, raw_data);
+}
+
 
 void CANMappingTest::formula_test(void)
 {
@@ -115,6 +133,7 @@ void CANMappingTest::extract_test_bit_mode(void)
                                         msg.data64 = offset_test_value;
 
                                         float value = canmapping_extract_value(msg.data64, &mapping);
+                                        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
 
                                         /* prepare the comparison value */
                                         uint64_t compare_value = test_value;
@@ -182,6 +201,7 @@ void CANMappingTest::extract_test(void)
                                         msg.data[offset + length - l - 1] = (can_value >> l * 8) & 0xff;
                                 }
                                 float value = canmapping_extract_value(msg.data64, &mapping);
+                                CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
 
 #ifdef CAN_MAPPING_TEST_DEBUG
                                 printf("endian=%d / test value=%d / offset=%d / length=%d / return=%f\r\n" ,
@@ -215,11 +235,13 @@ void CANMappingTest::extract_type_test(void)
         msg.data[0] = 255;
         mapping.type = CANMappingType_signed;
         float value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)-1, value);
 
         /* 8 bit unsigned */
         mapping.type = CANMappingType_unsigned;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)255, value);
 
         /* 16 bit signed */
@@ -228,11 +250,13 @@ void CANMappingTest::extract_type_test(void)
         msg.data[0] = 255;
         msg.data[1] = 255;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)-1, value);
 
         /* 16 bit unsigned */
         mapping.type = CANMappingType_unsigned;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)65535, value);
 
         /* 32 bit signed */
@@ -243,11 +267,13 @@ void CANMappingTest::extract_type_test(void)
         msg.data[2] = 255;
         msg.data[3] = 255;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)-1, value);
 
         /* 32 bit unsigned */
         mapping.type = CANMappingType_unsigned;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)4294967295, value);
 
         /* IEEE754 floating point*/
@@ -259,6 +285,7 @@ void CANMappingTest::extract_type_test(void)
         msg.data[2] = 0xC8;
         msg.data[3] = 0x42;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)100.0, value);
 
         /* 8 bit sign-magnitude */
@@ -266,18 +293,22 @@ void CANMappingTest::extract_type_test(void)
         mapping.length = 1;
         msg.data[0] = 0x01;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)1.0, value);
 
         msg.data[0] = 0x81;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)-1.0, value);
 
         msg.data[0] = 0x0;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)0.0, value);
 
         msg.data[0] = 0x80;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)-0.0, value);
 
         /* 16 bit sign-magnitude */
@@ -285,22 +316,26 @@ void CANMappingTest::extract_type_test(void)
         msg.data[0] = 0x01;
         msg.data[1] = 0x00;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)1.0, value);
 
 
         msg.data[0] = 0x01;
         msg.data[1] = 0x80;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)-1.0, value);
 
         msg.data[0] = 0x00;
         msg.data[1] = 0x00;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)0.0, value);
 
         msg.data[0] = 0x00;
         msg.data[1] = 0x80;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)-0.0, value);
 
         /* 32 bit sign-magnitude */
@@ -310,6 +345,7 @@ void CANMappingTest::extract_type_test(void)
         msg.data[2] = 0x00;
         msg.data[3] = 0x00;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)1.0, value);
 
         msg.data[0] = 0x01;
@@ -317,6 +353,7 @@ void CANMappingTest::extract_type_test(void)
         msg.data[2] = 0x00;
         msg.data[3] = 0x80;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)-1.0, value);
 
         msg.data[0] = 0x00;
@@ -324,6 +361,7 @@ void CANMappingTest::extract_type_test(void)
         msg.data[2] = 0x00;
         msg.data[3] = 0x80;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)0.0, value);
 
         msg.data[0] = 0x00;
@@ -331,6 +369,7 @@ void CANMappingTest::extract_type_test(void)
         msg.data[2] = 0x00;
         msg.data[3] = 0x80;
         value = canmapping_extract_value(msg.data64, &mapping);
+        CPPUNIT_ASSERT_EQUAL(value, extract_compiled(msg.data64, &mapping));
         CPPUNIT_ASSERT_EQUAL((float)-0.0, value);
 }
 
@@ -443,3 +482,101 @@ void CANMappingTest::mapping_test(void)
         CPPUNIT_ASSERT_EQUAL(true, result);
         CPPUNIT_ASSERT_EQUAL((float)MAPPING_FORMULA(0x0102, multiplier, divider, adder), value);
 }
+
+static void random_mapping(CANMapping *mapping)
+{
+        memset(mapping, 0, sizeof(*mapping));
+        mapping->bit_mode = rand() % 2;
+        if (mapping->bit_mode) {
+                mapping->length = 1 + rand() % 32;
+                mapping->offset = rand() % (64 - mapping->length + 1);
+        } else {
+                mapping->length = 1 + rand() % 4;
+                mapping->offset = rand() % (CAN_MSG_SIZE - mapping->length + 1);
+        }
+        mapping->big_endian = rand() % 2;
+        mapping->type = (enum CANMappingType) (rand() % CANMappingType_ENUM_COUNT);
+        mapping->multiplier = (rand() % 2001 - 1000) / 100.0f;
+        mapping->divider = rand() % 4 ? rand() % 100 : 0;
+        mapping->adder = (rand() % 2001 - 1000) / 10.0f;
+        mapping->conversion_filter_id = rand() % UNITS_CONVERSION_COUNT;
+}
+
+void CANMappingTest::compiled_test(void)
+{
+        srand(time(NULL));
+
+        for (size_t i = 0; i < 100000; i++) {
+                CANMapping mapping;
+                random_mapping(&mapping);
+
+                CAN_msg msg;
+                memset(&msg, 0, sizeof(CAN_msg));
+                for (size_t b = 0; b < CAN_MSG_SIZE; b++)
+                        msg.data[b] = rand();
+
+                float value;
+                canmapping_map_value(&value, &msg, &mapping);
+
+                struct canmapping_extractor extractor;
+                canmapping_compile(&extractor, &mapping);
+                const float compiled = canmapping_extract(&extractor, msg.data64);
+
+                /*
+                 * IEEE 754 payloads can be anything, including NaN and
+                 * values that overflow once scaled
+                 */
+                if (mapping.type == CANMappingType_IEEE754 &&
+                    (!isfinite(value) || !isfinite(compiled)))
+                        continue;
+
+                /*
+                 * The formula is folded into a single scale and offset,
+                 * so allow for rounding relative to the terms summed.
+                 */
+                const double raw = fabs(extract_compiled(msg.data64, &mapping));
+                const double tolerance = 1e-5 *
+                        (fabs(extractor.scale) * raw + fabs(extractor.offset) + 1);
+                CPPUNIT_ASSERT_DOUBLES_EQUAL(value, compiled, tolerance);
+        }
+}
+
+void CANMappingTest::compiled_benchmark(void)
+{
+        const size_t mappings = 64;
+        const size_t messages = 1000000;
+        CANMapping mapping[mappings];
+        struct canmapping_extractor extractor[mappings];
+        uint64_t payload[mappings];
+
+        srand(1);
+        for (size_t i = 0; i < mappings; i++) {
+                random_mapping(&mapping[i]);
+                /* Keep float payloads finite */
+                if (mapping[i].type == CANMappingType_IEEE754)
+                        mapping[i].type = CANMappingType_signed;
+                canmapping_compile(&extractor[i], &mapping[i]);
+                payload[i] = (uint64_t) rand() << 32 | rand();
+        }
+
+        float sum = 0;
+        clock_t start = clock();
+        for (size_t i = 0; i < messages; i++) {
+                const size_t m = i % mappings;
+                float value = canmapping_extract_value(payload[m], &mapping[m]);
+                value = canmapping_apply_formula(value, &mapping[m]);
+                sum += convert_units((enum unit_conversions) mapping[m].conversion_filter_id, value);
+        }
+        const double generic = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+        start = clock();
+        for (size_t i = 0; i < messages; i++) {
+                const size_t m = i % mappings;
+                sum += canmapping_extract(&extractor[m], payload[m]);
+        }
+        const double compiled = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+        printf("\nCAN extraction: generic %.1f M/s, compiled %.1f M/s (%g)\n",
+               generic > 0 ? messages / generic / 1e6 : 0.0,
+               compiled > 0 ? messages / compiled / 1e6 : 0.0, sum);
+}
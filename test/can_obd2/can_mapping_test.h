@@ -19,6 +19,8 @@ class CANMappingTest : public CppUnit::TestFixture
         CPPUNIT_TEST( extract_test );
         CPPUNIT_TEST( extract_test_bit_mode );
         CPPUNIT_TEST( extract_type_test );
+        CPPUNIT_TEST( compiled_test );
+        CPPUNIT_TEST( compiled_benchmark );
         CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -28,6 +30,8 @@ public:
         void extract_test(void);
         void extract_test_bit_mode(void);
         void extract_type_test(void);
+        void compiled_test(void);
+        void compiled_benchmark(void);
 };
 
 #endif /* TEST_CAN_OBD2_CAN_MAPPING_TEST_H_ */
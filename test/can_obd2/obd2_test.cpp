@@ -0,0 +1,450 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "CAN_mock.h"
+#include "OBD2.h"
+#include "loggerConfig.h"
+#include "obd2_test.h"
+#include "task.h"
+#include "task_testing.h"
+#include <cppunit/extensions/HelperMacros.h>
+#include <string.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( OBD2Test );
+
+#define TEST_PIDS       3
+#define MODE_CURRENT    0x01
+#define MODE_RESPONSE   0x41
+
+static const uint16_t test_pids[TEST_PIDS] = {0x0C, 0x0D, 0x05};
+
+static OBD2Config obd2_cfg;
+
+void OBD2Test::setUp()
+{
+        set_ticks(1000);
+        CAN_mock_reset();
+        OBD2_set_max_in_flight(OBD2_DEFAULT_IN_FLIGHT);
+
+        memset(&obd2_cfg, 0, sizeof(obd2_cfg));
+        obd2_cfg.enabled = true;
+        obd2_cfg.enabledPids = TEST_PIDS;
+        for (size_t i = 0; i < TEST_PIDS; i++) {
+                PidConfig *pid_cfg = &obd2_cfg.pids[i];
+                pid_cfg->pid = test_pids[i];
+                pid_cfg->mode = MODE_CURRENT;
+
+                CANMapping *mapping = &pid_cfg->mapping;
+                mapping->channel_cfg.sampleRate = SAMPLE_50Hz;
+                mapping->can_id = OBD2_11BIT_PID_RESPONSE;
+                mapping->multiplier = 1;
+                mapping->divider = 1;
+                mapping->offset = 3;
+                mapping->length = 1;
+                mapping->sub_id = -1;
+        }
+        OBD2_init_current_values(&obd2_cfg);
+}
+
+void OBD2Test::tearDown()
+{
+        OBD2_set_batching(false);
+        OBD2_set_max_in_flight(OBD2_DEFAULT_IN_FLIGHT);
+        OBD2_set_pid_delay(0);
+        reset_ticks();
+}
+
+/* The PID requested by a transmitted message */
+static uint8_t tx_pid(const size_t index)
+{
+        CAN_msg msg;
+        CPPUNIT_ASSERT(CAN_mock_get_tx_msg(index, &msg));
+        return msg.data[2];
+}
+
+static void respond_frame(const uint8_t *data, const size_t len)
+{
+        CAN_msg msg;
+        memset(&msg, 0x55, sizeof(msg));
+        msg.addressValue = OBD2_11BIT_PID_RESPONSE;
+        msg.dataLength = 8;
+        msg.can_bus = 0;
+        msg.isExtendedAddress = false;
+        memcpy(msg.data, data, len);
+        update_obd2_channels(&msg, &obd2_cfg);
+}
+
+static void respond(const uint8_t pid, const uint8_t value)
+{
+        const uint8_t data[] = {3, MODE_RESPONSE, pid, value};
+        respond_frame(data, sizeof(data));
+}
+
+/* Gets the ECU talking, so PIDs may be batched */
+static void activate(void)
+{
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        respond(tx_pid(0), 0);
+        CAN_mock_reset();
+}
+
+static float pid_value(const uint8_t pid)
+{
+        float value;
+        CPPUNIT_ASSERT(OBD2_get_value_for_pid(pid, &value));
+        return value;
+}
+
+static struct obd2_stats get_stats(void)
+{
+        struct obd2_stats stats;
+        OBD2_get_stats(&stats);
+        return stats;
+}
+
+void OBD2Test::window_test(void)
+{
+        /* One request at a time by default */
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+
+        /* Opening the window fills it with the other PIDs */
+        OBD2_set_max_in_flight(TEST_PIDS);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) TEST_PIDS, CAN_mock_tx_count());
+        CPPUNIT_ASSERT_EQUAL((uint8_t) TEST_PIDS, get_stats().in_flight);
+
+        bool requested[TEST_PIDS] = {false};
+        for (size_t i = 0; i < TEST_PIDS; i++) {
+                const uint8_t pid = tx_pid(i);
+                for (size_t p = 0; p < TEST_PIDS; p++) {
+                        if (pid != test_pids[p])
+                                continue;
+                        CPPUNIT_ASSERT(!requested[p]);
+                        requested[p] = true;
+                }
+        }
+
+        /* Still full */
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) TEST_PIDS, CAN_mock_tx_count());
+
+        /* and never more than the maximum */
+        OBD2_set_max_in_flight(UINT8_MAX);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) OBD2_MAX_IN_FLIGHT,
+                             get_stats().max_in_flight);
+}
+
+void OBD2Test::out_of_order_test(void)
+{
+        OBD2_set_max_in_flight(TEST_PIDS);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) TEST_PIDS, CAN_mock_tx_count());
+
+        /* Answer the newest request first */
+        const uint8_t last_pid = tx_pid(TEST_PIDS - 1);
+        const uint8_t first_pid = tx_pid(0);
+        respond(last_pid, 42);
+
+        float value;
+        CPPUNIT_ASSERT(OBD2_get_value_for_pid(last_pid, &value));
+        CPPUNIT_ASSERT_EQUAL(42.0f, value);
+        CPPUNIT_ASSERT(OBD2_get_value_for_pid(first_pid, &value));
+        CPPUNIT_ASSERT_EQUAL(0.0f, value);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) (TEST_PIDS - 1), get_stats().in_flight);
+
+        /* A response nobody asked for again is ignored */
+        respond(last_pid, 43);
+        CPPUNIT_ASSERT(OBD2_get_value_for_pid(last_pid, &value));
+        CPPUNIT_ASSERT_EQUAL(42.0f, value);
+
+        /* The free slot goes to the only PID not in flight */
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) TEST_PIDS + 1, CAN_mock_tx_count());
+        CPPUNIT_ASSERT_EQUAL(last_pid, tx_pid(TEST_PIDS));
+
+        respond(first_pid, 7);
+        CPPUNIT_ASSERT(OBD2_get_value_for_pid(first_pid, &value));
+        CPPUNIT_ASSERT_EQUAL(7.0f, value);
+        CPPUNIT_ASSERT(get_stats().active);
+}
+
+void OBD2Test::timeout_test(void)
+{
+        OBD2_set_max_in_flight(2);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, CAN_mock_tx_count());
+
+        CAN_msg msg;
+        CPPUNIT_ASSERT(CAN_mock_get_tx_msg(0, &msg));
+        CPPUNIT_ASSERT(!msg.isExtendedAddress);
+
+        /* Not timed out yet */
+        set_ticks(xTaskGetTickCount() + OBD2_PID_DEFAULT_TIMEOUT_MS / portTICK_RATE_MS - 1);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, CAN_mock_tx_count());
+
+        /*
+         * Both time out together, and with no ECU heard from yet we try
+         * 29 bit OBDII once for the pair, not once per request
+         */
+        set_ticks(xTaskGetTickCount() + 1);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 4, CAN_mock_tx_count());
+        CPPUNIT_ASSERT(CAN_mock_get_tx_msg(2, &msg));
+        CPPUNIT_ASSERT(msg.isExtendedAddress);
+        CPPUNIT_ASSERT(CAN_mock_get_tx_msg(3, &msg));
+        CPPUNIT_ASSERT(msg.isExtendedAddress);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 2, get_stats().in_flight);
+}
+
+void OBD2Test::delay_test(void)
+{
+        const size_t delay_ms = 2 * OBD2_PID_DEFAULT_TIMEOUT_MS;
+        OBD2_set_pid_delay(delay_ms);
+
+        /*
+         * One at a time, the delay only counts from a response.  A request
+         * that timed out is followed up right away, as it always was.
+         */
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+        set_ticks(xTaskGetTickCount() + OBD2_PID_DEFAULT_TIMEOUT_MS / portTICK_RATE_MS);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, CAN_mock_tx_count());
+
+        respond(tx_pid(1), 1);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, CAN_mock_tx_count());
+
+        /* With more in flight, it spaces out the queries too */
+        OBD2_init_current_values(&obd2_cfg);
+        OBD2_set_pid_delay(delay_ms);
+        OBD2_set_max_in_flight(TEST_PIDS);
+        CAN_mock_reset();
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+
+        set_ticks(xTaskGetTickCount() + delay_ms / portTICK_RATE_MS - 1);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+        set_ticks(xTaskGetTickCount() + 1);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT(CAN_mock_tx_count() > 1);
+}
+
+void OBD2Test::sequencer_ratio_test(void)
+{
+        const size_t rounds = 500;
+        size_t queries[2] = {0};
+
+        obd2_cfg.enabledPids = 2;
+        obd2_cfg.pids[1].mapping.channel_cfg.sampleRate = SAMPLE_1Hz;
+        OBD2_init_current_values(&obd2_cfg);
+        OBD2_set_max_in_flight(TEST_PIDS);
+
+        for (size_t round = 0; round < rounds; round++) {
+                /* Plenty of CAN traffic goes by between responses */
+                CAN_mock_reset();
+                for (size_t pass = 0; pass < 10; pass++)
+                        sequence_next_obd2_query(&obd2_cfg, 2);
+
+                for (size_t i = 0; i < CAN_mock_tx_count(); i++) {
+                        const uint8_t pid = tx_pid(i);
+                        queries[pid == test_pids[1]]++;
+                        respond(pid, 0);
+                }
+        }
+
+        /* Still queried in proportion to their sample rates */
+        CPPUNIT_ASSERT_EQUAL(rounds, queries[0]);
+        CPPUNIT_ASSERT(queries[1] >= rounds / 50 - 1);
+        CPPUNIT_ASSERT(queries[1] <= rounds / 50 + 1);
+}
+
+void OBD2Test::stats_test(void)
+{
+        const size_t latency_ticks = 4;
+        const size_t start = xTaskGetTickCount();
+
+        /* Answer every request after 20ms, for just over a second */
+        while (xTaskGetTickCount() - start <= 1000 / portTICK_RATE_MS) {
+                CAN_mock_reset();
+                sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+                CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+
+                set_ticks(xTaskGetTickCount() + latency_ticks);
+                respond(tx_pid(0), 1);
+        }
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+
+        const struct obd2_stats stats = get_stats();
+        CPPUNIT_ASSERT(stats.active);
+        CPPUNIT_ASSERT_EQUAL((uint16_t) TEST_PIDS, stats.channels);
+        CPPUNIT_ASSERT(stats.pid_rate >= 45 && stats.pid_rate <= 55);
+
+        for (size_t i = 0; i < TEST_PIDS; i++) {
+                uint16_t pid, latency;
+                CPPUNIT_ASSERT(OBD2_get_pid_latency(i, &pid, &latency));
+                CPPUNIT_ASSERT_EQUAL(test_pids[i], pid);
+                CPPUNIT_ASSERT_EQUAL((uint16_t) (latency_ticks * portTICK_RATE_MS),
+                                     latency);
+        }
+
+        uint16_t pid, latency;
+        CPPUNIT_ASSERT(!OBD2_get_pid_latency(TEST_PIDS, &pid, &latency));
+}
+
+void OBD2Test::batch_test(void)
+{
+        OBD2_set_batching(true);
+        activate();
+
+        /* Everything is due, so it all goes in one request */
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+
+        CAN_msg msg;
+        CPPUNIT_ASSERT(CAN_mock_get_tx_msg(0, &msg));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0x7DF, msg.addressValue);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) (TEST_PIDS + 1), msg.data[0]);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) MODE_CURRENT, msg.data[1]);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 1, get_stats().in_flight);
+        CPPUNIT_ASSERT(get_stats().batching);
+
+        /* The ECU answers two of them, in its own order, in a single frame */
+        const uint8_t data[] = {6, MODE_RESPONSE, 0x05, 11, 0x0C, 22, 33};
+        respond_frame(data, sizeof(data));
+        CPPUNIT_ASSERT_EQUAL(11.0f, pid_value(0x05));
+        CPPUNIT_ASSERT_EQUAL(22.0f, pid_value(0x0C));
+        CPPUNIT_ASSERT_EQUAL(0.0f, pid_value(0x0D));
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 0, get_stats().in_flight);
+        CPPUNIT_ASSERT(get_stats().batching);
+
+        /* The one left out is asked for on its own from now on */
+        OBD2_set_max_in_flight(TEST_PIDS);
+        CAN_mock_reset();
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, CAN_mock_tx_count());
+
+        bool single = false, batched = false;
+        for (size_t i = 0; i < CAN_mock_tx_count(); ++i) {
+                CPPUNIT_ASSERT(CAN_mock_get_tx_msg(i, &msg));
+                if (2 == msg.data[0]) {
+                        CPPUNIT_ASSERT_EQUAL((uint8_t) 0x0D, msg.data[2]);
+                        single = true;
+                } else {
+                        CPPUNIT_ASSERT_EQUAL((uint8_t) TEST_PIDS, msg.data[0]);
+                        CPPUNIT_ASSERT(0x0D != msg.data[2] &&
+                                       0x0D != msg.data[3]);
+                        batched = true;
+                }
+        }
+        CPPUNIT_ASSERT(single && batched);
+        CPPUNIT_ASSERT(get_stats().batching);
+}
+
+void OBD2Test::batch_multi_frame_test(void)
+{
+        OBD2_set_batching(true);
+        activate();
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+
+        /* 8 bytes of response don't fit in a single frame */
+        const uint8_t first[] = {0x10, 8, MODE_RESPONSE, 0x0C, 1, 2, 0x0D, 3};
+        respond_frame(first, sizeof(first));
+
+        /* We let the ECU send the rest */
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, CAN_mock_tx_count());
+        CAN_msg msg;
+        CPPUNIT_ASSERT(CAN_mock_get_tx_msg(1, &msg));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0x7E0, msg.addressValue);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 0x30, msg.data[0]);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 1, get_stats().in_flight);
+
+        const uint8_t consecutive[] = {0x21, 0x05, 4};
+        respond_frame(consecutive, sizeof(consecutive));
+        CPPUNIT_ASSERT_EQUAL(1.0f, pid_value(0x0C));
+        CPPUNIT_ASSERT_EQUAL(3.0f, pid_value(0x0D));
+        CPPUNIT_ASSERT_EQUAL(4.0f, pid_value(0x05));
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 0, get_stats().in_flight);
+}
+
+void OBD2Test::batch_short_first_frame_test(void)
+{
+        OBD2_set_batching(true);
+        activate();
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+
+        /* A first frame that claims less than a single frame holds */
+        const uint8_t first[] = {0x10, 0x05, MODE_RESPONSE, 0x0C, 1, 0x0D};
+        respond_frame(first, sizeof(first));
+        const uint8_t next[] = {0x21, 2, 0x05, 3, 4, 5, 6, 7};
+        respond_frame(next, sizeof(next));
+
+        /* is no transfer, so there's no flow control and nothing answered */
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 1, get_stats().in_flight);
+        CPPUNIT_ASSERT_EQUAL(0.0f, pid_value(0x0C));
+}
+
+void OBD2Test::batch_fallback_test(void)
+{
+        OBD2_set_batching(true);
+        activate();
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, CAN_mock_tx_count());
+
+        /* An ECU that doesn't know about batching says so */
+        const uint8_t rejected[] = {3, 0x7F, MODE_CURRENT, 0x12};
+        respond_frame(rejected, sizeof(rejected));
+        CPPUNIT_ASSERT(!get_stats().batching);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 0, get_stats().in_flight);
+
+        CAN_mock_reset();
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CAN_msg msg;
+        CPPUNIT_ASSERT(CAN_mock_get_tx_msg(0, &msg));
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 2, msg.data[0]);
+
+        /* Reloading the configuration tries again */
+        OBD2_init_current_values(&obd2_cfg);
+        CPPUNIT_ASSERT(get_stats().batching);
+        CAN_mock_reset();
+        activate();
+
+        /* and an ECU that ignores batches gets the same treatment */
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT(CAN_mock_get_tx_msg(0, &msg));
+        CPPUNIT_ASSERT_EQUAL((uint8_t) (TEST_PIDS + 1), msg.data[0]);
+
+        set_ticks(xTaskGetTickCount() + OBD2_PID_DEFAULT_TIMEOUT_MS / portTICK_RATE_MS);
+        sequence_next_obd2_query(&obd2_cfg, TEST_PIDS);
+        CPPUNIT_ASSERT(!get_stats().batching);
+        CPPUNIT_ASSERT(CAN_mock_get_tx_msg(1, &msg));
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 2, msg.data[0]);
+}
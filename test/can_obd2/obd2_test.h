@@ -0,0 +1,59 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef TEST_CAN_OBD2_OBD2_TEST_H_
+#define TEST_CAN_OBD2_OBD2_TEST_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class OBD2Test : public CppUnit::TestFixture
+{
+        CPPUNIT_TEST_SUITE( OBD2Test );
+        CPPUNIT_TEST( window_test );
+        CPPUNIT_TEST( out_of_order_test );
+        CPPUNIT_TEST( timeout_test );
+        CPPUNIT_TEST( delay_test );
+        CPPUNIT_TEST( sequencer_ratio_test );
+        CPPUNIT_TEST( stats_test );
+        CPPUNIT_TEST( batch_test );
+        CPPUNIT_TEST( batch_multi_frame_test );
+        CPPUNIT_TEST( batch_short_first_frame_test );
+        CPPUNIT_TEST( batch_fallback_test );
+        CPPUNIT_TEST_SUITE_END();
+
+public:
+        void setUp();
+        void tearDown();
+        void window_test(void);
+        void out_of_order_test(void);
+        void timeout_test(void);
+        void delay_test(void);
+        void sequencer_ratio_test(void);
+        void stats_test(void);
+        void batch_test(void);
+        void batch_multi_frame_test(void);
+        void batch_short_first_frame_test(void);
+        void batch_fallback_test(void);
+};
+
+#endif /* TEST_CAN_OBD2_OBD2_TEST_H_ */
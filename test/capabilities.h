@@ -109,6 +109,7 @@ CPP_GUARD_BEGIN
 #define CAN_CHANNELS			2
 #define CAN_SW_TERMINATION      true
 #define CAN_MAPPINGS            10
+#define CAN_FILTERS             14
 #define OBD2_CHANNELS           10
 
 //wireless links
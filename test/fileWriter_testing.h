@@ -32,6 +32,13 @@ int flush_logfile(struct logging_status *ls);
 int logging_stop(struct logging_status *ls);
 int logging_start(struct logging_status *ls);
 int logging_sample(struct logging_status *ls, LoggerMessage *msg);
+FRESULT commit_file_buffer(struct logging_status *ls);
+bool init_file_buffers(void);
+bool drain_next_file_buffer(const portTickType timeout);
+DWORD get_prealloc_size(const struct logfile_config *cfg, LoggerConfig *lc);
+int get_log_file_index(const char *name);
+
+extern bool file_io_async;
 
 CPP_GUARD_END
 
@@ -0,0 +1,176 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "logCompressTest.hh"
+#include "log_compress.h"
+#include "log_fixture.h"
+#include "loggerConfig.h"
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+
+using std::string;
+
+/*
+ * The fileWriter hands its buffer off to be compressed once the write
+ * threshold is reached, so that is the size of the blocks it writes.
+ */
+#define BLOCK_SIZE	DEFAULT_LOGFILE_WRITE_THRESHOLD
+
+CPPUNIT_TEST_SUITE_REGISTRATION( LogCompressTest );
+
+static string read_file(const char *name)
+{
+        std::ifstream file(name, std::ios::binary);
+        std::stringstream ss;
+        ss << file.rdbuf();
+        return ss.str();
+}
+
+/**
+ * Compresses data in BLOCK_SIZE chunks, the way the fileWriter does.
+ */
+static string compress(const string &data)
+{
+        struct log_compress lc;
+        char block[LOG_COMPRESS_BLOCK_BOUND(BLOCK_SIZE)];
+        string out;
+
+        for (size_t i = 0; i < data.size(); i += BLOCK_SIZE) {
+                const size_t len = std::min((size_t) BLOCK_SIZE,
+                                            data.size() - i);
+                const size_t block_len =
+                        log_compress_block(&lc, data.data() + i, len, block);
+                CPPUNIT_ASSERT(block_len <= LOG_COMPRESS_BLOCK_BOUND(len));
+                out.append(block, block_len);
+        }
+
+        return out;
+}
+
+static int decompress(const string &data, string *out)
+{
+        const struct log_format_writer w = LogFixture::string_writer(out);
+        return log_decompress(data.data(), data.size(), &w);
+}
+
+void LogCompressTest::testRoundTrip()
+{
+        const string log = read_file("sonoma.log").substr(0, 100000);
+        const string compressed = compress(log);
+
+        string decoded;
+        const int blocks = decompress(compressed, &decoded);
+        CPPUNIT_ASSERT_EQUAL((int) ((log.size() + BLOCK_SIZE - 1) /
+                                    BLOCK_SIZE), blocks);
+        CPPUNIT_ASSERT(log == decoded);
+        CPPUNIT_ASSERT(compressed.size() * 10 < log.size() * 7);
+}
+
+void LogCompressTest::testIncompressible()
+{
+        string noise;
+        srand(42);
+        for (size_t i = 0; i < BLOCK_SIZE; ++i)
+                noise += (char) rand();
+
+        /* Stored as is, so only the block header is added */
+        const string compressed = compress(noise);
+        CPPUNIT_ASSERT_EQUAL(noise.size() + LOG_COMPRESS_HEADER_LEN,
+                             compressed.size());
+
+        string decoded;
+        CPPUNIT_ASSERT_EQUAL(1, decompress(compressed, &decoded));
+        CPPUNIT_ASSERT(noise == decoded);
+
+        /* Short and highly repetitive data works too */
+        const string runs = string(300, 'a') + "abc" + string(150, ',');
+        decoded.clear();
+        CPPUNIT_ASSERT_EQUAL(1, decompress(compress(runs), &decoded));
+        CPPUNIT_ASSERT(runs == decoded);
+}
+
+void LogCompressTest::testTruncated()
+{
+        const string log = read_file("sonoma.log").substr(0, 10 * BLOCK_SIZE);
+        const string compressed = compress(log);
+
+        /* Cut the last block short, like a power loss would */
+        string decoded;
+        CPPUNIT_ASSERT_EQUAL(9, decompress(compressed.substr(
+                                                   0, compressed.size() - 10),
+                                           &decoded));
+        CPPUNIT_ASSERT(log.substr(0, 9 * BLOCK_SIZE) == decoded);
+
+        /* Junk after the last block, like unused pre-allocation */
+        decoded.clear();
+        CPPUNIT_ASSERT_EQUAL(10, decompress(compressed + string(100, '\0'),
+                                            &decoded));
+        CPPUNIT_ASSERT(log == decoded);
+}
+
+void LogCompressTest::testInvalid()
+{
+        string decoded;
+        CPPUNIT_ASSERT_EQUAL(-1, decompress("\"Interval\"|\"ms\"", &decoded));
+        CPPUNIT_ASSERT_EQUAL(-1, decompress("", &decoded));
+
+        /* A header claiming more data than it decodes to */
+        const char bad[] = { 'R', 'Z', 10, 0, 2, 0, 0x10, 'a' };
+        CPPUNIT_ASSERT_EQUAL(0, decompress(string(bad, sizeof(bad)),
+                                           &decoded));
+        CPPUNIT_ASSERT(decoded.empty());
+}
+
+static void benchmark(const char *name)
+{
+        const string log = read_file(name);
+        CPPUNIT_ASSERT(!log.empty());
+
+        const clock_t start = clock();
+        const string compressed = compress(log);
+        const double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+        string decoded;
+        decompress(compressed, &decoded);
+        CPPUNIT_ASSERT(log == decoded);
+
+        const double ratio = (double) compressed.size() / log.size();
+        printf("\n%s: %zu -> %zu bytes (%.1f%%), %.1f MB/s\n", name,
+               log.size(), compressed.size(), ratio * 100,
+               secs > 0 ? log.size() / secs / 1e6 : 0.0);
+
+        /*
+         * CSV logs are very repetitive, but blocks only find matches
+         * within themselves.  Expect a decent saving anyway.
+         */
+        CPPUNIT_ASSERT(ratio < 0.7);
+}
+
+void LogCompressTest::testBenchmark()
+{
+        benchmark("sonoma.log");
+        benchmark("predictive_time_test_lap.log");
+}
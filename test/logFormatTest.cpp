@@ -0,0 +1,169 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logFormatTest.hh"
+#include "log_fixture.h"
+#include "log_format.h"
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+using std::string;
+
+#define FIXTURE_FILE	"sonoma.log"
+#define FIXTURE_ROWS	2000
+
+CPPUNIT_TEST_SUITE_REGISTRATION( LogFormatTest );
+
+static void format_fixture(LogFixture &fixture, string *csv, string *rcb)
+{
+        const struct log_format_writer csv_w = LogFixture::string_writer(csv);
+        const struct log_format_writer rcb_w = LogFixture::string_writer(rcb);
+
+        log_format_csv_header(&csv_w, fixture.row(0));
+        log_format_rcb_header(&rcb_w, fixture.row(0));
+
+        for (size_t i = 0; i < fixture.rows(); ++i) {
+                struct sample *s = fixture.row(i);
+                CPPUNIT_ASSERT_EQUAL(0, log_format_csv_row(&csv_w, s));
+                CPPUNIT_ASSERT_EQUAL(0, log_format_rcb_record(&rcb_w, s, i));
+        }
+}
+
+void LogFormatTest::testCsvMatchesFixture()
+{
+        LogFixture fixture(FIXTURE_FILE, FIXTURE_ROWS);
+        string csv, rcb;
+        format_fixture(fixture, &csv, &rcb);
+
+        /* Our CSV writer should reproduce the header the unit wrote */
+        std::ifstream file(FIXTURE_FILE);
+        string header;
+        std::getline(file, header);
+        CPPUNIT_ASSERT_EQUAL(header + "\n", csv.substr(0, header.size() + 1));
+}
+
+void LogFormatTest::testRcbRoundTrip()
+{
+        LogFixture fixture(FIXTURE_FILE, FIXTURE_ROWS);
+        string csv, rcb, decoded;
+        format_fixture(fixture, &csv, &rcb);
+
+        const struct log_format_writer w = LogFixture::string_writer(&decoded);
+        const int records = log_format_rcb_to_csv(rcb.data(), rcb.size(), &w);
+
+        CPPUNIT_ASSERT_EQUAL((int) fixture.rows(), records);
+        CPPUNIT_ASSERT(csv == decoded);
+
+        /* The whole point of the exercise */
+        CPPUNIT_ASSERT(rcb.size() < csv.size());
+}
+
+void LogFormatTest::testRcbTruncated()
+{
+        LogFixture fixture(FIXTURE_FILE, FIXTURE_ROWS);
+        string csv, rcb, decoded;
+        format_fixture(fixture, &csv, &rcb);
+
+        /* Chop the last record in half, like a power loss would */
+        const struct log_format_writer w = LogFixture::string_writer(&decoded);
+        const int records = log_format_rcb_to_csv(rcb.data(), rcb.size() - 3,
+                                                  &w);
+
+        CPPUNIT_ASSERT_EQUAL((int) fixture.rows() - 1, records);
+
+        /* Everything but the last CSV row should match */
+        const size_t last_row = csv.rfind('\n', csv.size() - 2) + 1;
+        CPPUNIT_ASSERT(csv.substr(0, last_row) == decoded);
+}
+
+void LogFormatTest::testRcbInvalid()
+{
+        string decoded;
+        const struct log_format_writer w = LogFixture::string_writer(&decoded);
+        const char csv[] = "\"Interval\"|\"ms\"|0|0|1\n";
+
+        CPPUNIT_ASSERT_EQUAL(-1, log_format_rcb_to_csv(csv, sizeof(csv), &w));
+        CPPUNIT_ASSERT_EQUAL(-1, log_format_rcb_to_csv(RCB_MAGIC, 2, &w));
+        CPPUNIT_ASSERT(decoded.empty());
+}
+
+/**
+ * Turns a sparse CSV row back into a regular one the way a log reader
+ * would.
+ */
+static string expand_sparse_row(const string &row, const size_t channels)
+{
+        std::vector<string> values(channels);
+        std::istringstream fields(row);
+        string field;
+        size_t index = 0;
+
+        while (std::getline(fields, field, ',')) {
+                const size_t eq = field.find('=');
+                if (string::npos != eq) {
+                        index = atoi(field.substr(0, eq).c_str());
+                        field = field.substr(eq + 1);
+                }
+
+                CPPUNIT_ASSERT(index < channels);
+                values[index++] = field;
+        }
+
+        string expanded;
+        for (size_t i = 0; i < channels; ++i)
+                expanded += (i ? "," : "") + values[i];
+
+        return expanded;
+}
+
+void LogFormatTest::testCsvSparseMatchesCsv()
+{
+        LogFixture fixture(FIXTURE_FILE, FIXTURE_ROWS);
+        size_t csv_size = 0;
+        size_t sparse_size = 0;
+
+        for (size_t i = 0; i < fixture.rows(); ++i) {
+                struct sample *s = fixture.row(i);
+                string csv, sparse;
+                const struct log_format_writer csv_w =
+                        LogFixture::string_writer(&csv);
+                const struct log_format_writer sparse_w =
+                        LogFixture::string_writer(&sparse);
+
+                CPPUNIT_ASSERT_EQUAL(0, log_format_csv_row(&csv_w, s));
+                CPPUNIT_ASSERT_EQUAL(0, log_format_csv_sparse_row(&sparse_w,
+                                                                  s));
+                CPPUNIT_ASSERT_EQUAL('\n', sparse[sparse.size() - 1]);
+
+                const string row = sparse.substr(0, sparse.size() - 1);
+                CPPUNIT_ASSERT_EQUAL(csv, expand_sparse_row(
+                                             row, s->channel_count) + "\n");
+
+                csv_size += csv.size();
+                sparse_size += sparse.size();
+        }
+
+        /* Slow channels no longer cost a comma on every fast row */
+        CPPUNIT_ASSERT(sparse_size < csv_size);
+}
@@ -0,0 +1,209 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "crc32.h"
+#include "logJournalTest.hh"
+#include "log_journal.h"
+#include <string>
+
+using std::string;
+
+#define JOURNAL_ID	0x1234abcd
+
+CPPUNIT_TEST_SUITE_REGISTRATION( LogJournalTest );
+
+static void append_data(struct log_journal *j, string *out, const string &data)
+{
+        log_journal_update(j, data.data(), data.size());
+        out->append(data);
+}
+
+static void append_checkpoint(struct log_journal *j, string *out,
+                              const uint32_t rows)
+{
+        char buf[LOG_JOURNAL_CHECKPOINT_LEN];
+        out->append(buf, log_journal_checkpoint(j, buf, 1000 * rows, rows));
+}
+
+/**
+ * Builds a log of rows with a checkpoint after every other row.
+ */
+static string build_log(const size_t rows, const uint32_t id)
+{
+        struct log_journal j;
+        string out;
+
+        log_journal_init(&j, id);
+        append_data(&j, &out, "\"Interval\"|\"ms\"|0|0|1\r\n");
+        append_checkpoint(&j, &out, 0);
+
+        for (size_t i = 1; i <= rows; ++i) {
+                append_data(&j, &out, "1000,12.5,3.25\r\n");
+                if (0 == i % 2)
+                        append_checkpoint(&j, &out, i);
+        }
+
+        return out;
+}
+
+void LogJournalTest::testCrc32()
+{
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0xCBF43926, crc32("123456789", 9));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0, crc32("", 0));
+
+        /* Running updates match a single pass */
+        uint32_t crc = crc32_update(CRC32_INIT, "1234", 4);
+        crc = crc32_final(crc32_update(crc, "56789", 5));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0xCBF43926, crc);
+}
+
+void LogJournalTest::testCheckpointParse()
+{
+        struct log_journal j;
+        char buf[LOG_JOURNAL_CHECKPOINT_LEN];
+
+        log_journal_init(&j, JOURNAL_ID);
+        log_journal_update(&j, "abc", 3);
+        log_journal_checkpoint(&j, buf, 0xfeed, 42);
+
+        const string line(buf, sizeof(buf));
+        CPPUNIT_ASSERT_EQUAL(string("#CK,1234abcd,0000feed,0000002a,"
+                                    "00000003,"), line.substr(0, 40));
+        CPPUNIT_ASSERT_EQUAL(string("\r\n"), line.substr(48));
+
+        /* The next block starts out empty */
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0, j.len);
+
+        struct log_journal_checkpoint cp;
+        CPPUNIT_ASSERT(log_journal_parse(buf, sizeof(buf), &cp));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) JOURNAL_ID, cp.id);
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0xfeed, cp.tick);
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 42, cp.rows);
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 3, cp.len);
+
+        CPPUNIT_ASSERT(!log_journal_parse(buf, sizeof(buf) - 1, &cp));
+        buf[20] = 'x';
+        CPPUNIT_ASSERT(!log_journal_parse(buf, sizeof(buf), &cp));
+}
+
+void LogJournalTest::testFindFirst()
+{
+        const string log = build_log(4, JOURNAL_ID);
+        struct log_journal_checkpoint cp;
+
+        CPPUNIT_ASSERT(log_journal_find_first(log.data(), log.size(), &cp));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) JOURNAL_ID, cp.id);
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0, cp.rows);
+
+        const string plain = "\"Interval\"|\"ms\"|0|0|1\r\n1000,1,2\r\n";
+        CPPUNIT_ASSERT(!log_journal_find_first(plain.data(), plain.size(),
+                                               &cp));
+}
+
+void LogJournalTest::testFindLast()
+{
+        const string log = build_log(10, JOURNAL_ID);
+
+        /* A log that was closed cleanly ends on a checkpoint */
+        CPPUNIT_ASSERT_EQUAL((long) log.size(),
+                             log_journal_find_last(log.data(), log.size(),
+                                                   JOURNAL_ID));
+
+        /* A partial row and junk after it are not covered */
+        const string cut = log + "1000,12.5,3" + string(100, '\0');
+        CPPUNIT_ASSERT_EQUAL((long) log.size(),
+                             log_journal_find_last(cut.data(), cut.size(),
+                                                   JOURNAL_ID));
+
+        /* A checkpoint cut in half doesn't count either */
+        const string half = build_log(11, JOURNAL_ID) +
+                string(build_log(12, JOURNAL_ID), log.size() + 16, 20);
+        CPPUNIT_ASSERT_EQUAL((long) log.size(),
+                             log_journal_find_last(half.data(), half.size(),
+                                                   JOURNAL_ID));
+
+        /* Can't verify a checkpoint whose data is cut off at the start */
+        const size_t start = log.size() - LOG_JOURNAL_CHECKPOINT_LEN - 1;
+        CPPUNIT_ASSERT_EQUAL((long) -1,
+                             log_journal_find_last(log.data() + start,
+                                                   log.size() - start,
+                                                   JOURNAL_ID));
+}
+
+void LogJournalTest::testFindLastCorrupt()
+{
+        const string log = build_log(10, JOURNAL_ID);
+        const string prev = build_log(8, JOURNAL_ID);
+
+        /* A torn write in the last block falls back to the one before */
+        string torn = log;
+        torn[prev.size() + 3] = 'X';
+        CPPUNIT_ASSERT_EQUAL((long) prev.size(),
+                             log_journal_find_last(torn.data(), torn.size(),
+                                                   JOURNAL_ID));
+}
+
+void LogJournalTest::testFindLastOtherId()
+{
+        const string log = build_log(10, JOURNAL_ID);
+
+        /* Stale checkpoints from some other file are ignored */
+        const string stale = log + build_log(10, JOURNAL_ID + 1);
+        CPPUNIT_ASSERT_EQUAL((long) log.size(),
+                             log_journal_find_last(stale.data(),
+                                                   stale.size(),
+                                                   JOURNAL_ID));
+        CPPUNIT_ASSERT_EQUAL((long) -1,
+                             log_journal_find_last(log.data(), log.size(),
+                                                   JOURNAL_ID + 1));
+}
+
+void LogJournalTest::testVerify()
+{
+        const string log = build_log(10, JOURNAL_ID);
+        const string prev = build_log(8, JOURNAL_ID);
+        const char *cp = log.data() + log.size() - LOG_JOURNAL_CHECKPOINT_LEN;
+        const size_t start = prev.size();
+        const size_t len = log.size() - LOG_JOURNAL_CHECKPOINT_LEN - start;
+        struct log_journal j;
+
+        /* The block can be fed in a piece at a time */
+        log_journal_init(&j, JOURNAL_ID);
+        log_journal_update(&j, log.data() + start, 5);
+        log_journal_update(&j, log.data() + start + 5, len - 5);
+        CPPUNIT_ASSERT(log_journal_verify(&j, cp));
+
+        /* Wrong id, short data and changed data all fail */
+        log_journal_init(&j, JOURNAL_ID + 1);
+        log_journal_update(&j, log.data() + start, len);
+        CPPUNIT_ASSERT(!log_journal_verify(&j, cp));
+
+        log_journal_init(&j, JOURNAL_ID);
+        log_journal_update(&j, log.data() + start + 1, len - 1);
+        CPPUNIT_ASSERT(!log_journal_verify(&j, cp));
+
+        string torn(log, start, len);
+        torn[3] = 'X';
+        log_journal_init(&j, JOURNAL_ID);
+        log_journal_update(&j, torn.data(), torn.size());
+        CPPUNIT_ASSERT(!log_journal_verify(&j, cp));
+}
@@ -0,0 +1,50 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _LOG_JOURNAL_TEST_H_
+#define _LOG_JOURNAL_TEST_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class LogJournalTest : public CppUnit::TestFixture
+{
+        CPPUNIT_TEST_SUITE( LogJournalTest );
+        CPPUNIT_TEST( testCrc32 );
+        CPPUNIT_TEST( testCheckpointParse );
+        CPPUNIT_TEST( testFindFirst );
+        CPPUNIT_TEST( testFindLast );
+        CPPUNIT_TEST( testFindLastCorrupt );
+        CPPUNIT_TEST( testFindLastOtherId );
+        CPPUNIT_TEST( testVerify );
+        CPPUNIT_TEST_SUITE_END();
+
+public:
+        void testCrc32();
+        void testCheckpointParse();
+        void testFindFirst();
+        void testFindLast();
+        void testFindLastCorrupt();
+        void testFindLastOtherId();
+        void testVerify();
+};
+
+#endif /* _LOG_JOURNAL_TEST_H_ */
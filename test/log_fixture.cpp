@@ -0,0 +1,166 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log_fixture.h"
+#include "loggerConfig.h"
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+
+using std::string;
+using std::vector;
+
+static vector<string> split(const string &str, const char delim)
+{
+        vector<string> tokens;
+        std::stringstream ss(str);
+        string token;
+
+        while (std::getline(ss, token, delim))
+                tokens.push_back(token);
+
+        /* getline drops a trailing empty field */
+        if (!str.empty() && str[str.size() - 1] == delim)
+                tokens.push_back("");
+
+        return tokens;
+}
+
+static string unquote(const string &str)
+{
+        if (str.size() >= 2 && str[0] == '"')
+                return str.substr(1, str.size() - 2);
+
+        return str;
+}
+
+static unsigned char get_precision(const string &num)
+{
+        const size_t dot = num.find('.');
+        return dot == string::npos ? 0 : num.size() - dot - 1;
+}
+
+static enum SampleData get_sample_data(const string &label,
+                                       const unsigned char precision)
+{
+        if (label == "Utc")
+                return SampleData_LongLong_Noarg;
+
+        if (label == "Latitude" || label == "Longitude")
+                return SampleData_Double_Noarg;
+
+        return precision ? SampleData_Float_Noarg : SampleData_Int_Noarg;
+}
+
+LogFixture::LogFixture(const string &filename, const size_t max_rows)
+{
+        std::ifstream file(filename.c_str());
+        string line;
+
+        std::getline(file, line);
+        const vector<string> header = split(line, ',');
+
+        cfgs.resize(header.size());
+        samples.resize(header.size());
+        for (size_t i = 0; i < header.size(); ++i) {
+                const vector<string> fields = split(header[i], '|');
+                ChannelConfig *cfg = &cfgs[i];
+                ChannelSample *cs = &samples[i];
+
+                memset(cfg, 0, sizeof(*cfg));
+                strncpy(cfg->label, unquote(fields[0]).c_str(),
+                        DEFAULT_LABEL_LENGTH - 1);
+                strncpy(cfg->units, unquote(fields[1]).c_str(),
+                        DEFAULT_UNITS_LENGTH - 1);
+                cfg->precision = get_precision(fields[2]);
+                cfg->min = atof(fields[2].c_str());
+                cfg->max = atof(fields[3].c_str());
+                cfg->sampleRate = encodeSampleRate(atoi(fields[4].c_str()));
+
+                memset(cs, 0, sizeof(*cs));
+                cs->cfg = cfg;
+                cs->sampleData = get_sample_data(cfg->label, cfg->precision);
+        }
+
+        while (std::getline(file, line)) {
+                if (max_rows && values.size() >= max_rows)
+                        break;
+
+                const vector<string> fields = split(line, ',');
+                vector<Value> row(header.size());
+                for (size_t i = 0; i < header.size(); ++i) {
+                        const string f = i < fields.size() ? fields[i] : "";
+                        row[i].populated = !f.empty();
+                        row[i].ll = atoll(f.c_str());
+                        row[i].d = atof(f.c_str());
+                }
+                values.push_back(row);
+        }
+
+        s.ticks = 0;
+        s.channel_count = samples.size();
+        s.channel_samples = &samples[0];
+}
+
+size_t LogFixture::rows() const
+{
+        return values.size();
+}
+
+struct sample* LogFixture::row(const size_t index)
+{
+        const vector<Value> &row = values[index];
+
+        for (size_t i = 0; i < samples.size(); ++i) {
+                ChannelSample *cs = &samples[i];
+                cs->populated = row[i].populated;
+
+                switch (cs->sampleData) {
+                case SampleData_LongLong_Noarg:
+                        cs->valueLongLong = row[i].ll;
+                        break;
+                case SampleData_Double_Noarg:
+                        cs->valueDouble = row[i].d;
+                        break;
+                case SampleData_Float_Noarg:
+                        cs->valueFloat = row[i].d;
+                        break;
+                default:
+                        cs->valueInt = (int) row[i].ll;
+                        break;
+                }
+        }
+
+        s.ticks = index;
+        return &s;
+}
+
+static void append_string(const void *data, const size_t len, void *arg)
+{
+        ((string *) arg)->append((const char *) data, len);
+}
+
+struct log_format_writer LogFixture::string_writer(string *str)
+{
+        struct log_format_writer w = {append_string, str};
+        return w;
+}
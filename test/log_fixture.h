@@ -0,0 +1,70 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOG_FIXTURE_H_
+#define _LOG_FIXTURE_H_
+
+#include "log_format.h"
+#include "sampleRecord.h"
+#include <string>
+#include <vector>
+
+/**
+ * Loads a CSV log file captured from a real unit (like sonoma.log) and
+ * replays it as a sequence of struct sample objects, so formatting code
+ * can be exercised with realistic channel layouts and values.
+ */
+class LogFixture
+{
+public:
+        /**
+         * @param filename The CSV log to load.
+         * @param max_rows Stop after this many data rows.  0 loads all.
+         */
+        LogFixture(const std::string &filename, const size_t max_rows = 0);
+
+        size_t rows() const;
+
+        /**
+         * Populates the fixture sample with the values of the given row.
+         * @return The sample, which stays valid until the next call.
+         */
+        struct sample* row(const size_t index);
+
+        /**
+         * log_format_writer that appends to the std::string given as arg.
+         */
+        static struct log_format_writer string_writer(std::string *str);
+
+private:
+        struct Value {
+                bool populated;
+                long long ll;
+                double d;
+        };
+
+        std::vector<ChannelConfig> cfgs;
+        std::vector<ChannelSample> samples;
+        std::vector<std::vector<Value> > values;
+        struct sample s;
+};
+
+#endif /* _LOG_FIXTURE_H_ */
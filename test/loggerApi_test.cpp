@@ -19,14 +19,17 @@
  * this code. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "OBD2.h"
 #include "FreeRTOS.h"
 #include "api.h"
 #include "auto_logger.h"
 #include "bluetooth.h"
 #include "cellular.h"
 #include "channel_config.h"
+#include "connectivityTask.h"
 #include "constants.h"
 #include "cpu.h"
+#include "fileWriter.h"
 #include "imu.h"
 #include "jsmn.h"
 #include "lap_stats.h"
@@ -35,11 +38,14 @@
 #include "loggerApi.h"
 #include "loggerApi_test.h"
 #include "loggerConfig.h"
+#include "loggerTaskEx.h"
 #include "luaScript.h"
+#include "macros.h"
 #include "memory_mock.h"
 #include "mock_serial.h"
 #include "predictive_timer_2.h"
 #include "printk.h"
+#include "sampleRecord.h"
 #include "rcp_cpp_unit.hh"
 #include "sim900.h"
 #include "task.h"
@@ -47,11 +53,13 @@
 #include "units.h"
 #include "versionInfo.h"
 #include <fstream>
+#include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <streambuf>
 #include <string.h>
 #include <string>
+#include <time.h>
 
 #define JSON_TOKENS 10000
 #define FILE_PREFIX string("json_api_files/")
@@ -362,6 +370,23 @@ void LoggerApiTest::testSetAnalogCfg()
         testSetAnalogConfigFile("setAnalogCfg3.json");
 }
 
+void LoggerApiTest::testSetMultipleAnalogCfg()
+{
+        LoggerConfig *c = getWorkingLoggerConfig();
+        ADCConfig *adcCfg = &c->ADCConfigs[3];
+        const float alpha = adcCfg->filterAlpha;
+
+        /* Channel 0, checked as usual, has nested tokens ahead of channel 3 */
+        testSetAnalogConfigFile("setAnalogCfgMulti.json");
+
+        CPPUNIT_ASSERT_EQUAL(string("Oil"), string(adcCfg->cfg.label));
+        CPPUNIT_ASSERT_EQUAL(10, decodeSampleRate(adcCfg->cfg.sampleRate));
+        CPPUNIT_ASSERT_EQUAL(2.0F, adcCfg->calibration);
+
+        /* Fields of channel 0 don't leak into channel 3 */
+        CPPUNIT_ASSERT_EQUAL(alpha, adcCfg->filterAlpha);
+}
+
 void LoggerApiTest::testGetImuConfigFile(string filename, int index)
 {
         LoggerConfig *c = getWorkingLoggerConfig();
@@ -700,6 +725,52 @@ void LoggerApiTest::testGetMeta()
                              getSampleResponse(requestJson));
 }
 
+static string get_sample_meta(const struct sample *s)
+{
+        mock_resetTxBuffer();
+        api_send_sample_record(getMockSerial(), s, 0, true);
+
+        const string tx(mock_getTxBuffer());
+        return tx.substr(0, tx.find("\"d\":"));
+}
+
+void LoggerApiTest::testGetMetaCached()
+{
+        LoggerConfig *lc = getWorkingLoggerConfig();
+        ChannelConfig *cfg = &lc->ImuConfigs[0].cfg;
+        const size_t count = get_enabled_channel_count(lc);
+        struct sample pool[2] = {};
+
+        sample_pool_init(pool, 2, count);
+        const string meta = get_sample_meta(pool + 0);
+        CPPUNIT_ASSERT(string::npos != meta.find("\"AccelX\""));
+
+        /* Rendered once per pool layout, so this goes unnoticed */
+        strcpy(cfg->label, "Surge");
+        CPPUNIT_ASSERT(meta == get_sample_meta(pool + 1));
+
+        /* by the pool, but not by samples made on their own */
+        const string request = readFile("getMeta.json");
+        CPPUNIT_ASSERT(string::npos !=
+                       getSampleResponse(request).find("\"Surge\""));
+
+        /*
+         * A sample held across the rebuild keeps its layout, and meta
+         * rendered for it is never taken for the new layout.
+         */
+        struct sample *held = sample_pool_acquire(pool, 2);
+        sample_pool_init(pool, 2, count);
+        get_sample_meta(held);
+        sample_release(held);
+
+        const string rebuilt = get_sample_meta(pool + 1);
+        CPPUNIT_ASSERT(string::npos == rebuilt.find("\"AccelX\""));
+        CPPUNIT_ASSERT(string::npos != rebuilt.find("\"Surge\""));
+
+        free_sample_buffer(pool + 0);
+        free_sample_buffer(pool + 1);
+}
+
 void LoggerApiTest::testSampleData1()
 {
         string requestJson1 = readFile("sampleData1.json");
@@ -1285,6 +1356,135 @@ void LoggerApiTest::testSetCanChanCfgFile(string filename)
         }
 }
 
+static string can_chans_message(const size_t index, const size_t count)
+{
+        std::ostringstream msg;
+
+        msg << "{\"setCanChanCfg\":{\"index\":" << index << ",\"chans\":[";
+        for (size_t i = 0; i < count; ++i) {
+                msg << (i ? "," : "") << "{\"nm\":\"Chan" << i
+                    << "\",\"ut\":\"U\",\"min\":0,\"max\":100,\"sr\":10,"
+                    << "\"prec\":1,\"bm\":false,\"bus\":0,\"id\":" << 100 + i
+                    << ",\"subId\":-1,\"idMask\":0,\"bigEndian\":false,"
+                    << "\"offset\":" << i % 8 << ",\"len\":1,\"mult\":1,"
+                    << "\"div\":1,\"add\":0,\"type\":0,\"filtId\":0}";
+        }
+        msg << "],\"last\":true,\"en\":1}}";
+
+        return msg.str();
+}
+
+static void check_can_chans(const CANChannelConfig *cfg, const size_t count)
+{
+        CPPUNIT_ASSERT_EQUAL(count, (size_t) cfg->enabled_mappings);
+        CPPUNIT_ASSERT_EQUAL(1, (int) cfg->enabled);
+
+        for (size_t i = 0; i < count; ++i) {
+                const CANMapping *mapping = &cfg->can_channels[i].mapping;
+                std::ostringstream name;
+                name << "Chan" << i;
+
+                CPPUNIT_ASSERT_EQUAL(name.str(),
+                                     string(mapping->channel_cfg.label));
+                CPPUNIT_ASSERT_EQUAL((int) (100 + i), (int) mapping->can_id);
+                CPPUNIT_ASSERT_EQUAL((int) (i % 8), (int) mapping->offset);
+        }
+}
+
+static void reset_can_chans(CANChannelConfig *cfg)
+{
+        memset(cfg, 0, sizeof(*cfg));
+}
+
+void LoggerApiTest::testSetCanChanCfgStreamed()
+{
+        CANChannelConfig *cfg = &getWorkingLoggerConfig()->can_channel_cfg;
+        const string msg = can_chans_message(0, CONFIG_CAN_MAPPINGS);
+
+        /* Far more tokens than fit, so the channels go a few at a time */
+        reset_can_chans(cfg);
+        string json = msg;
+        mock_resetTxBuffer();
+        process_api(getMockSerial(), (char *) json.c_str(), json.size());
+        assertGenericResponse(mock_getTxBuffer(), "setCanChanCfg",
+                              API_SUCCESS);
+        check_can_chans(cfg, CONFIG_CAN_MAPPINGS);
+
+        /* Read in through a buffer it doesn't fit in either */
+        CPPUNIT_ASSERT(msg.size() > BUFFER_SIZE);
+        reset_can_chans(cfg);
+        mock_setRxBuffer((msg + "\r\n").c_str());
+
+        char buffer[BUFFER_SIZE];
+        size_t count = 0;
+        for (size_t reads = 0;
+             !process_rx_buffer(getMockSerial(), buffer, &count); ++reads)
+                CPPUNIT_ASSERT(reads < 100);
+
+        mock_resetTxBuffer();
+        process_api(getMockSerial(), buffer, BUFFER_SIZE);
+        assertGenericResponse(mock_getTxBuffer(), "setCanChanCfg",
+                              API_SUCCESS);
+        check_can_chans(cfg, CONFIG_CAN_MAPPINGS);
+
+        /* A message from another device in between cuts it off */
+        reset_can_chans(cfg);
+        mock_setRxBuffer((msg + "\r\n").c_str());
+        count = 0;
+        CPPUNIT_ASSERT(!process_rx_buffer(getMockSerial(), buffer, &count));
+        CPPUNIT_ASSERT(api_streamed_elements() > 0);
+
+        struct Serial *other = serial_create("other", 256, 1, NULL, NULL,
+                                             NULL, NULL);
+        json = "{\"getVersion\":null}";
+        process_api(other, (char *) json.c_str(), json.size());
+        serial_destroy(other);
+
+        /* so the rest of it fails instead of starting over */
+        while (!process_rx_buffer(getMockSerial(), buffer, &count));
+        mock_resetTxBuffer();
+        CPPUNIT_ASSERT_EQUAL(API_ERROR_MALFORMED,
+                             process_api(getMockSerial(), buffer,
+                                         BUFFER_SIZE));
+        assertGenericResponse(mock_getTxBuffer(), "setCanChanCfg",
+                              API_ERROR_MALFORMED);
+        CPPUNIT_ASSERT_EQUAL(0, (int) cfg->enabled_mappings);
+
+        /* A channel the handler rejects ends the message */
+        reset_can_chans(cfg);
+        json = can_chans_message(1, CONFIG_CAN_MAPPINGS);
+        mock_resetTxBuffer();
+        process_api(getMockSerial(), (char *) json.c_str(), json.size());
+        assertGenericResponse(mock_getTxBuffer(), "setCanChanCfg",
+                              API_ERROR_PARAMETER);
+        CPPUNIT_ASSERT_EQUAL(0, (int) cfg->enabled_mappings);
+
+        /* and leaves none of the channels it did take behind */
+        json = can_chans_message(0, CONFIG_CAN_MAPPINGS + 1);
+        mock_resetTxBuffer();
+        process_api(getMockSerial(), (char *) json.c_str(), json.size());
+        assertGenericResponse(mock_getTxBuffer(), "setCanChanCfg",
+                              API_ERROR_PARAMETER);
+        CPPUNIT_ASSERT_EQUAL(0, (int) cfg->enabled_mappings);
+        CPPUNIT_ASSERT_EQUAL(0, (int) cfg->can_channels[0].mapping.can_id);
+        CPPUNIT_ASSERT_EQUAL(string(""),
+                             string(cfg->can_channels[0].mapping.channel_cfg.label));
+
+        /* An index after the chans comes too late to place them by */
+        json = msg;
+        process_api(getMockSerial(), (char *) json.c_str(), json.size());
+        check_can_chans(cfg, CONFIG_CAN_MAPPINGS);
+
+        json = can_chans_message(0, CONFIG_CAN_MAPPINGS - 1);
+        json.erase(json.find("\"index\":0,"), strlen("\"index\":0,"));
+        json.insert(json.find(",\"last\""), ",\"index\":1");
+        mock_resetTxBuffer();
+        process_api(getMockSerial(), (char *) json.c_str(), json.size());
+        assertGenericResponse(mock_getTxBuffer(), "setCanChanCfg",
+                              API_ERROR_PARAMETER);
+        check_can_chans(cfg, CONFIG_CAN_MAPPINGS);
+}
+
 void LoggerApiTest::testSetObd2Cfg()
 {
         testSetObd2ConfigFile("setObd2Cfg1.json");
@@ -1543,12 +1743,49 @@ void LoggerApiTest::testGetStatus()
         CPPUNIT_ASSERT_EQUAL((int)BT_STATUS_NOT_INIT,
                              (int)(Number)bt_obj["init"]);
 
+        struct obd2_stats obd2_stats;
+        OBD2_get_stats(&obd2_stats);
+        Object obd2_obj = json["status"]["OBD2"];
+        CPPUNIT_ASSERT_EQUAL((int)obd2_stats.pid_rate,
+                             (int)(Number)obd2_obj["pidRate"]);
+        CPPUNIT_ASSERT_EQUAL((int)obd2_stats.max_in_flight,
+                             (int)(Number)obd2_obj["maxInFlight"]);
+        CPPUNIT_ASSERT_EQUAL((size_t)obd2_stats.channels,
+                             ((Array)obd2_obj["latMs"]).Size());
+
 
         Object logging_obj = json["status"]["logging"];
         CPPUNIT_ASSERT_EQUAL((int)LOGGING_STATUS_IDLE,
                              (int)(Number)logging_obj["status"]);
         CPPUNIT_ASSERT_EQUAL(0, (int)(Number)logging_obj["started"]);
 
+        struct file_writer_stats fw_stats;
+        file_writer_get_stats(&fw_stats);
+        Object writer_obj = logging_obj["writer"];
+        CPPUNIT_ASSERT_EQUAL(fw_stats.queue_overflows,
+                             (uint32_t)(Number)writer_obj["qOvf"]);
+        CPPUNIT_ASSERT_EQUAL(fw_stats.buffer_stalls,
+                             (uint32_t)(Number)writer_obj["stalls"]);
+        CPPUNIT_ASSERT_EQUAL(fw_stats.dropped_bytes,
+                             (uint32_t)(Number)writer_obj["dropped"]);
+
+        struct sample_consumer_stats sc_stats;
+        sample_consumer_get_stats(SAMPLE_CONSUMER_FILE, &sc_stats);
+        Object file_samples_obj = json["status"]["samples"]["file"];
+        CPPUNIT_ASSERT_EQUAL(sc_stats.dropped,
+                             (uint32_t)(Number)file_samples_obj["drop"]);
+        CPPUNIT_ASSERT_EQUAL(sc_stats.held_high_water,
+                             (uint32_t)(Number)file_samples_obj["heldHw"]);
+        CPPUNIT_ASSERT_EQUAL(sc_stats.starved,
+                             (uint32_t)(Number)file_samples_obj["starved"]);
+
+        sample_consumer_get_stats(SAMPLE_CONSUMER_CELLULAR, &sc_stats);
+        Object cell_samples_obj = json["status"]["samples"]["cell"];
+        CPPUNIT_ASSERT_EQUAL(sc_stats.dropped,
+                             (uint32_t)(Number)cell_samples_obj["drop"]);
+        CPPUNIT_ASSERT_EQUAL(sc_stats.held,
+                             (uint32_t)(Number)cell_samples_obj["held"]);
+
 
         Object track_obj = json["status"]["track"];
         CPPUNIT_ASSERT_EQUAL((int)TRACK_STATUS_WAITING_TO_CONFIG,
@@ -1761,6 +1998,54 @@ void LoggerApiTest::testSetAutoLoggerCfg()
         assertGenericResponse(response, "setSdLogCtrlCfg", API_SUCCESS);
 }
 
+void LoggerApiTest::testGetLogFileCfgDefault()
+{
+        const char *response = processApiGeneric("get_logfile_cfg.json");
+
+        Object json;
+        stringToJson(response, json);
+
+        Object cfg = json["logFileCfg"];
+        CPPUNIT_ASSERT_EQUAL(DEFAULT_LOGFILE_WRITE_THRESHOLD,
+                             (int)(Number)cfg["wrThresh"]);
+        CPPUNIT_ASSERT_EQUAL(DEFAULT_LOGFILE_WRITE_LATENCY_MS,
+                             (int)(Number)cfg["wrLatMs"]);
+        CPPUNIT_ASSERT_EQUAL((int) LOGFILE_FORMAT_CSV,
+                             (int)(Number)cfg["fmt"]);
+        CPPUNIT_ASSERT_EQUAL(DEFAULT_LOGFILE_PREALLOC_MINUTES,
+                             (int)(Number)cfg["preMin"]);
+        CPPUNIT_ASSERT_EQUAL(false, (bool)(Boolean)cfg["comp"]);
+        CPPUNIT_ASSERT_EQUAL(false, (bool)(Boolean)cfg["jrnl"]);
+}
+
+void LoggerApiTest::testSetLogFileCfg()
+{
+        const LoggerConfig *lc = getWorkingLoggerConfig();
+        char *response = processApiGeneric("set_logfile_cfg.json");
+
+        const struct logfile_config* cfg = &lc->logging_cfg.logfile;
+        CPPUNIT_ASSERT_EQUAL((uint16_t) 1024, cfg->write_threshold);
+        CPPUNIT_ASSERT_EQUAL((uint16_t) 250, cfg->write_latency_ms);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) LOGFILE_FORMAT_RCB, cfg->format);
+        CPPUNIT_ASSERT_EQUAL((uint8_t) 30, cfg->prealloc_minutes);
+        CPPUNIT_ASSERT_EQUAL(true, cfg->compress);
+        CPPUNIT_ASSERT_EQUAL(true, cfg->journal);
+
+        assertGenericResponse(response, "setLogFileCfg", API_SUCCESS);
+}
+
+void LoggerApiTest::testSetLogFileCfgRange()
+{
+        const LoggerConfig *lc = getWorkingLoggerConfig();
+        char *response = processApiGeneric("set_logfile_cfg_range.json");
+
+        const struct logfile_config* cfg = &lc->logging_cfg.logfile;
+        CPPUNIT_ASSERT_EQUAL((uint16_t) 0, cfg->write_threshold);
+        CPPUNIT_ASSERT_EQUAL((uint16_t) UINT16_MAX, cfg->write_latency_ms);
+
+        assertGenericResponse(response, "setLogFileCfg", API_SUCCESS);
+}
+
 void LoggerApiTest::testGetCameraControlCfgDefault()
 {
         const char *response = processApiGeneric("get_camera_control_cfg.json");
@@ -1807,3 +2092,275 @@ void LoggerApiTest::testSetCameraControlCfg()
 
         assertGenericResponse(response, "setCamCtrlCfg", API_SUCCESS);
 }
+
+struct tx_capture {
+        string data;
+        /* Number of times the driver got kicked */
+        size_t writes;
+};
+
+static void capture_tx(xQueueHandle q, void *arg)
+{
+        struct tx_capture *cap = (struct tx_capture *) arg;
+        char c;
+
+        ++cap->writes;
+        while (xQueueReceive(q, &c, 0))
+                cap->data += c;
+}
+
+void LoggerApiTest::testJsonWriter()
+{
+        struct tx_capture cap;
+        cap.writes = 0;
+        struct Serial *serial = serial_create("jw", 256, 1, NULL, NULL,
+                                              capture_tx, &cap);
+        const string long_str(100, 'x');
+
+        struct json_writer jw;
+        json_writer_init(&jw, serial);
+        json_writer_obj_start(&jw, NULL);
+        json_writer_int(&jw, "i", -1);
+
+        /* Nothing goes out until the buffer fills up or gets flushed */
+        CPPUNIT_ASSERT(cap.data.empty());
+
+        json_writer_string(&jw, "s", "a\"b\n");
+        json_writer_string(&jw, "n", NULL);
+        json_writer_array_start(&jw, "a");
+        json_writer_float(&jw, NULL, 1.5, 1);
+        json_writer_array_start(&jw, NULL);
+        json_writer_array_end(&jw);
+        json_writer_obj_start(&jw, NULL);
+        json_writer_bool(&jw, "b", true);
+        json_writer_obj_end(&jw);
+        json_writer_array_end(&jw);
+        json_writer_raw(&jw, "r", "[1,2]", 5);
+        json_writer_string(&jw, "l", long_str.c_str());
+        json_writer_obj_end(&jw);
+        json_writer_flush(&jw);
+
+        CPPUNIT_ASSERT_EQUAL(string("{\"i\":-1,\"s\":\"a\\\"b\\n\",\"n\":null,"
+                                    "\"a\":[1.5,[],{\"b\":true}],"
+                                    "\"r\":[1,2],\"l\":\"") + long_str +
+                             "\"}", cap.data);
+        CPPUNIT_ASSERT(cap.writes < cap.data.size() / 20);
+
+        /* A fragment picks up commas within what the caller has open */
+        cap.data.clear();
+        json_writer_init(&jw, serial);
+        json_writer_uint(&jw, "a", 1);
+        json_writer_null(&jw, "b");
+        json_writer_flush(&jw);
+        CPPUNIT_ASSERT_EQUAL(string("\"a\":1,\"b\":null"), cap.data);
+
+        serial_destroy(serial);
+}
+
+/* getTrackDb of circuits as rendered by the unbuffered json_* helpers */
+static void unbuffered_geo_point(struct Serial *serial, const char *name,
+                                 const GeoPoint *point, int more)
+{
+        json_arrayStart(serial, name);
+        json_arrayElementFloat(serial, point->latitude,
+                               DEFAULT_GPS_POSITION_PRECISION, 1);
+        json_arrayElementFloat(serial, point->longitude,
+                               DEFAULT_GPS_POSITION_PRECISION, 0);
+        json_arrayEnd(serial, more);
+}
+
+static void unbuffered_track_db(struct Serial *serial, const Tracks *tracks)
+{
+        json_objStart(serial);
+        json_objStartString(serial, "trackDb");
+        json_int(serial, "size", tracks->count, 1);
+        json_int(serial, "max", MAX_TRACK_COUNT, 1);
+        json_arrayStart(serial, "tracks");
+        for (size_t t = 0; t < tracks->count; ++t) {
+                const Track *track = tracks->tracks + t;
+
+                json_objStart(serial);
+                json_int(serial, "id", track->trackId, 1);
+                json_int(serial, "type", track->track_type, 1);
+                unbuffered_geo_point(serial, "sf",
+                                     &track->circuit.startFinish, 1);
+                json_arrayStart(serial, "sec");
+                for (size_t i = 0; i < CIRCUIT_SECTOR_COUNT; ++i)
+                        unbuffered_geo_point(serial, NULL,
+                                             &track->circuit.sectors[i],
+                                             i < CIRCUIT_SECTOR_COUNT - 1);
+                json_arrayEnd(serial, 0);
+                json_objEnd(serial, t < tracks->count - 1);
+        }
+        json_arrayEnd(serial, 0);
+        json_objEnd(serial, 0);
+        json_objEnd(serial, 0);
+}
+
+static void enable_all_channels(LoggerConfig *lc)
+{
+        for (size_t i = 0; i < CONFIG_ADC_CHANNELS; ++i)
+                lc->ADCConfigs[i].cfg.sampleRate = SAMPLE_10Hz;
+        for (size_t i = 0; i < CONFIG_IMU_CHANNELS; ++i)
+                lc->ImuConfigs[i].cfg.sampleRate = SAMPLE_10Hz;
+        for (size_t i = 0; i < CONFIG_GPIO_CHANNELS; ++i)
+                lc->GPIOConfigs[i].cfg.sampleRate = SAMPLE_10Hz;
+        for (size_t i = 0; i < CONFIG_TIMER_CHANNELS; ++i)
+                lc->TimerConfigs[i].cfg.sampleRate = SAMPLE_10Hz;
+        for (size_t i = 0; i < CONFIG_PWM_CHANNELS; ++i)
+                lc->PWMConfigs[i].cfg.sampleRate = SAMPLE_10Hz;
+
+        lc->OBD2Configs.enabled = true;
+        lc->OBD2Configs.enabledPids = CONFIG_OBD2_CHANNELS;
+        for (size_t i = 0; i < CONFIG_OBD2_CHANNELS; ++i) {
+                ChannelConfig *cfg = &lc->OBD2Configs.pids[i].mapping.channel_cfg;
+                sprintf(cfg->label, "PID%zu", i);
+                cfg->sampleRate = SAMPLE_10Hz;
+        }
+
+        lc->can_channel_cfg.enabled = true;
+        lc->can_channel_cfg.enabled_mappings = CONFIG_CAN_MAPPINGS;
+        for (size_t i = 0; i < CONFIG_CAN_MAPPINGS; ++i) {
+                ChannelConfig *cfg =
+                        &lc->can_channel_cfg.can_channels[i].mapping.channel_cfg;
+                sprintf(cfg->label, "CAN%zu", i);
+                cfg->sampleRate = SAMPLE_10Hz;
+        }
+
+        configChanged();
+}
+
+/**
+ * Runs an API handler rounds times.
+ * @return Milliseconds per response.
+ */
+static double time_response(int (*func)(struct Serial *, const jsmntok_t *),
+                            struct Serial *serial, struct tx_capture *cap,
+                            const size_t rounds)
+{
+        const clock_t start = clock();
+        for (size_t r = 0; r < rounds; ++r) {
+                cap->data.clear();
+                cap->writes = 0;
+                func(serial, NULL);
+        }
+
+        return 1000.0 * (clock() - start) / CLOCKS_PER_SEC / rounds;
+}
+
+static int unbuffered_get_track_db(struct Serial *serial, const jsmntok_t *json)
+{
+        unbuffered_track_db(serial, get_tracks());
+        return API_SUCCESS_NO_RETURN;
+}
+
+void LoggerApiTest::testResponseBenchmark()
+{
+        const size_t rounds = 50;
+        struct tx_capture cap;
+        struct Serial *serial = serial_create("bench", 256, 1, NULL, NULL,
+                                              capture_tx, &cap);
+
+        /* Fill the track DB, keeping what was there to restore later */
+        Tracks *saved = (Tracks *) malloc(sizeof(Tracks));
+        memcpy(saved, get_tracks(), sizeof(Tracks));
+        Tracks *full = (Tracks *) calloc(1, sizeof(Tracks));
+        full->count = MAX_TRACK_COUNT;
+        for (size_t t = 0; t < MAX_TRACK_COUNT; ++t) {
+                Track *track = full->tracks + t;
+                track->trackId = t + 1;
+                track->track_type = TRACK_TYPE_CIRCUIT;
+                track->circuit.startFinish.latitude = 38.16 + t;
+                track->circuit.startFinish.longitude = -122.45 - t;
+                for (size_t i = 0; i < CIRCUIT_SECTOR_COUNT; ++i)
+                        track->circuit.sectors[i] =
+                                track->circuit.startFinish;
+        }
+        flash_tracks(full, sizeof(Tracks));
+
+        const double unbuffered_ms = time_response(unbuffered_get_track_db,
+                                                   serial, &cap, rounds);
+        const string expected = cap.data;
+        const size_t unbuffered_writes = cap.writes;
+
+        const double track_db_ms = time_response(api_getTrackDb, serial,
+                                                 &cap, rounds);
+        CPPUNIT_ASSERT_EQUAL(expected, cap.data);
+        CPPUNIT_ASSERT(cap.writes < unbuffered_writes / 10);
+        printf("\ngetTrackDb: %d tracks, %zu bytes, "
+               "%.3f ms with %zu writes buffered, "
+               "%.3f ms with %zu writes unbuffered\n",
+               MAX_TRACK_COUNT, cap.data.size(), track_db_ms, cap.writes,
+               unbuffered_ms, unbuffered_writes);
+
+        LoggerConfig *lc = getWorkingLoggerConfig();
+        enable_all_channels(lc);
+        const double meta_ms = time_response(api_getMeta, serial, &cap,
+                                             rounds);
+        printf("getMeta: %zu channels, %zu bytes, %.3f ms with %zu writes\n",
+               get_enabled_channel_count(lc), cap.data.size(), meta_ms,
+               cap.writes);
+
+        flash_tracks(saved, sizeof(Tracks));
+        free(full);
+        free(saved);
+        serial_destroy(serial);
+}
+
+static const api_t test_apis[] = {API_METHODS NULL_API};
+
+/* How dispatch used to find a command */
+static const api_t* find_api_linear(const char *name)
+{
+        for (const api_t *api = test_apis; api->cmd; ++api)
+                if (0 == strcmp(api->cmd, name))
+                        return api;
+
+        return NULL;
+}
+
+void LoggerApiTest::testFindApi()
+{
+        for (const api_t *api = test_apis; api->cmd; ++api) {
+                const api_t *found = find_api(api->cmd);
+                CPPUNIT_ASSERT(found);
+                CPPUNIT_ASSERT_EQUAL(string(api->cmd), string(found->cmd));
+                CPPUNIT_ASSERT(api->func == found->func);
+        }
+
+        CPPUNIT_ASSERT(!find_api(""));
+        CPPUNIT_ASSERT(!find_api("getMet"));
+        CPPUNIT_ASSERT(!find_api("getMetaX"));
+        CPPUNIT_ASSERT(!find_api(unknown_api_key()));
+}
+
+/**
+ * @return Nanoseconds per lookup of every command name.
+ */
+static double lookup_ns(const api_t* (*find)(const char *))
+{
+        const size_t rounds = 20000;
+        size_t lookups = 0;
+        size_t found = 0;
+
+        const clock_t start = clock();
+        for (size_t r = 0; r < rounds; ++r) {
+                for (const api_t *api = test_apis; api->cmd; ++api) {
+                        found += NULL != find(api->cmd);
+                        ++lookups;
+                }
+        }
+
+        const double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+        CPPUNIT_ASSERT_EQUAL(lookups, found);
+        return 1e9 * secs / lookups;
+}
+
+void LoggerApiTest::testFindApiBenchmark()
+{
+        const double hashed = lookup_ns(find_api);
+        const double linear = lookup_ns(find_api_linear);
+
+        printf("\nfind_api: %zu commands, %.1f ns hashed, %.1f ns linear\n",
+               ARRAY_LEN(test_apis) - 1, hashed, linear);
+}
@@ -44,6 +44,7 @@ class LoggerApiTest : public CppUnit::TestFixture
         CPPUNIT_TEST( testGetAnalogCfg );
         CPPUNIT_TEST( testGetMultipleAnalogCfg );
         CPPUNIT_TEST( testSetAnalogCfg );
+        CPPUNIT_TEST( testSetMultipleAnalogCfg );
         CPPUNIT_TEST( testGetImuCfg );
         CPPUNIT_TEST( testSetImuCfg );
         CPPUNIT_TEST( testGetPwmCfg );
@@ -64,6 +65,7 @@ class LoggerApiTest : public CppUnit::TestFixture
         CPPUNIT_TEST( testSampleData2 );
         CPPUNIT_TEST( testHeartBeat );
         CPPUNIT_TEST( testGetMeta );
+        CPPUNIT_TEST( testGetMetaCached );
         CPPUNIT_TEST( testLogStartStop );
         CPPUNIT_TEST( testCalibrateImu);
         CPPUNIT_TEST( testFlashConfig);
@@ -74,6 +76,7 @@ class LoggerApiTest : public CppUnit::TestFixture
         CPPUNIT_TEST( testGetObd2Cfg);
         CPPUNIT_TEST( testGetCanChanCfg);
         CPPUNIT_TEST( testSetCanChanCfg);
+        CPPUNIT_TEST( testSetCanChanCfgStreamed );
         CPPUNIT_TEST( testGetScript);
         CPPUNIT_TEST( testSetScript);
         CPPUNIT_TEST( testRunScript);
@@ -92,8 +95,15 @@ class LoggerApiTest : public CppUnit::TestFixture
         CPPUNIT_TEST( setActiveTrackRadiusDegrees );
         CPPUNIT_TEST( testGetAutoLoggerCfgDefault );
         CPPUNIT_TEST( testSetAutoLoggerCfg );
+        CPPUNIT_TEST( testGetLogFileCfgDefault );
+        CPPUNIT_TEST( testSetLogFileCfg );
+        CPPUNIT_TEST( testSetLogFileCfgRange );
         CPPUNIT_TEST( testGetCameraControlCfgDefault );
         CPPUNIT_TEST( testSetCameraControlCfg );
+        CPPUNIT_TEST( testJsonWriter );
+        CPPUNIT_TEST( testResponseBenchmark );
+        CPPUNIT_TEST( testFindApi );
+        CPPUNIT_TEST( testFindApiBenchmark );
 
         CPPUNIT_TEST_SUITE_END();
 
@@ -117,12 +127,18 @@ public:
         void testSampleData2();
         void testHeartBeat();
         void testGetMeta();
+        void testGetMetaCached();
+        void testJsonWriter();
+        void testResponseBenchmark();
+        void testFindApi();
+        void testFindApiBenchmark();
         void testLogStartStop();
         void testSetConnectivityCfg();
         void testGetConnectivityCfg();
         void testGetAnalogCfg();
         void testGetMultipleAnalogCfg();
         void testSetAnalogCfg();
+        void testSetMultipleAnalogCfg();
         void testGetImuCfg();
         void testSetImuCfg();
         void testGetPwmCfg();
@@ -146,6 +162,7 @@ public:
         void testSetCanCfg();
         void testGetCanChanCfg();
         void testSetCanChanCfg();
+        void testSetCanChanCfgStreamed();
         void testSetObd2Cfg();
         void testSetObd2ConfigFile_fromIndex();
         void testSetObd2ConfigFile_invalid();
@@ -163,6 +180,9 @@ public:
         void testSetGetWifiCfg();
         void testGetAutoLoggerCfgDefault();
         void testSetAutoLoggerCfg();
+        void testGetLogFileCfgDefault();
+        void testSetLogFileCfg();
+        void testSetLogFileCfgRange();
         void testGetCameraControlCfgDefault();
         void testSetCameraControlCfg();
 
@@ -20,30 +20,106 @@
 
 #include "loggerFileWriterTest.hh"
 #include "FreeRTOS.h"
+#include "ff_testing.h"
 #include "fileWriter.h"
 #include "fileWriter_testing.h"
+#include "log_compress.h"
+#include "log_fixture.h"
+#include "log_format.h"
+#include "log_journal.h"
+#include "loggerConfig.h"
+#include "sdcard.h"
 #include <string.h>
 #include "task.h"
 #include "task_testing.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <string>
 
 // Registers the fixture into the 'registry'
 CPPUNIT_TEST_SUITE_REGISTRATION( LoggerFileWriterTest );
 
+#define TEST_CHANNEL_COUNT	4
+/* Enough channels for a row wider than 4 KB */
+#define WIDE_CHANNEL_COUNT	600
+
 struct logging_status _ls;
 struct logging_status *ls;
 
+static ChannelConfig test_channel_cfgs[TEST_CHANNEL_COUNT];
+static ChannelSample test_channel_samples[TEST_CHANNEL_COUNT];
+static ChannelConfig wide_channel_cfgs[WIDE_CHANNEL_COUNT];
+static ChannelSample wide_channel_samples[WIDE_CHANNEL_COUNT];
+static struct sample test_sample;
+static struct logfile_config saved_logfile_cfg;
+
 void LoggerFileWriterTest::setUp()
 {
         _ls = (struct logging_status) {
                 0
         };
         ls = &_ls;
+
+        saved_logfile_cfg = getWorkingLoggerConfig()->logging_cfg.logfile;
+        init_file_buffers();
+
+        /* Start every test with a freshly mounted, empty card */
+        ff_testing_reset();
+        InitFS();
+        reset_ticks();
+
+        for (size_t i = 0; i < TEST_CHANNEL_COUNT; ++i) {
+                ChannelConfig *cfg = test_channel_cfgs + i;
+                memset(cfg, 0, sizeof(ChannelConfig));
+                snprintf(cfg->label, sizeof(cfg->label), "Chan%d", (int) i);
+                strcpy(cfg->units, "Unit");
+                cfg->max = 1000;
+                cfg->precision = 2;
+                cfg->sampleRate = SAMPLE_100Hz;
+
+                ChannelSample *cs = test_channel_samples + i;
+                memset(cs, 0, sizeof(ChannelSample));
+                cs->cfg = cfg;
+                cs->populated = true;
+                cs->sampleData = SampleData_Float_Noarg;
+                cs->valueFloat = 123.45 * i;
+        }
+
+        test_sample.channel_count = TEST_CHANNEL_COUNT;
+        test_sample.channel_samples = test_channel_samples;
 }
 
-void LoggerFileWriterTest::tearDown() {}
+void LoggerFileWriterTest::tearDown()
+{
+        file_io_async = false;
+        while (drain_next_file_buffer(0));
+
+        logging_stop(ls);
+        getWorkingLoggerConfig()->logging_cfg.logfile = saved_logfile_cfg;
+}
+
+void LoggerFileWriterTest::startLogging(const uint16_t threshold,
+                                        const uint16_t latency_ms,
+                                        const uint8_t format,
+                                        const uint8_t prealloc_minutes)
+{
+        struct logfile_config *cfg =
+                &getWorkingLoggerConfig()->logging_cfg.logfile;
+        cfg->write_threshold = threshold;
+        cfg->write_latency_ms = latency_ms;
+        cfg->format = format;
+        cfg->prealloc_minutes = prealloc_minutes;
+        logging_start(ls);
+}
+
+int LoggerFileWriterTest::logRow(const size_t tick)
+{
+        test_sample.ticks = tick;
+        LoggerMessage msg = create_logger_message(LoggerMessageType_Sample,
+                                                  tick, &test_sample, false);
+        return logging_sample(ls, &msg);
+}
 
 void LoggerFileWriterTest::testFlushLogfile()
 {
@@ -94,6 +170,569 @@ void LoggerFileWriterTest::testLoggingSampleSkip()
         CPPUNIT_ASSERT_EQUAL(0, rc);
 }
 
-/*
- * TODO: Build in tests for file open and close methods.
+void LoggerFileWriterTest::testWriteEveryRowUncoalesced()
+{
+        startLogging(0, 0);
+
+        for (size_t tick = 1; tick <= 10; ++tick) {
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+                CPPUNIT_ASSERT_EQUAL((unsigned int) tick,
+                                     ff_testing_write_calls());
+        }
+}
+
+void LoggerFileWriterTest::testCoalescedWritesSectorAligned()
+{
+        startLogging(SD_SECTOR_SIZE, 60000);
+
+        const size_t rows = 200;
+        for (size_t tick = 1; tick <= rows; ++tick) {
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+                CPPUNIT_ASSERT_EQUAL((size_t) 0, ff_testing_bytes_written() %
+                                     SD_SECTOR_SIZE);
+        }
+
+        const unsigned int writes = ff_testing_write_calls();
+        CPPUNIT_ASSERT(writes > 0);
+        CPPUNIT_ASSERT(writes < rows / 4);
+
+        /* Stopping must write out the partial sector that remains */
+        const size_t aligned_bytes = ff_testing_bytes_written();
+        logging_stop(ls);
+        CPPUNIT_ASSERT(ff_testing_bytes_written() > aligned_bytes);
+
+        const std::string data(ff_testing_written_data(),
+                               ff_testing_bytes_written());
+        CPPUNIT_ASSERT_EQUAL(0, (int) data.find("\"Chan0\"|\"Unit\""));
+        CPPUNIT_ASSERT_EQUAL((size_t) rows + 1,
+                             (size_t) std::count(data.begin(), data.end(), '\n'));
+        CPPUNIT_ASSERT_EQUAL('\n', data[data.size() - 1]);
+}
+
+void LoggerFileWriterTest::testCoalescedWriteLatencyDeadline()
+{
+        const uint16_t latency_ms = 100;
+        startLogging(2 * SD_SECTOR_SIZE, latency_ms);
+
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        CPPUNIT_ASSERT_EQUAL((unsigned int) 0, ff_testing_write_calls());
+
+        set_ticks(latency_ms / portTICK_RATE_MS - 1);
+        CPPUNIT_ASSERT_EQUAL(FR_OK, commit_file_buffer(ls));
+        CPPUNIT_ASSERT_EQUAL((unsigned int) 0, ff_testing_write_calls());
+
+        set_ticks(latency_ms / portTICK_RATE_MS);
+        CPPUNIT_ASSERT_EQUAL(FR_OK, commit_file_buffer(ls));
+        CPPUNIT_ASSERT(ff_testing_write_calls() > 0);
+
+        /* Nothing left to write, so no more writes should happen */
+        const unsigned int writes = ff_testing_write_calls();
+        CPPUNIT_ASSERT_EQUAL(FR_OK, commit_file_buffer(ls));
+        CPPUNIT_ASSERT_EQUAL(writes, ff_testing_write_calls());
+}
+
+void LoggerFileWriterTest::testSanitizeConfig()
+{
+        struct logfile_config cfg;
+
+        cfg.write_threshold = 1000;
+        logfile_sanitize_config(&cfg);
+        CPPUNIT_ASSERT_EQUAL((uint16_t) 512, cfg.write_threshold);
+
+        cfg.write_threshold = 100;
+        logfile_sanitize_config(&cfg);
+        CPPUNIT_ASSERT_EQUAL((uint16_t) 0, cfg.write_threshold);
+
+        cfg.write_threshold = 60000;
+        logfile_sanitize_config(&cfg);
+        CPPUNIT_ASSERT(cfg.write_threshold <= 60000);
+        CPPUNIT_ASSERT_EQUAL(0, cfg.write_threshold % SD_SECTOR_SIZE);
+}
+
+void LoggerFileWriterTest::testRcbFormatMatchesCsv()
+{
+        const size_t rows = 50;
+
+        startLogging(SD_SECTOR_SIZE, 60000, LOGFILE_FORMAT_CSV);
+        for (size_t tick = 1; tick <= rows; ++tick) {
+                test_channel_samples[tick % TEST_CHANNEL_COUNT].populated =
+                        false;
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+                test_channel_samples[tick % TEST_CHANNEL_COUNT].populated =
+                        true;
+        }
+        logging_stop(ls);
+        const std::string csv(ff_testing_written_data(),
+                              ff_testing_bytes_written());
+
+        ff_testing_reset();
+        InitFS();
+        startLogging(SD_SECTOR_SIZE, 60000, LOGFILE_FORMAT_RCB);
+        CPPUNIT_ASSERT_EQUAL(LOGFILE_FORMAT_RCB, (int) ls->cfg.format);
+        for (size_t tick = 1; tick <= rows; ++tick) {
+                test_channel_samples[tick % TEST_CHANNEL_COUNT].populated =
+                        false;
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+                test_channel_samples[tick % TEST_CHANNEL_COUNT].populated =
+                        true;
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string("rc_0.rcb"), std::string(ls->name));
+        logging_stop(ls);
+
+        std::string decoded;
+        const struct log_format_writer w = LogFixture::string_writer(&decoded);
+        CPPUNIT_ASSERT_EQUAL((int) rows,
+                             log_format_rcb_to_csv(ff_testing_written_data(),
+                                                   ff_testing_bytes_written(),
+                                                   &w));
+        CPPUNIT_ASSERT(csv == decoded);
+}
+
+void LoggerFileWriterTest::testAsyncBufferHandoff()
+{
+        file_io_async = true;
+        startLogging(SD_SECTOR_SIZE, 60000);
+
+        /* Fill the first buffer.  It should be handed off, not written */
+        size_t tick = 1;
+        while (ff_testing_write_calls() == 0 &&
+               !drain_next_file_buffer(0)) {
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick++));
+                CPPUNIT_ASSERT_EQUAL((unsigned int) 0,
+                                     ff_testing_write_calls());
+        }
+
+        /* The I/O side wrote exactly one sector sized buffer */
+        CPPUNIT_ASSERT_EQUAL((unsigned int) 1, ff_testing_write_calls());
+        CPPUNIT_ASSERT_EQUAL((size_t) SD_SECTOR_SIZE,
+                             ff_testing_bytes_written());
+        CPPUNIT_ASSERT(!drain_next_file_buffer(0));
+
+        /* Formatting kept going into the other buffer meanwhile */
+        CPPUNIT_ASSERT_EQUAL(0, logRow(tick++));
+        CPPUNIT_ASSERT_EQUAL((unsigned int) 1, ff_testing_write_calls());
+
+        struct file_writer_stats stats;
+        file_writer_get_stats(&stats);
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0, stats.buffer_stalls);
+
+        /* Let the I/O side write the last partial buffer on stop */
+        set_ticks(60000 / portTICK_RATE_MS);
+        CPPUNIT_ASSERT_EQUAL(FR_OK, commit_file_buffer(ls));
+        CPPUNIT_ASSERT(drain_next_file_buffer(0));
+        CPPUNIT_ASSERT(ff_testing_bytes_written() > SD_SECTOR_SIZE);
+}
+
+void LoggerFileWriterTest::testPreallocSize()
+{
+        LoggerConfig *lc = getWorkingLoggerConfig();
+        struct logfile_config cfg = { 0 };
+
+        cfg.prealloc_minutes = 0;
+        CPPUNIT_ASSERT_EQUAL((DWORD) 0, get_prealloc_size(&cfg, lc));
+
+        cfg.prealloc_minutes = 1;
+        const DWORD csv_size = get_prealloc_size(&cfg, lc);
+        CPPUNIT_ASSERT(csv_size > 0);
+        CPPUNIT_ASSERT_EQUAL((DWORD) 0, csv_size % SD_SECTOR_SIZE);
+
+        cfg.format = LOGFILE_FORMAT_RCB;
+        CPPUNIT_ASSERT(get_prealloc_size(&cfg, lc) < csv_size);
+
+        /* Really long periods are capped */
+        cfg.format = LOGFILE_FORMAT_CSV;
+        cfg.prealloc_minutes = 255;
+        const DWORD max_size = get_prealloc_size(&cfg, lc);
+        CPPUNIT_ASSERT(max_size > csv_size);
+        CPPUNIT_ASSERT(max_size <= 64UL * 1024 * 1024);
+}
+
+void LoggerFileWriterTest::testPreallocateAndTruncate()
+{
+        /* Only journaled files know where their data ends */
+        startLogging(SD_SECTOR_SIZE, 60000, LOGFILE_FORMAT_CSV, 1);
+        CPPUNIT_ASSERT_EQUAL((DWORD) 0, ls->prealloc_size);
+        logging_stop(ls);
+        ff_testing_reset();
+        InitFS();
+
+        getWorkingLoggerConfig()->logging_cfg.logfile.journal = true;
+        startLogging(SD_SECTOR_SIZE, 60000, LOGFILE_FORMAT_CSV, 1);
+        CPPUNIT_ASSERT(ls->prealloc_size > 0);
+
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        CPPUNIT_ASSERT_EQUAL((size_t) ls->prealloc_size,
+                             ff_testing_file_size());
+
+        for (size_t tick = 2; tick <= 100; ++tick)
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+
+        /* Writing into the extent must not grow the file */
+        CPPUNIT_ASSERT(ff_testing_bytes_written() < ls->prealloc_size);
+        CPPUNIT_ASSERT_EQUAL((size_t) ls->prealloc_size,
+                             ff_testing_file_size());
+
+        /* The unused part of the extent is given back on stop */
+        logging_stop(ls);
+        CPPUNIT_ASSERT_EQUAL(ff_testing_bytes_written(),
+                             ff_testing_file_size());
+}
+
+void LoggerFileWriterTest::testPreallocateCardFull()
+{
+        /* The card fills up part way through growing the file */
+        ff_testing_set_disk_size(100000);
+        getWorkingLoggerConfig()->logging_cfg.logfile.journal = true;
+        startLogging(SD_SECTOR_SIZE, 60000, LOGFILE_FORMAT_CSV, 1);
+        CPPUNIT_ASSERT(ls->prealloc_size > 100000);
+
+        /* The file is treated as full and just grows as rows are written */
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        CPPUNIT_ASSERT_EQUAL((DWORD) 0, ls->prealloc_size);
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, ff_testing_file_size());
+
+        for (size_t tick = 2; tick <= 100; ++tick)
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+
+        logging_stop(ls);
+        CPPUNIT_ASSERT_EQUAL(ff_testing_bytes_written(),
+                             ff_testing_file_size());
+}
+
+void LoggerFileWriterTest::testLogFileIndex()
+{
+        CPPUNIT_ASSERT_EQUAL(0, get_log_file_index("rc_0.log"));
+        CPPUNIT_ASSERT_EQUAL(123, get_log_file_index("RC_123.LOG"));
+        CPPUNIT_ASSERT_EQUAL(99999, get_log_file_index("rc_99999.rcb"));
+        CPPUNIT_ASSERT_EQUAL(7, get_log_file_index("rc_7.rcs"));
+        CPPUNIT_ASSERT_EQUAL(-1, get_log_file_index("rc_.log"));
+        CPPUNIT_ASSERT_EQUAL(-1, get_log_file_index("rc_12.txt"));
+        CPPUNIT_ASSERT_EQUAL(-1, get_log_file_index("rc_12"));
+        CPPUNIT_ASSERT_EQUAL(-1, get_log_file_index("foo_1.log"));
+        CPPUNIT_ASSERT_EQUAL(-1, get_log_file_index("rc_1a.log"));
+}
+
+void LoggerFileWriterTest::testNewLogFileOpenIsConstant()
+{
+        const int sessions = 5000;
+        char name[FILENAME_LEN];
+
+        for (int i = 0; i < sessions; ++i) {
+                snprintf(name, sizeof(name), "rc_%d.log", i);
+                CPPUNIT_ASSERT(ff_testing_add_file(name));
+        }
+        ff_testing_add_file("notes.txt");
+
+        /* Directory is scanned once and the first name we try is free */
+        unsigned int opens = ff_testing_open_calls();
+        startLogging(0, 0);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        CPPUNIT_ASSERT_EQUAL(std::string("rc_5000.log"),
+                             std::string(ls->name));
+        CPPUNIT_ASSERT_EQUAL(opens + 1, ff_testing_open_calls());
+        logging_stop(ls);
+
+        /* The next session uses the cached index without a scan */
+        opens = ff_testing_open_calls();
+        startLogging(0, 0, LOGFILE_FORMAT_RCB);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(2));
+        CPPUNIT_ASSERT_EQUAL(std::string("rc_5001.rcb"),
+                             std::string(ls->name));
+        CPPUNIT_ASSERT_EQUAL(opens + 1, ff_testing_open_calls());
+        logging_stop(ls);
+
+        /* A file we didn't know about just costs one extra probe */
+        ff_testing_add_file("rc_5002.log");
+        opens = ff_testing_open_calls();
+        startLogging(0, 0);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(3));
+        CPPUNIT_ASSERT_EQUAL(std::string("rc_5003.log"),
+                             std::string(ls->name));
+        CPPUNIT_ASSERT_EQUAL(opens + 2, ff_testing_open_calls());
+}
+
+void LoggerFileWriterTest::testLogFileIndexWraps()
+{
+        ff_testing_add_file("rc_0.log");
+        ff_testing_add_file("rc_99998.log");
+
+        /* No names left past the last file, so reuse a free one */
+        startLogging(0, 0);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        CPPUNIT_ASSERT_EQUAL(std::string("rc_1.log"), std::string(ls->name));
+        logging_stop(ls);
+
+        startLogging(0, 0);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(2));
+        CPPUNIT_ASSERT_EQUAL(std::string("rc_2.log"), std::string(ls->name));
+}
+
+void LoggerFileWriterTest::testSparseCsvFormat()
+{
+        startLogging(0, 0, LOGFILE_FORMAT_CSV_SPARSE);
+
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        test_channel_samples[0].populated = false;
+        test_channel_samples[1].populated = false;
+        CPPUNIT_ASSERT_EQUAL(0, logRow(2));
+        CPPUNIT_ASSERT_EQUAL(std::string("rc_0.rcs"), std::string(ls->name));
+        logging_stop(ls);
+
+        /* Same header as a regular CSV log, then just the populated data */
+        const std::string data(ff_testing_written_data(),
+                               ff_testing_bytes_written());
+        CPPUNIT_ASSERT_EQUAL(0, (int) data.find("\"Chan0\"|\"Unit\""));
+        const std::string rows = "\n0=0.0,123.45,246.9,370.35\n"
+                "2=246.9,370.35\n";
+        CPPUNIT_ASSERT_EQUAL(rows, data.substr(data.size() - rows.size()));
+}
+
+void LoggerFileWriterTest::testCompressedLog()
+{
+        const size_t rows = 200;
+
+        startLogging(SD_SECTOR_SIZE, 60000);
+        for (size_t tick = 1; tick <= rows; ++tick)
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+        logging_stop(ls);
+        const std::string csv(ff_testing_written_data(),
+                              ff_testing_bytes_written());
+
+        ff_testing_reset();
+        InitFS();
+        getWorkingLoggerConfig()->logging_cfg.logfile.compress = true;
+        startLogging(SD_SECTOR_SIZE, 60000);
+        for (size_t tick = 1; tick <= rows; ++tick)
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+        CPPUNIT_ASSERT_EQUAL(std::string("rc_0.rcz"), std::string(ls->name));
+        logging_stop(ls);
+
+        /* One block per buffer handed off, and a lot smaller */
+        const std::string compressed(ff_testing_written_data(),
+                                     ff_testing_bytes_written());
+        CPPUNIT_ASSERT(compressed.size() < csv.size() / 2);
+
+        std::string decoded;
+        const struct log_format_writer w = LogFixture::string_writer(&decoded);
+        CPPUNIT_ASSERT_EQUAL((int) ff_testing_write_calls(),
+                             log_decompress(compressed.data(),
+                                            compressed.size(), &w));
+        CPPUNIT_ASSERT(csv == decoded);
+}
+
+/**
+ * @return The log with every journal checkpoint line taken out.
  */
+static std::string strip_checkpoints(const std::string &log)
+{
+        std::string out;
+        size_t pos = 0;
+        size_t ck;
+
+        while (std::string::npos != (ck = log.find(LOG_JOURNAL_MAGIC, pos))) {
+                out.append(log, pos, ck - pos);
+                pos = ck + LOG_JOURNAL_CHECKPOINT_LEN;
+        }
+
+        return out + log.substr(std::min(pos, log.size()));
+}
+
+void LoggerFileWriterTest::testJournalCheckpoints()
+{
+        const size_t rows = 200;
+
+        startLogging(SD_SECTOR_SIZE, 60000);
+        for (size_t tick = 1; tick <= rows; ++tick)
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+        logging_stop(ls);
+        const std::string csv(ff_testing_written_data(),
+                              ff_testing_bytes_written());
+
+        ff_testing_reset();
+        InitFS();
+        getWorkingLoggerConfig()->logging_cfg.logfile.journal = true;
+        startLogging(SD_SECTOR_SIZE, 60000);
+        for (size_t tick = 1; tick <= rows; ++tick)
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+        logging_stop(ls);
+
+        /* Same rows with checkpoints on lines of their own in between */
+        const std::string log(ff_testing_written_data(),
+                              ff_testing_bytes_written());
+        CPPUNIT_ASSERT(csv == strip_checkpoints(log));
+        CPPUNIT_ASSERT(log.size() - csv.size() >
+                       csv.size() / 1024 * LOG_JOURNAL_CHECKPOINT_LEN);
+        CPPUNIT_ASSERT(std::string::npos == log.find("\r\n\r\n"));
+
+        /* Stopping leaves the log ending on a good checkpoint */
+        struct log_journal_checkpoint cp;
+        CPPUNIT_ASSERT(log_journal_parse(log.data() + log.size() -
+                                         LOG_JOURNAL_CHECKPOINT_LEN,
+                                         LOG_JOURNAL_CHECKPOINT_LEN, &cp));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) rows + 1, cp.rows);
+        CPPUNIT_ASSERT_EQUAL((long) log.size(),
+                             log_journal_find_last(log.data(), log.size(),
+                                                   cp.id));
+
+        /* Binary logs with checkpoints still convert */
+        ff_testing_reset();
+        InitFS();
+        startLogging(SD_SECTOR_SIZE, 60000, LOGFILE_FORMAT_RCB);
+        for (size_t tick = 1; tick <= rows; ++tick)
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+        logging_stop(ls);
+
+        std::string converted;
+        const struct log_format_writer w =
+                LogFixture::string_writer(&converted);
+        CPPUNIT_ASSERT_EQUAL((int) rows,
+                             log_format_rcb_to_csv(ff_testing_written_data(),
+                                                   ff_testing_bytes_written(),
+                                                   &w));
+        CPPUNIT_ASSERT(csv == converted);
+
+        /* Compressed logs can't carry checkpoints */
+        logging_stop(ls);
+        getWorkingLoggerConfig()->logging_cfg.logfile.compress = true;
+        startLogging(SD_SECTOR_SIZE, 60000);
+        CPPUNIT_ASSERT(!ls->cfg.journal);
+}
+
+void LoggerFileWriterTest::testJournalRecovery()
+{
+        getWorkingLoggerConfig()->logging_cfg.logfile.journal = true;
+        startLogging(SD_SECTOR_SIZE, 60000);
+        for (size_t tick = 1; tick <= 300; ++tick)
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+        logging_stop(ls);
+        const std::string log(ff_testing_written_data(),
+                              ff_testing_bytes_written());
+
+        /*
+         * Power is lost part way through a row.  The rest of the
+         * pre-allocated space holds whatever was on the card before,
+         * including checkpoints from some long gone file.
+         */
+        const size_t cut = log.size() * 2 / 3;
+        std::string junk(8000, '\0');
+        junk.replace(1000, log.size() / 2, log.substr(0, log.size() / 2));
+        std::string crashed = log.substr(0, cut) + junk;
+        for (size_t pos = cut; std::string::npos !=
+                     (pos = crashed.find(LOG_JOURNAL_MAGIC, pos)); ++pos) {
+                char *id = &crashed[pos + LOG_JOURNAL_MAGIC_LEN];
+                *id = 'f' == *id ? 'e' : 'f';
+        }
+
+        const size_t good = log.rfind(LOG_JOURNAL_MAGIC,
+                                      cut - LOG_JOURNAL_CHECKPOINT_LEN) +
+                LOG_JOURNAL_CHECKPOINT_LEN;
+        CPPUNIT_ASSERT(good < cut);
+
+        /*
+         * Recovery happens on the first new file after the card mounts.
+         * It looks back as far as the pre-allocation could have reached.
+         */
+        ff_testing_reset();
+        CPPUNIT_ASSERT(ff_testing_set_file_data("rc_0.log", crashed.data(),
+                                                crashed.size()));
+        InitFS();
+        startLogging(SD_SECTOR_SIZE, 60000, LOGFILE_FORMAT_CSV, 1);
+        CPPUNIT_ASSERT(ls->prealloc_size > junk.size());
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        CPPUNIT_ASSERT_EQUAL(std::string("rc_1.log"), std::string(ls->name));
+        CPPUNIT_ASSERT_EQUAL(good, ff_testing_file_data_len());
+
+        /* Nothing more to do once it ends on a good checkpoint */
+        logging_stop(ls);
+        ff_testing_reset();
+        CPPUNIT_ASSERT(ff_testing_set_file_data("rc_0.log", crashed.data(),
+                                                good));
+        InitFS();
+        startLogging(SD_SECTOR_SIZE, 60000);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        CPPUNIT_ASSERT_EQUAL(good, ff_testing_file_data_len());
+
+        /* Logs without checkpoints are left alone */
+        logging_stop(ls);
+        ff_testing_reset();
+        const std::string plain = strip_checkpoints(crashed);
+        CPPUNIT_ASSERT(ff_testing_set_file_data("rc_0.log", plain.data(),
+                                                plain.size()));
+        InitFS();
+        startLogging(SD_SECTOR_SIZE, 60000);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        CPPUNIT_ASSERT_EQUAL(plain.size(), ff_testing_file_data_len());
+}
+
+void LoggerFileWriterTest::testJournalRecoveryWideRows()
+{
+        for (size_t i = 0; i < WIDE_CHANNEL_COUNT; ++i) {
+                wide_channel_cfgs[i] = test_channel_cfgs[0];
+                snprintf(wide_channel_cfgs[i].label,
+                         sizeof(wide_channel_cfgs[i].label), "W%d",
+                         (int) i);
+                wide_channel_cfgs[i].units[0] = '\0';
+                wide_channel_samples[i] = test_channel_samples[1];
+                wide_channel_samples[i].cfg = wide_channel_cfgs + i;
+        }
+        test_sample.channel_count = WIDE_CHANNEL_COUNT;
+        test_sample.channel_samples = wide_channel_samples;
+
+        getWorkingLoggerConfig()->logging_cfg.logfile.journal = true;
+        startLogging(SD_SECTOR_SIZE, 60000);
+        for (size_t tick = 1; tick <= 8; ++tick)
+                CPPUNIT_ASSERT_EQUAL(0, logRow(tick));
+        logging_stop(ls);
+        const std::string log(ff_testing_written_data(),
+                              ff_testing_bytes_written());
+
+        /* Power is lost part way through the last row */
+        const size_t cut = log.size() - 1000;
+        const std::string crashed = log.substr(0, cut) +
+                std::string(3000, '\0');
+        const size_t good = log.rfind(LOG_JOURNAL_MAGIC,
+                                      cut - LOG_JOURNAL_CHECKPOINT_LEN) +
+                LOG_JOURNAL_CHECKPOINT_LEN;
+
+        /* Blocks are wider than recovery reads the file at a time */
+        const size_t prev = log.rfind(LOG_JOURNAL_MAGIC,
+                                      good - LOG_JOURNAL_CHECKPOINT_LEN - 1) +
+                LOG_JOURNAL_CHECKPOINT_LEN;
+        CPPUNIT_ASSERT(good - prev - LOG_JOURNAL_CHECKPOINT_LEN > 4096);
+
+        ff_testing_reset();
+        CPPUNIT_ASSERT(ff_testing_set_file_data("rc_0.log", crashed.data(),
+                                                crashed.size()));
+        InitFS();
+        startLogging(SD_SECTOR_SIZE, 60000, LOGFILE_FORMAT_CSV, 1);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        CPPUNIT_ASSERT_EQUAL(good, ff_testing_file_data_len());
+
+        test_sample.channel_count = TEST_CHANNEL_COUNT;
+        test_sample.channel_samples = test_channel_samples;
+}
+
+void LoggerFileWriterTest::testJournalFlushInterval()
+{
+        const portTickType ticks = FLUSH_INTERVAL_MS / portTICK_RATE_MS;
+
+        getWorkingLoggerConfig()->logging_cfg.logfile.journal = true;
+        startLogging(SD_SECTOR_SIZE, 60000, LOGFILE_FORMAT_CSV, 1);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        ls->flush_tick = 0;
+
+        /* Pre-allocated and journaled files sync less often */
+        set_ticks(ticks);
+        CPPUNIT_ASSERT_EQUAL(-2, flush_logfile(ls));
+        set_ticks(JOURNAL_FLUSH_INTERVAL_MS / portTICK_RATE_MS);
+        CPPUNIT_ASSERT_EQUAL(0, flush_logfile(ls));
+
+        /* Without pre-allocation the sync keeps the file size current */
+        logging_stop(ls);
+        reset_ticks();
+        startLogging(SD_SECTOR_SIZE, 60000);
+        CPPUNIT_ASSERT_EQUAL(0, logRow(1));
+        ls->flush_tick = 0;
+        set_ticks(ticks);
+        CPPUNIT_ASSERT_EQUAL(0, flush_logfile(ls));
+}
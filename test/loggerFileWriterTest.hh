@@ -21,6 +21,7 @@
 #ifndef _LOGGERFILEWRITER_TEST_H_
 #define _LOGGERFILEWRITER_TEST_H_
 
+#include "loggerConfig.h"
 #include <cppunit/extensions/HelperMacros.h>
 
 class LoggerFileWriterTest : public CppUnit::TestFixture
@@ -30,6 +31,24 @@ class LoggerFileWriterTest : public CppUnit::TestFixture
         CPPUNIT_TEST( testLoggingStart );
         CPPUNIT_TEST( testLoggingStop );
         CPPUNIT_TEST( testLoggingSampleSkip );
+        CPPUNIT_TEST( testWriteEveryRowUncoalesced );
+        CPPUNIT_TEST( testCoalescedWritesSectorAligned );
+        CPPUNIT_TEST( testCoalescedWriteLatencyDeadline );
+        CPPUNIT_TEST( testSanitizeConfig );
+        CPPUNIT_TEST( testRcbFormatMatchesCsv );
+        CPPUNIT_TEST( testAsyncBufferHandoff );
+        CPPUNIT_TEST( testPreallocSize );
+        CPPUNIT_TEST( testPreallocateAndTruncate );
+        CPPUNIT_TEST( testPreallocateCardFull );
+        CPPUNIT_TEST( testLogFileIndex );
+        CPPUNIT_TEST( testNewLogFileOpenIsConstant );
+        CPPUNIT_TEST( testLogFileIndexWraps );
+        CPPUNIT_TEST( testSparseCsvFormat );
+        CPPUNIT_TEST( testCompressedLog );
+        CPPUNIT_TEST( testJournalCheckpoints );
+        CPPUNIT_TEST( testJournalRecovery );
+        CPPUNIT_TEST( testJournalRecoveryWideRows );
+        CPPUNIT_TEST( testJournalFlushInterval );
         CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -41,6 +60,30 @@ public:
         void testLoggingStart();
         void testLoggingStop();
         void testLoggingSampleSkip();
+        void testWriteEveryRowUncoalesced();
+        void testCoalescedWritesSectorAligned();
+        void testCoalescedWriteLatencyDeadline();
+        void testSanitizeConfig();
+        void testRcbFormatMatchesCsv();
+        void testAsyncBufferHandoff();
+        void testPreallocSize();
+        void testPreallocateAndTruncate();
+        void testPreallocateCardFull();
+        void testLogFileIndex();
+        void testNewLogFileOpenIsConstant();
+        void testLogFileIndexWraps();
+        void testSparseCsvFormat();
+        void testCompressedLog();
+        void testJournalCheckpoints();
+        void testJournalRecovery();
+        void testJournalRecoveryWideRows();
+        void testJournalFlushInterval();
+
+private:
+        void startLogging(const uint16_t threshold, const uint16_t latency_ms,
+                          const uint8_t format = LOGFILE_FORMAT_CSV,
+                          const uint8_t prealloc_minutes = 0);
+        int logRow(const size_t tick);
 };
 
 #endif /* _LOGGERFILEWRITER_TEST_H_ */
@@ -21,7 +21,40 @@
 
 
 #include "CAN_device.h"
+#include "CAN_mock.h"
 #include <stdbool.h>
+#include <string.h>
+
+#define CAN_MOCK_TX_MSGS        16
+
+static CAN_msg tx_msgs[CAN_MOCK_TX_MSGS];
+static size_t tx_count;
+static size_t filter_sets[CAN_CHANNELS];
+
+void CAN_mock_reset(void)
+{
+        tx_count = 0;
+        memset(filter_sets, 0, sizeof(filter_sets));
+}
+
+size_t CAN_mock_tx_count(void)
+{
+        return tx_count;
+}
+
+bool CAN_mock_get_tx_msg(const size_t index, CAN_msg *msg)
+{
+        if (index >= tx_count || index >= CAN_MOCK_TX_MSGS)
+                return false;
+
+        memcpy(msg, &tx_msgs[index], sizeof(*msg));
+        return true;
+}
+
+size_t CAN_mock_filter_sets(const uint8_t channel)
+{
+        return channel < CAN_CHANNELS ? filter_sets[channel] : 0;
+}
 
 int CAN_device_init(const uint8_t channel, const uint32_t baud, const bool termination_enabled)
 {
@@ -30,6 +63,9 @@ int CAN_device_init(const uint8_t channel, const uint32_t baud, const bool termi
 
 int CAN_device_tx_msg(const uint8_t channel, const CAN_msg *msg, unsigned int timeoutMs)
 {
+        if (tx_count < CAN_MOCK_TX_MSGS)
+                memcpy(&tx_msgs[tx_count], msg, sizeof(*msg));
+        tx_count++;
         return 1;
 }
 
@@ -41,5 +77,7 @@ int CAN_device_rx_msg(CAN_msg *msg, const unsigned int timeoutMs)
 int CAN_device_set_filter(const uint8_t channel, const uint8_t id, const uint8_t extended,
                           const uint32_t filter, const uint32_t mask, const bool enabled)
 {
+        if (channel < CAN_CHANNELS)
+                filter_sets[channel]++;
         return 1;
 }
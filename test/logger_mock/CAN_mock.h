@@ -0,0 +1,47 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CAN_MOCK_H_
+#define CAN_MOCK_H_
+
+#include "CAN.h"
+#include "cpp_guard.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+CPP_GUARD_BEGIN
+
+/* Forget the messages transmitted and filters set so far */
+void CAN_mock_reset(void);
+
+/* The number of messages transmitted since the last reset */
+size_t CAN_mock_tx_count(void);
+
+/* Get a transmitted message, oldest first */
+bool CAN_mock_get_tx_msg(const size_t index, CAN_msg *msg);
+
+/* The number of filters set on a channel since the last reset */
+size_t CAN_mock_filter_sets(const uint8_t channel);
+
+CPP_GUARD_END
+
+#endif /* CAN_MOCK_H_ */
@@ -32,6 +32,8 @@ void test_sd_interactive(struct Serial *serial, int lines,int doFlush, int quiet
 
 }
 
+static unsigned int mount_count;
+
 void InitFSHardware(void)
 {
 
@@ -39,9 +41,15 @@ void InitFSHardware(void)
 
 int InitFS()
 {
+        ++mount_count;
         return 0;
 }
 
+unsigned int sdcard_mount_count(void)
+{
+        return mount_count;
+}
+
 int UnmountFS()
 {
         return 0;
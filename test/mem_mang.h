@@ -30,6 +30,7 @@ CPP_GUARD_BEGIN
 
 #define portMalloc malloc
 #define portFree free
+#define portRealloc realloc
 
 CPP_GUARD_END
 
@@ -32,15 +32,21 @@
 #include "loggerConfig.h"
 #include "loggerHardware.h"
 #include "loggerSampleData.test.h"
+#include "macros.h"
 #include "mock_serial.h"
 #include "predictive_timer_2.h"
 #include "sampleRecord.h"
 #include "task.h"
 #include "task_testing.h"
 
+#include <stdio.h>
+#include <string.h>
 #include <string>
+#include <time.h>
+#include <vector>
 
 using std::string;
+using std::vector;
 
 // Registers the fixture into the 'registry'
 CPPUNIT_TEST_SUITE_REGISTRATION( SampleRecordTest );
@@ -431,27 +437,271 @@ void SampleRecordTest::testInitSampleRecord()
 }
 
 
-void SampleRecordTest::testIsValidLoggerMessage()
+void SampleRecordTest::testSamplePool()
 {
+        const size_t channel_count = get_enabled_channel_count(lc);
+        struct sample pool[3] = {};
+        init_sample_buffer(pool + 0, channel_count);
+        init_sample_buffer(pool + 2, channel_count);
+
+        /* Samples without buffers are never handed out */
+        struct sample *a = sample_pool_acquire(pool, 3);
+        struct sample *b = sample_pool_acquire(pool, 3);
+        CPPUNIT_ASSERT_EQUAL(pool + 0, a);
+        CPPUNIT_ASSERT_EQUAL(pool + 2, b);
+        CPPUNIT_ASSERT_EQUAL(1, (int) a->refs);
+        CPPUNIT_ASSERT(!sample_pool_acquire(pool, 3));
+
+        /* Comes back once every reference is gone */
+        sample_hold(a);
+        sample_release(a);
+        CPPUNIT_ASSERT(!sample_pool_acquire(pool, 3));
+        sample_release(a);
+        CPPUNIT_ASSERT_EQUAL(pool + 0, sample_pool_acquire(pool, 3));
+
+        /* Releasing nothing, or too much, is harmless */
+        sample_release(NULL);
+        sample_release(b);
+        sample_release(b);
+        CPPUNIT_ASSERT_EQUAL(0, (int) b->refs);
+
+        free_sample_buffer(pool + 0);
+        free_sample_buffer(pool + 2);
+}
+
+void SampleRecordTest::testSampleConsumerSend()
+{
+        const enum sample_consumer c = SAMPLE_CONSUMER_CELLULAR;
+        xQueueHandle queue = xQueueCreate(1, sizeof(LoggerMessage));
+        struct sample_consumer_stats before;
+        struct sample_consumer_stats stats;
+        struct sample smpl = {};
         LoggerMessage lm;
-        struct sample s;
 
-        /* Test the non sample case.  This always passes */
-        lm = create_logger_message(LoggerMessageType_Start, 0, NULL, false);
-        lm.ticks = 42;
-        s.ticks = 42;
-        CPPUNIT_ASSERT_EQUAL(true, is_sample_data_valid(&lm));
-        lm.ticks = 41;
-        CPPUNIT_ASSERT_EQUAL(true,  is_sample_data_valid(&lm));
-
-        /* Test the sample case. */
-        lm = create_logger_message(LoggerMessageType_Sample, 0, &s, false);
-        lm.ticks = 42;
-        s.ticks = 42;
-        CPPUNIT_ASSERT_EQUAL(true, is_sample_data_valid(&lm));
-        lm.ticks = 41;
-        CPPUNIT_ASSERT_EQUAL(false,  is_sample_data_valid(&lm));
+        sample_consumer_get_stats(c, &before);
+        const LoggerMessage msg =
+                create_logger_message(LoggerMessageType_Sample, 42, &smpl,
+                                      false);
+
+        /* Nothing goes to a consumer that isn't listening */
+        CPPUNIT_ASSERT(pdTRUE != send_logger_message(c, queue, &msg));
+        CPPUNIT_ASSERT_EQUAL(0, (int) smpl.refs);
+
+        sample_consumer_subscribe(c);
+        CPPUNIT_ASSERT_EQUAL(pdTRUE, send_logger_message(c, queue, &msg));
+        CPPUNIT_ASSERT_EQUAL(1, (int) smpl.refs);
+
+        /* A full queue drops the sample without holding it */
+        CPPUNIT_ASSERT(pdTRUE != send_logger_message(c, queue, &msg));
+        CPPUNIT_ASSERT_EQUAL(1, (int) smpl.refs);
+
+        sample_consumer_get_stats(c, &stats);
+        CPPUNIT_ASSERT_EQUAL(before.dropped + 1, stats.dropped);
+        CPPUNIT_ASSERT_EQUAL(before.held + 1, stats.held);
+        CPPUNIT_ASSERT(stats.held_high_water >= stats.held);
+
+        /* The biggest holder takes the blame for an empty pool */
+        sample_pool_starved();
+        sample_consumer_get_stats(c, &stats);
+        CPPUNIT_ASSERT_EQUAL(before.starved + 1, stats.starved);
+
+        CPPUNIT_ASSERT_EQUAL(pdTRUE, receive_logger_message(queue, &lm, 0));
+        CPPUNIT_ASSERT_EQUAL(&smpl, lm.sample);
+        CPPUNIT_ASSERT_EQUAL((size_t) 42, lm.ticks);
+        release_logger_message(c, &lm);
+        CPPUNIT_ASSERT_EQUAL(0, (int) smpl.refs);
+
+        sample_consumer_get_stats(c, &stats);
+        CPPUNIT_ASSERT_EQUAL(before.held, stats.held);
+
+        /* Messages without samples always go through */
+        sample_consumer_unsubscribe(c, queue);
+        const LoggerMessage start =
+                create_logger_message(LoggerMessageType_Start, 0, NULL, false);
+        CPPUNIT_ASSERT_EQUAL(pdTRUE, send_logger_message(c, queue, &start));
+}
+
+void SampleRecordTest::testSampleConsumerUnsubscribe()
+{
+        const enum sample_consumer c = SAMPLE_CONSUMER_BLUETOOTH;
+        xQueueHandle queue = xQueueCreate(3, sizeof(LoggerMessage));
+        struct sample smpl = {};
+        LoggerMessage lm;
+
+        const LoggerMessage sample_msg =
+                create_logger_message(LoggerMessageType_Sample, 1, &smpl,
+                                      false);
+        const LoggerMessage stop_msg =
+                create_logger_message(LoggerMessageType_Stop, 2, NULL, false);
+
+        sample_consumer_subscribe(c);
+        send_logger_message(c, queue, &sample_msg);
+        send_logger_message(c, queue, &stop_msg);
+        send_logger_message(c, queue, &sample_msg);
+        CPPUNIT_ASSERT_EQUAL(2, (int) smpl.refs);
+
+        /* Queued samples go back to the pool.  Everything else stays */
+        sample_consumer_unsubscribe(c, queue);
+        CPPUNIT_ASSERT_EQUAL(0, (int) smpl.refs);
+        CPPUNIT_ASSERT_EQUAL(1, (int) uxQueueMessagesWaiting(queue));
+        CPPUNIT_ASSERT_EQUAL(pdTRUE, receive_logger_message(queue, &lm, 0));
+        CPPUNIT_ASSERT_EQUAL(LoggerMessageType_Stop, lm.type);
+
+        struct sample_consumer_stats stats;
+        sample_consumer_get_stats(c, &stats);
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0, stats.held);
+}
+
+void SampleRecordTest::testSampleConsumerHoldLimit()
+{
+        const size_t limit = SAMPLE_TELEMETRY_MAX_HELD;
+        xQueueHandle bt = create_logger_message_queue();
+        xQueueHandle cell = create_logger_message_queue();
+        xQueueHandle file = create_logger_message_queue();
+        struct sample smpls[LOGGER_MESSAGE_BUFFER_SIZE] = {};
+        struct sample_consumer_stats before;
+        struct sample_consumer_stats stats;
+
+        /* Stalled links never hold more than their share of the pool */
+        CPPUNIT_ASSERT(limit + SAMPLE_FILE_RESERVED <
+                       LOGGER_MESSAGE_BUFFER_SIZE);
+        sample_consumer_subscribe(SAMPLE_CONSUMER_BLUETOOTH);
+        sample_consumer_subscribe(SAMPLE_CONSUMER_CELLULAR);
+        sample_consumer_get_stats(SAMPLE_CONSUMER_BLUETOOTH, &before);
+        for (size_t i = 0; i < LOGGER_MESSAGE_BUFFER_SIZE; ++i) {
+                const LoggerMessage msg =
+                        create_logger_message(LoggerMessageType_Sample, i,
+                                              smpls + i, false);
+                send_logger_message(SAMPLE_CONSUMER_BLUETOOTH, bt, &msg);
+                send_logger_message(SAMPLE_CONSUMER_CELLULAR, cell, &msg);
+        }
+
+        sample_consumer_get_stats(SAMPLE_CONSUMER_BLUETOOTH, &stats);
+        CPPUNIT_ASSERT_EQUAL((uint32_t) limit, stats.held);
+        CPPUNIT_ASSERT_EQUAL(before.dropped + LOGGER_MESSAGE_BUFFER_SIZE -
+                             (uint32_t) limit, stats.dropped);
+
+        /* Sharing the samples the other link holds costs nothing extra */
+        sample_consumer_get_stats(SAMPLE_CONSUMER_CELLULAR, &stats);
+        CPPUNIT_ASSERT_EQUAL((uint32_t) limit, stats.held);
+        for (size_t i = 0; i < LOGGER_MESSAGE_BUFFER_SIZE; ++i)
+                CPPUNIT_ASSERT_EQUAL(i < limit ? 2 : 0, (int) smpls[i].refs);
+
+        /* The file writer can have the whole pool */
+        sample_consumer_subscribe(SAMPLE_CONSUMER_FILE);
+        for (size_t i = 0; i < LOGGER_MESSAGE_BUFFER_SIZE; ++i) {
+                const LoggerMessage msg =
+                        create_logger_message(LoggerMessageType_Sample, i,
+                                              smpls + i, false);
+                CPPUNIT_ASSERT_EQUAL(pdTRUE,
+                                     send_logger_message(SAMPLE_CONSUMER_FILE,
+                                                         file, &msg));
+        }
 
+        sample_consumer_unsubscribe(SAMPLE_CONSUMER_FILE, file);
+        sample_consumer_unsubscribe(SAMPLE_CONSUMER_BLUETOOTH, bt);
+        sample_consumer_unsubscribe(SAMPLE_CONSUMER_CELLULAR, cell);
+        for (size_t i = 0; i < LOGGER_MESSAGE_BUFFER_SIZE; ++i)
+                CPPUNIT_ASSERT_EQUAL(0, (int) smpls[i].refs);
+}
+
+void SampleRecordTest::testStalledLinksLeaveFileSamples()
+{
+        const size_t count = LOGGER_MESSAGE_BUFFER_SIZE;
+        const enum sample_consumer consumers[] = {
+                SAMPLE_CONSUMER_FILE,
+                SAMPLE_CONSUMER_BLUETOOTH,
+                SAMPLE_CONSUMER_CELLULAR,
+        };
+        xQueueHandle queues[ARRAY_LEN(consumers)];
+        struct sample pool[LOGGER_MESSAGE_BUFFER_SIZE] = {};
+        struct sample *current = NULL;
+        struct sample_consumer_stats before;
+        struct sample_consumer_stats stats;
+        LoggerMessage lm;
+
+        const size_t channel_count = get_enabled_channel_count(lc);
+        CPPUNIT_ASSERT_EQUAL(count,
+                             sample_pool_init(pool, count, channel_count));
+        for (size_t c = 0; c < ARRAY_LEN(consumers); ++c) {
+                queues[c] = create_logger_message_queue();
+                sample_consumer_subscribe(consumers[c]);
+        }
+        sample_consumer_get_stats(SAMPLE_CONSUMER_FILE, &before);
+
+        /*
+         * Bluetooth stalls right away and cellular a few samples later, so
+         * they sit on different samples.  The file writer lags a sample
+         * behind the logger.
+         */
+        for (size_t tick = 1; tick <= 4 * count; ++tick) {
+                struct sample *smpl = sample_pool_acquire(pool, count);
+                CPPUNIT_ASSERT(smpl);
+
+                const LoggerMessage msg =
+                        create_logger_message(LoggerMessageType_Sample, tick,
+                                              smpl, false);
+                for (size_t c = 0; c < ARRAY_LEN(consumers); ++c)
+                        send_logger_message(consumers[c], queues[c], &msg);
+
+                sample_release(current);
+                current = smpl;
+
+                while (uxQueueMessagesWaiting(queues[0]) > 1 &&
+                       receive_logger_message(queues[0], &lm, 0))
+                        release_logger_message(SAMPLE_CONSUMER_FILE, &lm);
+
+                while (tick <= SAMPLE_TELEMETRY_MAX_HELD &&
+                       receive_logger_message(queues[2], &lm, 0))
+                        release_logger_message(SAMPLE_CONSUMER_CELLULAR, &lm);
+        }
+
+        sample_consumer_get_stats(SAMPLE_CONSUMER_FILE, &stats);
+        CPPUNIT_ASSERT_EQUAL(before.dropped, stats.dropped);
+
+        sample_release(current);
+        for (size_t c = 0; c < ARRAY_LEN(consumers); ++c)
+                sample_consumer_unsubscribe(consumers[c], queues[c]);
+        for (size_t i = 0; i < count; ++i) {
+                CPPUNIT_ASSERT_EQUAL(0, (int) pool[i].refs);
+                free_sample_buffer(pool + i);
+        }
+}
+
+void SampleRecordTest::testSamplePoolLayout()
+{
+        const size_t channel_count = get_enabled_channel_count(lc);
+        struct sample pool[2] = {};
+
+        CPPUNIT_ASSERT_EQUAL((size_t) 2,
+                             sample_pool_init(pool, 2, channel_count));
+        CPPUNIT_ASSERT_EQUAL(sample_pool_layout(), pool[0].layout);
+
+        /* A held sample keeps the buffer its consumer is reading */
+        struct sample *held = sample_pool_acquire(pool, 2);
+        ChannelSample *cs = held->channel_samples;
+        lc->LapConfigs.lapCountCfg.sampleRate = SAMPLE_DISABLED;
+        CPPUNIT_ASSERT_EQUAL(channel_count - 1,
+                             get_enabled_channel_count(lc));
+        CPPUNIT_ASSERT_EQUAL((size_t) 2,
+                             sample_pool_init(pool, 2, channel_count - 1));
+        CPPUNIT_ASSERT_EQUAL(cs, held->channel_samples);
+        CPPUNIT_ASSERT_EQUAL(channel_count, held->channel_count);
+        CPPUNIT_ASSERT(held->layout != sample_pool_layout());
+
+        struct sample *other = pool + 1 == held ? pool : pool + 1;
+        CPPUNIT_ASSERT_EQUAL(channel_count - 1, other->channel_count);
+        CPPUNIT_ASSERT_EQUAL(sample_pool_layout(), other->layout);
+
+        /* And is rebuilt for the new layout once it comes back */
+        CPPUNIT_ASSERT_EQUAL(other, sample_pool_acquire(pool, 2));
+        sample_release(held);
+        CPPUNIT_ASSERT_EQUAL(held, sample_pool_acquire(pool, 2));
+        CPPUNIT_ASSERT_EQUAL(channel_count - 1, held->channel_count);
+        CPPUNIT_ASSERT_EQUAL(sample_pool_layout(), held->layout);
+
+        free_sample_buffer(pool + 0);
+        free_sample_buffer(pool + 1);
 }
 
 void SampleRecordTest::testLoggerMessageAlwaysHasTime()
@@ -476,6 +726,126 @@ void SampleRecordTest::testLoggerMessageAlwaysHasTime()
         CPPUNIT_ASSERT_EQUAL(true, tick < 1000);
 }
 
+static int g_getter_calls;
+
+static int count_int_getter()
+{
+        return ++g_getter_calls;
+}
+
+static float count_float_getter(int index)
+{
+        return ++g_getter_calls + index;
+}
+
+/*
+ * A sample with lots of CAN/OBD2 like channels at mixed rates, plus the
+ * two always sampled time channels up front.
+ */
+struct mixed_rate_sample {
+        vector<ChannelConfig> cfgs;
+        vector<ChannelSample> channels;
+        vector<uint16_t> order;
+        struct sample s;
+
+        mixed_rate_sample(const size_t count) :
+                cfgs(count), channels(count), order(count)
+        {
+                static const unsigned short rates[] = {
+                        SAMPLE_100Hz, SAMPLE_50Hz, SAMPLE_25Hz,
+                        SAMPLE_10Hz, SAMPLE_5Hz, SAMPLE_1Hz,
+                };
+
+                for (size_t i = 0; i < count; ++i) {
+                        ChannelConfig *cfg = &cfgs[i];
+                        ChannelSample *cs = &channels[i];
+
+                        cfg->sampleRate = rates[i % ARRAY_LEN(rates)];
+                        cfg->flags = i < 2 ? ALWAYS_SAMPLED : 0;
+                        cs->cfg = cfg;
+                        cs->channelIndex = i;
+                        if (i % 3) {
+                                cs->sampleData = SampleData_Float;
+                                cs->get_float_sample = count_float_getter;
+                        } else {
+                                cs->sampleData = SampleData_Int_Noarg;
+                                cs->get_int_sample_noarg = count_int_getter;
+                        }
+                }
+
+                memset(&s, 0, sizeof(s));
+                s.channel_count = count;
+                s.channel_samples = &channels[0];
+                s.schedule.order = &order[0];
+                sample_schedule_init(&s);
+        }
+};
+
+void SampleRecordTest::testSampleSchedule()
+{
+        mixed_rate_sample scheduled(60);
+        mixed_rate_sample scanned(60);
+        CPPUNIT_ASSERT(scheduled.s.schedule.valid);
+        CPPUNIT_ASSERT_EQUAL(2, (int) scheduled.s.schedule.always_count);
+
+        /* Getters are grouped by type within each rate */
+        const struct sample_schedule_bucket *b = scheduled.s.schedule.buckets;
+        const uint16_t *order = scheduled.s.schedule.order + b->start;
+        for (size_t i = 1; i < b->count; ++i)
+                CPPUNIT_ASSERT(scheduled.channels[order[i - 1]].sampleData <=
+                               scheduled.channels[order[i]].sampleData);
+
+        /* Must match checking every channel on every tick */
+        scanned.s.schedule.valid = false;
+        for (size_t tick = 0; tick < 2100; ++tick) {
+                CPPUNIT_ASSERT_EQUAL(populate_sample_buffer(&scanned.s, tick),
+                                     populate_sample_buffer(&scheduled.s, tick));
+
+                for (size_t i = 0; i < 60; ++i)
+                        CPPUNIT_ASSERT_EQUAL(scanned.channels[i].populated,
+                                             scheduled.channels[i].populated);
+        }
+
+        /* Too many rates falls back to scanning */
+        for (size_t i = 0; i < 60; ++i)
+                scheduled.cfgs[i].sampleRate = 1 + i;
+        sample_schedule_init(&scheduled.s);
+        CPPUNIT_ASSERT(!scheduled.s.schedule.valid);
+        CPPUNIT_ASSERT_EQUAL(1, populate_sample_buffer(&scheduled.s, 1));
+}
+
+/**
+ * @return The number of ticks populate_sample_buffer runs per second.
+ */
+static double populate_ticks_per_sec(struct sample *s)
+{
+        const size_t ticks = 20000;
+        const clock_t start = clock();
+        for (size_t tick = 0; tick < ticks; ++tick)
+                populate_sample_buffer(s, tick);
+
+        const double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+        return secs > 0 ? ticks / secs : 0;
+}
+
+void SampleRecordTest::testSampleScheduleBenchmark()
+{
+        static const size_t counts[] = {25, 50, 100, 200, 400};
+
+        printf("\n");
+        for (size_t i = 0; i < ARRAY_LEN(counts); ++i) {
+                mixed_rate_sample sample(counts[i]);
+                const double scheduled = populate_ticks_per_sec(&sample.s);
+
+                sample.s.schedule.valid = false;
+                const double scanned = populate_ticks_per_sec(&sample.s);
+
+                printf("populate_sample_buffer: %3zu channels, "
+                       "%.0f ticks/s scheduled, %.0f ticks/s scanned\n",
+                       counts[i], scheduled, scanned);
+        }
+}
+
 void SampleRecordTest::test_get_sample_value_by_name()
 {
         lc->ADCConfigs[7].scalingMode = SCALING_MODE_RAW;
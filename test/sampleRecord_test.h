@@ -29,8 +29,15 @@ class SampleRecordTest : public CppUnit::TestFixture
         CPPUNIT_TEST_SUITE( SampleRecordTest );
         CPPUNIT_TEST( testInitSampleRecord );
         CPPUNIT_TEST( testPopulateSampleRecord );
-        CPPUNIT_TEST( testIsValidLoggerMessage );
+        CPPUNIT_TEST( testSamplePool );
+        CPPUNIT_TEST( testSampleConsumerSend );
+        CPPUNIT_TEST( testSampleConsumerUnsubscribe );
+        CPPUNIT_TEST( testSampleConsumerHoldLimit );
+        CPPUNIT_TEST( testStalledLinksLeaveFileSamples );
+        CPPUNIT_TEST( testSamplePoolLayout );
         CPPUNIT_TEST( testLoggerMessageAlwaysHasTime );
+        CPPUNIT_TEST( testSampleSchedule );
+        CPPUNIT_TEST( testSampleScheduleBenchmark );
         CPPUNIT_TEST( test_get_sample_value_by_name );
         CPPUNIT_TEST_SUITE_END();
 
@@ -40,8 +47,15 @@ public:
         void tearDown();
         void testInitSampleRecord();
         void testPopulateSampleRecord();
-        void testIsValidLoggerMessage();
+        void testSamplePool();
+        void testSampleConsumerSend();
+        void testSampleConsumerUnsubscribe();
+        void testSampleConsumerHoldLimit();
+        void testStalledLinksLeaveFileSamples();
+        void testSamplePoolLayout();
         void testLoggerMessageAlwaysHasTime();
+        void testSampleSchedule();
+        void testSampleScheduleBenchmark();
         void test_get_sample_value_by_name();
 
 private:
@@ -0,0 +1,158 @@
+/*
+ * Race Capture Pro Firmware
+ *
+ * Copyright (C) 2015 Autosport Labs
+ *
+ * This file is part of the Race Capture Pro fimrware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "macros.h"
+#include "mock_serial.h"
+#include "queue.h"
+#include "serial.h"
+#include "serial_test.hh"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+
+using std::string;
+
+#define TX_CAP	16
+#define RX_CAP	16
+
+static struct Serial *serial;
+static string tx_data;
+static size_t post_tx_calls;
+
+/* Acts like a driver that sends everything as soon as it is kicked */
+static void drain_tx(xQueueHandle q, void *arg)
+{
+        char c;
+        ++post_tx_calls;
+        while (xQueueReceive(q, &c, 0))
+                tx_data += c;
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( SerialTest );
+
+void SerialTest::setUp()
+{
+        serial = serial_create("Test", TX_CAP, RX_CAP, NULL, NULL, drain_tx,
+                               NULL);
+        tx_data.clear();
+        post_tx_calls = 0;
+}
+
+void SerialTest::tearDown()
+{
+        serial_destroy(serial);
+}
+
+void SerialTest::testWriteBuff()
+{
+        const char msg[] = "Hello world";
+
+        CPPUNIT_ASSERT_EQUAL((int) strlen(msg), serial_write_s(serial, msg));
+        CPPUNIT_ASSERT_EQUAL(string(msg), tx_data);
+
+        /* The driver gets kicked once, not once per byte */
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, post_tx_calls);
+}
+
+void SerialTest::testWriteBuffQueueFull()
+{
+        char msg[TX_CAP * 5 + 3];
+        for (size_t i = 0; i < sizeof(msg); ++i)
+                msg[i] = 'a' + i % 26;
+
+        CPPUNIT_ASSERT_EQUAL((int) sizeof(msg),
+                             serial_write_buff(serial, msg, sizeof(msg)));
+        CPPUNIT_ASSERT_EQUAL(string(msg, sizeof(msg)), tx_data);
+
+        /* A kick per full queue, and one more for the byte that waited */
+        CPPUNIT_ASSERT(post_tx_calls <= 2 * (sizeof(msg) / TX_CAP + 1));
+}
+
+void SerialTest::testWriteBuffClosed()
+{
+        serial_close(serial);
+        CPPUNIT_ASSERT_EQUAL(-1, serial_write_s(serial, "nope"));
+        CPPUNIT_ASSERT_EQUAL(string(""), tx_data);
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, post_tx_calls);
+}
+
+void SerialTest::testReadBuff()
+{
+        xQueueHandle rx = serial_get_rx_queue(serial);
+        const char msg[] = "ABCDEFGHIJ";
+        for (const char *c = msg; *c; ++c)
+                xQueueSend(rx, c, 0);
+
+        /* Takes what fits, then the rest */
+        char buf[RX_CAP] = {0};
+        CPPUNIT_ASSERT_EQUAL(4, serial_read_buff_wait(serial, buf, 4, 0));
+        CPPUNIT_ASSERT_EQUAL(string("ABCD"), string(buf, 4));
+        CPPUNIT_ASSERT_EQUAL(6, serial_read_buff_wait(serial, buf,
+                                                      sizeof(buf), 0));
+        CPPUNIT_ASSERT_EQUAL(string("EFGHIJ"), string(buf, 6));
+
+        /* Nothing waiting */
+        CPPUNIT_ASSERT_EQUAL(0, serial_read_buff_wait(serial, buf,
+                                                      sizeof(buf), 0));
+
+        serial_close(serial);
+        CPPUNIT_ASSERT_EQUAL(-1, serial_read_buff_wait(serial, buf,
+                                                       sizeof(buf), 0));
+}
+
+/**
+ * @return Bytes per second written to the mock serial device.
+ */
+static double write_bytes_per_sec(const bool bulk)
+{
+        struct Serial *s = getMockSerial();
+        char buf[1024];
+        memset(buf, 'x', sizeof(buf));
+
+        const size_t rounds = 2000;
+        const clock_t start = clock();
+        for (size_t r = 0; r < rounds; ++r) {
+                mock_resetTxBuffer();
+                if (bulk) {
+                        serial_write_buff(s, buf, sizeof(buf));
+                } else {
+                        for (size_t i = 0; i < sizeof(buf); ++i)
+                                serial_write_c(s, buf[i]);
+                }
+        }
+
+        const double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+        CPPUNIT_ASSERT_EQUAL(sizeof(buf), strlen(mock_getTxBuffer()));
+        return secs > 0 ? rounds * sizeof(buf) / secs : 0;
+}
+
+void SerialTest::testWriteBenchmark()
+{
+        setupMockSerial();
+
+        const double per_char = write_bytes_per_sec(false);
+        const double bulk = write_bytes_per_sec(true);
+        printf("\nserial write: %.1f MB/s per char, %.1f MB/s bulk\n",
+               per_char / 1e6, bulk / 1e6);
+
+        mock_resetTxBuffer();
+}
@@ -0,0 +1,169 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ff.h"
+#include "ff_testing.h"
+#include "telemetryBacklogTest.hh"
+#include "telemetry_backlog.h"
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#define BACKLOG_FILE	"tele.buf"
+#define CHUNK_LEN	64
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TelemetryBacklogTest );
+
+static FIL file;
+static char chunk[CHUNK_LEN];
+static struct telemetry_backlog backlog;
+static string contents;
+/* Where the record for each tick appended starts */
+static vector<uint32_t> offsets;
+
+void TelemetryBacklogTest::setUp()
+{
+        ff_testing_reset();
+        telemetry_backlog_init(&backlog, &file, chunk, sizeof(chunk));
+        contents.clear();
+        offsets.clear();
+}
+
+/**
+ * Appends records like the buffering task does, with some carrying meta
+ * so they aren't all the same length.
+ */
+static void append_run(const uint32_t first, const uint32_t count)
+{
+        for (uint32_t tick = first; tick < first + count; ++tick) {
+                const string meta = tick % 7 ? "" :
+                        "\"meta\":[" + string(tick % 50, 'm') + "],";
+                offsets.push_back(contents.size());
+                telemetry_backlog_index(&backlog, tick, contents.size());
+                contents += "{\"s\":{\"t\":" + std::to_string(tick) + "," +
+                        meta + "\"d\":[1,2,3]}}\r\n";
+        }
+}
+
+static void open_file()
+{
+        CPPUNIT_ASSERT(ff_testing_set_file_data(BACKLOG_FILE, contents.data(),
+                                                contents.size()));
+        CPPUNIT_ASSERT_EQUAL(FR_OK, f_open(&file, BACKLOG_FILE,
+                                           FA_READ | FA_WRITE));
+}
+
+/**
+ * Checks that resuming after every tick of the latest run lands on the
+ * record that follows it.
+ * @param first Index into offsets of the first record of the run.
+ */
+static void check_resume(const size_t first, const uint32_t first_tick)
+{
+        for (size_t i = first; i < offsets.size(); ++i) {
+                const uint32_t tick = first_tick + i - first;
+                const uint32_t next = i + 1 < offsets.size() ?
+                        offsets[i + 1] : contents.size();
+
+                backlog.read_offset = 0;
+                CPPUNIT_ASSERT(telemetry_backlog_resume(&backlog, tick));
+                CPPUNIT_ASSERT_EQUAL(next, backlog.read_offset);
+        }
+
+        /* Not sent yet, so there is nothing to resume from */
+        const uint32_t last = first_tick + offsets.size() - first - 1;
+        backlog.read_offset = 5;
+        CPPUNIT_ASSERT(!telemetry_backlog_resume(&backlog, last + 1));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 5, backlog.read_offset);
+}
+
+void TelemetryBacklogTest::testResume()
+{
+        append_run(0, 100);
+        open_file();
+
+        CPPUNIT_ASSERT_EQUAL((size_t) 100 / TELEMETRY_BACKLOG_INDEX_INTERVAL + 1,
+                             backlog.count);
+        check_resume(0, 0);
+}
+
+void TelemetryBacklogTest::testResumeThinned()
+{
+        /* The file starts part way into a run, like after a reopen */
+        const uint32_t first = 13;
+        append_run(first, 1500);
+        open_file();
+
+        /* The index still covers it all */
+        CPPUNIT_ASSERT(backlog.count <= TELEMETRY_BACKLOG_INDEX_LEN);
+        CPPUNIT_ASSERT(backlog.interval > TELEMETRY_BACKLOG_INDEX_INTERVAL);
+        CPPUNIT_ASSERT_EQUAL(first, backlog.index[0].tick);
+        check_resume(0, first);
+
+        /* The server got what came just before the file, so send it all */
+        backlog.read_offset = 5;
+        CPPUNIT_ASSERT(telemetry_backlog_resume(&backlog, first - 1));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0, backlog.read_offset);
+        CPPUNIT_ASSERT(!telemetry_backlog_resume(&backlog, first - 2));
+}
+
+void TelemetryBacklogTest::testResumeRuns()
+{
+        /* Ticks start over when a new log starts */
+        append_run(0, 50);
+        const size_t second = offsets.size();
+        append_run(0, 30);
+        open_file();
+
+        CPPUNIT_ASSERT_EQUAL(offsets[second],
+                             backlog.index[backlog.run_start].offset);
+        check_resume(second, 0);
+
+        /* Only the latest run counts */
+        CPPUNIT_ASSERT(!telemetry_backlog_resume(&backlog, 40));
+}
+
+void TelemetryBacklogTest::testRead()
+{
+        append_run(0, 40);
+        open_file();
+
+        CPPUNIT_ASSERT(telemetry_backlog_resume(&backlog, 9));
+        CPPUNIT_ASSERT_EQUAL(contents.size() - offsets[10],
+                             (size_t) telemetry_backlog_pending(&backlog));
+
+        /* Comes back in full chunks until it catches up */
+        string sent;
+        size_t len;
+        const char *data;
+        while ((data = telemetry_backlog_read(&backlog, &len)) && len) {
+                CPPUNIT_ASSERT(len == CHUNK_LEN ||
+                               !telemetry_backlog_pending(&backlog));
+                sent.append(data, len);
+        }
+
+        CPPUNIT_ASSERT(data);
+        CPPUNIT_ASSERT(contents.substr(offsets[10]) == sent);
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0, telemetry_backlog_pending(&backlog));
+}
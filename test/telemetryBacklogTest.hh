@@ -0,0 +1,45 @@
+/*
+ * Race Capture Firmware
+ *
+ * Copyright (C) 2016 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _TELEMETRY_BACKLOG_TEST_H_
+#define _TELEMETRY_BACKLOG_TEST_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class TelemetryBacklogTest : public CppUnit::TestFixture
+{
+        CPPUNIT_TEST_SUITE( TelemetryBacklogTest );
+        CPPUNIT_TEST( testResume );
+        CPPUNIT_TEST( testResumeThinned );
+        CPPUNIT_TEST( testResumeRuns );
+        CPPUNIT_TEST( testRead );
+        CPPUNIT_TEST_SUITE_END();
+
+public:
+        void setUp();
+        void testResume();
+        void testResumeThinned();
+        void testResumeRuns();
+        void testRead();
+};
+
+#endif /* _TELEMETRY_BACKLOG_TEST_H_ */
@@ -0,0 +1,582 @@
+/*
+ * Race Capture Pro Firmware
+ *
+ * Copyright (C) 2015 Autosport Labs
+ *
+ * This file is part of the Race Capture Pro fimrware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "api.h"
+#include "log_fixture.h"
+#include "log_format.h"
+#include "loggerApi.h"
+#include "macros.h"
+#include "serial.h"
+#include "task_testing.h"
+#include "telemetryFrameTest.hh"
+#include "telemetry_batch.h"
+#include "telemetry_frame.h"
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#define FIXTURE_FILE	"sonoma.log"
+#define FIXTURE_ROWS	2000
+#define TX_CAP		64
+#define KEYFRAME_INTERVAL	100
+#define BATCH_TX_CAP	4096
+
+static struct Serial *serial;
+static string tx_data;
+static struct telemetry_delta delta;
+
+static void drain_tx(xQueueHandle q, void *arg)
+{
+        char c;
+        while (xQueueReceive(q, &c, 0))
+                tx_data += c;
+}
+
+/* Every kick of the driver is one write on the link */
+static void drain_tx_writes(xQueueHandle q, void *arg)
+{
+        vector<string> *writes = static_cast<vector<string>*>(arg);
+        string write;
+        char c;
+        while (xQueueReceive(q, &c, 0))
+                write += c;
+
+        writes->push_back(write);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TelemetryFrameTest );
+
+void TelemetryFrameTest::setUp()
+{
+        serial = serial_create("Test", TX_CAP, TX_CAP, NULL, NULL, drain_tx,
+                               NULL);
+        tx_data.clear();
+        telemetry_delta_init(&delta);
+}
+
+void TelemetryFrameTest::tearDown()
+{
+        telemetry_delta_free(&delta);
+        serial_destroy(serial);
+}
+
+static string send_sample(const enum serial_telemetry_format fmt,
+                          const struct sample *s, const unsigned int tick)
+{
+        /* Like the connectivity tasks do */
+        if (0 == tick % KEYFRAME_INTERVAL)
+                telemetry_delta_reset(&delta);
+
+        tx_data.clear();
+        if (fmt != serial_get_telemetry_format(serial))
+                serial_set_telemetry_format(serial, fmt);
+        api_send_telemetry_sample(serial, &delta, s, tick, 0 == tick);
+        return tx_data;
+}
+
+static string get_json_field(const string &json, const string &name,
+                             const char end)
+{
+        const string key = "\"" + name + "\":";
+        const size_t start = json.find(key);
+        CPPUNIT_ASSERT(string::npos != start);
+
+        const size_t val = start + key.size();
+        return json.substr(val, json.find(end, val) - val);
+}
+
+/**
+ * Rebuilds the CSV row that log_format_csv_row would write from the
+ * values and channel bitmaps of a JSON sample.
+ */
+static string json_to_csv_row(const string &json, const size_t channels)
+{
+        vector<string> fields;
+        std::istringstream d(get_json_field(json, "d", ']').substr(1));
+        string field;
+        while (std::getline(d, field, ','))
+                fields.push_back(field);
+
+        const size_t bitmaps = (channels + 31) / 32;
+        CPPUNIT_ASSERT(fields.size() >= bitmaps);
+        const size_t first_bitmap = fields.size() - bitmaps;
+
+        string row;
+        size_t value = 0;
+        for (size_t i = 0; i < channels; ++i) {
+                const unsigned long bitmap =
+                        strtoul(fields[first_bitmap + i / 32].c_str(),
+                                NULL, 10);
+
+                row += i ? "," : "";
+                if (bitmap & (1UL << i % 32))
+                        row += fields[value++];
+        }
+
+        CPPUNIT_ASSERT_EQUAL(first_bitmap, value);
+        return row + "\n";
+}
+
+static void string_append(const void *data, const size_t len, void *arg)
+{
+        static_cast<vector<string>*>(arg)->push_back(
+                string(static_cast<const char*>(data), len));
+}
+
+static uint32_t get_u32(const string &s, const size_t pos)
+{
+        const uint8_t *p = (const uint8_t *) s.data() + pos;
+        return (uint32_t) p[0] | (uint32_t) p[1] << 8 |
+                (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+void TelemetryFrameTest::testMatchesJson()
+{
+        LogFixture fixture(FIXTURE_FILE, FIXTURE_ROWS);
+        string json_csv, stream;
+        size_t json_size = 0;
+
+        for (size_t i = 0; i < fixture.rows(); ++i) {
+                struct sample *s = fixture.row(i);
+                const string json = send_sample(SERIAL_TELEMETRY_FORMAT_JSON,
+                                                s, i);
+                const string bin = send_sample(SERIAL_TELEMETRY_FORMAT_BINARY,
+                                               s, i);
+
+                const string t = get_json_field(json, "t", ',');
+                CPPUNIT_ASSERT_EQUAL((int) i, atoi(t.c_str()));
+                CPPUNIT_ASSERT_EQUAL(0 == i,
+                                     string::npos != json.find("\"meta\""));
+                json_csv += json_to_csv_row(json, s->channel_count);
+                json_size += json.size();
+                stream += bin;
+        }
+
+        /* Every sample frame carries its tick, and only the first has meta */
+        vector<string> payloads;
+        const struct log_format_writer frames_w = {string_append, &payloads};
+        CPPUNIT_ASSERT_EQUAL((int) fixture.rows() + 1,
+                             telemetry_frame_decode(stream.data(),
+                                                    stream.size(),
+                                                    &frames_w));
+        CPPUNIT_ASSERT_EQUAL(string(RCB_MAGIC),
+                             payloads[0].substr(0, RCB_MAGIC_LEN));
+
+        string rcb = payloads[0];
+        for (size_t i = 1; i < payloads.size(); ++i) {
+                CPPUNIT_ASSERT_EQUAL((char) RCB_RECORD_MARKER, payloads[i][0]);
+                CPPUNIT_ASSERT_EQUAL((uint32_t) i - 1, get_u32(payloads[i], 1));
+                rcb += payloads[i];
+        }
+
+        /* Same values, down to the precision JSON formats them with */
+        string decoded;
+        const struct log_format_writer csv_w =
+                LogFixture::string_writer(&decoded);
+        CPPUNIT_ASSERT_EQUAL((int) fixture.rows(),
+                             log_format_rcb_to_csv(rcb.data(), rcb.size(),
+                                                   &csv_w));
+        CPPUNIT_ASSERT(json_csv == decoded.substr(decoded.find('\n') + 1));
+
+        printf("\nTelemetry %u samples: JSON %u bytes, binary %u bytes\n",
+               (unsigned) fixture.rows(), (unsigned) json_size,
+               (unsigned) stream.size());
+        CPPUNIT_ASSERT(stream.size() < json_size * 3 / 4);
+}
+
+void TelemetryFrameTest::testDecodeSkipsGarbage()
+{
+        LogFixture fixture(FIXTURE_FILE, 3);
+        string stream;
+
+        for (size_t i = 0; i < fixture.rows(); ++i)
+                stream += send_sample(SERIAL_TELEMETRY_FORMAT_BINARY,
+                                      fixture.row(i), i);
+
+        /* An API reply between frames, and damage to the last frame */
+        const string reply = "{\"rc\":1}\r\n";
+        const size_t first_len = TELEMETRY_FRAME_OVERHEAD +
+                ((uint8_t) stream[1] | (uint8_t) stream[2] << 8);
+        stream.insert(first_len, reply);
+        stream[stream.size() - TELEMETRY_FRAME_CRC_LEN - 1] ^= 0x40;
+
+        vector<string> payloads;
+        const struct log_format_writer w = {string_append, &payloads};
+        CPPUNIT_ASSERT_EQUAL((int) fixture.rows(),
+                             telemetry_frame_decode(stream.data(),
+                                                    stream.size(), &w));
+
+        /* Cut short, like when a connection drops mid frame */
+        payloads.clear();
+        CPPUNIT_ASSERT_EQUAL(1, telemetry_frame_decode(stream.data(),
+                                                       first_len + 5, &w));
+        CPPUNIT_ASSERT_EQUAL(string(RCB_MAGIC),
+                             payloads[0].substr(0, RCB_MAGIC_LEN));
+}
+
+/**
+ * Sends every fixture row and decodes the stream back to CSV.
+ * @return The number of records decoded.
+ */
+static int round_trip(LogFixture &fixture,
+                      const enum serial_telemetry_format fmt,
+                      vector<string> *frames, string *csv)
+{
+        string stream;
+        for (size_t i = 0; i < fixture.rows(); ++i) {
+                const string frame = send_sample(fmt, fixture.row(i), i);
+                if (frames)
+                        frames->push_back(frame);
+                stream += frame;
+        }
+
+        string rcb;
+        const struct log_format_writer rcb_w = LogFixture::string_writer(&rcb);
+        telemetry_frame_decode(stream.data(), stream.size(), &rcb_w);
+
+        const struct log_format_writer csv_w = LogFixture::string_writer(csv);
+        return log_format_rcb_to_csv(rcb.data(), rcb.size(), &csv_w);
+}
+
+void TelemetryFrameTest::testDeltaRoundTrip()
+{
+        LogFixture fixture(FIXTURE_FILE, FIXTURE_ROWS);
+        vector<string> bin_frames, delta_frames;
+        string bin_csv, delta_csv;
+
+        CPPUNIT_ASSERT_EQUAL((int) fixture.rows(),
+                             round_trip(fixture,
+                                        SERIAL_TELEMETRY_FORMAT_BINARY,
+                                        &bin_frames, &bin_csv));
+        CPPUNIT_ASSERT_EQUAL((int) fixture.rows(),
+                             round_trip(fixture,
+                                        SERIAL_TELEMETRY_FORMAT_DELTA,
+                                        &delta_frames, &delta_csv));
+        CPPUNIT_ASSERT(bin_csv == delta_csv);
+
+        size_t bin_size = 0, delta_size = 0, keyframes = 0;
+        for (size_t i = 0; i < fixture.rows(); ++i) {
+                bin_size += bin_frames[i].size();
+                delta_size += delta_frames[i].size();
+
+                /* Keyframes go out as plain records */
+                const bool keyframe = 0 == i % KEYFRAME_INTERVAL;
+                keyframes += keyframe;
+                CPPUNIT_ASSERT_EQUAL(keyframe, bin_frames[i] == delta_frames[i]);
+        }
+
+        printf("\nTelemetry %u samples: binary %u bytes, delta %u bytes "
+               "with %u keyframes\n", (unsigned) fixture.rows(),
+               (unsigned) bin_size, (unsigned) delta_size,
+               (unsigned) keyframes);
+        CPPUNIT_ASSERT(delta_size < bin_size * 3 / 5);
+}
+
+void TelemetryFrameTest::testDeltaLostFrame()
+{
+        LogFixture fixture(FIXTURE_FILE, KEYFRAME_INTERVAL * 2);
+        vector<string> frames;
+        string csv;
+        round_trip(fixture, SERIAL_TELEMETRY_FORMAT_DELTA, &frames, &csv);
+
+        /* Lose a record, then reconnect, which forces a keyframe early */
+        const size_t lost = 10;
+        const size_t reconnect = 20;
+        string stream;
+        for (size_t i = 0; i < fixture.rows(); ++i) {
+                if (reconnect == i)
+                        telemetry_delta_reset(&delta);
+
+                const string frame = send_sample(SERIAL_TELEMETRY_FORMAT_DELTA,
+                                                 fixture.row(i), i);
+                if (lost != i)
+                        stream += frame;
+        }
+
+        /* Everything from the lost record up to the reconnect is gone */
+        string rcb, decoded;
+        const struct log_format_writer rcb_w = LogFixture::string_writer(&rcb);
+        const struct log_format_writer csv_w =
+                LogFixture::string_writer(&decoded);
+        telemetry_frame_decode(stream.data(), stream.size(), &rcb_w);
+        CPPUNIT_ASSERT_EQUAL((int) (fixture.rows() - (reconnect - lost)),
+                             log_format_rcb_to_csv(rcb.data(), rcb.size(),
+                                                   &csv_w));
+
+        /* and what made it through is right */
+        const size_t header_end = csv.find('\n') + 1;
+        size_t cut_start = header_end;
+        for (size_t i = 0; i < lost; ++i)
+                cut_start = csv.find('\n', cut_start) + 1;
+
+        size_t cut_end = cut_start;
+        for (size_t i = lost; i < reconnect; ++i)
+                cut_end = csv.find('\n', cut_end) + 1;
+
+        CPPUNIT_ASSERT(csv.substr(0, cut_start) + csv.substr(cut_end) ==
+                       decoded);
+}
+
+static void set_telemetry(const string &args)
+{
+        string json = "{\"setTelemetry\":" + args + "}";
+        process_api(serial, (char *) json.c_str(), json.size());
+}
+
+void TelemetryFrameTest::testDeltaRestart()
+{
+        LogFixture fixture(FIXTURE_FILE, 4);
+        const size_t last = fixture.rows() - 1;
+        const string keyframe =
+                send_sample(SERIAL_TELEMETRY_FORMAT_BINARY,
+                            fixture.row(last), last);
+
+        /* Picking delta again starts the host over with a keyframe */
+        for (size_t i = 1; i < last; ++i)
+                send_sample(SERIAL_TELEMETRY_FORMAT_DELTA, fixture.row(i), i);
+        set_telemetry("{\"fmt\":\"delta\"}");
+        CPPUNIT_ASSERT(keyframe == send_sample(SERIAL_TELEMETRY_FORMAT_DELTA,
+                                               fixture.row(last), last));
+
+        /* So does any record that wasn't delta encoded */
+        for (size_t i = 1; i < last; ++i)
+                send_sample(SERIAL_TELEMETRY_FORMAT_DELTA, fixture.row(i), i);
+        send_sample(SERIAL_TELEMETRY_FORMAT_BINARY, fixture.row(1), 1);
+        CPPUNIT_ASSERT(keyframe == send_sample(SERIAL_TELEMETRY_FORMAT_DELTA,
+                                               fixture.row(last), last));
+        CPPUNIT_ASSERT(keyframe != send_sample(SERIAL_TELEMETRY_FORMAT_DELTA,
+                                               fixture.row(last), last));
+}
+
+void TelemetryFrameTest::testSetTelemetryFormat()
+{
+        CPPUNIT_ASSERT_EQUAL(SERIAL_TELEMETRY_FORMAT_JSON,
+                             serial_get_telemetry_format(serial));
+
+        set_telemetry("{\"fmt\":\"bin\"}");
+        CPPUNIT_ASSERT_EQUAL(SERIAL_TELEMETRY_FORMAT_BINARY,
+                             serial_get_telemetry_format(serial));
+
+        /* Unknown formats are refused and leave things alone */
+        set_telemetry("{\"fmt\":\"xml\"}");
+        CPPUNIT_ASSERT_EQUAL(SERIAL_TELEMETRY_FORMAT_BINARY,
+                             serial_get_telemetry_format(serial));
+
+        /* Older hosts never ask, and must get JSON */
+        set_telemetry("{\"rate\":10}");
+        CPPUNIT_ASSERT_EQUAL(SERIAL_TELEMETRY_FORMAT_JSON,
+                             serial_get_telemetry_format(serial));
+
+        set_telemetry("{\"fmt\":\"bin\"}");
+        serial_reopen(serial);
+        CPPUNIT_ASSERT_EQUAL(SERIAL_TELEMETRY_FORMAT_JSON,
+                             serial_get_telemetry_format(serial));
+}
+
+/**
+ * Sends fixture rows through a batch like the connectivity tasks do.
+ * @return What the batch sent, one entry per write.
+ */
+static vector<string> send_batched(LogFixture &fixture,
+                                   const enum serial_telemetry_format fmt,
+                                   const struct telemetry_batch_cfg &cfg,
+                                   vector<size_t> *held)
+{
+        vector<string> writes;
+        struct Serial *s = serial_create("Batch", BATCH_TX_CAP, BATCH_TX_CAP,
+                                         NULL, NULL, drain_tx_writes, &writes);
+        serial_set_telemetry_format(s, fmt);
+
+        struct telemetry_batch batch;
+        telemetry_batch_init(&batch, s, &cfg);
+        struct telemetry_delta batch_delta;
+        telemetry_delta_init(&batch_delta);
+
+        reset_ticks();
+        for (size_t i = 0; i < fixture.rows(); ++i) {
+                if (0 == i % KEYFRAME_INTERVAL)
+                        telemetry_delta_reset(&batch_delta);
+
+                api_batch_telemetry_sample(&batch, &batch_delta,
+                                           fixture.row(i), i, 0 == i);
+                if (held)
+                        held->push_back(batch.samples);
+
+                increment_tick();
+        }
+        telemetry_batch_flush(&batch);
+
+        telemetry_delta_free(&batch_delta);
+        telemetry_batch_free(&batch);
+        serial_destroy(s);
+        return writes;
+}
+
+static string join(const vector<string> &writes)
+{
+        string all;
+        for (size_t i = 0; i < writes.size(); ++i)
+                all += writes[i];
+
+        return all;
+}
+
+void TelemetryFrameTest::testBatch()
+{
+        const enum serial_telemetry_format fmts[] = {
+                SERIAL_TELEMETRY_FORMAT_JSON,
+                SERIAL_TELEMETRY_FORMAT_BINARY,
+                SERIAL_TELEMETRY_FORMAT_DELTA,
+        };
+        const size_t rows = 12;
+        LogFixture fixture(FIXTURE_FILE, rows);
+
+        for (size_t f = 0; f < ARRAY_LEN(fmts); ++f) {
+                string unbatched;
+                for (size_t i = 0; i < fixture.rows(); ++i)
+                        unbatched += send_sample(fmts[f], fixture.row(i), i);
+                telemetry_delta_reset(&delta);
+
+                /* Off, every sample goes out as it comes */
+                const struct telemetry_batch_cfg off = {0};
+                vector<size_t> held;
+                vector<string> writes = send_batched(fixture, fmts[f], off,
+                                                     &held);
+                CPPUNIT_ASSERT(unbatched == join(writes));
+                CPPUNIT_ASSERT_EQUAL((size_t) 0, held.back());
+
+                /* On, the same bytes in a third of the writes */
+                const struct telemetry_batch_cfg on = {3, BATCH_TX_CAP, 1000};
+                const size_t off_writes = writes.size();
+                held.clear();
+                writes = send_batched(fixture, fmts[f], on, &held);
+                CPPUNIT_ASSERT(unbatched == join(writes));
+                CPPUNIT_ASSERT_EQUAL(rows / 3, writes.size());
+                CPPUNIT_ASSERT(writes.size() * 3 <= off_writes);
+                for (size_t i = 0; i < rows; ++i)
+                        CPPUNIT_ASSERT_EQUAL((i + 1) % 3, held[i]);
+        }
+}
+
+void TelemetryFrameTest::testBatchLimits()
+{
+        LogFixture fixture(FIXTURE_FILE, 20);
+        string unbatched;
+        for (size_t i = 0; i < fixture.rows(); ++i)
+                unbatched += send_sample(SERIAL_TELEMETRY_FORMAT_JSON,
+                                         fixture.row(i), i);
+
+        /*
+         * The byte budget holds, and still nothing is lost.  The meta is
+         * bigger than the whole budget, so it goes out on its own.
+         */
+        const struct telemetry_batch_cfg small = {100, 256, 1000};
+        vector<string> writes = send_batched(fixture,
+                                             SERIAL_TELEMETRY_FORMAT_JSON,
+                                             small, NULL);
+        CPPUNIT_ASSERT(unbatched == join(writes));
+        CPPUNIT_ASSERT(writes.size() > 1);
+        for (size_t i = 0; i < writes.size(); ++i)
+                CPPUNIT_ASSERT(writes[i].size() <= small.bytes ||
+                               '[' == writes[i][0]);
+
+        /*
+         * A batch goes out once its first sample has waited long enough.
+         * Samples come a tick apart, so that is every 6th sample here.
+         */
+        const struct telemetry_batch_cfg slow = {100, BATCH_TX_CAP,
+                                                 5 * portTICK_RATE_MS};
+        vector<size_t> held;
+        writes = send_batched(fixture, SERIAL_TELEMETRY_FORMAT_JSON, slow,
+                              &held);
+        CPPUNIT_ASSERT(unbatched == join(writes));
+        CPPUNIT_ASSERT_EQUAL(fixture.rows() / 6, writes.size() - 1);
+        CPPUNIT_ASSERT_EQUAL((size_t) 5, held[4]);
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, held[5]);
+
+        /* and polling sends it without waiting for another sample */
+        struct telemetry_batch batch;
+        writes.clear();
+        struct Serial *s = serial_create("Batch", BATCH_TX_CAP, BATCH_TX_CAP,
+                                         NULL, NULL, drain_tx_writes, &writes);
+        telemetry_batch_init(&batch, s, &slow);
+        reset_ticks();
+        api_batch_telemetry_sample(&batch, NULL, fixture.row(0), 0, 0);
+        set_ticks(4);
+        CPPUNIT_ASSERT(!telemetry_batch_poll(&batch));
+        CPPUNIT_ASSERT(writes.empty());
+        set_ticks(5);
+        CPPUNIT_ASSERT(telemetry_batch_poll(&batch));
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, writes.size());
+        telemetry_batch_free(&batch);
+        serial_destroy(s);
+}
+
+void TelemetryFrameTest::testBatchWholeSamples()
+{
+        LogFixture fixture(FIXTURE_FILE, 8);
+        const string reply = "{\"reply\":1}\r\n";
+        const struct telemetry_batch_cfg small = {100, 256, 1000};
+        vector<string> writes;
+        struct Serial *s = serial_create("Batch", BATCH_TX_CAP, BATCH_TX_CAP,
+                                         NULL, NULL, drain_tx_writes, &writes);
+        struct telemetry_batch batch;
+        telemetry_batch_init(&batch, s, &small);
+
+        /* API replies go out between samples, without a flush */
+        for (size_t i = 0; i < fixture.rows(); ++i) {
+                api_batch_telemetry_sample(&batch, NULL, fixture.row(i), i,
+                                           0 == i);
+                serial_write_buff(s, reply.data(), reply.size());
+        }
+        telemetry_batch_flush(&batch);
+
+        /*
+         * None of them may land inside a sample.  Not even the first, with
+         * the meta, which is bigger than the whole budget.
+         */
+        const string all = join(writes);
+        std::istringstream lines(all);
+        string line;
+        size_t samples = 0, replies = 0;
+        while (std::getline(lines, line)) {
+                if (reply == line + "\n") {
+                        ++replies;
+                        continue;
+                }
+
+                CPPUNIT_ASSERT_EQUAL(0, (int) line.find("{\"s\":"));
+                CPPUNIT_ASSERT_EQUAL(string("}}\r"),
+                                     line.substr(line.size() - 3));
+                ++samples;
+        }
+        CPPUNIT_ASSERT(all.find("\r\n") > small.bytes);
+        CPPUNIT_ASSERT_EQUAL(fixture.rows(), samples);
+        CPPUNIT_ASSERT_EQUAL(fixture.rows(), replies);
+
+        telemetry_batch_free(&batch);
+        serial_destroy(s);
+}